@@ -77,7 +77,7 @@ timeouts_create(uint64_t timestamp)
     /*
      * Allocate memory and initialize it to zero
      */
-    timeouts = CALLOC(1, sizeof(*timeouts));
+    timeouts = HUGE_CALLOC(1, sizeof(*timeouts));
     
     /*
      * We just mask off the low order bits to determine wrap. I'm using
@@ -0,0 +1,807 @@
+/*
+    Summaries of scan files (--readscan-stats)
+
+    See in-analytics.h. Counts are grouped in a hash table keyed by
+    a small integer:
+
+        0x00PPpppp  - IP protocol 'PP', port 'pppp', from STATUS records
+        0x01aaaaaa  - application protocol 'aaaaaa', from BANNER records
+
+    Each group has a small HyperLogLog for its distinct hosts, and
+    there's a bigger one for the distinct hosts over the whole scan.
+
+    The top banners, networks and certificate names are kept with
+    "space-saving": a fixed
+    number of counters, where an item not already counted takes over
+    the counter with the smallest count, inheriting that count as its
+    possible error. Any item more common than 1 in 'capacity' is sure to
+    be there, and the count of any item is too high by at most 'error'.
+*/
+#include "in-analytics.h"
+#include "masscan-app.h"
+#include "masscan-status.h"
+#include "output.h"
+#include "unusedparm.h"
+#include "util-malloc.h"
+#include "util-safefunc.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Precision of the HyperLogLog for the whole scan, 2^14 registers,
+ * for an error of about 1% */
+#define HLL_BITS_TOTAL 14
+
+/** Precision for each group, 2^8 registers, for an error of about 6%.
+ * This is kept small because a scan of all ports has many groups */
+#define HLL_BITS_GROUP 8
+
+/** How many counters space-saving keeps for each item we report */
+#define TOPK_SLACK 8
+
+/** The most bytes of a banner that are counted, from its first line */
+#define TOPK_TEXT_MAX 80
+
+#define GROUP_PORT      0x00000000
+#define GROUP_SERVICE   0x01000000
+
+struct Hll {
+    unsigned bits;
+    unsigned char *reg;
+};
+
+struct Group {
+    unsigned key;
+    unsigned is_used;
+    uint64_t count;     /* open ports, or banners */
+    uint64_t closed;
+    struct Hll hosts;
+};
+
+struct TopItem {
+    uint64_t hash;
+    uint64_t count;
+    uint64_t error;
+    char *text;
+};
+
+struct TopK {
+    unsigned capacity;
+    unsigned count;
+    struct TopItem *items;
+};
+
+struct Analytics {
+    unsigned top_k;
+    uint64_t open;
+    uint64_t closed;
+    uint64_t banners;
+    struct Hll hosts;
+
+    struct Group *groups;
+    unsigned group_mask;
+    unsigned group_count;
+
+    struct TopK top_banners;
+    struct TopK top_nets;
+    struct TopK top_names;
+};
+
+/***************************************************************************
+ * The 64-bit finalizer from "splitmix64", which spreads any change in the
+ * input across all the bits of the output.
+ ***************************************************************************/
+static uint64_t
+mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t
+hash_ip(ipaddress ip)
+{
+    if (ip.version == 6)
+        return mix64(ip.ipv6.hi ^ mix64(ip.ipv6.lo));
+    return mix64(ip.ipv4);
+}
+
+static uint64_t
+hash_text(const char *text)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    while (*text) {
+        h ^= (unsigned char)*text++;
+        h *= 0x100000001b3ULL;
+    }
+    return mix64(h);
+}
+
+/***************************************************************************
+ * HyperLogLog: each register holds one more than the longest run of
+ * leading zeroes seen among the hashes that picked it.
+ ***************************************************************************/
+static void
+hll_init(struct Hll *hll, unsigned bits)
+{
+    hll->bits = bits;
+    hll->reg = CALLOC(1, (size_t)1 << bits);
+}
+
+static void
+hll_free(struct Hll *hll)
+{
+    free(hll->reg);
+    hll->reg = NULL;
+}
+
+static void
+hll_add(struct Hll *hll, uint64_t hash)
+{
+    size_t index = (size_t)(hash >> (64 - hll->bits));
+    uint64_t rest = hash << hll->bits;
+    unsigned char rank = 1;
+
+    while (rank <= 64 - hll->bits && (rest & 0x8000000000000000ULL) == 0) {
+        rest <<= 1;
+        rank++;
+    }
+    if (hll->reg[index] < rank)
+        hll->reg[index] = rank;
+}
+
+static void
+hll_merge(struct Hll *dst, const struct Hll *src)
+{
+    size_t count = (size_t)1 << dst->bits;
+    size_t i;
+
+    for (i=0; i<count; i++) {
+        if (dst->reg[i] < src->reg[i])
+            dst->reg[i] = src->reg[i];
+    }
+}
+
+/***************************************************************************
+ * The estimate is Otmar Ertl's "improved raw estimator", from "New
+ * cardinality estimation algorithms for HyperLogLog sketches" (2017),
+ * which unlike the original doesn't need separate handling of small
+ * counts, nor tables of bias corrections for counts just above them.
+ ***************************************************************************/
+static double
+hll_sigma(double x)
+{
+    double y = 1.0;
+    double z = x;
+    double z_prev;
+
+    if (x == 1.0)
+        return HUGE_VAL;
+    do {
+        x *= x;
+        z_prev = z;
+        z += x * y;
+        y += y;
+    } while (z != z_prev);
+    return z;
+}
+
+static double
+hll_tau(double x)
+{
+    double y = 1.0;
+    double z;
+    double z_prev;
+
+    if (x == 0.0 || x == 1.0)
+        return 0.0;
+    z = 1.0 - x;
+    do {
+        x = sqrt(x);
+        z_prev = z;
+        y *= 0.5;
+        z -= (1.0 - x) * (1.0 - x) * y;
+    } while (z != z_prev);
+    return z / 3.0;
+}
+
+static uint64_t
+hll_estimate(const struct Hll *hll)
+{
+    size_t m = (size_t)1 << hll->bits;
+    unsigned q = 64 - hll->bits;
+    unsigned histogram[66] = {0};
+    double z;
+    size_t i;
+    unsigned k;
+
+    for (i=0; i<m; i++)
+        histogram[hll->reg[i]]++;
+
+    z = (double)m * hll_tau(1.0 - (double)histogram[q+1] / (double)m);
+    for (k=q; k>=1; k--)
+        z = 0.5 * (z + histogram[k]);
+    z += (double)m * hll_sigma((double)histogram[0] / (double)m);
+
+    return (uint64_t)(0.5 / log(2.0) * (double)m * (double)m / z + 0.5);
+}
+
+/***************************************************************************
+ * The hash table of groups, open addressing with linear probing.
+ ***************************************************************************/
+static void
+groups_grow(struct Analytics *stats)
+{
+    struct Group *old = stats->groups;
+    unsigned old_size = stats->group_mask + 1;
+    unsigned new_size = old ? old_size * 2 : 64;
+    unsigned i;
+
+    stats->groups = CALLOC(new_size, sizeof(stats->groups[0]));
+    stats->group_mask = new_size - 1;
+
+    for (i=0; old && i<old_size; i++) {
+        unsigned j;
+        if (!old[i].is_used)
+            continue;
+        j = (unsigned)mix64(old[i].key) & stats->group_mask;
+        while (stats->groups[j].is_used)
+            j = (j + 1) & stats->group_mask;
+        stats->groups[j] = old[i];
+    }
+    free(old);
+}
+
+static struct Group *
+groups_get(struct Analytics *stats, unsigned key)
+{
+    unsigned j;
+
+    if (stats->groups == NULL || stats->group_count * 2 >= stats->group_mask)
+        groups_grow(stats);
+
+    j = (unsigned)mix64(key) & stats->group_mask;
+    for (;;) {
+        struct Group *group = &stats->groups[j];
+        if (!group->is_used) {
+            group->is_used = 1;
+            group->key = key;
+            hll_init(&group->hosts, HLL_BITS_GROUP);
+            stats->group_count++;
+            return group;
+        }
+        if (group->key == key)
+            return group;
+        j = (j + 1) & stats->group_mask;
+    }
+}
+
+/***************************************************************************
+ * Space-saving top-K.
+ ***************************************************************************/
+static void
+topk_init(struct TopK *top, unsigned capacity)
+{
+    top->capacity = capacity;
+    top->count = 0;
+    top->items = CALLOC(capacity, sizeof(top->items[0]));
+}
+
+static void
+topk_free(struct TopK *top)
+{
+    unsigned i;
+    for (i=0; i<top->count; i++)
+        free(top->items[i].text);
+    free(top->items);
+    top->items = NULL;
+    top->count = 0;
+}
+
+static struct TopItem *
+topk_find(const struct TopK *top, uint64_t hash, const char *text)
+{
+    unsigned i;
+    for (i=0; i<top->count; i++) {
+        struct TopItem *item = &top->items[i];
+        if (item->hash == hash && strcmp(item->text, text) == 0)
+            return item;
+    }
+    return NULL;
+}
+
+/** The count any item missing from the table might have, which is 0
+ * until the table fills up */
+static uint64_t
+topk_floor(const struct TopK *top)
+{
+    uint64_t floor = ~0ULL;
+    unsigned i;
+
+    if (top->count < top->capacity)
+        return 0;
+    for (i=0; i<top->count; i++) {
+        if (floor > top->items[i].count)
+            floor = top->items[i].count;
+    }
+    return floor;
+}
+
+static void
+topk_add(struct TopK *top, const char *text)
+{
+    uint64_t hash = hash_text(text);
+    struct TopItem *item;
+    unsigned i;
+
+    item = topk_find(top, hash, text);
+    if (item) {
+        item->count++;
+        return;
+    }
+
+    if (top->count < top->capacity) {
+        item = &top->items[top->count++];
+        item->count = 0;
+        item->error = 0;
+    } else {
+        /* Take over the smallest counter */
+        item = &top->items[0];
+        for (i=1; i<top->count; i++) {
+            if (item->count > top->items[i].count)
+                item = &top->items[i];
+        }
+        free(item->text);
+        item->error = item->count;
+    }
+    item->hash = hash;
+    item->text = STRDUP(text);
+    item->count++;
+}
+
+static int
+topk_compare(const void *lhs, const void *rhs)
+{
+    const struct TopItem *a = (const struct TopItem *)lhs;
+    const struct TopItem *b = (const struct TopItem *)rhs;
+
+    if (a->count != b->count)
+        return a->count > b->count ? -1 : 1;
+    return strcmp(a->text, b->text);
+}
+
+/***************************************************************************
+ * Merges two summaries: an item in only one of them might have had up to
+ * the other's floor in the other, so that's added to both its count and
+ * its error. Then only the biggest counters are kept.
+ ***************************************************************************/
+static void
+topk_merge(struct TopK *dst, const struct TopK *src)
+{
+    uint64_t dst_floor = topk_floor(dst);
+    uint64_t src_floor = topk_floor(src);
+    struct TopItem *items;
+    unsigned count = 0;
+    unsigned i;
+
+    items = CALLOC(dst->count + src->count + 1, sizeof(items[0]));
+
+    for (i=0; i<dst->count; i++) {
+        struct TopItem *item = &dst->items[i];
+        const struct TopItem *other = topk_find(src, item->hash, item->text);
+
+        items[count] = *item;
+        if (other) {
+            items[count].count += other->count;
+            items[count].error += other->error;
+        } else {
+            items[count].count += src_floor;
+            items[count].error += src_floor;
+        }
+        count++;
+    }
+    for (i=0; i<src->count; i++) {
+        const struct TopItem *item = &src->items[i];
+
+        if (topk_find(dst, item->hash, item->text))
+            continue;
+        items[count] = *item;
+        items[count].text = STRDUP(item->text);
+        items[count].count += dst_floor;
+        items[count].error += dst_floor;
+        count++;
+    }
+
+    qsort(items, count, sizeof(items[0]), topk_compare);
+    for (i=dst->capacity; i<count; i++)
+        free(items[i].text);
+    if (count > dst->capacity)
+        count = dst->capacity;
+
+    memcpy(dst->items, items, count * sizeof(items[0]));
+    dst->count = count;
+    free(items);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct Analytics *
+analytics_create(unsigned top_k)
+{
+    struct Analytics *stats;
+
+    if (top_k == 0)
+        top_k = 10;
+
+    stats = CALLOC(1, sizeof(*stats));
+    stats->top_k = top_k;
+    hll_init(&stats->hosts, HLL_BITS_TOTAL);
+    topk_init(&stats->top_banners, top_k * TOPK_SLACK);
+    topk_init(&stats->top_nets, top_k * TOPK_SLACK);
+    topk_init(&stats->top_names, top_k * TOPK_SLACK);
+    return stats;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+analytics_destroy(struct Analytics *stats)
+{
+    unsigned i;
+
+    if (stats == NULL)
+        return;
+    for (i=0; stats->groups && i<=stats->group_mask; i++) {
+        if (stats->groups[i].is_used)
+            hll_free(&stats->groups[i].hosts);
+    }
+    free(stats->groups);
+    hll_free(&stats->hosts);
+    topk_free(&stats->top_banners);
+    topk_free(&stats->top_nets);
+    topk_free(&stats->top_names);
+    free(stats);
+}
+
+/***************************************************************************
+ * The network a host is in, a /16 for IPv4 or a /48 for IPv6.
+ ***************************************************************************/
+static void
+format_network(ipaddress ip, char *buf, size_t sizeof_buf)
+{
+    ipaddress_formatted_t fmt;
+
+    if (ip.version == 6) {
+        ip.ipv6.hi &= 0xFFFFFFFFFFFF0000ULL;
+        ip.ipv6.lo = 0;
+        fmt = ipaddress_fmt(ip);
+        snprintf(buf, sizeof_buf, "%s/48", fmt.string);
+    } else {
+        ip.ipv4 &= 0xFFFF0000;
+        fmt = ipaddress_fmt(ip);
+        snprintf(buf, sizeof_buf, "%s/16", fmt.string);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+analytics_status(struct Analytics *stats, int status,
+                 ipaddress ip, unsigned ip_proto, unsigned port)
+{
+    struct Group *group;
+    uint64_t hash;
+    char net[64];
+
+    group = groups_get(stats, GROUP_PORT | (ip_proto & 0xFF) << 16 | (port & 0xFFFF));
+    if (status != PortStatus_Open) {
+        group->closed++;
+        stats->closed++;
+        return;
+    }
+
+    group->count++;
+    stats->open++;
+
+    hash = hash_ip(ip);
+    hll_add(&group->hosts, hash);
+    hll_add(&stats->hosts, hash);
+
+    format_network(ip, net, sizeof(net));
+    topk_add(&stats->top_nets, net);
+}
+
+/***************************************************************************
+ * The name in the certificate, from an SSL banner like
+ * "TLS/1.2 cipher:0xc02f, www.example.com, example.com", where the
+ * certificate's CN comes first, then its other names.
+ ***************************************************************************/
+static void
+certificate_name(const unsigned char *px, size_t length,
+                 char *buf, size_t sizeof_buf)
+{
+    size_t offset = 0;
+    size_t i = 0;
+
+    buf[0] = '\0';
+    while (offset < length && px[offset] != ',')
+        offset++;
+    if (offset++ >= length)
+        return;
+    while (offset < length && px[offset] == ' ')
+        offset++;
+    while (offset < length && px[offset] != ',' && i + 1 < sizeof_buf) {
+        unsigned char c = px[offset++];
+        if (c == '\r' || c == '\n')
+            break;
+        buf[i++] = (c >= 0x20 && c < 0x7F) ? (char)c : '.';
+    }
+    buf[i] = '\0';
+}
+
+/***************************************************************************
+ * Banners are counted by their first line, with anything unprintable
+ * replaced, and prefixed by their protocol.
+ ***************************************************************************/
+void
+analytics_banner(struct Analytics *stats,
+                 ipaddress ip, unsigned ip_proto, unsigned port,
+                 unsigned app_proto,
+                 const unsigned char *px, size_t length)
+{
+    struct Group *group;
+    char text[TOPK_TEXT_MAX + 32];
+    size_t offset;
+    size_t i;
+
+    UNUSEDPARM(ip_proto);
+    UNUSEDPARM(port);
+
+    group = groups_get(stats, GROUP_SERVICE | (app_proto & 0xFFFFFF));
+    group->count++;
+    stats->banners++;
+    hll_add(&group->hosts, hash_ip(ip));
+
+    snprintf(text, sizeof(text), "[%s] ",
+             masscan_app_to_string((enum ApplicationProtocol)app_proto));
+    offset = strlen(text);
+    for (i=0; i<length && i<TOPK_TEXT_MAX; i++) {
+        unsigned char c = px[i];
+        if (c == '\r' || c == '\n')
+            break;
+        text[offset++] = (c >= 0x20 && c < 0x7F) ? (char)c : '.';
+    }
+    text[offset] = '\0';
+    topk_add(&stats->top_banners, text);
+
+    if (app_proto == PROTO_SSL3) {
+        certificate_name(px, length, text, TOPK_TEXT_MAX);
+        if (text[0])
+            topk_add(&stats->top_names, text);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+analytics_merge(struct Analytics *dst, const struct Analytics *src)
+{
+    unsigned i;
+
+    dst->open += src->open;
+    dst->closed += src->closed;
+    dst->banners += src->banners;
+    hll_merge(&dst->hosts, &src->hosts);
+
+    for (i=0; src->groups && i<=src->group_mask; i++) {
+        const struct Group *from = &src->groups[i];
+        struct Group *to;
+
+        if (!from->is_used)
+            continue;
+        to = groups_get(dst, from->key);
+        to->count += from->count;
+        to->closed += from->closed;
+        hll_merge(&to->hosts, &from->hosts);
+    }
+
+    topk_merge(&dst->top_banners, &src->top_banners);
+    topk_merge(&dst->top_nets, &src->top_nets);
+    topk_merge(&dst->top_names, &src->top_names);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+group_compare(const void *lhs, const void *rhs)
+{
+    const struct Group *a = *(const struct Group * const *)lhs;
+    const struct Group *b = *(const struct Group * const *)rhs;
+
+    if (a->count != b->count)
+        return a->count > b->count ? -1 : 1;
+    return a->key < b->key ? -1 : (a->key > b->key);
+}
+
+static void
+print_top(const struct TopK *top, unsigned top_k, const char *title, FILE *fp)
+{
+    struct TopItem *items;
+    unsigned i;
+
+    if (top->count == 0)
+        return;
+
+    items = MALLOC(top->count * sizeof(items[0]));
+    memcpy(items, top->items, top->count * sizeof(items[0]));
+    qsort(items, top->count, sizeof(items[0]), topk_compare);
+
+    fprintf(fp, "\n%-12s %10s  %s\n", "count", "error", title);
+    for (i=0; i<top->count && i<top_k; i++) {
+        fprintf(fp, "%-12llu %10llu  %s\n",
+                (unsigned long long)items[i].count,
+                (unsigned long long)items[i].error,
+                items[i].text);
+    }
+    free(items);
+}
+
+void
+analytics_print(const struct Analytics *stats, FILE *fp)
+{
+    struct Group **list;
+    unsigned count = 0;
+    unsigned i;
+
+    fprintf(fp, "open: %llu  closed: %llu  banners: %llu  hosts: ~%llu\n",
+            (unsigned long long)stats->open,
+            (unsigned long long)stats->closed,
+            (unsigned long long)stats->banners,
+            (unsigned long long)hll_estimate(&stats->hosts));
+
+    list = MALLOC((stats->group_count + 1) * sizeof(list[0]));
+    for (i=0; stats->groups && i<=stats->group_mask; i++) {
+        if (stats->groups[i].is_used)
+            list[count++] = &stats->groups[i];
+    }
+    qsort(list, count, sizeof(list[0]), group_compare);
+
+    fprintf(fp, "\n%-12s %12s %12s %12s\n", "port", "open", "closed", "hosts");
+    for (i=0; i<count; i++) {
+        const struct Group *group = list[i];
+        char name[32];
+
+        if ((group->key & 0xFF000000) != GROUP_PORT)
+            continue;
+        snprintf(name, sizeof(name), "%u/%s", group->key & 0xFFFF,
+                 name_from_ip_proto((group->key >> 16) & 0xFF));
+        fprintf(fp, "%-12s %12llu %12llu %12llu\n", name,
+                (unsigned long long)group->count,
+                (unsigned long long)group->closed,
+                (unsigned long long)(group->count ? hll_estimate(&group->hosts) : 0));
+    }
+
+    if (stats->banners) {
+        fprintf(fp, "\n%-12s %12s %12s\n", "service", "banners", "hosts");
+        for (i=0; i<count; i++) {
+            const struct Group *group = list[i];
+
+            if ((group->key & 0xFF000000) != GROUP_SERVICE)
+                continue;
+            fprintf(fp, "%-12s %12llu %12llu\n",
+                    masscan_app_to_string((enum ApplicationProtocol)(group->key & 0xFFFFFF)),
+                    (unsigned long long)group->count,
+                    (unsigned long long)hll_estimate(&group->hosts));
+        }
+    }
+    free(list);
+
+    print_top(&stats->top_nets, stats->top_k, "network", fp);
+    print_top(&stats->top_banners, stats->top_k, "banner", fp);
+    print_top(&stats->top_names, stats->top_k, "certificate", fp);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+analytics_selftest(void)
+{
+    struct Analytics *stats[2];
+    struct Group *group;
+    struct TopItem *item;
+    uint64_t estimate;
+    ipaddress ip = {0};
+    unsigned i;
+
+    stats[0] = analytics_create(3);
+    stats[1] = analytics_create(3);
+
+    /* 40000 hosts with port 80 open, split between two threads, with the
+     * second 10000 seen by both */
+    ip.version = 4;
+    for (i=0; i<40000; i++) {
+        ip.ipv4 = 0x0A000000 + i;
+        analytics_status(stats[i < 20000], PortStatus_Open, ip, 6, 80);
+        if (i >= 10000 && i < 20000)
+            analytics_status(stats[0], PortStatus_Open, ip, 6, 80);
+        analytics_status(stats[0], PortStatus_Closed, ip, 6, 22);
+    }
+
+    /* One banner that's common, among lots of rare ones */
+    for (i=0; i<5000; i++) {
+        char text[32];
+        ip.ipv4 = 0x0A000000 + i;
+        if (i % 3 == 0) {
+            analytics_banner(stats[i & 1], ip, 6, 22, PROTO_SSH2,
+                             (const unsigned char *)"SSH-2.0-OpenSSH_9.6\r\n", 21);
+        } else {
+            snprintf(text, sizeof(text), "SSH-2.0-rare_%u", i);
+            analytics_banner(stats[i & 1], ip, 6, 22, PROTO_SSH2,
+                             (const unsigned char *)text, strlen(text));
+        }
+    }
+
+    /* SSL banners, one from each thread, and one with no certificate */
+    for (i=0; i<3; i++) {
+        const char *text = (i < 2)
+                ? "TLS/1.2 cipher:0xc02f, www.example.com, example.com"
+                : "TLS/1.2 cipher:0xc02f";
+        analytics_banner(stats[i & 1], ip, 6, 443, PROTO_SSL3,
+                         (const unsigned char *)text, strlen(text));
+    }
+
+    analytics_merge(stats[0], stats[1]);
+
+    if (stats[0]->open != 50000 || stats[0]->closed != 40000
+        || stats[0]->banners != 5003)
+        goto fail;
+
+    /* Within a few percent of 40000 distinct hosts */
+    estimate = hll_estimate(&stats[0]->hosts);
+    if (estimate < 39000 || estimate > 41000)
+        goto fail;
+    group = groups_get(stats[0], GROUP_PORT | 6 << 16 | 80);
+    estimate = hll_estimate(&group->hosts);
+    if (group->count != 50000 || estimate < 35000 || estimate > 45000)
+        goto fail;
+    group = groups_get(stats[0], GROUP_PORT | 6 << 16 | 22);
+    if (group->count != 0 || group->closed != 40000)
+        goto fail;
+
+    /* The common banner has been found, with a count that's never too
+     * low, and never too high by more than its error */
+    qsort(stats[0]->top_banners.items, stats[0]->top_banners.count,
+          sizeof(struct TopItem), topk_compare);
+    item = &stats[0]->top_banners.items[0];
+    if (strcmp(item->text, "[ssh] SSH-2.0-OpenSSH_9.6") != 0
+        || item->count < 1667 || item->count - item->error > 1667)
+        goto fail;
+
+    /* The hosts are all in one /16 */
+    item = &stats[0]->top_nets.items[0];
+    if (stats[0]->top_nets.count != 1 || item->count != 50000
+        || strcmp(item->text, "10.0.0.0/16") != 0)
+        goto fail;
+
+    /* The certificate name is the first after the cipher */
+    if (stats[0]->top_names.count != 1)
+        goto fail;
+    item = &stats[0]->top_names.items[0];
+    if (item->count != 2 || strcmp(item->text, "www.example.com") != 0)
+        goto fail;
+
+    analytics_destroy(stats[0]);
+    analytics_destroy(stats[1]);
+    return 0;
+fail:
+    fprintf(stderr, "[-] analytics: selftest failed\n");
+    analytics_destroy(stats[0]);
+    analytics_destroy(stats[1]);
+    return 1;
+}
@@ -0,0 +1,72 @@
+/*
+    Summaries of scan files (--readscan-stats)
+
+    Answering questions like "how many hosts have port 443 open" or "what
+    are the most common SSH versions" used to mean converting the scan
+    files to NDJSON and piping that through other tools, which for big
+    scans takes far longer than reading the files did.
+
+    Instead, --readscan can aggregate the records as it reads them: counts
+    per port and per service, the number of distinct hosts for each of
+    those, and the most common banners, networks (/16s, or /48s for IPv6)
+    and certificate names. Each thread reading
+    files keeps its own tables, and they are merged at the end, so there's
+    no locking while reading.
+
+    Distinct hosts are estimated with HyperLogLog, and the most common
+    items are found with the "space-saving" algorithm, so that memory
+    doesn't grow with the number of hosts or banners. Both are mergeable,
+    which is what lets each thread work alone.
+*/
+#ifndef IN_ANALYTICS_H
+#define IN_ANALYTICS_H
+#include "massip-addr.h"
+#include <stdio.h>
+
+struct Analytics;
+
+/**
+ * Create empty tables, one per thread.
+ * @param top_k
+ *      How many of the most common banners, networks and certificate
+ *      names to report.
+ */
+struct Analytics *
+analytics_create(unsigned top_k);
+
+void
+analytics_destroy(struct Analytics *stats);
+
+/**
+ * Counts a STATUS record, open or closed.
+ */
+void
+analytics_status(struct Analytics *stats, int status,
+                 ipaddress ip, unsigned ip_proto, unsigned port);
+
+/**
+ * Counts a BANNER record.
+ */
+void
+analytics_banner(struct Analytics *stats,
+                 ipaddress ip, unsigned ip_proto, unsigned port,
+                 unsigned app_proto,
+                 const unsigned char *px, size_t length);
+
+/**
+ * Adds the counts from 'src' into 'dst'. The 'src' tables are left
+ * as they were.
+ */
+void
+analytics_merge(struct Analytics *dst, const struct Analytics *src);
+
+/**
+ * Prints the report as text.
+ */
+void
+analytics_print(const struct Analytics *stats, FILE *fp);
+
+int
+analytics_selftest(void);
+
+#endif
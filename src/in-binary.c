@@ -12,6 +12,10 @@
 #include "util-safefunc.h"
 #include "in-filter.h"
 #include "in-report.h"
+#include "in-analytics.h"
+#include "out-compress.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
 #include "util-malloc.h"
 #include "util-logger.h"
 
@@ -35,11 +39,56 @@ struct MasscanRecord {
     enum ApplicationProtocol app_proto;
 };
 
+/**
+ * Where the records go: either written out again in another format, or
+ * counted for --readscan-stats. When reading with several threads, each
+ * has its own sink.
+ */
+struct ReadScanSink {
+    struct Output *out;
+    struct Analytics *stats;
+};
 
 /***************************************************************************
  ***************************************************************************/
 static void
-parse_status(struct Output *out,
+sink_started(struct ReadScanSink *sink, time_t timestamp)
+{
+    if (sink->out && sink->out->when_scan_started == 0)
+        sink->out->when_scan_started = timestamp;
+}
+
+static void
+sink_status(struct ReadScanSink *sink, time_t timestamp, int status,
+            ipaddress ip, unsigned ip_proto, unsigned port,
+            unsigned reason, unsigned ttl, const unsigned char mac[6])
+{
+    if (sink->stats)
+        analytics_status(sink->stats, status, ip, ip_proto, port);
+    else
+        output_report_status(sink->out, timestamp, status, ip, ip_proto,
+                             port, reason, ttl, mac);
+}
+
+static void
+sink_banner(struct ReadScanSink *sink, time_t timestamp,
+            ipaddress ip, unsigned ip_proto, unsigned port,
+            unsigned app_proto, unsigned ttl,
+            const unsigned char *px, unsigned length)
+{
+    if (sink->stats)
+        analytics_banner(sink->stats, ip, ip_proto, port, app_proto,
+                         px, length);
+    else
+        output_report_banner(sink->out, timestamp, ip, ip_proto, port,
+                             app_proto, ttl, px, length);
+}
+
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+parse_status(struct ReadScanSink *sink,
         enum PortStatus status, /* open/closed */
         const unsigned char *buf, size_t buf_length)
 {
@@ -62,8 +111,7 @@ parse_status(struct Output *out,
     else
         memset(record.mac, 0, 6);
 
-    if (out->when_scan_started == 0)
-        out->when_scan_started = record.timestamp;
+    sink_started(sink, record.timestamp);
 
     switch (record.port) {
     case 53:
@@ -85,7 +133,7 @@ parse_status(struct Output *out,
     /*
      * Now report the result
      */
-    output_report_status(out,
+    sink_status(sink,
                     record.timestamp,
                     status,
                     record.ip,
@@ -100,7 +148,7 @@ parse_status(struct Output *out,
 /***************************************************************************
  ***************************************************************************/
 static void
-parse_status2(struct Output *out,
+parse_status2(struct ReadScanSink *sink,
         enum PortStatus status, /* open/closed */
         const unsigned char *buf, size_t buf_length,
         struct MassIP *filter)
@@ -125,8 +173,7 @@ parse_status2(struct Output *out,
     else
         memset(record.mac, 0, 6);
 
-    if (out->when_scan_started == 0)
-        out->when_scan_started = record.timestamp;
+    sink_started(sink, record.timestamp);
 
     /* Filter for known IP/ports, if specified on command-line */
     if (filter && filter->count_ipv4s) {
@@ -141,7 +188,7 @@ parse_status2(struct Output *out,
     /*
      * Now report the result
      */
-    output_report_status(out,
+    sink_status(sink,
                     record.timestamp,
                     status,
                     record.ip,
@@ -225,7 +272,7 @@ _get_long(const unsigned char *buf, size_t length, size_t *r_offset)
 /***************************************************************************
  ***************************************************************************/
 static void
-parse_status6(struct Output *out,
+parse_status6(struct ReadScanSink *sink,
         enum PortStatus status, /* open/closed */
         const unsigned char *buf, size_t length,
         struct MassIP *filter)
@@ -247,8 +294,7 @@ parse_status6(struct Output *out,
     record.ip.ipv6.hi = _get_long(buf, length, &offset);
     record.ip.ipv6.lo = _get_long(buf, length, &offset);
 
-    if (out->when_scan_started == 0)
-        out->when_scan_started = record.timestamp;
+    sink_started(sink, record.timestamp);
 
     /* Filter for known IP/ports, if specified on command-line */
     if (filter && filter->count_ipv4s) {
@@ -263,7 +309,7 @@ parse_status6(struct Output *out,
     /*
      * Now report the result
      */
-    output_report_status(out,
+    sink_status(sink,
                     record.timestamp,
                     status,
                     record.ip,
@@ -278,7 +324,7 @@ parse_status6(struct Output *out,
 /***************************************************************************
  ***************************************************************************/
 static void
-parse_banner6(struct Output *out, unsigned char *buf, size_t length,
+parse_banner6(struct ReadScanSink *sink, unsigned char *buf, size_t length,
               const struct MassIP *filter,
               const struct RangeList *btypes)
 {
@@ -301,8 +347,7 @@ parse_banner6(struct Output *out, unsigned char *buf, size_t length,
     record.ip.ipv6.hi = _get_long(buf, length, &offset);
     record.ip.ipv6.lo = _get_long(buf, length, &offset);
     
-    if (out->when_scan_started == 0)
-        out->when_scan_started = record.timestamp;
+    sink_started(sink, record.timestamp);
 
     
     /*
@@ -317,8 +362,8 @@ parse_banner6(struct Output *out, unsigned char *buf, size_t length,
      */
     if (offset > length)
         return;
-    output_report_banner(
-                out,
+    sink_banner(
+                sink,
                 record.timestamp,
                 record.ip,
                 record.ip_proto,    /* TCP=6, UDP=17 */
@@ -337,7 +382,7 @@ parse_banner6(struct Output *out, unsigned char *buf, size_t length,
  *  now, but eventually I'll get rid of it.
  ***************************************************************************/
 static void
-parse_banner3(struct Output *out, unsigned char *buf, size_t buf_length)
+parse_banner3(struct ReadScanSink *sink, unsigned char *buf, size_t buf_length)
 {
     struct MasscanRecord record;
 
@@ -350,14 +395,13 @@ parse_banner3(struct Output *out, unsigned char *buf, size_t buf_length)
     record.port      = buf[8]<<8 | buf[9];
     record.app_proto = buf[10]<<8 | buf[11];
 
-    if (out->when_scan_started == 0)
-        out->when_scan_started = record.timestamp;
+    sink_started(sink, record.timestamp);
 
     /*
      * Now print the output
      */
-    output_report_banner(
-                out,
+    sink_banner(
+                sink,
                 record.timestamp,
                 record.ip,
                 6, /* this is always TCP */
@@ -373,7 +417,7 @@ parse_banner3(struct Output *out, unsigned char *buf, size_t buf_length)
  * number. We also convert the banner string into a safer form.
  ***************************************************************************/
 static void
-parse_banner4(struct Output *out, unsigned char *buf, size_t buf_length)
+parse_banner4(struct ReadScanSink *sink, unsigned char *buf, size_t buf_length)
 {
     struct MasscanRecord record;
 
@@ -390,14 +434,13 @@ parse_banner4(struct Output *out, unsigned char *buf, size_t buf_length)
     record.port      = buf[9]<<8 | buf[10];
     record.app_proto = buf[11]<<8 | buf[12];
 
-    if (out->when_scan_started == 0)
-        out->when_scan_started = record.timestamp;
+    sink_started(sink, record.timestamp);
 
     /*
      * Now print the output
      */
-    output_report_banner(
-                out,
+    sink_banner(
+                sink,
                 record.timestamp,
                 record.ip,
                 record.ip_proto,    /* TCP=6, UDP=17 */
@@ -412,7 +455,7 @@ parse_banner4(struct Output *out, unsigned char *buf, size_t buf_length)
 /***************************************************************************
  ***************************************************************************/
 static void
-parse_banner9(struct Output *out, unsigned char *buf, size_t buf_length,
+parse_banner9(struct ReadScanSink *sink, unsigned char *buf, size_t buf_length,
               const struct MassIP *filter,
               const struct RangeList *btypes)
 {
@@ -434,8 +477,7 @@ parse_banner9(struct Output *out, unsigned char *buf, size_t buf_length,
     record.app_proto = buf[11]<<8 | buf[12];
     record.ttl       = buf[13];
 
-    if (out->when_scan_started == 0)
-        out->when_scan_started = record.timestamp;
+    sink_started(sink, record.timestamp);
 
     /*
      * KLUDGE: when doing SSL stuff, add a IP:name pair to a database
@@ -454,8 +496,8 @@ parse_banner9(struct Output *out, unsigned char *buf, size_t buf_length,
     /*
      * Now print the output
      */
-    output_report_banner(
-                out,
+    sink_banner(
+                sink,
                 record.timestamp,
                 record.ip,
                 record.ip_proto,    /* TCP=6, UDP=17 */
@@ -470,11 +512,12 @@ parse_banner9(struct Output *out, unsigned char *buf, size_t buf_length,
  * Read in the file, one record at a time.
  ***************************************************************************/
 static uint64_t
-_binaryfile_parse(struct Output *out, const char *filename,
+_binaryfile_parse(struct ReadScanSink *sink, const char *filename,
            struct MassIP *filter,
            const struct RangeList *btypes)
 {
     FILE *fp = 0;
+    struct CompressReader *compress = NULL;
     unsigned char *buf = 0;
     size_t bytes_read;
     uint64_t total_records = 0;
@@ -490,6 +533,12 @@ _binaryfile_parse(struct Output *out, const char *filename,
         goto end;
     }
 
+    /* Files written with --output-compress are read the same, through
+     * a thread that decompresses them */
+    fp = compress_reader_open(fp, filename, &compress);
+    if (fp == NULL)
+        goto end;
+
     LOG(0, "[+] --readscan %s\n", filename);
     
     if (feof(fp)) {
@@ -529,8 +578,8 @@ _binaryfile_parse(struct Output *out, const char *filename,
             i++;
 
         /* extract timestamp */
-        if (i < 'a')
-            out->when_scan_started = strtoul((char*)buf+i,0,0);
+        if (i < 'a' && sink->out)
+            sink->out->when_scan_started = strtoul((char*)buf+i,0,0);
     }
 
     /* Now read all records */
@@ -583,14 +632,14 @@ _binaryfile_parse(struct Output *out, const char *filename,
         switch (type) {
             case 1: /* STATUS: open */
                 if (!btypes->count)
-                    parse_status(out, PortStatus_Open, buf, bytes_read);
+                    parse_status(sink, PortStatus_Open, buf, bytes_read);
                 break;
             case 2: /* STATUS: closed */
                 if (!btypes->count)
-                    parse_status(out, PortStatus_Closed, buf, bytes_read);
+                    parse_status(sink, PortStatus_Closed, buf, bytes_read);
                 break;
             case 3: /* BANNER */
-                parse_banner3(out, buf, bytes_read);
+                parse_banner3(sink, buf, bytes_read);
                 break;
             case 4:
                 if (fread(buf+bytes_read,1,1,fp) != 1) {
@@ -598,32 +647,32 @@ _binaryfile_parse(struct Output *out, const char *filename,
                     exit(1);
                 }
                 bytes_read++;
-                parse_banner4(out, buf, bytes_read);
+                parse_banner4(sink, buf, bytes_read);
                 break;
             case 5:
-                parse_banner4(out, buf, bytes_read);
+                parse_banner4(sink, buf, bytes_read);
                 break;
             case 6: /* STATUS: open */
                 if (!btypes->count)
-                    parse_status2(out, PortStatus_Open, buf, bytes_read, filter);
+                    parse_status2(sink, PortStatus_Open, buf, bytes_read, filter);
                 break;
             case 7: /* STATUS: closed */
                 if (!btypes->count)
-                    parse_status2(out, PortStatus_Closed, buf, bytes_read, filter);
+                    parse_status2(sink, PortStatus_Closed, buf, bytes_read, filter);
                 break;
             case 9:
-                parse_banner9(out, buf, bytes_read, filter, btypes);
+                parse_banner9(sink, buf, bytes_read, filter, btypes);
                 break;
             case 10: /* Open6 */
                 if (!btypes->count)
-                    parse_status6(out, PortStatus_Open, buf, bytes_read, filter);
+                    parse_status6(sink, PortStatus_Open, buf, bytes_read, filter);
                 break;
             case 11: /* Closed6 */
                 if (!btypes->count)
-                    parse_status6(out, PortStatus_Closed, buf, bytes_read, filter);
+                    parse_status6(sink, PortStatus_Closed, buf, bytes_read, filter);
                 break;
             case 13: /* Banner6 */
-                parse_banner6(out, buf, bytes_read, filter, btypes);
+                parse_banner6(sink, buf, bytes_read, filter, btypes);
                 break;
             case 'm': /* FILEHEADER */
                 //goto end;
@@ -641,11 +690,96 @@ end:
     if (buf)
         free(buf);
     if (fp)
-        fclose(fp);
+        compress_reader_close(fp, compress);
     return total_records;
 }
 
 
+/***************************************************************************
+ * For --readscan-stats, each of these threads takes whatever file is next
+ * in the list, counting its records into tables of its own.
+ ***************************************************************************/
+struct ReadScanWorker {
+    struct Masscan *masscan;
+    char **filenames;
+    unsigned filename_count;
+    volatile unsigned *next;
+    struct Analytics *stats;
+    uint64_t records;
+    size_t thread_handle;
+};
+
+static void
+readscan_worker_thread(void *v)
+{
+    struct ReadScanWorker *worker = (struct ReadScanWorker *)v;
+    struct ReadScanSink sink = {0};
+
+    sink.stats = worker->stats;
+
+    for (;;) {
+        unsigned index;
+
+        index = pixie_locked_add_u32(worker->next, 1);
+        index--;
+        if (index >= worker->filename_count)
+            break;
+        worker->records += _binaryfile_parse(&sink, worker->filenames[index],
+                                            &worker->masscan->targets,
+                                            &worker->masscan->banner_types);
+    }
+}
+
+/***************************************************************************
+ * Reads the files in parallel, then merges what the threads counted and
+ * prints the report.
+ ***************************************************************************/
+static void
+readscan_stats(struct Masscan *masscan, int arg_first, int arg_max, char *argv[])
+{
+    struct ReadScanWorker *workers;
+    volatile unsigned next = 0;
+    unsigned filename_count = (unsigned)(arg_max - arg_first);
+    unsigned thread_count = masscan->readscan_stats.threads;
+    uint64_t records = 0;
+    uint64_t start = pixie_gettime();
+    unsigned i;
+
+    if (thread_count == 0)
+        thread_count = pixie_cpu_get_count();
+    if (thread_count > filename_count)
+        thread_count = filename_count;
+    if (thread_count == 0)
+        thread_count = 1;
+
+    workers = CALLOC(thread_count, sizeof(workers[0]));
+    for (i=0; i<thread_count; i++) {
+        workers[i].masscan = masscan;
+        workers[i].filenames = argv + arg_first;
+        workers[i].filename_count = filename_count;
+        workers[i].next = &next;
+        workers[i].stats = analytics_create(masscan->readscan_stats.top);
+        workers[i].thread_handle = pixie_begin_thread(readscan_worker_thread,
+                                                      0, &workers[i]);
+    }
+
+    for (i=0; i<thread_count; i++) {
+        pixie_thread_join(workers[i].thread_handle);
+        records += workers[i].records;
+        if (i)
+            analytics_merge(workers[0].stats, workers[i].stats);
+    }
+
+    LOG(0, "[+] %" PRIu64 " records from %u files in %.2f seconds, %u threads\n",
+        records, filename_count,
+        (double)(pixie_gettime() - start) / 1000000.0, thread_count);
+    analytics_print(workers[0].stats, stdout);
+
+    for (i=0; i<thread_count; i++)
+        analytics_destroy(workers[i].stats);
+    free(workers);
+}
+
 /*****************************************************************************
  * When masscan is called with the "--readscan" parameter, it doesn't
  * do a scan of the live network, but instead reads scan results from
@@ -656,13 +790,20 @@ void
 readscan_binary_scanfile(struct Masscan *masscan,
                      int arg_first, int arg_max, char *argv[])
 {
+    struct ReadScanSink sink = {0};
     struct Output *out;
     int i;
 
+    if (masscan->readscan_stats.is_enabled) {
+        readscan_stats(masscan, arg_first, arg_max, argv);
+        return;
+    }
+
     /*
      * Create the output system, such as XML or JSON output
      */
     out = output_create(masscan, 0);
+    sink.out = out;
     
     /*
      * Set the start time to zero. We'll read it from the first file
@@ -681,7 +822,7 @@ readscan_binary_scanfile(struct Masscan *masscan,
      * Then arg_first=3 and arg_max=5.
      */
     for (i=arg_first; i<arg_max; i++) {
-        _binaryfile_parse(out, argv[i], &masscan->targets, &masscan->banner_types);
+        _binaryfile_parse(&sink, argv[i], &masscan->targets, &masscan->banner_types);
     }
 
     /* Done! */
@@ -28,6 +28,9 @@
 #include "massip-parse.h"
 #include "massip-port.h"
 #include "templ-opts.h"
+#include "rawsock-xdp.h"
+#include "pixie-file.h"
+#include "out-compress.h"
 #include <ctype.h>
 #include <limits.h>
 
@@ -212,7 +215,7 @@ print_nmap_help(void)
 "  --ttl <val>: Set IP time-to-live field\n"
 "  --spoof-mac <mac address/prefix/vendor name>: Spoof your MAC address\n"
 "OUTPUT:\n"
-"  --output-format <format>: Sets output to binary/list/unicornscan/json/ndjson/grepable/xml\n"
+"  --output-format <format>: Sets output to binary/list/unicornscan/json/ndjson/grepable/xml/arrow\n"
 "  --output-file <file>: Write scan results to file. If --output-format is\n"
 "     not given default is xml\n"
 "  -oL/-oJ/-oD/-oG/-oB/-oX/-oU <file>: Output scan in List/JSON/nDjson/Grepable/Binary/XML/Unicornscan format,\n"
@@ -384,34 +387,78 @@ masscan_echo_nic(struct Masscan *masscan, FILE *fp, unsigned i)
         ipaddress_formatted_t fmt = macaddress_fmt(masscan->nic[i].router_mac_ipv6);
         fprintf(fp, "router-mac-ipv6%s = %s\n", idx_str, fmt.string);
     }
+    if (masscan->nic[i].is_checksum_offload)
+        fprintf(fp, "adapter-offload%s = true\n", idx_str);
 
 }
 
 
+/***************************************************************************
+ * Writes the settings to a temporary file, which then replaces the
+ * named file. That way, if we're killed in the middle of writing, the
+ * last complete file is still there.
+ ***************************************************************************/
+int
+masscan_write_state(struct Masscan *masscan, const char *filename)
+{
+    char tmpname[512];
+    FILE *fp;
+
+    if (strlen(filename) + 5 > sizeof(tmpname)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", filename);
+
+    fp = fopen(tmpname, "wt");
+    if (fp == NULL)
+        return -1;
+
+    masscan_echo(masscan, fp, 0);
+
+    if (ferror(fp) || pixie_fsync(fp) != 0) {
+        int err = errno;
+        fclose(fp);
+        remove(tmpname);
+        errno = err;
+        return -1;
+    }
+    fclose(fp);
+
+    if (pixie_rename_replace(tmpname, filename) != 0) {
+        int err = errno;
+        remove(tmpname);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+const char *
+masscan_state_filename(const struct Masscan *masscan)
+{
+    if (masscan->checkpoint.filename && masscan->checkpoint.filename[0])
+        return masscan->checkpoint.filename;
+    return "paused.conf";
+}
+
 /***************************************************************************
  ***************************************************************************/
 void
 masscan_save_state(struct Masscan *masscan)
 {
-    char filename[512];
-    FILE *fp;
+    const char *filename = masscan_state_filename(masscan);
 
-    safe_strcpy(filename, sizeof(filename), "paused.conf");
     fprintf(stderr, "                                   "
                     "                                   \r");
     fprintf(stderr, "saving resume file to: %s\n", filename);
 
-    fp = fopen(filename, "wt");
-    if (fp == NULL) {
+    if (masscan_write_state(masscan, filename) != 0) {
         fprintf(stderr, "[-] FAIL: saving resume file\n");
         fprintf(stderr, "[-] %s: %s\n", filename, strerror(errno));
-        return;
     }
-
-    
-    masscan_echo(masscan, fp, 0);
-
-    fclose(fp);
 }
 
 
@@ -888,6 +935,152 @@ ARRAY(const char *rhs)
     return (unsigned)parseInt(p);
 }
 
+/**
+ * The most popular ports, most popular first, used by `--top-ports` and
+ * to rank ports for `--port-tiers`.
+ */
+static const unsigned short top_udp_ports[] = {
+    161, /* SNMP - should be found on all network equipment */
+    135, /* MS-RPC - should be found on all modern Windows */
+    500, /* ISAKMP - for establishing IPsec tunnels */
+    137, /* NetBIOS-NameService - should be found on old Windows */
+    138, /* NetBIOS-Datagram - should be found on old Windows */
+    445, /* SMB datagram service */
+    67, /* DHCP */
+    53, /* DNS */
+    1900, /* UPnP - Microsoft-focused local discovery */
+    5353, /* mDNS - Apple-focused local discovery */
+    4500, /* nat-t-ike - IPsec NAT traversal */
+    514, /* syslog - all Unix machiens */
+    69, /* TFTP */
+    49152, /* first of modern ephemeral ports */
+    631, /* IPP - printing protocol for Linux */
+    123, /* NTP network time protocol */
+    1434, /* MS-SQL server*/
+    520, /* RIP - routers use this protocol sometimes */
+    7, /* Echo */
+    111, /* SunRPC portmapper */
+    2049, /* SunRPC NFS */
+    5683, /* COAP */
+    11211, /* memcached */
+    1701, /* L2TP */
+    27960, /* quaked amplifier */
+    1645, /* RADIUS */
+    1812, /* RADIUS */
+    1646, /* RADIUS */
+    1813, /* RADIUS */
+    3343, /* Microsoft Cluster Services */
+    2535, /* MADCAP rfc2730 TODO FIXME */
+    
+};
+
+static const unsigned short top_tcp_ports[] = {
+    80, 443, 8080,   /* also web */
+    21, 990,     /* FTP, oldie but goodie */
+    22,     /* SSH, so much infrastructure */
+    23, 992,     /* Telnet, oldie but still around*/
+    24,     /* people put things here instead of TelnetSSH*/
+    25, 465, 587, 2525,     /* SMTP email*/
+    5800, 5900, 5901, /* VNC */
+    111,    /* SunRPC */
+    139, 445, /* Microsoft Windows networking */
+    135,    /* DCEPRC, more Microsoft Windows */
+    3389,   /* Microsoft Windows RDP */
+    88,     /* Kerberos, also Microsoft windows */
+    389, 636,    /* LDAP and MS Win */
+    1433,   /* MS SQL */
+    53,     /* DNS */
+    2083, 2096,   /* cPanel */
+    9050,   /* ToR */
+    8140,   /* Puppet */
+    11211,  /* memcached */
+    1098, 1099, /* Java RMI */
+    6000, 6001, /* XWindows */
+    5060, 5061, /* SIP - session initiation protocool */
+    554,    /* RTSP */
+    548,    /* AFP */
+    
+
+    1,3,4,6,7,9,13,17,19,20,26,30,32,33,37,42,43,49,70,
+    79,81,82,83,84,85,89,90,99,100,106,109,110,113,119,125,
+    143,144,146,161,163,179,199,211,212,222,254,255,256,259,264,280,
+    301,306,311,340,366,406,407,416,417,425,427,444,458,464,
+    465,481,497,500,512,513,514,515,524,541,543,544,545,554,555,563,
+    593,616,617,625,631,646,648,666,667,668,683,687,691,700,705,
+    711,714,720,722,726,749,765,777,783,787,800,801,808,843,873,880,888,
+    898,900,901,902,903,911,912,981,987,993,995,999,1000,1001,
+    1002,1007,1009,1010,1011,1021,1022,1023,1024,1025,1026,1027,1028,
+    1029,1030,1031,1032,1033,1034,1035,1036,1037,1038,1039,1040,1041,
+    1042,1043,1044,1045,1046,1047,1048,1049,1050,1051,1052,1053,1054,
+    1055,1056,1057,1058,1059,1060,1061,1062,1063,1064,1065,1066,1067,
+    1068,1069,1070,1071,1072,1073,1074,1075,1076,1077,1078,1079,1080,
+    1081,1082,1083,1084,1085,1086,1087,1088,1089,1090,1091,1092,1093,
+    1094,1095,1096,1097,1100,1102,1104,1105,1106,1107,1108,
+    1110,1111,1112,1113,1114,1117,1119,1121,1122,1123,1124,1126,1130,
+    1131,1132,1137,1138,1141,1145,1147,1148,1149,1151,1152,1154,1163,
+    1164,1165,1166,1169,1174,1175,1183,1185,1186,1187,1192,1198,1199,
+    1201,1213,1216,1217,1218,1233,1234,1236,1244,1247,1248,1259,1271,
+    1272,1277,1287,1296,1300,1301,1309,1310,1311,1322,1328,1334,1352,
+    1417,1434,1443,1455,1461,1494,1500,1501,1503,1521,1524,1533,
+    1556,1580,1583,1594,1600,1641,1658,1666,1687,1688,1700,1717,1718,
+    1719,1720,1721,1723,1755,1761,1782,1783,1801,1805,1812,1839,1840,
+    1862,1863,1864,1875,1900,1914,1935,1947,1971,1972,1974,1984,1998,
+    1999,2000,2001,2002,2003,2004,2005,2006,2007,2008,2009,2010,2013,
+    2020,2021,2022,2030,2033,2034,2035,2038,2040,2041,2042,2043,2045,
+    2046,2047,2048,2049,2065,2068,2099,2100,2103,2105,2106,2107,2111,
+    2119,2121,2126,2135,2144,2160,2161,2170,2179,2190,2191,2196,2200,
+    2222,2251,2260,2288,2301,2323,2366,2381,2382,2383,2393,2394,2399,
+    2401,2492,2500,2522,2557,2601,2602,2604,2605,2607,2608,2638,
+    2701,2702,2710,2717,2718,2725,2800,2809,2811,2869,2875,2909,2910,
+    2920,2967,2968,2998,3000,3001,3003,3005,3006,3007,3011,3013,3017,
+    3030,3031,3052,3071,3077,3128,3168,3211,3221,3260,3261,3268,3269,
+    3283,3300,3301,3306,3322,3323,3324,3325,3333,3351,3367,3369,3370,
+    3371,3372,3389,3390,3404,3476,3493,3517,3527,3546,3551,3580,3659,
+    3689,3690,3703,3737,3766,3784,3800,3801,3809,3814,3826,3827,3828,
+    3851,3869,3871,3878,3880,3889,3905,3914,3918,3920,3945,3971,3986,
+    3995,3998,4000,4001,4002,4003,4004,4005,4006,4045,4111,4125,4126,
+    4129,4224,4242,4279,4321,4343,4443,4444,4445,4446,4449,4550,4567,
+    4662,4848,4899,4900,4998,5000,5001,5002,5003,5004,5009,5030,5033,
+    5050,5051,5054,5080,5087,5100,5101,5102,5120,5190,5200,
+    5214,5221,5222,5225,5226,5269,5280,5298,5357,5405,5414,5431,5432,
+    5440,5500,5510,5544,5550,5555,5560,5566,5631,5633,5666,5678,5679,
+    5718,5730,5801,5802,5810,5811,5815,5822,5825,5850,5859,5862,
+    5877,5902,5903,5904,5906,5907,5910,5911,5915,5922,5925,
+    5950,5952,5959,5960,5961,5962,5963,5987,5988,5989,5998,5999,
+    6002,6003,6004,6005,6006,6007,6009,6025,6059,6100,6101,6106,
+    6112,6123,6129,6156,6346,6389,6502,6510,6543,6547,6565,6566,6567,
+    6580,6646,6666,6667,6668,6669,6689,6692,6699,6779,6788,6789,6792,
+    6839,6881,6901,6969,7000,7001,7002,7004,7007,7019,7025,7070,7100,
+    7103,7106,7200,7201,7402,7435,7443,7496,7512,7625,7627,7676,7741,
+    7777,7778,7800,7911,7920,7921,7937,7938,7999,8000,8001,8002,8007,
+    8008,8009,8010,8011,8021,8022,8031,8042,8045,8080,8081,8082,8083,
+    8084,8085,8086,8087,8088,8089,8090,8093,8099,8100,8180,8181,8192,
+    8193,8194,8200,8222,8254,8290,8291,8292,8300,8333,8383,8400,8402,
+    8443,8500,8600,8649,8651,8652,8654,8701,8800,8873,8888,8899,8994,
+    9000,9001,9002,9003,9009,9010,9011,9040,9071,9080,9081,9090,
+    9091,9099,9100,9101,9102,9103,9110,9111,9200,9207,9220,9290,9415,
+    9418,9485,9500,9502,9503,9535,9575,9593,9594,9595,9618,9666,9876,
+    9877,9878,9898,9900,9917,9929,9943,9944,9968,9998,9999,10000,10001,
+    10002,10003,10004,10009,10010,10012,10024,10025,10082,10180,10215,
+    10243,10566,10616,10617,10621,10626,10628,10629,10778,11110,11111,
+    11967,12000,12174,12265,12345,13456,13722,13782,13783,14000,14238,
+    14441,14442,15000,15002,15003,15004,15660,15742,16000,16001,16012,
+    16016,16018,16080,16113,16992,16993,17877,17988,18040,18101,18988,
+    19101,19283,19315,19350,19780,19801,19842,20000,20005,20031,20221,
+    20222,20828,21571,22939,23502,24444,24800,25734,25735,26214,27000,
+    27352,27353,27355,27356,27715,28201,30000,30718,30951,31038,31337,
+    32768,32769,32770,32771,32772,32773,32774,32775,32776,32777,32778,
+    32779,32780,32781,32782,32783,32784,32785,33354,33899,34571,34572,
+    34573,35500,38292,40193,40911,41511,42510,44176,44442,44443,44501,
+    45100,48080,49152,49153,49154,49155,49156,49157,49158,49159,49160,
+    49161,49163,49165,49167,49175,49176,49400,49999,50000,50001,50002,
+    50003,50006,50300,50389,50500,50636,50800,51103,51493,52673,52822,
+    52848,52869,54045,54328,55055,55056,55555,55600,56737,56738,57294,
+    57797,58080,60020,60443,61532,61900,62078,63331,64623,64680,65000,
+    65129,65389};
+static const unsigned max_tcp_ports = sizeof(top_tcp_ports)/sizeof(top_tcp_ports[0]);
+static const unsigned max_udp_ports = sizeof(top_udp_ports)/sizeof(top_udp_ports[0]);
+
 /**
  * Called if user specified `--top-ports` on the command-line.
  */
@@ -895,148 +1088,7 @@ static void
 config_top_ports(struct Masscan *masscan, unsigned maxports)
 {
     unsigned i;
-    static const unsigned short top_udp_ports[] = {
-        161, /* SNMP - should be found on all network equipment */
-        135, /* MS-RPC - should be found on all modern Windows */
-        500, /* ISAKMP - for establishing IPsec tunnels */
-        137, /* NetBIOS-NameService - should be found on old Windows */
-        138, /* NetBIOS-Datagram - should be found on old Windows */
-        445, /* SMB datagram service */
-        67, /* DHCP */
-        53, /* DNS */
-        1900, /* UPnP - Microsoft-focused local discovery */
-        5353, /* mDNS - Apple-focused local discovery */
-        4500, /* nat-t-ike - IPsec NAT traversal */
-        514, /* syslog - all Unix machiens */
-        69, /* TFTP */
-        49152, /* first of modern ephemeral ports */
-        631, /* IPP - printing protocol for Linux */
-        123, /* NTP network time protocol */
-        1434, /* MS-SQL server*/
-        520, /* RIP - routers use this protocol sometimes */
-        7, /* Echo */
-        111, /* SunRPC portmapper */
-        2049, /* SunRPC NFS */
-        5683, /* COAP */
-        11211, /* memcached */
-        1701, /* L2TP */
-        27960, /* quaked amplifier */
-        1645, /* RADIUS */
-        1812, /* RADIUS */
-        1646, /* RADIUS */
-        1813, /* RADIUS */
-        3343, /* Microsoft Cluster Services */
-        2535, /* MADCAP rfc2730 TODO FIXME */
-        
-    };
-
-    static const unsigned short top_tcp_ports[] = {
-        80, 443, 8080,   /* also web */
-        21, 990,     /* FTP, oldie but goodie */
-        22,     /* SSH, so much infrastructure */
-        23, 992,     /* Telnet, oldie but still around*/
-        24,     /* people put things here instead of TelnetSSH*/
-        25, 465, 587, 2525,     /* SMTP email*/
-        5800, 5900, 5901, /* VNC */
-        111,    /* SunRPC */
-        139, 445, /* Microsoft Windows networking */
-        135,    /* DCEPRC, more Microsoft Windows */
-        3389,   /* Microsoft Windows RDP */
-        88,     /* Kerberos, also Microsoft windows */
-        389, 636,    /* LDAP and MS Win */
-        1433,   /* MS SQL */
-        53,     /* DNS */
-        2083, 2096,   /* cPanel */
-        9050,   /* ToR */
-        8140,   /* Puppet */
-        11211,  /* memcached */
-        1098, 1099, /* Java RMI */
-        6000, 6001, /* XWindows */
-        5060, 5061, /* SIP - session initiation protocool */
-        554,    /* RTSP */
-        548,    /* AFP */
-        
-
-        1,3,4,6,7,9,13,17,19,20,26,30,32,33,37,42,43,49,70,
-        79,81,82,83,84,85,89,90,99,100,106,109,110,113,119,125,
-        143,144,146,161,163,179,199,211,212,222,254,255,256,259,264,280,
-        301,306,311,340,366,406,407,416,417,425,427,444,458,464,
-        465,481,497,500,512,513,514,515,524,541,543,544,545,554,555,563,
-        593,616,617,625,631,646,648,666,667,668,683,687,691,700,705,
-        711,714,720,722,726,749,765,777,783,787,800,801,808,843,873,880,888,
-        898,900,901,902,903,911,912,981,987,993,995,999,1000,1001,
-        1002,1007,1009,1010,1011,1021,1022,1023,1024,1025,1026,1027,1028,
-        1029,1030,1031,1032,1033,1034,1035,1036,1037,1038,1039,1040,1041,
-        1042,1043,1044,1045,1046,1047,1048,1049,1050,1051,1052,1053,1054,
-        1055,1056,1057,1058,1059,1060,1061,1062,1063,1064,1065,1066,1067,
-        1068,1069,1070,1071,1072,1073,1074,1075,1076,1077,1078,1079,1080,
-        1081,1082,1083,1084,1085,1086,1087,1088,1089,1090,1091,1092,1093,
-        1094,1095,1096,1097,1100,1102,1104,1105,1106,1107,1108,
-        1110,1111,1112,1113,1114,1117,1119,1121,1122,1123,1124,1126,1130,
-        1131,1132,1137,1138,1141,1145,1147,1148,1149,1151,1152,1154,1163,
-        1164,1165,1166,1169,1174,1175,1183,1185,1186,1187,1192,1198,1199,
-        1201,1213,1216,1217,1218,1233,1234,1236,1244,1247,1248,1259,1271,
-        1272,1277,1287,1296,1300,1301,1309,1310,1311,1322,1328,1334,1352,
-        1417,1434,1443,1455,1461,1494,1500,1501,1503,1521,1524,1533,
-        1556,1580,1583,1594,1600,1641,1658,1666,1687,1688,1700,1717,1718,
-        1719,1720,1721,1723,1755,1761,1782,1783,1801,1805,1812,1839,1840,
-        1862,1863,1864,1875,1900,1914,1935,1947,1971,1972,1974,1984,1998,
-        1999,2000,2001,2002,2003,2004,2005,2006,2007,2008,2009,2010,2013,
-        2020,2021,2022,2030,2033,2034,2035,2038,2040,2041,2042,2043,2045,
-        2046,2047,2048,2049,2065,2068,2099,2100,2103,2105,2106,2107,2111,
-        2119,2121,2126,2135,2144,2160,2161,2170,2179,2190,2191,2196,2200,
-        2222,2251,2260,2288,2301,2323,2366,2381,2382,2383,2393,2394,2399,
-        2401,2492,2500,2522,2557,2601,2602,2604,2605,2607,2608,2638,
-        2701,2702,2710,2717,2718,2725,2800,2809,2811,2869,2875,2909,2910,
-        2920,2967,2968,2998,3000,3001,3003,3005,3006,3007,3011,3013,3017,
-        3030,3031,3052,3071,3077,3128,3168,3211,3221,3260,3261,3268,3269,
-        3283,3300,3301,3306,3322,3323,3324,3325,3333,3351,3367,3369,3370,
-        3371,3372,3389,3390,3404,3476,3493,3517,3527,3546,3551,3580,3659,
-        3689,3690,3703,3737,3766,3784,3800,3801,3809,3814,3826,3827,3828,
-        3851,3869,3871,3878,3880,3889,3905,3914,3918,3920,3945,3971,3986,
-        3995,3998,4000,4001,4002,4003,4004,4005,4006,4045,4111,4125,4126,
-        4129,4224,4242,4279,4321,4343,4443,4444,4445,4446,4449,4550,4567,
-        4662,4848,4899,4900,4998,5000,5001,5002,5003,5004,5009,5030,5033,
-        5050,5051,5054,5080,5087,5100,5101,5102,5120,5190,5200,
-        5214,5221,5222,5225,5226,5269,5280,5298,5357,5405,5414,5431,5432,
-        5440,5500,5510,5544,5550,5555,5560,5566,5631,5633,5666,5678,5679,
-        5718,5730,5801,5802,5810,5811,5815,5822,5825,5850,5859,5862,
-        5877,5902,5903,5904,5906,5907,5910,5911,5915,5922,5925,
-        5950,5952,5959,5960,5961,5962,5963,5987,5988,5989,5998,5999,
-        6002,6003,6004,6005,6006,6007,6009,6025,6059,6100,6101,6106,
-        6112,6123,6129,6156,6346,6389,6502,6510,6543,6547,6565,6566,6567,
-        6580,6646,6666,6667,6668,6669,6689,6692,6699,6779,6788,6789,6792,
-        6839,6881,6901,6969,7000,7001,7002,7004,7007,7019,7025,7070,7100,
-        7103,7106,7200,7201,7402,7435,7443,7496,7512,7625,7627,7676,7741,
-        7777,7778,7800,7911,7920,7921,7937,7938,7999,8000,8001,8002,8007,
-        8008,8009,8010,8011,8021,8022,8031,8042,8045,8080,8081,8082,8083,
-        8084,8085,8086,8087,8088,8089,8090,8093,8099,8100,8180,8181,8192,
-        8193,8194,8200,8222,8254,8290,8291,8292,8300,8333,8383,8400,8402,
-        8443,8500,8600,8649,8651,8652,8654,8701,8800,8873,8888,8899,8994,
-        9000,9001,9002,9003,9009,9010,9011,9040,9071,9080,9081,9090,
-        9091,9099,9100,9101,9102,9103,9110,9111,9200,9207,9220,9290,9415,
-        9418,9485,9500,9502,9503,9535,9575,9593,9594,9595,9618,9666,9876,
-        9877,9878,9898,9900,9917,9929,9943,9944,9968,9998,9999,10000,10001,
-        10002,10003,10004,10009,10010,10012,10024,10025,10082,10180,10215,
-        10243,10566,10616,10617,10621,10626,10628,10629,10778,11110,11111,
-        11967,12000,12174,12265,12345,13456,13722,13782,13783,14000,14238,
-        14441,14442,15000,15002,15003,15004,15660,15742,16000,16001,16012,
-        16016,16018,16080,16113,16992,16993,17877,17988,18040,18101,18988,
-        19101,19283,19315,19350,19780,19801,19842,20000,20005,20031,20221,
-        20222,20828,21571,22939,23502,24444,24800,25734,25735,26214,27000,
-        27352,27353,27355,27356,27715,28201,30000,30718,30951,31038,31337,
-        32768,32769,32770,32771,32772,32773,32774,32775,32776,32777,32778,
-        32779,32780,32781,32782,32783,32784,32785,33354,33899,34571,34572,
-        34573,35500,38292,40193,40911,41511,42510,44176,44442,44443,44501,
-        45100,48080,49152,49153,49154,49155,49156,49157,49158,49159,49160,
-        49161,49163,49165,49167,49175,49176,49400,49999,50000,50001,50002,
-        50003,50006,50300,50389,50500,50636,50800,51103,51493,52673,52822,
-        52848,52869,54045,54328,55055,55056,55555,55600,56737,56738,57294,
-        57797,58080,60020,60443,61532,61900,62078,63331,64623,64680,65000,
-        65129,65389};
     struct RangeList *ports = &masscan->targets.ports;
-    static const unsigned max_tcp_ports = sizeof(top_tcp_ports)/sizeof(top_tcp_ports[0]);
-    static const unsigned max_udp_ports = sizeof(top_udp_ports)/sizeof(top_udp_ports[0]);
 
 
     if (masscan->scan_type.tcp) {
@@ -1128,6 +1180,70 @@ static int SET_banners_rawudp(struct Masscan *masscan, const char *name, const c
     return CONF_OK;
 }
 
+static int SET_stateless_banners(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->is_stateless_banners || masscan->echo_all)
+            fprintf(masscan->echo, "stateless-banners = %s\n", masscan->is_stateless_banners?"true":"false");
+       return 0;
+    }
+    masscan->is_stateless_banners = parseBoolean(value);
+    if (masscan->is_stateless_banners)
+        masscan->is_banners = true;
+    return CONF_OK;
+}
+
+static int SET_readscan_stats(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->readscan_stats.is_enabled || masscan->echo_all)
+            fprintf(masscan->echo, "readscan-stats = %s\n", masscan->readscan_stats.is_enabled?"true":"false");
+       return 0;
+    }
+    masscan->readscan_stats.is_enabled = parseBoolean(value);
+    return CONF_OK;
+}
+
+static int SET_readscan_top(struct Masscan *masscan, const char *name, const char *value)
+{
+    uint64_t n;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->readscan_stats.top || masscan->echo_all)
+            fprintf(masscan->echo, "readscan-top = %u\n", masscan->readscan_stats.top);
+        return 0;
+    }
+    n = parseInt(value);
+    if (n == 0 || n > 10000) {
+        fprintf(stderr, "FAIL: %s: bad readscan-top, expected 1 to 10000\n", value);
+        return CONF_ERR;
+    }
+    masscan->readscan_stats.top = (unsigned)n;
+    return CONF_OK;
+}
+
+static int SET_readscan_threads(struct Masscan *masscan, const char *name, const char *value)
+{
+    uint64_t n;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->readscan_stats.threads || masscan->echo_all)
+            fprintf(masscan->echo, "readscan-threads = %u\n", masscan->readscan_stats.threads);
+        return 0;
+    }
+    n = parseInt(value);
+    if (n > 1024) {
+        fprintf(stderr, "FAIL: %s: bad readscan-threads\n", value);
+        return CONF_ERR;
+    }
+    masscan->readscan_stats.threads = (unsigned)n;
+    return CONF_OK;
+}
+
 static int SET_capture(struct Masscan *masscan, const char *name, const char *value)
 {
     if (masscan->echo) {
@@ -1284,6 +1400,25 @@ static int SET_hello_string(struct Masscan *masscan, const char *name, const cha
     return CONF_OK;
 }
 
+static int SET_banner_limit(struct Masscan *masscan, const char *name, const char *value)
+{
+    uint64_t n;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->tcp_banner_limit || masscan->echo_all)
+            fprintf(masscan->echo, "banner-limit = %u\n", masscan->tcp_banner_limit);
+        return 0;
+    }
+    n = parseSize(value);
+    if (n == 0 || n > 0x7FFFFFFF) {
+        fprintf(stderr, "FAIL: %s: bad banner limit\n", value);
+        return CONF_ERR;
+    }
+    masscan->tcp_banner_limit = (unsigned)n;
+    return CONF_OK;
+}
+
 static int SET_hello_timeout(struct Masscan *masscan, const char *name, const char *value)
 {
     UNUSEDPARM(name);
@@ -1296,6 +1431,20 @@ static int SET_hello_timeout(struct Masscan *masscan, const char *name, const ch
     return CONF_OK;
 }
 
+static int SET_hello_learn(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->hello_learn.filename || masscan->echo_all)
+            fprintf(masscan->echo, "hello-learn = %s\n",
+                    masscan->hello_learn.filename?masscan->hello_learn.filename:"");
+        return 0;
+    }
+    free(masscan->hello_learn.filename);
+    masscan->hello_learn.filename = STRDUP(value);
+    return CONF_OK;
+}
+
 static int SET_http_cookie(struct Masscan *masscan, const char *name, const char *value)
 {
     unsigned char *newvalue;
@@ -1627,6 +1776,262 @@ static int SET_output_append(struct Masscan *masscan, const char *name, const ch
     return CONF_OK;
 }
 
+/***************************************************************************
+ * The names used by --output-format and --output-sink
+ ***************************************************************************/
+static const struct {
+    const char *name;
+    enum OutputFormat format;
+} output_format_names[] = {
+    {"interactive", Output_Interactive},
+    {"list",        Output_List},
+    {"unicornscan", Output_Unicornscan},
+    {"xml",         Output_XML},
+    {"binary",      Output_Binary},
+    {"grepable",    Output_Grepable},
+    {"greppable",   Output_Grepable},
+    {"json",        Output_JSON},
+    {"ndjson",      Output_NDJSON},
+    {"certs",       Output_Certs},
+    {"none",        Output_None},
+    {"redis",       Output_Redis},
+    {"hostonly",    Output_Hostonly},
+    {"arrow",       Output_Arrow},
+    {0, 0}
+};
+
+static enum OutputFormat
+output_format_parse(const char *value, size_t length)
+{
+    unsigned i;
+
+    if (EQUALSx("unknown(0)", value, length))
+        return Output_Interactive;
+    for (i=0; output_format_names[i].name; i++) {
+        if (EQUALSx(output_format_names[i].name, value, length))
+            return output_format_names[i].format;
+    }
+    return Output_Default;
+}
+
+static const char *
+output_format_name(enum OutputFormat format)
+{
+    unsigned i;
+
+    for (i=0; output_format_names[i].name; i++) {
+        if (output_format_names[i].format == format)
+            return output_format_names[i].name;
+    }
+    return NULL;
+}
+
+static int SET_output_compress(struct Masscan *masscan, const char *name, const char *value)
+{
+    int method;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->output.compress || masscan->echo_all)
+            fprintf(masscan->echo, "output-compress = %s\n",
+                    masscan->output.compress?compress_name(masscan->output.compress):"auto");
+        return 0;
+    }
+    if (EQUALS("auto", value)) {
+        masscan->output.compress = Compress_Default;
+        return CONF_OK;
+    }
+    method = compress_parse(value);
+    if (method < 0) {
+        fprintf(stderr, "FAIL: output-compress=<method>: expected gzip, zstd, none, or auto: %s\n", value);
+        return CONF_ERR;
+    }
+    masscan->output.compress = method;
+    return CONF_OK;
+}
+
+static int SET_output_compress_level(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->output.compress_level || masscan->echo_all)
+            fprintf(masscan->echo, "output-compress-level = %d\n", masscan->output.compress_level);
+        return 0;
+    }
+    if (!isInteger(value) || parseInt(value) > 22) {
+        fprintf(stderr, "FAIL: output-compress-level=<n>: expected 1 to 9 for gzip, or up to 22 for zstd: %s\n", value);
+        return CONF_ERR;
+    }
+    masscan->output.compress_level = (int)parseInt(value);
+    return CONF_OK;
+}
+
+static int SET_arrow_batch(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->output.arrow_batch || masscan->echo_all)
+            fprintf(masscan->echo, "arrow-batch = %u\n", masscan->output.arrow_batch);
+        return 0;
+    }
+    if (!isInteger(value) || parseInt(value) == 0 || parseInt(value) > 0x7FFFFFFF) {
+        fprintf(stderr, "FAIL: arrow-batch=<rows>: expected a number of rows: %s\n", value);
+        return CONF_ERR;
+    }
+    masscan->output.arrow_batch = (unsigned)parseInt(value);
+    return CONF_OK;
+}
+
+/***************************************************************************
+ * --output-sink FORMAT:FILE [rotate=TIME] [rotate-size=SIZE] [show=LIST]
+ *               [compress=METHOD]
+ * @return 0 on success, 1 if it doesn't parse, 2 for a format that can't
+ *      be a sink
+ ***************************************************************************/
+static int
+parse_output_sink(const char *value, struct OutputSink *sink)
+{
+    size_t length;
+
+    /* FORMAT: */
+    length = INDEX_OF(value, ':');
+    if (value[length] != ':')
+        return 1;
+    sink->format = output_format_parse(value, length);
+    if (sink->format == Output_Default || sink->format == Output_Interactive
+        || sink->format == Output_Redis)
+        return 2;
+    value += length + 1;
+
+    /* FILE */
+    for (length=0; value[length] && !isspace(value[length]&0xFF); length++)
+        ;
+    if (length == 0)
+        return 1;
+    sink->filename = MALLOC(length + 1);
+    memcpy(sink->filename, value, length);
+    sink->filename[length] = '\0';
+    value += length;
+
+    /* options, like "rotate=hourly" */
+    for (;;) {
+        char option[64];
+        const char *arg;
+
+        while (isspace(*value&0xFF))
+            value++;
+        if (*value == '\0')
+            break;
+        for (length=0; value[length] && !isspace(value[length]&0xFF); length++)
+            ;
+        if (length >= sizeof(option) || value[INDEX_OF(value, '=')] != '='
+            || INDEX_OF(value, '=') > length) {
+            goto fail;
+        }
+        memcpy(option, value, length);
+        option[length] = '\0';
+        arg = option + INDEX_OF(option, '=') + 1;
+        option[arg - option - 1] = '\0';
+        value += length;
+
+        if (EQUALS("rotate-size", option))
+            sink->rotate_filesize = parseSize(arg);
+        else if (EQUALS("rotate", option))
+            sink->rotate_timeout = (unsigned)parseTime(arg);
+        else if (EQUALS("compress", option)) {
+            int method = compress_parse(arg);
+            if (method < 0) {
+                goto fail;
+            }
+            sink->compress = method;
+        } else if (EQUALS("show", option)) {
+            sink->is_show_set = 1;
+            while (*arg) {
+                unsigned n = INDEX_OF(arg, ',');
+                if (EQUALSx("open", arg, n))
+                    sink->is_show_open = 1;
+                else if (EQUALSx("closed", arg, n) || EQUALSx("close", arg, n))
+                    sink->is_show_closed = 1;
+                else if (EQUALSx("host", arg, n))
+                    sink->is_show_host = 1;
+                else if (EQUALSx("all", arg, n))
+                    sink->is_show_open = sink->is_show_closed = sink->is_show_host = 1;
+                else {
+                    goto fail;
+                }
+                arg += n;
+                while (*arg == ',')
+                    arg++;
+            }
+        } else {
+            goto fail;
+        }
+    }
+
+    return 0;
+fail:
+    free(sink->filename);
+    sink->filename = NULL;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int SET_output_sink(struct Masscan *masscan, const char *name, const char *value)
+{
+    struct OutputSink sink;
+    int err;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        unsigned i;
+        for (i=0; i<masscan->output.sink_count; i++) {
+            const struct OutputSink *s = &masscan->output.sinks[i];
+            fprintf(masscan->echo, "output-sink = %s:%s",
+                    output_format_name(s->format), s->filename);
+            if (s->rotate_timeout)
+                fprintf(masscan->echo, " rotate=%u", s->rotate_timeout);
+            if (s->rotate_filesize)
+                fprintf(masscan->echo, " rotate-size=%" PRIu64, s->rotate_filesize);
+            if (s->is_show_set) {
+                const char *comma = "";
+                fprintf(masscan->echo, " show=");
+                if (s->is_show_open) {
+                    fprintf(masscan->echo, "%sopen", comma);
+                    comma = ",";
+                }
+                if (s->is_show_closed) {
+                    fprintf(masscan->echo, "%sclosed", comma);
+                    comma = ",";
+                }
+                if (s->is_show_host)
+                    fprintf(masscan->echo, "%shost", comma);
+            }
+            if (s->compress)
+                fprintf(masscan->echo, " compress=%s", compress_name(s->compress));
+            fprintf(masscan->echo, "\n");
+        }
+        return 0;
+    }
+
+    memset(&sink, 0, sizeof(sink));
+    err = parse_output_sink(value, &sink);
+    if (err == 2) {
+        fprintf(stderr, "FAIL: output-sink: unknown or unsupported format: %.*s\n",
+                (int)INDEX_OF(value, ':'), value);
+        return CONF_ERR;
+    } else if (err) {
+        fprintf(stderr, "FAIL: output-sink=<format>:<file> [rotate=<time>] [rotate-size=<size>] [show=<open,closed>] [compress=<method>]\n");
+        return CONF_ERR;
+    }
+
+    masscan->output.sinks = REALLOCARRAY(masscan->output.sinks,
+                                         masscan->output.sink_count + 1,
+                                         sizeof(sink));
+    masscan->output.sinks[masscan->output.sink_count++] = sink;
+    return CONF_OK;
+}
+
 static int SET_output_filename(struct Masscan *masscan, const char *name, const char *value)
 {
     UNUSEDPARM(name);
@@ -1652,44 +2057,22 @@ static int SET_output_format(struct Masscan *masscan, const char *name, const ch
         ipaddress_formatted_t fmt;
         switch (masscan->output.format) {
             case Output_Default:    if (masscan->echo_all) fprintf(fp, "output-format = interactive\n"); break;
-            case Output_Interactive:fprintf(fp, "output-format = interactive\n"); break;
-            case Output_List:       fprintf(fp, "output-format = list\n"); break;
-            case Output_Unicornscan:fprintf(fp, "output-format = unicornscan\n"); break;
-            case Output_XML:        fprintf(fp, "output-format = xml\n"); break;
-            case Output_Binary:     fprintf(fp, "output-format = binary\n"); break;
-            case Output_Grepable:   fprintf(fp, "output-format = grepable\n"); break;
-            case Output_JSON:       fprintf(fp, "output-format = json\n"); break;
-            case Output_NDJSON:     fprintf(fp, "output-format = ndjson\n"); break;
-            case Output_Certs:      fprintf(fp, "output-format = certs\n"); break;
-            case Output_None:       fprintf(fp, "output-format = none\n"); break;
-            case Output_Hostonly:   fprintf(fp, "output-format = hostonly\n"); break;
             case Output_Redis:
                 fmt = ipaddress_fmt(masscan->redis.ip);
                 fprintf(fp, "output-format = redis\n");
                 fprintf(fp, "redis = %s %u\n", fmt.string, masscan->redis.port);
                 break;
-                
             default:
-                fprintf(fp, "output-format = unknown(%u)\n", masscan->output.format);
+                if (output_format_name(masscan->output.format))
+                    fprintf(fp, "output-format = %s\n", output_format_name(masscan->output.format));
+                else
+                    fprintf(fp, "output-format = unknown(%u)\n", masscan->output.format);
                 break;
         }
         return 0;
     }
-    if (EQUALS("unknown(0)", value))        x = Output_Interactive;
-    else if (EQUALS("interactive", value))  x = Output_Interactive;
-    else if (EQUALS("list", value))         x = Output_List;
-    else if (EQUALS("unicornscan", value))  x = Output_Unicornscan;
-    else if (EQUALS("xml", value))          x = Output_XML;
-    else if (EQUALS("binary", value))       x = Output_Binary;
-    else if (EQUALS("greppable", value))    x = Output_Grepable;
-    else if (EQUALS("grepable", value))     x = Output_Grepable;
-    else if (EQUALS("json", value))         x = Output_JSON;
-    else if (EQUALS("ndjson", value))       x = Output_NDJSON;
-    else if (EQUALS("certs", value))        x = Output_Certs;
-    else if (EQUALS("none", value))         x = Output_None;
-    else if (EQUALS("redis", value))        x = Output_Redis;
-    else if (EQUALS("hostonly", value))     x = Output_Hostonly;
-    else {
+    x = output_format_parse(value, strlen(value));
+    if (x == Output_Default) {
         LOG(0, "FAIL: unknown output-format: %s\n", value);
         LOG(0, "  hint: 'binary', 'xml', 'grepable', ...\n");
         return CONF_ERR;
@@ -1811,6 +2194,38 @@ static int SET_pcap_filename(struct Masscan *masscan, const char *name, const ch
     return CONF_OK;
 }
 
+static int SET_pcap_snaplen(struct Masscan *masscan, const char *name, const char *value)
+{
+    uint64_t n;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->pcap.snaplen || masscan->echo_all)
+            fprintf(masscan->echo, "pcap-snaplen = %u\n", masscan->pcap.snaplen);
+        return 0;
+    }
+    n = parseInt(value);
+    if (n > 65535) {
+        fprintf(stderr, "FAIL: %s: bad pcap snaplen\n", value);
+        return CONF_ERR;
+    }
+    masscan->pcap.snaplen = (unsigned)n;
+    return CONF_OK;
+}
+
+static int SET_pcap_rotate(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->pcap.rotate_bytes || masscan->echo_all)
+            fprintf(masscan->echo, "pcap-rotate = %llu\n",
+                    (unsigned long long)masscan->pcap.rotate_bytes);
+        return 0;
+    }
+    masscan->pcap.rotate_bytes = parseSize(value);
+    return CONF_OK;
+}
+
 /* Specifies a 'libpcap' file from which to read packet-payloads. The payloads found
  * in this file will serve as the template for spewing out custom packets. There are
  * other options that can set payloads as well, like "--nmap-payloads" for reading
@@ -1920,54 +2335,323 @@ static int SET_resume_index(struct Masscan *masscan, const char *name, const cha
     return CONF_OK;
 }
 
-static int SET_retries(struct Masscan *masscan, const char *name, const char *value)
+static int SET_resume_thread(struct Masscan *masscan, const char *name, const char *value)
 {
-    uint64_t x;
-    
+    uint64_t n[4];
+    char *p = (char *)value;
+    unsigned i;
+
     UNUSEDPARM(name);
     if (masscan->echo) {
-        if (masscan->retries || masscan->echo_all)
-            fprintf(masscan->echo, "retries = %u\n", masscan->retries);
+        for (i=0; i<sizeof(masscan->resume.threads)/sizeof(masscan->resume.threads[0]); i++) {
+            const struct ResumeThread *t = &masscan->resume.threads[i];
+            if (!t->is_valid)
+                continue;
+            fprintf(masscan->echo, "resume-thread = %u %" PRIu64 " %u %" PRIu64 "\n",
+                    i, t->index, t->retry, t->repeats);
+        }
         return 0;
     }
-    x = strtoul(value, 0, 0);
-    if (x >= 1000) {
-        fprintf(stderr, "FAIL: retries=<n>: expected number less than 1000\n");
+    for (i=0; i<4; i++) {
+        char *next;
+        while (isspace(*p & 0xFF))
+            p++;
+        if (!isdigit(*p & 0xFF))
+            break;
+        n[i] = strtoull(p, &next, 10);
+        p = next;
+    }
+    if (i < 4 || n[0] >= sizeof(masscan->resume.threads)/sizeof(masscan->resume.threads[0])) {
+        fprintf(stderr, "FAIL: %s: bad resume-thread, expected <thread> <index> <retry> <repeats>\n", value);
         return CONF_ERR;
     }
-    masscan->retries = (unsigned)x;
+    masscan->resume.threads[n[0]].is_valid = 1;
+    masscan->resume.threads[n[0]].index = n[1];
+    masscan->resume.threads[n[0]].retry = (unsigned)n[2];
+    masscan->resume.threads[n[0]].repeats = n[3];
     return CONF_OK;
-    
 }
 
-static int SET_rotate_time(struct Masscan *masscan, const char *name, const char *value)
+static int SET_checkpoint(struct Masscan *masscan, const char *name, const char *value)
 {
     UNUSEDPARM(name);
     if (masscan->echo) {
-        if (masscan->output.rotate.timeout || masscan->echo_all)
-            fprintf(masscan->echo, "rotate = %u\n", masscan->output.rotate.timeout);
+        if (masscan->checkpoint.seconds || masscan->echo_all)
+            fprintf(masscan->echo, "checkpoint = %u\n", masscan->checkpoint.seconds);
         return 0;
     }
-    masscan->output.rotate.timeout = (unsigned)parseTime(value);
+    if (!isdigit(value[0]&0xFF)) {
+        fprintf(stderr, "FAIL: %s: bad checkpoint, expected seconds\n", value);
+        return CONF_ERR;
+    }
+    masscan->checkpoint.seconds = (unsigned)parseTime(value);
     return CONF_OK;
 }
-static int SET_rotate_directory(struct Masscan *masscan, const char *name, const char *value)
+
+static int SET_checkpoint_file(struct Masscan *masscan, const char *name, const char *value)
 {
-    char *p;
     UNUSEDPARM(name);
     if (masscan->echo) {
-        if (memcmp(masscan->output.rotate.directory, ".",2) != 0 || masscan->echo_all) {
-            fprintf(masscan->echo, "rotate-dir = %s\n", masscan->output.rotate.directory);
-        }
+        if (masscan->checkpoint.filename || masscan->echo_all)
+            fprintf(masscan->echo, "checkpoint-file = %s\n",
+                    masscan->checkpoint.filename?masscan->checkpoint.filename:"");
         return 0;
     }
-    safe_strcpy(   masscan->output.rotate.directory,
-             sizeof(masscan->output.rotate.directory),
-             value);
-    /* strip trailing slashes */
-    p = masscan->output.rotate.directory;
-    while (*p && (p[strlen(p)-1] == '/' || p[strlen(p)-1] == '\\')) /* Fix for #561 */
-        p[strlen(p)-1] = '\0';
+    free(masscan->checkpoint.filename);
+    masscan->checkpoint.filename = STRDUP(value);
+    return CONF_OK;
+}
+
+static int SET_retries(struct Masscan *masscan, const char *name, const char *value)
+{
+    uint64_t x;
+    
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->retries || masscan->echo_all)
+            fprintf(masscan->echo, "retries = %u\n", masscan->retries);
+        return 0;
+    }
+    x = strtoul(value, 0, 0);
+    if (x >= 1000) {
+        fprintf(stderr, "FAIL: retries=<n>: expected number less than 1000\n");
+        return CONF_ERR;
+    }
+    masscan->retries = (unsigned)x;
+    return CONF_OK;
+    
+}
+
+static int SET_hugepages(struct Masscan *masscan, const char *name, const char *value)
+{
+    static const char *names[] = {"off", "auto", "2m", "1g"};
+    int policy;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->hugepages || masscan->echo_all)
+            fprintf(masscan->echo, "hugepages = %s\n", names[masscan->hugepages & 3]);
+        return 0;
+    }
+    policy = huge_parse_policy(value);
+    if (policy < 0) {
+        fprintf(stderr, "FAIL: hugepages=<type>: expected off, auto, 2m, or 1g\n");
+        return CONF_ERR;
+    }
+    masscan->hugepages = (unsigned)policy;
+    return CONF_OK;
+}
+
+static int SET_dedup_size(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->dedup.entries || masscan->echo_all)
+            fprintf(masscan->echo, "dedup-size = %llu\n",
+                    (unsigned long long)masscan->dedup.entries);
+        return 0;
+    }
+    if (!isInteger(value)) {
+        fprintf(stderr, "FAIL: dedup-size=<n>: expected a number of responses, or 0 for auto\n");
+        return CONF_ERR;
+    }
+    masscan->dedup.entries = parseInt(value);
+    return CONF_OK;
+}
+
+static int SET_dedup_window(struct Masscan *masscan, const char *name, const char *value)
+{
+    uint64_t x;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->dedup.window || masscan->echo_all)
+            fprintf(masscan->echo, "dedup-window = %u\n", masscan->dedup.window);
+        return 0;
+    }
+    x = parseTime(value);
+    if (x == 0 || x > 3600) {
+        fprintf(stderr, "FAIL: dedup-window=<secs>: expected time from 1 to 3600 seconds\n");
+        return CONF_ERR;
+    }
+    masscan->dedup.window = (unsigned)x;
+    return CONF_OK;
+}
+
+static int SET_rx_threads(struct Masscan *masscan, const char *name, const char *value)
+{
+    uint64_t x;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->rx_thread_count > 1 || masscan->echo_all)
+            fprintf(masscan->echo, "rx-threads = %u\n", masscan->rx_thread_count);
+        return 0;
+    }
+    x = strtoul(value, 0, 0);
+    if (x < 1 || x > 64) {
+        fprintf(stderr, "FAIL: rx-threads=<n>: expected number from 1 to 64\n");
+        return CONF_ERR;
+    }
+    masscan->rx_thread_count = (unsigned)x;
+    return CONF_OK;
+}
+
+static int SET_pin_threads(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->is_pin_threads || masscan->echo_all)
+            fprintf(masscan->echo, "pin-threads = %s\n", masscan->is_pin_threads?"true":"false");
+        return 0;
+    }
+    masscan->is_pin_threads = parseBoolean(value);
+    return CONF_OK;
+}
+
+static int SET_busy_poll(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->is_busy_poll || masscan->echo_all)
+            fprintf(masscan->echo, "busy-poll = %s\n", masscan->is_busy_poll?"true":"false");
+        return 0;
+    }
+    masscan->is_busy_poll = parseBoolean(value);
+    return CONF_OK;
+}
+
+static int SET_neighbor_thread(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (!masscan->is_neighbor_thread || masscan->echo_all)
+            fprintf(masscan->echo, "neighbor-thread = %s\n", masscan->is_neighbor_thread?"true":"false");
+        return 0;
+    }
+    masscan->is_neighbor_thread = parseBoolean(value);
+    return CONF_OK;
+}
+
+static void
+masscan_echo_ports(const char *name, const struct RangeList *ports, FILE *fp);
+
+static int SET_discover_ports(struct Masscan *masscan, const char *name, const char *value)
+{
+    unsigned is_error = 0;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->discover.ports.count)
+            masscan_echo_ports("discover-ports", &masscan->discover.ports, masscan->echo);
+        return 0;
+    }
+    rangelist_parse_ports(&masscan->discover.ports, value, &is_error, 0);
+    if (is_error) {
+        fprintf(stderr, "FAIL: discover-ports=<ports>: bad port list: %s\n", value);
+        return CONF_ERR;
+    }
+    rangelist_sort(&masscan->discover.ports);
+    return CONF_OK;
+}
+
+static int SET_port_tiers(struct Masscan *masscan, const char *name, const char *value)
+{
+    static const unsigned default_bounds[] = {10, 100, 1000};
+    unsigned count = 0;
+    unsigned i;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->tiers.bound_count) {
+            fprintf(masscan->echo, "port-tiers = ");
+            for (i=0; i<masscan->tiers.bound_count; i++)
+                fprintf(masscan->echo, "%s%u", i?",":"", masscan->tiers.bounds[i]);
+            fprintf(masscan->echo, "\n");
+        }
+        return 0;
+    }
+
+    if (value && isBoolean(value) && !parseBoolean(value)) {
+        /* ex: `--port-tiers false` */
+        masscan->tiers.bound_count = 0;
+        return CONF_OK;
+    }
+    if (value == 0 || value[0] == '\0' || isBoolean(value)) {
+        /* ex: `--port-tiers` or `--port-tiers true` */
+        for (i=0; i<sizeof(default_bounds)/sizeof(default_bounds[0]); i++)
+            masscan->tiers.bounds[i] = default_bounds[i];
+        masscan->tiers.bound_count = i;
+        return CONF_OK;
+    }
+
+    /* ex: `--port-tiers 20` or `--port-tiers=20,200` */
+    while (*value) {
+        uint64_t num;
+
+        if (!isdigit(*value & 0xFF))
+            goto fail;
+        num = parseInt(value);
+        if (count + 1 >= MAX_PORT_TIERS)
+            goto fail;
+        if (num == 0 || num > 0x30000 || (count && num <= masscan->tiers.bounds[count-1]))
+            goto fail;
+        masscan->tiers.bounds[count++] = (unsigned)num;
+
+        while (isdigit(*value & 0xFF))
+            value++;
+        if (*value == ',')
+            value++;
+    }
+    masscan->tiers.bound_count = count;
+    return CONF_OK;
+fail:
+    fprintf(stderr, "FAIL: port-tiers=<ranks>: expected up to %u increasing numbers, like 10,100,1000\n",
+            MAX_PORT_TIERS - 1);
+    return CONF_ERR;
+}
+
+static int SET_port_frequency_file(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->tiers.frequency_file)
+            fprintf(masscan->echo, "port-frequency-file = %s\n", masscan->tiers.frequency_file);
+        return 0;
+    }
+    free(masscan->tiers.frequency_file);
+    masscan->tiers.frequency_file = STRDUP(value);
+    return CONF_OK;
+}
+
+static int SET_rotate_time(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->output.rotate.timeout || masscan->echo_all)
+            fprintf(masscan->echo, "rotate = %u\n", masscan->output.rotate.timeout);
+        return 0;
+    }
+    masscan->output.rotate.timeout = (unsigned)parseTime(value);
+    return CONF_OK;
+}
+static int SET_rotate_directory(struct Masscan *masscan, const char *name, const char *value)
+{
+    char *p;
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (memcmp(masscan->output.rotate.directory, ".",2) != 0 || masscan->echo_all) {
+            fprintf(masscan->echo, "rotate-dir = %s\n", masscan->output.rotate.directory);
+        }
+        return 0;
+    }
+    safe_strcpy(   masscan->output.rotate.directory,
+             sizeof(masscan->output.rotate.directory),
+             value);
+    /* strip trailing slashes */
+    p = masscan->output.rotate.directory;
+    while (*p && (p[strlen(p)-1] == '/' || p[strlen(p)-1] == '\\')) /* Fix for #561 */
+        p[strlen(p)-1] = '\0';
     return CONF_OK;
 }
 static int SET_rotate_offset(struct Masscan *masscan, const char *name, const char *value)
@@ -2076,6 +2760,131 @@ static int SET_shard(struct Masscan *masscan, const char *name, const char *valu
     return CONF_OK;
 }
 
+static int SET_coordinator(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->coord.listen || masscan->echo_all)
+            fprintf(masscan->echo, "coordinator = %s\n",
+                    masscan->coord.listen?masscan->coord.listen:"");
+        return 0;
+    }
+    if (value[0] == '\0') {
+        fprintf(stderr, "FAIL: coordinator: expected [<ip>:]<port> or <path>\n");
+        return CONF_ERR;
+    }
+    free(masscan->coord.listen);
+    masscan->coord.listen = STRDUP(value);
+    if (masscan->op == 0 || masscan->op == Operation_Scan)
+        masscan->op = Operation_Coordinator;
+    return CONF_OK;
+}
+
+static int SET_worker(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->coord.connect || masscan->echo_all)
+            fprintf(masscan->echo, "worker = %s\n",
+                    masscan->coord.connect?masscan->coord.connect:"");
+        return 0;
+    }
+    if (value[0] == '\0') {
+        fprintf(stderr, "FAIL: worker: expected <ip>:<port> or <path>\n");
+        return CONF_ERR;
+    }
+    free(masscan->coord.connect);
+    masscan->coord.connect = STRDUP(value);
+    return CONF_OK;
+}
+
+static int SET_chunk_size(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->coord.chunk_size || masscan->echo_all)
+            fprintf(masscan->echo, "chunk-size = %" PRIu64 "\n", masscan->coord.chunk_size);
+        return 0;
+    }
+    if (!isdigit(value[0]&0xFF) || parseInt(value) == 0) {
+        fprintf(stderr, "FAIL: %s: bad chunk-size, expected a number of indexes\n", value);
+        return CONF_ERR;
+    }
+    masscan->coord.chunk_size = parseInt(value);
+    return CONF_OK;
+}
+
+static int SET_worker_timeout(struct Masscan *masscan, const char *name, const char *value)
+{
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        if (masscan->coord.timeout || masscan->echo_all)
+            fprintf(masscan->echo, "worker-timeout = %u\n", masscan->coord.timeout);
+        return 0;
+    }
+    if (!isdigit(value[0]&0xFF)) {
+        fprintf(stderr, "FAIL: %s: bad worker-timeout, expected seconds\n", value);
+        return CONF_ERR;
+    }
+    masscan->coord.timeout = (unsigned)parseTime(value);
+    return CONF_OK;
+}
+
+/***************************************************************************
+ * coordinator-chunk = <first>[-<last>] <next>|done
+ * How far the coordinator got through each chunk, for --resume.
+ ***************************************************************************/
+static int SET_coordinator_chunk(struct Masscan *masscan, const char *name, const char *value)
+{
+    struct CoordSaved saved;
+    char *p = (char *)value;
+
+    UNUSEDPARM(name);
+    if (masscan->echo) {
+        size_t i;
+        for (i=0; i<masscan->coord.saved_count; i++) {
+            const struct CoordSaved *x = &masscan->coord.saved[i];
+            fprintf(masscan->echo, "coordinator-chunk = %" PRIu64, x->first);
+            if (x->last != x->first)
+                fprintf(masscan->echo, "-%" PRIu64, x->last);
+            if (x->next == UINT64_MAX)
+                fprintf(masscan->echo, " done\n");
+            else
+                fprintf(masscan->echo, " %" PRIu64 "\n", x->next);
+        }
+        return 0;
+    }
+
+    if (!isdigit(*p & 0xFF))
+        goto fail;
+    saved.first = strtoull(p, &p, 10);
+    saved.last = saved.first;
+    if (*p == '-') {
+        p++;
+        if (!isdigit(*p & 0xFF))
+            goto fail;
+        saved.last = strtoull(p, &p, 10);
+    }
+    while (isspace(*p & 0xFF))
+        p++;
+    if (strcmp(p, "done") == 0)
+        saved.next = UINT64_MAX;
+    else if (isdigit(*p & 0xFF))
+        saved.next = strtoull(p, &p, 10);
+    else
+        goto fail;
+    if (saved.last < saved.first)
+        goto fail;
+
+    masscan->coord.saved = REALLOC(masscan->coord.saved,
+            (masscan->coord.saved_count + 1) * sizeof(masscan->coord.saved[0]));
+    masscan->coord.saved[masscan->coord.saved_count++] = saved;
+    return CONF_OK;
+fail:
+    fprintf(stderr, "FAIL: %s: bad coordinator-chunk, expected <first>[-<last>] <next>|done\n", value);
+    return CONF_ERR;
+}
+
 static int SET_output_stylesheet(struct Masscan *masscan, const char *name, const char *value)
 {
     UNUSEDPARM(name);
@@ -2306,111 +3115,562 @@ static int SET_tcp_sackok(struct Masscan *masscan, const char *name, const char
                     break;
             }
         }
-        return 0;
+        return 0;
+    }
+
+    if (masscan->templ_opts == NULL)
+        masscan->templ_opts = calloc(1, sizeof(*masscan->templ_opts));
+
+    if (value == 0 || value[0] == '\0') {
+        masscan->templ_opts->tcp.is_sackok = Add;
+    } else if (isBoolean(value)) {
+        if (parseBoolean(value)) {
+            masscan->templ_opts->tcp.is_sackok = Add;
+        } else
+            masscan->templ_opts->tcp.is_sackok = Remove;
+    } else if (isInteger(value)) {
+        if (parseInt(value) != 0)
+            masscan->templ_opts->tcp.is_sackok = Add;
+    } else
+        goto fail;
+
+    return CONF_OK;
+fail:
+    fprintf(stderr, "[-] %s: bad value: %s\n", name, value);
+    return CONF_ERR;
+}
+
+
+static int SET_debug_tcp(struct Masscan *masscan, const char *name, const char *value) {
+    extern int is_tcp_debug; /* global */
+    UNUSEDPARM(name);
+    UNUSEDPARM(masscan);
+
+    if (value == 0 || value[0] == '\0')
+        is_tcp_debug = 1;
+    else
+        is_tcp_debug = parseBoolean(value);
+    return CONF_OK;
+}
+
+
+
+struct ConfigParameter {
+    const char *name;
+    SET_PARAMETER set;
+    unsigned flags;
+    const char *alts[6];
+};
+enum {F_NONE, F_BOOL=1, F_NUMABLE=2};
+struct ConfigParameter config_parameters[] = {
+    {"resume-index",    SET_resume_index,       0,      {0}},
+    {"resume-count",    SET_resume_count,       0,      {0}},
+    {"resume-thread",   SET_resume_thread,      0,      {0}},
+    {"checkpoint",      SET_checkpoint,         0,      {0}},
+    {"checkpoint-file", SET_checkpoint_file,    0,      {0}},
+    {"seed",            SET_seed,               0,      {0}},
+    {"arpscan",         SET_arpscan,            F_BOOL, {"arp",0}},
+    {"randomize-hosts", SET_randomize_hosts,    F_BOOL, {0}},
+    {"rate",            SET_rate,               0,      {"max-rate",0}},
+    {"shard",           SET_shard,              0,      {"shards",0}},
+    {"coordinator",     SET_coordinator,        0,      {0}},
+    {"worker",          SET_worker,             0,      {0}},
+    {"chunk-size",      SET_chunk_size,         0,      {0}},
+    {"worker-timeout",  SET_worker_timeout,     0,      {0}},
+    {"coordinator-chunk", SET_coordinator_chunk, 0,     {0}},
+    {"banners",         SET_banners,            F_BOOL, {"banner",0}}, /* --banners */
+    {"rawudp",          SET_banners_rawudp,     F_BOOL, {"rawudp",0}}, /* --rawudp */
+    {"stateless-banners", SET_stateless_banners, F_BOOL, {"stateless-banner",0}},
+    {"readscan-stats",  SET_readscan_stats,     F_BOOL, {"readscan-report",0}},
+    {"readscan-top",    SET_readscan_top,       0,      {0}},
+    {"readscan-threads", SET_readscan_threads,  0,      {0}},
+    {"nobanners",       SET_nobanners,          F_BOOL, {"nobanner",0}},
+    {"retries",         SET_retries,            0,      {"retry", "max-retries", "max-retry", 0}},
+    {"rx-threads",      SET_rx_threads,         0,      {"rx-thread", "receive-threads", 0}},
+    {"pin-threads",     SET_pin_threads,        F_BOOL, {"pin-thread", 0}},
+    {"busy-poll",       SET_busy_poll,          F_BOOL, {"busypoll", 0}},
+    {"neighbor-thread", SET_neighbor_thread,    F_BOOL, {"arp-thread", 0}},
+    {"discover-ports",  SET_discover_ports,     0,      {"discovery-ports", 0}},
+    {"port-tiers",      SET_port_tiers,         F_NUMABLE, {"port-tier", 0}},
+    {"port-frequency-file", SET_port_frequency_file, 0,  {"port-frequencies", 0}},
+    {"noreset",         SET_noreset,            F_BOOL, {0}},
+    {"nmap-payloads",   SET_nmap_payloads,      0,      {"nmap-payload",0}},
+    {"nmap-service-probes",SET_nmap_service_probes, 0,  {"nmap-service-probe",0}},
+    {"offline",         SET_offline,            F_BOOL, {"notransmit", "nosend", "dry-run", 0}},
+    {"pcap-filename",   SET_pcap_filename,      0,      {"pcap",0}},
+    {"pcap-snaplen",    SET_pcap_snaplen,       0,      {0}},
+    {"pcap-rotate",     SET_pcap_rotate,        0,      {0}},
+    {"pcap-payloads",   SET_pcap_payloads,      0,      {"pcap-payload",0}},
+    {"hello",           SET_hello,              0,      {0}},
+    {"hello-file",      SET_hello_file,         0,      {"hello-filename",0}},
+    {"hello-string",    SET_hello_string,       0,      {0}},
+    {"hello-timeout",   SET_hello_timeout,      0,      {0}},
+    {"hello-learn",     SET_hello_learn,        0,      {0}},
+    {"banner-limit",    SET_banner_limit,       0,      {0}},
+    {"hugepages",       SET_hugepages,          F_BOOL, {"hugepage", "huge-pages", 0}},
+    {"dedup-size",      SET_dedup_size,         F_NUMABLE, {"dedup-entries",0}},
+    {"dedup-window",    SET_dedup_window,       0,      {0}},
+    {"http-cookie",     SET_http_cookie,        0,      {0}},
+    {"http-header",     SET_http_header,        0,      {"http-field", 0}},
+    {"http-method",     SET_http_method,        0,      {0}},
+    {"http-version",    SET_http_version,       0,      {0}},
+    {"http-url",        SET_http_url,           0,      {"http-uri",0}},
+    {"http-user-agent", SET_http_user_agent,    0,      {"http-useragent",0}},
+    {"http-host",       SET_http_host,          0,      {0}},
+    {"http-payload",    SET_http_payload,       0,      {0}},
+    {"ndjson-status",   SET_status_ndjson,      F_BOOL, {"status-ndjson", 0}},
+    {"json-status",     SET_status_json,        F_BOOL, {"status-json", 0}},
+    {"min-packet",      SET_min_packet,         0,      {"min-pkt",0}},
+    {"capture",         SET_capture,            0,      {0}},
+    {"nocapture",       SET_capture,            0,      {"no-capture", 0}},
+    {"SPACE",           SET_space,              0,      {0}},
+    {"output-filename", SET_output_filename,    0,      {"output-file",0}},
+    {"output-format",   SET_output_format,      0,      {0}},
+    {"output-show",     SET_output_show,        0,      {"output-status", "show",0}},
+    {"output-noshow",   SET_output_noshow,      0,      {"noshow",0}},
+    {"output-show-open",SET_output_show_open,   F_BOOL, {"open", "open-only", 0}},
+    {"output-append",   SET_output_append,      0,      {"append-output",0}},
+    {"output-compress", SET_output_compress,    0,      {"compress",0}},
+    {"output-compress-level", SET_output_compress_level, F_NUMABLE, {"compress-level",0}},
+    {"arrow-batch",     SET_arrow_batch,        F_NUMABLE, {"arrow-batch-size",0}},
+    {"output-sink",     SET_output_sink,        0,      {"output-also",0}},
+    {"rotate",          SET_rotate_time,        0,      {"output-rotate", "rotate-output", "rotate-time", 0}},
+    {"rotate-dir",      SET_rotate_directory,   0,      {"output-rotate-dir", "rotate-directory", 0}},
+    {"rotate-offset",   SET_rotate_offset,      0,      {"output-rotate-offset", 0}},
+    {"rotate-size",     SET_rotate_filesize,    0,      {"output-rotate-filesize", "rotate-filesize", 0}},
+    {"stylesheet",      SET_output_stylesheet,  0,      {0}},
+    {"script",          SET_script,             0,      {0}},
+    {"SPACE",           SET_space,              0,      {0}},
+    {"tcp-mss",         SET_tcp_mss,            F_NUMABLE, {"tcpmss",0}},
+    {"tcp-wscale",      SET_tcp_wscale,         F_NUMABLE, {0}},
+    {"tcp-tsecho",      SET_tcp_tsecho,         F_NUMABLE, {0}},
+    {"tcp-sackok",      SET_tcp_sackok,         F_BOOL, {0}},
+    {"top-ports",       SET_topports,           F_NUMABLE, {"top-port",0}},
+
+    {"debug-tcp",       SET_debug_tcp,          F_BOOL, {"tcp-debug", 0}},
+    {0}
+};
+
+/***************************************************************************
+ * Handles "profile = <name>", which starts (or returns to) a scan profile,
+ * and the parameters that apply to the current profile rather than the
+ * whole scan once one has been started.
+ * @return 1 if handled here, 0 otherwise
+ ***************************************************************************/
+static int
+profile_set_parameter(struct Masscan *masscan,
+                      const char *name, const char *value)
+{
+    struct ScanProfile *profile;
+
+    if (EQUALS("profile", name)) {
+        unsigned i;
+
+        for (i=0; i<masscan->profile_count; i++) {
+            if (strcmp(masscan->profile[i].name, value) == 0)
+                break;
+        }
+        if (i == masscan->profile_count) {
+            if (masscan->profile_count >= MAX_PROFILES) {
+                fprintf(stderr, "FAIL: profile: max %u profiles\n", MAX_PROFILES);
+                exit(1);
+            }
+            profile = &masscan->profile[masscan->profile_count++];
+            safe_strcpy(profile->name, sizeof(profile->name), value);
+            profile->weight = 1;
+        }
+        masscan->profile_current = i;
+        if (masscan->op == 0)
+            masscan->op = Operation_Scan;
+        return 1;
+    }
+
+    if (masscan->profile_count == 0)
+        return 0;
+    profile = &masscan->profile[masscan->profile_current];
+
+    if (EQUALS("range", name) || EQUALS("ranges", name)
+               || EQUALS("ip", name) || EQUALS("ipv4", name)
+               || EQUALS("dst-ip", name) || EQUALS("dest-ip", name)
+               || EQUALS("destination-ip", name)
+               || EQUALS("target-ip", name)) {
+        if (massip_add_target_string(&profile->targets, value))
+            fprintf(stderr, "ERROR: bad IP address/range: %s\n", value);
+    } else if (EQUALS("ports", name) || EQUALS("port", name)
+             || EQUALS("dst-port", name) || EQUALS("dest-port", name)
+             || EQUALS("destination-port", name)
+             || EQUALS("target-port", name)) {
+        unsigned defaultrange = 0;
+
+        if (masscan->scan_type.udp)
+            defaultrange = Templ_UDP;
+        else if (masscan->scan_type.sctp)
+            defaultrange = Templ_SCTP;
+        if (massip_add_port_string(&profile->targets, value, defaultrange)) {
+            fprintf(stderr, "[-] FAIL: bad target port: %s\n", value);
+            exit(1);
+        }
+    } else if (EQUALS("seed", name)) {
+        if (EQUALS("time", value))
+            profile->seed = time(0);
+        else
+            profile->seed = parseInt(value);
+        profile->is_seed = 1;
+    } else if (EQUALS("retries", name) || EQUALS("retry", name)
+               || EQUALS("max-retries", name) || EQUALS("max-retry", name)) {
+        uint64_t x = strtoul(value, 0, 0);
+        if (x >= 1000) {
+            fprintf(stderr, "FAIL: retries=<n>: expected number less than 1000\n");
+            exit(1);
+        }
+        profile->retries = (unsigned)x;
+        profile->is_retries = 1;
+    } else if (EQUALS("weight", name)) {
+        uint64_t x = strtoul(value, 0, 0);
+        if (x < 1 || x > 1000) {
+            fprintf(stderr, "FAIL: weight=<n>: expected number from 1 to 1000\n");
+            exit(1);
+        }
+        profile->weight = (unsigned)x;
+    } else if (EQUALS("output-filename", name) || EQUALS("output-file", name)) {
+        if (masscan->output.format == 0)
+            masscan->output.format = Output_XML;
+        safe_strcpy(profile->output_filename,
+                    sizeof(profile->output_filename), value);
+    } else if (EQUALS("resume-index", name)) {
+        profile->resume_index = parseInt(value);
+    } else
+        return 0;
+    return 1;
+}
+
+/***************************************************************************
+ * Once the configuration is read, apply the excludes to each profile,
+ * and make the global target list the union of all the profiles, so
+ * that everything else (UDP payloads, counts, ARP scan checks) sees
+ * every target.
+ ***************************************************************************/
+void
+masscan_profiles_finalize(struct Masscan *masscan)
+{
+    unsigned i;
+
+    if (masscan->profile_count == 0)
+        return;
+
+    rangelist_remove_all(&masscan->targets.ipv4);
+    range6list_remove_all(&masscan->targets.ipv6);
+    rangelist_remove_all(&masscan->targets.ports);
+
+    for (i=0; i<masscan->profile_count; i++) {
+        struct ScanProfile *profile = &masscan->profile[i];
+
+        if (!profile->is_seed)
+            profile->seed = masscan->seed;
+        if (!profile->is_retries)
+            profile->retries = masscan->retries;
+
+        massip_apply_excludes(&profile->targets, &masscan->exclude);
+        massip_optimize(&profile->targets);
+
+        rangelist_merge(&masscan->targets.ipv4, &profile->targets.ipv4);
+        range6list_merge(&masscan->targets.ipv6, &profile->targets.ipv6);
+        rangelist_merge(&masscan->targets.ports, &profile->targets.ports);
+
+        if (profile_range(profile) == 0)
+            LOG(0, "[-] profile %s: no targets\n", profile->name);
+    }
+}
+
+/***************************************************************************
+ * With --discover-ports, the first phase of the scan covers the same
+ * addresses as the second, but only on the discovery ports. Must be
+ * called after the targets have been optimized, as the address lists
+ * (and their lookup tables) are shared rather than copied.
+ ***************************************************************************/
+void
+masscan_discover_finalize(struct Masscan *masscan)
+{
+    struct MassIP *targets = &masscan->discover.targets;
+
+    if (masscan->discover.ports.count == 0)
+        return;
+    if (masscan->profile_count) {
+        LOG(0, "FAIL: --discover-ports can't be combined with --profile\n");
+        exit(1);
+    }
+
+    targets->ipv4 = masscan->targets.ipv4;
+    targets->ipv6 = masscan->targets.ipv6;
+    targets->ports = masscan->discover.ports;
+    rangelist_optimize(&targets->ports);
+    masscan->discover.ports = targets->ports;
+
+    targets->count_ports = rangelist_count(&targets->ports);
+    targets->count_ipv4s = masscan->targets.count_ipv4s;
+    targets->count_ipv6s = masscan->targets.count_ipv6s;
+    targets->ipv4_index_threshold = targets->count_ipv4s * targets->count_ports;
+}
+
+/***************************************************************************
+ * A port's popularity, for --port-tiers. Lower ranks are scanned first.
+ ***************************************************************************/
+struct PortRank {
+    unsigned port;
+    unsigned rank;
+    double frequency;
+};
+
+static int
+portrank_compare(const void *lhs, const void *rhs)
+{
+    const struct PortRank *a = (const struct PortRank *)lhs;
+    const struct PortRank *b = (const struct PortRank *)rhs;
+
+    /* Most frequent first, then in the order they were read */
+    if (a->frequency != b->frequency)
+        return (a->frequency > b->frequency) ? -1 : 1;
+    if (a->rank != b->rank)
+        return (a->rank < b->rank) ? -1 : 1;
+    return 0;
+}
+
+/***************************************************************************
+ * Parses a line of a --port-frequency-file. This is the format of nmap's
+ * "nmap-services" file, like the following, but the name is optional,
+ * as are the protocol (default TCP) and the frequency (default 0):
+ *      http    80/tcp  0.484143        # World Wide Web HTTP
+ * @return 1 if the line had a port, 0 if it was blank or a comment
+ ***************************************************************************/
+static int
+tiers_parse_line(const char *line, unsigned *port, double *frequency)
+{
+    size_t i = 0;
+
+    while (line[i] && line[i] != '#') {
+        size_t token;
+        unsigned long num;
+        const char *proto;
+
+        /* Skip to the next token, like the service name */
+        while (isspace(line[i] & 0xFF))
+            i++;
+        token = i;
+        while (line[i] && line[i] != '#' && !isspace(line[i] & 0xFF))
+            i++;
+        if (!isdigit(line[token] & 0xFF))
+            continue;
+
+        num = strtoul(line + token, (char **)&proto, 10);
+        if (num > 65535)
+            continue;
+        if (proto == line + i)
+            *port = (unsigned)num;
+        else if (strncmp(proto, "/tcp", 4) == 0 && proto + 4 == line + i)
+            *port = (unsigned)num;
+        else if (strncmp(proto, "/udp", 4) == 0 && proto + 4 == line + i)
+            *port = Templ_UDP + (unsigned)num;
+        else if (strncmp(proto, "/sctp", 5) == 0 && proto + 5 == line + i)
+            *port = Templ_SCTP + (unsigned)num;
+        else
+            continue;
+
+        /* The frequency, if any, follows the port */
+        *frequency = 0.0;
+        while (line[i] == ' ' || line[i] == '\t')
+            i++;
+        if (line[i] && line[i] != '#') {
+            char *end;
+            double x = strtod(line + i, &end);
+            if (end != line + i && (*end == '\0' || isspace(*end & 0xFF)))
+                *frequency = x;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Ranks ports by a --port-frequency-file, most frequent first.
+ ***************************************************************************/
+static struct PortRank *
+tiers_read_frequency_file(const char *filename, unsigned *count)
+{
+    struct PortRank *ranking = NULL;
+    unsigned max = 0;
+    char line[512];
+    FILE *fp;
+    unsigned i;
+
+    *count = 0;
+    fp = fopen(filename, "rt");
+    if (fp == NULL) {
+        fprintf(stderr, "[-] FAIL: --port-frequency-file\n");
+        fprintf(stderr, "[-] %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        struct PortRank x;
+
+        if (!tiers_parse_line(line, &x.port, &x.frequency))
+            continue;
+        if (*count >= max) {
+            max = max ? max * 2 : 1024;
+            ranking = REALLOCARRAY(ranking, max, sizeof(ranking[0]));
+        }
+        x.rank = *count;
+        ranking[(*count)++] = x;
+    }
+    fclose(fp);
+
+    if (*count)
+        qsort(ranking, *count, sizeof(ranking[0]), portrank_compare);
+    for (i=0; i<*count; i++)
+        ranking[i].rank = i;
+
+    LOG(1, "[+] %s: %u ranked ports\n", filename, *count);
+    return ranking;
+}
+
+/***************************************************************************
+ * Ranks ports by their order in the --top-ports lists. TCP and UDP are
+ * ranked separately, so the 10th most popular UDP port is in the same
+ * tier as the 10th most popular TCP port.
+ ***************************************************************************/
+static struct PortRank *
+tiers_default_ranking(unsigned *count)
+{
+    struct PortRank *ranking;
+    unsigned i;
+
+    ranking = REALLOCARRAY(NULL, max_tcp_ports + max_udp_ports, sizeof(ranking[0]));
+    *count = 0;
+    for (i=0; i<max_tcp_ports; i++) {
+        ranking[*count].port = top_tcp_ports[i];
+        ranking[*count].rank = i;
+        ranking[*count].frequency = 0.0;
+        (*count)++;
+    }
+    for (i=0; i<max_udp_ports; i++) {
+        ranking[*count].port = Templ_UDP + top_udp_ports[i];
+        ranking[*count].rank = i;
+        ranking[*count].frequency = 0.0;
+        (*count)++;
+    }
+    return ranking;
+}
+
+/***************************************************************************
+ * Splits 'ports' into tiers: ports ranked below bounds[0] go in the
+ * first, below bounds[1] in the second, and so on, with everything else
+ * (including ports that aren't ranked at all) in the last. Empty tiers
+ * are skipped.
+ * @return the number of tiers
+ ***************************************************************************/
+static unsigned
+tiers_split(const struct RangeList *ports,
+            const struct PortRank *ranking, unsigned ranking_count,
+            const unsigned *bounds, unsigned bound_count,
+            struct RangeList *tiers)
+{
+    struct RangeList rest = {0};
+    unsigned count = 0;
+    unsigned t;
+    unsigned i;
+
+    for (t=0; t<bound_count; t++) {
+        struct RangeList *tier = &tiers[count];
+
+        memset(tier, 0, sizeof(*tier));
+        for (i=0; i<ranking_count; i++) {
+            unsigned port = ranking[i].port;
+            unsigned j;
+
+            if (ranking[i].rank >= bounds[t])
+                continue;
+            if (t && ranking[i].rank < bounds[t-1])
+                continue;
+            if (!rangelist_is_contains(ports, port))
+                continue;
+
+            /* A port listed twice stays in the higher tier */
+            for (j=0; j<count; j++) {
+                if (rangelist_is_contains(&tiers[j], port))
+                    break;
+            }
+            if (j < count || rangelist_is_contains(tier, port))
+                continue;
+
+            rangelist_add_range(tier, port, port);
+        }
+        if (tier->count) {
+            rangelist_sort(tier);
+            count++;
+        }
     }
 
-    if (masscan->templ_opts == NULL)
-        masscan->templ_opts = calloc(1, sizeof(*masscan->templ_opts));
-
-    if (value == 0 || value[0] == '\0') {
-        masscan->templ_opts->tcp.is_sackok = Add;
-    } else if (isBoolean(value)) {
-        if (parseBoolean(value)) {
-            masscan->templ_opts->tcp.is_sackok = Add;
-        } else
-            masscan->templ_opts->tcp.is_sackok = Remove;
-    } else if (isInteger(value)) {
-        if (parseInt(value) != 0)
-            masscan->templ_opts->tcp.is_sackok = Add;
-    } else
-        goto fail;
-
-    return CONF_OK;
-fail:
-    fprintf(stderr, "[-] %s: bad value: %s\n", name, value);
-    return CONF_ERR;
+    rangelist_merge(&rest, ports);
+    for (t=0; t<count; t++)
+        rangelist_exclude(&rest, &tiers[t]);
+    if (rest.count)
+        tiers[count++] = rest;
+    return count;
 }
 
+/***************************************************************************
+ * With --port-tiers, each tier covers the same addresses as the main
+ * targets, but only its own ports. Must be called after the targets have
+ * been optimized, as the address lists are shared rather than copied.
+ ***************************************************************************/
+void
+masscan_tiers_finalize(struct Masscan *masscan)
+{
+    struct RangeList ports[MAX_PORT_TIERS];
+    struct PortRank *ranking;
+    unsigned ranking_count;
+    unsigned k;
 
-static int SET_debug_tcp(struct Masscan *masscan, const char *name, const char *value) {
-    extern int is_tcp_debug; /* global */
-    UNUSEDPARM(name);
-    UNUSEDPARM(masscan);
+    if (masscan->tiers.bound_count == 0)
+        return;
+    if (masscan->profile_count) {
+        LOG(0, "FAIL: --port-tiers can't be combined with --profile\n");
+        exit(1);
+    }
+    if (masscan->discover.ports.count) {
+        LOG(0, "FAIL: --port-tiers can't be combined with --discover-ports\n");
+        exit(1);
+    }
 
-    if (value == 0 || value[0] == '\0')
-        is_tcp_debug = 1;
+    if (masscan->tiers.frequency_file)
+        ranking = tiers_read_frequency_file(masscan->tiers.frequency_file, &ranking_count);
     else
-        is_tcp_debug = parseBoolean(value);
-    return CONF_OK;
-}
+        ranking = tiers_default_ranking(&ranking_count);
 
+    masscan->tiers.count = tiers_split(&masscan->targets.ports,
+                                       ranking, ranking_count,
+                                       masscan->tiers.bounds,
+                                       masscan->tiers.bound_count,
+                                       ports);
+    free(ranking);
 
+    for (k=0; k<masscan->tiers.count; k++) {
+        struct MassIP *targets = &masscan->tiers.targets[k];
 
-struct ConfigParameter {
-    const char *name;
-    SET_PARAMETER set;
-    unsigned flags;
-    const char *alts[6];
-};
-enum {F_NONE, F_BOOL=1, F_NUMABLE=2};
-struct ConfigParameter config_parameters[] = {
-    {"resume-index",    SET_resume_index,       0,      {0}},
-    {"resume-count",    SET_resume_count,       0,      {0}},
-    {"seed",            SET_seed,               0,      {0}},
-    {"arpscan",         SET_arpscan,            F_BOOL, {"arp",0}},
-    {"randomize-hosts", SET_randomize_hosts,    F_BOOL, {0}},
-    {"rate",            SET_rate,               0,      {"max-rate",0}},
-    {"shard",           SET_shard,              0,      {"shards",0}},
-    {"banners",         SET_banners,            F_BOOL, {"banner",0}}, /* --banners */
-    {"rawudp",          SET_banners_rawudp,     F_BOOL, {"rawudp",0}}, /* --rawudp */
-    {"nobanners",       SET_nobanners,          F_BOOL, {"nobanner",0}},
-    {"retries",         SET_retries,            0,      {"retry", "max-retries", "max-retry", 0}},
-    {"noreset",         SET_noreset,            F_BOOL, {0}},
-    {"nmap-payloads",   SET_nmap_payloads,      0,      {"nmap-payload",0}},
-    {"nmap-service-probes",SET_nmap_service_probes, 0,  {"nmap-service-probe",0}},
-    {"offline",         SET_offline,            F_BOOL, {"notransmit", "nosend", "dry-run", 0}},
-    {"pcap-filename",   SET_pcap_filename,      0,      {"pcap",0}},
-    {"pcap-payloads",   SET_pcap_payloads,      0,      {"pcap-payload",0}},
-    {"hello",           SET_hello,              0,      {0}},
-    {"hello-file",      SET_hello_file,         0,      {"hello-filename",0}},
-    {"hello-string",    SET_hello_string,       0,      {0}},
-    {"hello-timeout",   SET_hello_timeout,      0,      {0}},
-    {"http-cookie",     SET_http_cookie,        0,      {0}},
-    {"http-header",     SET_http_header,        0,      {"http-field", 0}},
-    {"http-method",     SET_http_method,        0,      {0}},
-    {"http-version",    SET_http_version,       0,      {0}},
-    {"http-url",        SET_http_url,           0,      {"http-uri",0}},
-    {"http-user-agent", SET_http_user_agent,    0,      {"http-useragent",0}},
-    {"http-host",       SET_http_host,          0,      {0}},
-    {"http-payload",    SET_http_payload,       0,      {0}},
-    {"ndjson-status",   SET_status_ndjson,      F_BOOL, {"status-ndjson", 0}},
-    {"json-status",     SET_status_json,        F_BOOL, {"status-json", 0}},
-    {"min-packet",      SET_min_packet,         0,      {"min-pkt",0}},
-    {"capture",         SET_capture,            0,      {0}},
-    {"nocapture",       SET_capture,            0,      {"no-capture", 0}},
-    {"SPACE",           SET_space,              0,      {0}},
-    {"output-filename", SET_output_filename,    0,      {"output-file",0}},
-    {"output-format",   SET_output_format,      0,      {0}},
-    {"output-show",     SET_output_show,        0,      {"output-status", "show",0}},
-    {"output-noshow",   SET_output_noshow,      0,      {"noshow",0}},
-    {"output-show-open",SET_output_show_open,   F_BOOL, {"open", "open-only", 0}},
-    {"output-append",   SET_output_append,      0,      {"append-output",0}},
-    {"rotate",          SET_rotate_time,        0,      {"output-rotate", "rotate-output", "rotate-time", 0}},
-    {"rotate-dir",      SET_rotate_directory,   0,      {"output-rotate-dir", "rotate-directory", 0}},
-    {"rotate-offset",   SET_rotate_offset,      0,      {"output-rotate-offset", 0}},
-    {"rotate-size",     SET_rotate_filesize,    0,      {"output-rotate-filesize", "rotate-filesize", 0}},
-    {"stylesheet",      SET_output_stylesheet,  0,      {0}},
-    {"script",          SET_script,             0,      {0}},
-    {"SPACE",           SET_space,              0,      {0}},
-    {"tcp-mss",         SET_tcp_mss,            F_NUMABLE, {"tcpmss",0}},
-    {"tcp-wscale",      SET_tcp_wscale,         F_NUMABLE, {0}},
-    {"tcp-tsecho",      SET_tcp_tsecho,         F_NUMABLE, {0}},
-    {"tcp-sackok",      SET_tcp_sackok,         F_BOOL, {0}},
-    {"top-ports",       SET_topports,           F_NUMABLE, {"top-port",0}},
+        targets->ipv4 = masscan->targets.ipv4;
+        targets->ipv6 = masscan->targets.ipv6;
+        targets->ports = ports[k];
+        rangelist_optimize(&targets->ports);
 
-    {"debug-tcp",       SET_debug_tcp,          F_BOOL, {"tcp-debug", 0}},
-    {0}
-};
+        targets->count_ports = rangelist_count(&targets->ports);
+        targets->count_ipv4s = masscan->targets.count_ipv4s;
+        targets->count_ipv6s = masscan->targets.count_ipv6s;
+        targets->ipv4_index_threshold = targets->count_ipv4s * targets->count_ports;
+
+        LOG(1, "[+] port tier %u: %llu ports\n", k + 1,
+            (unsigned long long)targets->count_ports);
+    }
+}
 
 /***************************************************************************
  * Called either from the "command-line" parser when it sees a --param,
@@ -2425,6 +3685,13 @@ masscan_set_parameter(struct Masscan *masscan,
         fprintf(stderr, "%s: bad index\n", name);
         exit(1);
     }
+
+    /*
+     * PROFILES:
+     * After "profile = <name>", targets and such belong to that profile
+     */
+    if (profile_set_parameter(masscan, name, value))
+        return;
     
     /*
      * NEW:
@@ -3008,6 +4275,17 @@ masscan_set_parameter(struct Masscan *masscan,
     } else if (EQUALS("version-trace", name)) {
         fprintf(stderr, "nmap(%s): unsupported\n", name);
         exit(1);
+    } else if (EQUALS("adapter-xdp", name) || EQUALS("xdp", name)) {
+        int mode = xdpsock_parse_mode(value);
+        if (mode < 0) {
+            fprintf(stderr, "CONF: %s: expected 'auto', 'generic', or 'native'\n", name);
+            exit(1);
+        }
+        masscan->nic[index].xdp_mode = (unsigned)mode;
+    } else if (EQUALS("adapter-xdp-queue", name) || EQUALS("xdp-queue", name)) {
+        masscan->nic[index].xdp_queue = (unsigned)parseInt(value);
+    } else if (EQUALS("adapter-offload", name) || EQUALS("checksum-offload", name)) {
+        masscan->nic[index].is_checksum_offload = parseBoolean(value);
     } else if (EQUALS("vlan", name) || EQUALS("adapter-vlan", name)) {
         masscan->nic[index].is_vlan = 1;
         masscan->nic[index].vlan_id = (unsigned)parseInt(value);
@@ -3062,7 +4340,8 @@ is_singleton(const char *name)
         "log-errors", "append-output", "webxml",
         "no-stylesheet", "heartbleed", "ticketbleed",
         "send-eth", "send-ip", "iflist",
-        "nmap", "trace-packet", "pfring", "sendq",
+        "nmap", "trace-packet", "pfring", "sendq", "xdp", "adapter-xdp",
+        "adapter-offload", "checksum-offload",
         "ping", "ping-sweep", "nobacktrace", "backtrace",
         "infinite", "nointeractive", "interactive", "status", "nostatus",
         "read-range", "read-ranges", "readrange", "read-ranges",
@@ -3197,6 +4476,7 @@ void
 masscan_command_line(struct Masscan *masscan, int argc, char *argv[])
 {
     int i;
+    unsigned is_output_seen = 0;
 
     for (i=1; i<argc; i++) {
 
@@ -3385,6 +4665,9 @@ masscan_command_line(struct Masscan *masscan, int argc, char *argv[])
                 /* Do nothing: this code never does DNS lookups anyway */
                 break;
             case 'o': /* nmap output format */
+            {
+                enum OutputFormat previous = masscan->output.format;
+
                 switch (argv[i][2]) {
                 case 'A':
                     masscan->output.format = Output_All;
@@ -3441,8 +4724,19 @@ masscan_command_line(struct Masscan *masscan, int argc, char *argv[])
                     exit(1);
                 }
 
-                masscan_set_parameter(masscan, "output-filename", argv[i]);
+                if (is_output_seen) {
+                    /* Another -oX, -oB, etc. writes another file at the
+                     * same time, rather than replacing the first */
+                    char sink[512];
+                    snprintf(sink, sizeof(sink), "%s:%s",
+                             output_format_name(masscan->output.format), argv[i]);
+                    masscan->output.format = previous;
+                    masscan_set_parameter(masscan, "output-sink", sink);
+                } else
+                    masscan_set_parameter(masscan, "output-filename", argv[i]);
+                is_output_seen = 1;
                 break;
+            }
             case 'O':
                 fprintf(stderr, "nmap(%s): unsupported, OS detection is too complex\n", argv[i]);
                 exit(1);
@@ -3614,61 +4908,20 @@ masscan_command_line(struct Masscan *masscan, int argc, char *argv[])
 }
 
 /***************************************************************************
- * Prints the current configuration to the command-line then exits.
- * Use#1: create a template file of all settable parameters.
- * Use#2: make sure your configuration was interpreted correctly.
+ * Prints a port list, like "ports = 80,U:53", using the same prefixes
+ * as the parser for UDP, SCTP, ICMP, and other protocols.
  ***************************************************************************/
-void
-masscan_echo(struct Masscan *masscan, FILE *fp, unsigned is_echo_all)
+static void
+masscan_echo_ports(const char *name, const struct RangeList *ports, FILE *fp)
 {
     unsigned i;
-    unsigned l = 0;
-    
-    /*
-     * NEW:
-     * Print all configuration parameters
-     */
-    masscan->echo = fp;
-    masscan->echo_all = is_echo_all;
-    for (i=0; config_parameters[i].name; i++) {
-        config_parameters[i].set(masscan, 0, 0);
-    }
-    masscan->echo = 0;
-    masscan->echo_all = 0;
-    
-    /*
-     * OLD:
-     * Things here below are the old way of echoing parameters.
-     * TODO: cleanup this code, replacing with the new way.
-     */
-    if (masscan->nic_count == 0)
-        masscan_echo_nic(masscan, fp, 0);
-    else {
-        for (i=0; i<masscan->nic_count; i++)
-            masscan_echo_nic(masscan, fp, i);
-    }
-
-    /**
-     * Fix for #737, save adapter-port/source-port value or range
-     */
-    if (masscan->nic[0].src.port.first != 0) {
-        fprintf(fp, "adapter-port = %d", masscan->nic[0].src.port.first);
-        if (masscan->nic[0].src.port.first != masscan->nic[0].src.port.last) {
-            /* --adapter-port <first>-<last> */
-            fprintf(fp, "-%d", masscan->nic[0].src.port.last);
-        }
-        fprintf(fp, "\n");
-    }
+    unsigned l;
 
-    /*
-     * Targets
-     */
-    fprintf(fp, "# TARGET SELECTION (IP, PORTS, EXCLUDES)\n");
-    fprintf(fp, "ports = ");
+    fprintf(fp, "%s = ", name);
     /* Disable comma generation for the first element */
     l = 0;
-    for (i=0; i<masscan->targets.ports.count; i++) {
-        struct Range range = masscan->targets.ports.list[i];
+    for (i=0; i<ports->count; i++) {
+        struct Range range = ports->list[i];
         do {
             struct Range rrange = range;
             unsigned done = 0;
@@ -3707,13 +4960,24 @@ masscan_echo(struct Masscan *masscan, FILE *fp, unsigned is_echo_all)
         } while (range.begin <= range.end);
     }
     fprintf(fp, "\n");
+}
+
+/***************************************************************************
+ * Prints the "ports = " and "range = " lines for a target list.
+ ***************************************************************************/
+static void
+masscan_echo_targets(const struct MassIP *targets, FILE *fp)
+{
+    unsigned i;
+
+    masscan_echo_ports("ports", &targets->ports, fp);
 
     /*
      * IPv4 address targets
      */
-    for (i=0; i<masscan->targets.ipv4.count; i++) {
+    for (i=0; i<targets->ipv4.count; i++) {
         unsigned prefix_bits;
-        struct Range range = masscan->targets.ipv4.list[i];
+        struct Range range = targets->ipv4.list[i];
 
         if (range.begin == range.end) {
             fprintf(fp, "range = %u.%u.%u.%u",
@@ -3745,9 +5009,9 @@ masscan_echo(struct Masscan *masscan, FILE *fp, unsigned is_echo_all)
         }
         fprintf(fp, "\n");
     }
-    for (i=0; i<masscan->targets.ipv6.count; i++) {
+    for (i=0; i<targets->ipv6.count; i++) {
         bool exact = false;
-        struct Range6 range = masscan->targets.ipv6.list[i];
+        struct Range6 range = range6list_at(&targets->ipv6, i);
         ipaddress_formatted_t fmt = ipv6address_fmt(range.begin);
         
         fprintf(fp, "range = %s", fmt.string);
@@ -3765,6 +5029,82 @@ masscan_echo(struct Masscan *masscan, FILE *fp, unsigned is_echo_all)
     }
 }
 
+/***************************************************************************
+ * Prints the current configuration to the command-line then exits.
+ * Use#1: create a template file of all settable parameters.
+ * Use#2: make sure your configuration was interpreted correctly.
+ ***************************************************************************/
+void
+masscan_echo(struct Masscan *masscan, FILE *fp, unsigned is_echo_all)
+{
+    unsigned i;
+    
+    /*
+     * NEW:
+     * Print all configuration parameters
+     */
+    masscan->echo = fp;
+    masscan->echo_all = is_echo_all;
+    for (i=0; config_parameters[i].name; i++) {
+        config_parameters[i].set(masscan, 0, 0);
+    }
+    masscan->echo = 0;
+    masscan->echo_all = 0;
+    
+    /*
+     * OLD:
+     * Things here below are the old way of echoing parameters.
+     * TODO: cleanup this code, replacing with the new way.
+     */
+    if (masscan->nic_count == 0)
+        masscan_echo_nic(masscan, fp, 0);
+    else {
+        for (i=0; i<masscan->nic_count; i++)
+            masscan_echo_nic(masscan, fp, i);
+    }
+
+    /**
+     * Fix for #737, save adapter-port/source-port value or range
+     */
+    if (masscan->nic[0].src.port.first != 0) {
+        fprintf(fp, "adapter-port = %d", masscan->nic[0].src.port.first);
+        if (masscan->nic[0].src.port.first != masscan->nic[0].src.port.last) {
+            /* --adapter-port <first>-<last> */
+            fprintf(fp, "-%d", masscan->nic[0].src.port.last);
+        }
+        fprintf(fp, "\n");
+    }
+
+    /*
+     * Targets
+     */
+    if (masscan->profile_count == 0) {
+        fprintf(fp, "# TARGET SELECTION (IP, PORTS, EXCLUDES)\n");
+        masscan_echo_targets(&masscan->targets, fp);
+        return;
+    }
+
+    /*
+     * Profiles go last, since everything after a "profile =" line
+     * belongs to that profile
+     */
+    fprintf(fp, "# SCAN PROFILES\n");
+    for (i=0; i<masscan->profile_count; i++) {
+        const struct ScanProfile *profile = &masscan->profile[i];
+
+        fprintf(fp, "profile = %s\n", profile->name);
+        fprintf(fp, "weight = %u\n", profile->weight);
+        fprintf(fp, "seed = %" PRIu64 "\n", profile->seed);
+        fprintf(fp, "retries = %u\n", profile->retries);
+        if (profile->resume_index)
+            fprintf(fp, "resume-index = %" PRIu64 "\n", profile->resume_index);
+        if (profile->output_filename[0])
+            fprintf(fp, "output-filename = %s\n", profile->output_filename);
+        masscan_echo_targets(&profile->targets, fp);
+        fprintf(fp, "\n");
+    }
+}
+
 
 /***************************************************************************
  * Prints the list of CIDR to scan to the command-line then exits.
@@ -3831,7 +5171,7 @@ masscan_echo_cidr(struct Masscan *masscan, FILE *fp, unsigned is_echo_all)
      * For all IPv6 ranges...
      */
     for (i=0; i<masscan->targets.ipv6.count; i++) {
-        struct Range6 range = masscan->targets.ipv6.list[i];
+        struct Range6 range = range6list_at(&masscan->targets.ipv6, i);
         bool exact = false;
         while (!exact) {
             ipaddress_formatted_t fmt = ipv6address_fmt(range.begin);
@@ -3951,6 +5291,111 @@ mainconf_selftest()
             goto failure;
     }
 
+    /* --port-tiers: popular ports first, everything else last */
+    {
+        static const struct PortRank ranking[] = {
+            {80, 0, 0.0}, {443, 1, 0.0}, {22, 2, 0.0},
+            {Templ_UDP+161, 0, 0.0}, {8080, 3, 0.0}, {80, 4, 0.0},
+        };
+        static const unsigned bounds[] = {2, 4};
+        struct RangeList ports = {0};
+        struct RangeList tiers[3];
+        unsigned port;
+        double frequency;
+        unsigned is_error = 0;
+        unsigned count;
+        unsigned k;
+
+        rangelist_parse_ports(&ports, "20-25,80,443,8080,U:161-162", &is_error, 0);
+        rangelist_sort(&ports);
+        count = tiers_split(&ports, ranking, 6, bounds, 2, tiers);
+        if (count != 3)
+            goto failure;
+        if (rangelist_count(&tiers[0]) != 3
+            || !rangelist_is_contains(&tiers[0], 80)
+            || !rangelist_is_contains(&tiers[0], 443)
+            || !rangelist_is_contains(&tiers[0], Templ_UDP+161))
+            goto failure;
+        if (rangelist_count(&tiers[1]) != 2
+            || !rangelist_is_contains(&tiers[1], 22)
+            || !rangelist_is_contains(&tiers[1], 8080))
+            goto failure;
+        if (rangelist_count(&tiers[2]) != 6
+            || rangelist_is_contains(&tiers[2], 22)
+            || !rangelist_is_contains(&tiers[2], Templ_UDP+162))
+            goto failure;
+        for (k=0; k<count; k++)
+            rangelist_remove_all(&tiers[k]);
+
+        /* Ports that aren't ranked all end up in the one tier */
+        count = tiers_split(&ports, ranking, 0, bounds, 2, tiers);
+        if (count != 1 || rangelist_count(&tiers[0]) != rangelist_count(&ports))
+            goto failure;
+        rangelist_remove_all(&tiers[0]);
+        rangelist_remove_all(&ports);
+
+        if (!tiers_parse_line("http\t80/tcp\t0.484143\t# World Wide Web HTTP\n", &port, &frequency)
+            || port != 80 || frequency < 0.48 || frequency > 0.49)
+            goto failure;
+        if (!tiers_parse_line("snmp 161/udp 0.433467\r\n", &port, &frequency)
+            || port != Templ_UDP + 161)
+            goto failure;
+        if (!tiers_parse_line("8443", &port, &frequency)
+            || port != 8443 || frequency != 0.0)
+            goto failure;
+        if (tiers_parse_line("# 80/tcp 1.0\n", &port, &frequency)
+            || tiers_parse_line("  \n", &port, &frequency)
+            || tiers_parse_line("x 80/ddp 1.0\n", &port, &frequency))
+            goto failure;
+    }
+
+    /* --output-sink */
+    {
+        struct Masscan *masscan = CALLOC(1, sizeof(*masscan));
+        const struct OutputSink *sink;
+        unsigned is_fail = 0;
+        unsigned i;
+
+        if (SET_output_sink(masscan, "output-sink",
+                "ndjson:scan.ndjson.gz rotate=1h rotate-size=10m show=open compress=zstd") != 0
+            || SET_output_sink(masscan, "output-sink", "xml:scan.xml") != 0
+            || masscan->output.sink_count != 2)
+            is_fail = 1;
+        else {
+            sink = &masscan->output.sinks[0];
+            if (sink->format != Output_NDJSON
+                || strcmp(sink->filename, "scan.ndjson.gz") != 0
+                || sink->rotate_timeout != 3600
+                || sink->rotate_filesize != 10*1024*1024
+                || !sink->is_show_set || !sink->is_show_open || sink->is_show_closed
+                || sink->compress != Compress_Zstd)
+                is_fail = 1;
+            sink = &masscan->output.sinks[1];
+            if (sink->format != Output_XML || sink->is_show_set
+                || sink->rotate_timeout || sink->compress)
+                is_fail = 1;
+        }
+
+        /* These fail without printing anything, unlike SET_output_sink() */
+        {
+            struct OutputSink bad;
+            memset(&bad, 0, sizeof(bad));
+            if (parse_output_sink("interactive:x", &bad) != 2
+                || parse_output_sink("list:x bogus=1", &bad) != 1
+                || parse_output_sink("list:x show=open,bogus", &bad) != 1
+                || parse_output_sink("scan.xml", &bad) != 1
+                || bad.filename != NULL)
+                is_fail = 1;
+        }
+
+        for (i=0; i<masscan->output.sink_count; i++)
+            free(masscan->output.sinks[i].filename);
+        free(masscan->output.sinks);
+        free(masscan);
+        if (is_fail)
+            goto failure;
+    }
+
     return 0;
 failure:
     fprintf(stderr, "[+] selftest failure: config subsystem\n");
@@ -0,0 +1,994 @@
+/*
+    Dynamic work distribution: a coordinator handing out chunks
+
+    See main-coordinator.h for the overview and the protocol. The
+    coordinator is a single thread around select(), since all it does is
+    answer a few short lines a second from each worker. The chunk table
+    is kept apart from the sockets, so that the selftest can exercise
+    handing out, reassigning and saving chunks without a network.
+*/
+#include "main-coordinator.h"
+#include "main-globals.h"
+#include "main-status.h"
+#include "masscan.h"
+#include "massip-rangesv4.h"
+#include "massip-rangesv6.h"
+#include "pixie-sockets.h"
+#include "pixie-timer.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(WIN32)
+#include <ws2tcpip.h>
+#define close_socket(fd) closesocket(fd)
+#else
+#include <netdb.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define close_socket(fd) close(fd)
+#endif
+
+/* Don't die of SIGPIPE when a worker or coordinator goes away */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/***************************************************************************
+ * The chunk table
+ ***************************************************************************/
+struct CoordChunk {
+    /** Every index before this has been scanned */
+    uint64_t next;
+    uint64_t end;
+    /** When the worker scanning it last reported progress */
+    time_t last_seen;
+    unsigned is_assigned;
+};
+
+struct CoordChunks {
+    struct CoordChunk *list;
+    uint64_t count;
+    uint64_t chunk_size;
+    uint64_t range;
+    /** The number of indexes scanned, for the status line */
+    uint64_t done;
+    /** The number of chunks not yet finished */
+    uint64_t remaining;
+    /** No chunk before this one is waiting to be handed out */
+    uint64_t cursor;
+};
+
+static struct CoordChunks *
+chunks_create(uint64_t range, uint64_t chunk_size)
+{
+    struct CoordChunks *chunks;
+    uint64_t i;
+
+    chunks = CALLOC(1, sizeof(*chunks));
+    chunks->range = range;
+    chunks->chunk_size = chunk_size;
+    chunks->count = (range + chunk_size - 1) / chunk_size;
+    chunks->remaining = chunks->count;
+    chunks->list = CALLOC((size_t)chunks->count + 1, sizeof(chunks->list[0]));
+    for (i=0; i<chunks->count; i++) {
+        chunks->list[i].next = i * chunk_size;
+        chunks->list[i].end = chunks->list[i].next + chunk_size;
+        if (chunks->list[i].end > range)
+            chunks->list[i].end = range;
+    }
+    return chunks;
+}
+
+static void
+chunks_destroy(struct CoordChunks *chunks)
+{
+    if (chunks == NULL)
+        return;
+    free(chunks->list);
+    free(chunks);
+}
+
+/***************************************************************************
+ * Moves a chunk forward to 'next', which only ever goes up.
+ ***************************************************************************/
+static void
+chunks_progress(struct CoordChunks *chunks, uint64_t id, uint64_t next, time_t now)
+{
+    struct CoordChunk *chunk;
+
+    if (id >= chunks->count)
+        return;
+    chunk = &chunks->list[id];
+    if (chunk->next >= chunk->end)
+        return;
+    if (next > chunk->end)
+        next = chunk->end;
+    if (next > chunk->next) {
+        chunks->done += next - chunk->next;
+        chunk->next = next;
+        if (chunk->next >= chunk->end) {
+            chunk->is_assigned = 0;
+            chunks->remaining--;
+        }
+    }
+    chunk->last_seen = now;
+}
+
+/***************************************************************************
+ * @return the chunk given out, or -1 if there are none left to give
+ ***************************************************************************/
+static int64_t
+chunks_assign(struct CoordChunks *chunks, time_t now)
+{
+    uint64_t id;
+
+    for (id=chunks->cursor; id<chunks->count; id++) {
+        struct CoordChunk *chunk = &chunks->list[id];
+
+        if (chunk->is_assigned || chunk->next >= chunk->end)
+            continue;
+        chunk->is_assigned = 1;
+        chunk->last_seen = now;
+        chunks->cursor = id + 1;
+        return (int64_t)id;
+    }
+    chunks->cursor = chunks->count;
+    return -1;
+}
+
+/***************************************************************************
+ * A worker went away: what's left of its chunk goes to someone else.
+ ***************************************************************************/
+static void
+chunks_release(struct CoordChunks *chunks, uint64_t id)
+{
+    if (id >= chunks->count)
+        return;
+    chunks->list[id].is_assigned = 0;
+    if (chunks->cursor > id)
+        chunks->cursor = id;
+}
+
+/***************************************************************************
+ * Copies the progress into the --resume settings, as runs of finished
+ * chunks and single chunks that are partly done.
+ ***************************************************************************/
+static void
+chunks_save(const struct CoordChunks *chunks, struct Masscan *masscan)
+{
+    size_t count = 0;
+    size_t max = 16;
+    uint64_t id;
+
+    free(masscan->coord.saved);
+    masscan->coord.saved = MALLOC(max * sizeof(masscan->coord.saved[0]));
+
+    for (id=0; id<chunks->count; id++) {
+        const struct CoordChunk *chunk = &chunks->list[id];
+        struct CoordSaved *saved;
+        uint64_t begin = id * chunks->chunk_size;
+
+        if (chunk->next == begin)
+            continue;
+        if (chunk->next >= chunk->end && count
+            && masscan->coord.saved[count-1].next == UINT64_MAX
+            && masscan->coord.saved[count-1].last + 1 == id) {
+            masscan->coord.saved[count-1].last = id;
+            continue;
+        }
+
+        if (count >= max) {
+            max *= 2;
+            masscan->coord.saved = REALLOC(masscan->coord.saved,
+                                max * sizeof(masscan->coord.saved[0]));
+        }
+        saved = &masscan->coord.saved[count++];
+        saved->first = id;
+        saved->last = id;
+        saved->next = (chunk->next >= chunk->end) ? UINT64_MAX : chunk->next;
+    }
+    masscan->coord.saved_count = count;
+}
+
+/***************************************************************************
+ * The reverse of chunks_save(), for --resume.
+ ***************************************************************************/
+static void
+chunks_restore(struct CoordChunks *chunks, const struct Masscan *masscan)
+{
+    size_t i;
+
+    for (i=0; i<masscan->coord.saved_count; i++) {
+        const struct CoordSaved *saved = &masscan->coord.saved[i];
+        uint64_t id;
+
+        if (saved->last >= chunks->count) {
+            LOG(0, "[-] coordinator: saved chunk %llu past the end, different scan?\n",
+                (unsigned long long)saved->last);
+            continue;
+        }
+        for (id=saved->first; id<=saved->last; id++)
+            chunks_progress(chunks, id, saved->next, 0);
+    }
+}
+
+/***************************************************************************
+ * Workers must scan exactly what the coordinator thinks they do, which
+ * is more than having the same count: "-p80" and "-p81" have the same
+ * count, but shuffle to different targets.
+ ***************************************************************************/
+static uint64_t
+fingerprint_add(uint64_t hash, uint64_t x)
+{
+    unsigned i;
+
+    /* FNV-1a, a byte at a time */
+    for (i=0; i<8; i++) {
+        hash ^= (x >> (i * 8)) & 0xFF;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t
+coord_fingerprint(const struct MassIP *targets, unsigned retries)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    hash = fingerprint_add(hash, retries);
+    for (i=0; i<targets->ipv4.count; i++) {
+        hash = fingerprint_add(hash, targets->ipv4.list[i].begin);
+        hash = fingerprint_add(hash, targets->ipv4.list[i].end);
+    }
+    for (i=0; i<targets->ipv6.count; i++) {
+        struct Range6 range = range6list_at(&targets->ipv6, i);
+        hash = fingerprint_add(hash, range.begin.hi);
+        hash = fingerprint_add(hash, range.begin.lo);
+        hash = fingerprint_add(hash, range.end.hi);
+        hash = fingerprint_add(hash, range.end.lo);
+    }
+    for (i=0; i<targets->ports.count; i++) {
+        hash = fingerprint_add(hash, targets->ports.list[i].begin);
+        hash = fingerprint_add(hash, targets->ports.list[i].end);
+    }
+    return hash;
+}
+
+static uint64_t
+coord_count(const struct MassIP *targets)
+{
+    return (rangelist_count(&targets->ipv4) + range6list_count(&targets->ipv6).lo)
+            * rangelist_count(&targets->ports);
+}
+
+/***************************************************************************
+ * Sockets
+ ***************************************************************************/
+
+/***************************************************************************
+ * Opens the address, which is "[ip:]port" or the path of a Unix socket,
+ * for listening or connecting.
+ * @return the socket, or -1 on failure, which has been logged
+ ***************************************************************************/
+static ptrdiff_t
+coord_open(const char *address, int is_listen)
+{
+    struct addrinfo hints;
+    struct addrinfo *ai = NULL;
+    struct addrinfo *p;
+    char host[256];
+    const char *port;
+    const char *colon;
+    ptrdiff_t fd = -1;
+    int x;
+
+#if !defined(WIN32)
+    if (strchr(address, '/')) {
+        struct sockaddr_un sun;
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(sun.sun_path)) {
+            LOG(0, "[-] coordinator: %s: path too long\n", address);
+            return -1;
+        }
+        memcpy(sun.sun_path, address, strlen(address) + 1);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) {
+            LOG(0, "[-] coordinator: socket(): %s\n", strerror(errno));
+            return -1;
+        }
+        if (is_listen) {
+            unlink(address);
+            x = bind((int)fd, (struct sockaddr *)&sun, sizeof(sun));
+            if (x == 0)
+                x = listen((int)fd, 64);
+        } else
+            x = connect((int)fd, (struct sockaddr *)&sun, sizeof(sun));
+        if (x != 0) {
+            LOG(0, "[-] coordinator: %s: %s\n", address, strerror(errno));
+            close_socket((int)fd);
+            return -1;
+        }
+        return fd;
+    }
+#endif
+
+    /* Split into host and port, where just a port means listening on
+     * every address */
+    colon = strrchr(address, ':');
+    if (colon == NULL) {
+        host[0] = '\0';
+        port = address;
+    } else {
+        size_t length = colon - address;
+        if (length >= sizeof(host))
+            length = sizeof(host) - 1;
+        memcpy(host, address, length);
+        host[length] = '\0';
+        port = colon + 1;
+    }
+    if (host[0] == '[' && host[strlen(host)-1] == ']') {
+        memmove(host, host+1, strlen(host));
+        host[strlen(host)-1] = '\0';
+    }
+    if (host[0] == '\0' && !is_listen) {
+        LOG(0, "[-] worker: %s: expected <ip>:<port>\n", address);
+        return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (is_listen)
+        hints.ai_flags = AI_PASSIVE;
+    x = getaddrinfo(host[0]?host:NULL, port, &hints, &ai);
+    if (x != 0) {
+        LOG(0, "[-] coordinator: %s: %s\n", address, gai_strerror(x));
+        return -1;
+    }
+
+    for (p=ai; p; p=p->ai_next) {
+        fd = (ptrdiff_t)socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd == -1)
+            continue;
+        if (is_listen) {
+            int yes = 1;
+            setsockopt((SOCKET)fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&yes, sizeof(yes));
+            x = bind((SOCKET)fd, p->ai_addr, (int)p->ai_addrlen);
+            if (x == 0)
+                x = listen((SOCKET)fd, 64);
+        } else
+            x = connect((SOCKET)fd, p->ai_addr, (int)p->ai_addrlen);
+        if (x == 0)
+            break;
+        close_socket((SOCKET)fd);
+        fd = -1;
+    }
+    if (fd == -1)
+        LOG(0, "[-] coordinator: %s: %s\n", address, strerror(errno));
+    freeaddrinfo(ai);
+    return fd;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+coord_send(ptrdiff_t fd, const char *fmt, ...)
+{
+    char line[256];
+    size_t length;
+    size_t offset = 0;
+    va_list marker;
+    int x;
+
+    va_start(marker, fmt);
+    x = vsnprintf(line, sizeof(line), fmt, marker);
+    va_end(marker);
+    if (x < 0 || (size_t)x >= sizeof(line))
+        return -1;
+    length = (size_t)x;
+
+    while (offset < length) {
+        x = send((SOCKET)fd, line + offset, (int)(length - offset), MSG_NOSIGNAL);
+        if (x <= 0)
+            return -1;
+        offset += x;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Parses up to 'max' numbers following the command word.
+ * @return how many were found
+ ***************************************************************************/
+static unsigned
+coord_numbers(const char *line, uint64_t *n, unsigned max, const char **rest)
+{
+    const char *p = line;
+    unsigned count = 0;
+
+    while (*p && *p != ' ')
+        p++;
+    while (count < max) {
+        char *next;
+        while (*p == ' ')
+            p++;
+        if (*p < '0' || *p > '9')
+            break;
+        n[count++] = strtoull(p, &next, 10);
+        p = next;
+    }
+    while (*p == ' ')
+        p++;
+    if (rest)
+        *rest = p;
+    return count;
+}
+
+/***************************************************************************
+ * The coordinator
+ ***************************************************************************/
+struct CoordClient {
+    ptrdiff_t fd;
+    char buf[512];
+    size_t length;
+    /** The chunk this worker is scanning, or -1 */
+    int64_t chunk;
+    /** Packets the worker has sent, as it last reported */
+    uint64_t packets;
+    char name[64];
+    unsigned id;
+    unsigned is_hello:1;
+};
+
+struct Coordinator {
+    struct Masscan *masscan;
+    struct CoordChunks *chunks;
+    uint64_t count;
+    uint64_t fingerprint;
+    struct CoordClient *clients;
+    unsigned client_count;
+    /** Packets sent by workers that have gone */
+    uint64_t packets_gone;
+    unsigned next_id;
+};
+
+static void
+coordinator_drop(struct Coordinator *coord, unsigned i, const char *reason)
+{
+    struct CoordClient *client = &coord->clients[i];
+
+    if (client->is_hello)
+        LOG(1, "[+] coordinator: worker #%u (%s) left: %s\n",
+            client->id, client->name, reason);
+    if (client->chunk >= 0) {
+        chunks_release(coord->chunks, (uint64_t)client->chunk);
+        LOG(1, "[+] coordinator: chunk %lld goes back, from index %llu\n",
+            (long long)client->chunk,
+            (unsigned long long)coord->chunks->list[client->chunk].next);
+    }
+    coord->packets_gone += client->packets;
+    close_socket((SOCKET)client->fd);
+
+    coord->clients[i] = coord->clients[--coord->client_count];
+}
+
+/***************************************************************************
+ * Answers one line from a worker.
+ * @return 0, or -1 if the worker should be dropped
+ ***************************************************************************/
+static int
+coordinator_line(struct Coordinator *coord, struct CoordClient *client,
+                 const char *line, time_t now)
+{
+    struct CoordChunks *chunks = coord->chunks;
+    const struct Masscan *masscan = coord->masscan;
+    uint64_t n[3];
+    unsigned count;
+    const char *rest;
+
+    if (memcmp(line, "HELLO ", 6) == 0) {
+        count = coord_numbers(line, n, 3, &rest);
+        snprintf(client->name, sizeof(client->name), "%.63s", rest);
+        if (count != 3 || n[0] != coord->count || n[1] != masscan->retries
+            || n[2] != coord->fingerprint) {
+            LOG(0, "[-] coordinator: worker #%u (%s) is doing a different scan\n",
+                client->id, client->name);
+            coord_send(client->fd, "ERROR different targets, ports or retries\n");
+            return -1;
+        }
+        client->is_hello = 1;
+        LOG(1, "[+] coordinator: worker #%u (%s) joined\n", client->id, client->name);
+        return coord_send(client->fd, "OK %llu %llu\n",
+                          (unsigned long long)masscan->seed,
+                          (unsigned long long)(masscan->max_rate<1?1:masscan->max_rate));
+    }
+    if (!client->is_hello) {
+        coord_send(client->fd, "ERROR expected HELLO\n");
+        return -1;
+    }
+
+    if (memcmp(line, "PROGRESS ", 9) == 0) {
+        if (coord_numbers(line, n, 3, 0) != 3)
+            return -1;
+        if (client->chunk >= 0 && n[0] == (uint64_t)client->chunk)
+            chunks_progress(chunks, n[0], n[1], now);
+        client->packets = n[2];
+        return 0;
+    }
+
+    if (memcmp(line, "NEXT", 4) == 0 && (line[4] == '\0' || line[4] == ' ')) {
+        int64_t id;
+
+        if (client->chunk >= 0) {
+            if (coord_numbers(line, n, 1, 0) == 1 && n[0] == (uint64_t)client->chunk) {
+                struct CoordChunk *chunk = &chunks->list[client->chunk];
+                chunks_progress(chunks, n[0], chunk->end, now);
+            } else
+                chunks_release(chunks, (uint64_t)client->chunk);
+            client->chunk = -1;
+        }
+
+        id = chunks_assign(chunks, now);
+        if (id >= 0) {
+            struct CoordChunk *chunk = &chunks->list[id];
+            client->chunk = id;
+            LOG(2, "[+] coordinator: chunk %lld to worker #%u\n", (long long)id, client->id);
+            return coord_send(client->fd, "CHUNK %lld %llu %llu %llu\n",
+                              (long long)id,
+                              (unsigned long long)chunk->next,
+                              (unsigned long long)chunk->end,
+                              (unsigned long long)chunks->done);
+        }
+        if (chunks->remaining)
+            return coord_send(client->fd, "WAIT %llu\n",
+                              (unsigned long long)chunks->done);
+        return coord_send(client->fd, "DONE\n");
+    }
+
+    coord_send(client->fd, "ERROR unknown command\n");
+    return -1;
+}
+
+/***************************************************************************
+ * Reads what the worker sent, and answers each whole line.
+ ***************************************************************************/
+static int
+coordinator_read(struct Coordinator *coord, struct CoordClient *client, time_t now)
+{
+    int x;
+    char *eol;
+
+    x = recv((SOCKET)client->fd, client->buf + client->length,
+             (int)(sizeof(client->buf) - 1 - client->length), 0);
+    if (x <= 0)
+        return -1;
+    client->length += x;
+    client->buf[client->length] = '\0';
+
+    while ((eol = strchr(client->buf, '\n')) != NULL) {
+        size_t used = eol - client->buf + 1;
+
+        *eol = '\0';
+        if (eol > client->buf && eol[-1] == '\r')
+            eol[-1] = '\0';
+        if (coordinator_line(coord, client, client->buf, now) != 0)
+            return -1;
+        memmove(client->buf, client->buf + used, client->length - used + 1);
+        client->length -= used;
+    }
+
+    /* A line that doesn't fit isn't from a worker */
+    if (client->length >= sizeof(client->buf) - 1)
+        return -1;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+coordinator_run(struct Masscan *masscan)
+{
+    struct Coordinator coord[1];
+    struct Status status;
+    ptrdiff_t fd;
+    uint64_t range;
+    uint64_t chunk_size;
+    uint64_t packets_last = 0;
+    uint64_t when_status = 0;
+    uint64_t when_checkpoint = 0;
+    uint64_t when_done = 0;
+    int is_complete;
+
+    memset(coord, 0, sizeof(coord));
+    coord->masscan = masscan;
+    coord->count = coord_count(&masscan->targets);
+    coord->fingerprint = coord_fingerprint(&masscan->targets, masscan->retries);
+    range = coord->count * (masscan->retries + 1);
+
+    /* Remember the chunk size we chose, so that a --resume of this
+     * coordinator cuts the chunks the same way */
+    chunk_size = masscan->coord.chunk_size;
+    if (chunk_size == 0) {
+        chunk_size = range / COORD_CHUNKS;
+        if (chunk_size < COORD_CHUNK_MIN)
+            chunk_size = COORD_CHUNK_MIN;
+        masscan->coord.chunk_size = chunk_size;
+    }
+    if (masscan->coord.timeout == 0)
+        masscan->coord.timeout = COORD_TIMEOUT;
+
+    coord->chunks = chunks_create(range, chunk_size);
+    chunks_restore(coord->chunks, masscan);
+
+    fd = coord_open(masscan->coord.listen, 1);
+    if (fd == -1) {
+        chunks_destroy(coord->chunks);
+        return 1;
+    }
+    LOG(0, "[+] coordinator: listening on %s, %llu chunks of %llu, %llu done\n",
+        masscan->coord.listen,
+        (unsigned long long)coord->chunks->count,
+        (unsigned long long)chunk_size,
+        (unsigned long long)(coord->chunks->count - coord->chunks->remaining));
+
+    status_start(&status);
+    when_checkpoint = pixie_gettime() + masscan->checkpoint.seconds * 1000000ULL;
+    while (!is_tx_done) {
+        fd_set readset;
+        struct timeval tv;
+        ptrdiff_t nfds = fd;
+        time_t now;
+        uint64_t usecs;
+        unsigned i;
+        int x;
+
+        FD_ZERO(&readset);
+        FD_SET((SOCKET)fd, &readset);
+        for (i=0; i<coord->client_count; i++) {
+            FD_SET((SOCKET)coord->clients[i].fd, &readset);
+            if (nfds < coord->clients[i].fd)
+                nfds = coord->clients[i].fd;
+        }
+        tv.tv_sec = 0;
+        tv.tv_usec = 250000;
+        x = select((int)nfds + 1, &readset, 0, 0, &tv);
+        if (x < 0 && errno != EINTR) {
+            LOG(0, "[-] coordinator: select(): %s\n", strerror(errno));
+            break;
+        }
+        now = time(0);
+
+        /* Answer the workers. Going backwards, since dropping one moves
+         * the last one into its place */
+        for (i=coord->client_count; x > 0 && i-- > 0; ) {
+            struct CoordClient *client = &coord->clients[i];
+            if (!FD_ISSET((SOCKET)client->fd, &readset))
+                continue;
+            if (coordinator_read(coord, client, now) != 0)
+                coordinator_drop(coord, i, "disconnected");
+        }
+
+        /* New workers */
+        if (x > 0 && FD_ISSET((SOCKET)fd, &readset)) {
+            ptrdiff_t fd2 = (ptrdiff_t)accept((SOCKET)fd, 0, 0);
+            if (fd2 != -1) {
+                struct CoordClient *client;
+                coord->clients = REALLOC(coord->clients,
+                            (coord->client_count + 1) * sizeof(coord->clients[0]));
+                client = &coord->clients[coord->client_count++];
+                memset(client, 0, sizeof(*client));
+                client->fd = fd2;
+                client->chunk = -1;
+                client->id = ++coord->next_id;
+            }
+        }
+
+        /* Workers that have stopped reporting lose their chunk */
+        for (i=coord->client_count; i-- > 0; ) {
+            struct CoordClient *client = &coord->clients[i];
+            if (client->chunk >= 0
+                && now - coord->chunks->list[client->chunk].last_seen > (time_t)masscan->coord.timeout)
+                coordinator_drop(coord, i, "timed out");
+        }
+
+        usecs = pixie_gettime();
+        if (usecs >= when_status) {
+            uint64_t packets = coord->packets_gone;
+            double rate;
+
+            for (i=0; i<coord->client_count; i++)
+                packets += coord->clients[i].packets;
+            rate = when_status ? (packets - packets_last) * 1000000.0 / (usecs - when_status + 1000000) : 0;
+            packets_last = packets;
+            when_status = usecs + 1000000;
+
+            snprintf(status.extra, sizeof(status.extra), "workers=%u chunks=%llu/%llu",
+                     coord->client_count,
+                     (unsigned long long)(coord->chunks->count - coord->chunks->remaining),
+                     (unsigned long long)coord->chunks->count);
+            if (masscan->output.is_status_updates)
+                status_print(&status, coord->chunks->done, range, rate,
+                             0, 0, packets, 0, masscan->output.is_status_ndjson);
+        }
+
+        if (masscan->checkpoint.seconds && usecs >= when_checkpoint) {
+            const char *filename = masscan_state_filename(masscan);
+            when_checkpoint = usecs + masscan->checkpoint.seconds * 1000000ULL;
+            chunks_save(coord->chunks, masscan);
+            if (masscan_write_state(masscan, filename) != 0)
+                LOG(0, "[-] checkpoint: %s: %s\n", filename, strerror(errno));
+        }
+
+        /* Once everything is done, wait a little while for the workers
+         * to ask for more and be told there isn't any */
+        if (coord->chunks->remaining == 0) {
+            if (when_done == 0)
+                when_done = usecs + 5000000;
+            if (coord->client_count == 0 || usecs >= when_done)
+                break;
+        }
+    }
+    status_finish(&status);
+
+    is_complete = (coord->chunks->remaining == 0);
+    while (coord->client_count)
+        coordinator_drop(coord, coord->client_count - 1, "coordinator exiting");
+    close_socket((SOCKET)fd);
+#if !defined(WIN32)
+    if (strchr(masscan->coord.listen, '/'))
+        unlink(masscan->coord.listen);
+#endif
+
+    if (!is_complete) {
+        chunks_save(coord->chunks, masscan);
+        masscan_save_state(masscan);
+    } else {
+        LOG(0, "[+] coordinator: all %llu chunks done\n",
+            (unsigned long long)coord->chunks->count);
+        if (masscan->checkpoint.seconds)
+            remove(masscan_state_filename(masscan));
+    }
+
+    free(coord->clients);
+    chunks_destroy(coord->chunks);
+    return is_complete ? 0 : 1;
+}
+
+/***************************************************************************
+ * The worker
+ ***************************************************************************/
+struct CoordWorker {
+    ptrdiff_t fd;
+    char buf[512];
+    size_t length;
+    /** The chunk we're scanning, or -1 */
+    int64_t chunk;
+};
+
+/***************************************************************************
+ * Waits for the next line from the coordinator.
+ ***************************************************************************/
+static int
+worker_readline(struct CoordWorker *worker, char *line, size_t sizeof_line)
+{
+    for (;;) {
+        char *eol = memchr(worker->buf, '\n', worker->length);
+        int x;
+
+        if (eol) {
+            size_t used = eol - worker->buf + 1;
+            size_t length = used - 1;
+            if (length >= sizeof_line)
+                length = sizeof_line - 1;
+            memcpy(line, worker->buf, length);
+            line[length] = '\0';
+            if (length && line[length-1] == '\r')
+                line[length-1] = '\0';
+            memmove(worker->buf, worker->buf + used, worker->length - used);
+            worker->length -= used;
+            return 0;
+        }
+        if (worker->length >= sizeof(worker->buf))
+            return -1;
+        x = recv((SOCKET)worker->fd, worker->buf + worker->length,
+                 (int)(sizeof(worker->buf) - worker->length), 0);
+        if (x <= 0)
+            return -1;
+        worker->length += x;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct CoordWorker *
+coord_worker_connect(const char *address, const struct MassIP *targets,
+                     unsigned retries, const char *name,
+                     uint64_t *seed, uint64_t *stride)
+{
+    struct CoordWorker *worker;
+    char line[256];
+    uint64_t n[2];
+
+    worker = CALLOC(1, sizeof(*worker));
+    worker->chunk = -1;
+    worker->fd = coord_open(address, 0);
+    if (worker->fd == -1) {
+        free(worker);
+        return NULL;
+    }
+
+    if (coord_send(worker->fd, "HELLO %llu %u %llu %s\n",
+                   (unsigned long long)coord_count(targets), retries,
+                   (unsigned long long)coord_fingerprint(targets, retries),
+                   name) != 0
+        || worker_readline(worker, line, sizeof(line)) != 0) {
+        LOG(0, "[-] worker: %s: no answer from the coordinator\n", address);
+        coord_worker_close(worker);
+        return NULL;
+    }
+    if (memcmp(line, "OK ", 3) != 0 || coord_numbers(line, n, 2, 0) != 2) {
+        LOG(0, "[-] worker: %s: %s\n", address, line);
+        coord_worker_close(worker);
+        return NULL;
+    }
+    *seed = n[0];
+    *stride = n[1];
+    return worker;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+enum CoordNext
+coord_worker_next(struct CoordWorker *worker,
+                  uint64_t *begin, uint64_t *end, uint64_t *done)
+{
+    char line[256];
+    uint64_t n[4];
+    int x;
+
+    if (worker->chunk >= 0)
+        x = coord_send(worker->fd, "NEXT %lld\n", (long long)worker->chunk);
+    else
+        x = coord_send(worker->fd, "NEXT\n");
+    worker->chunk = -1;
+    if (x != 0 || worker_readline(worker, line, sizeof(line)) != 0)
+        return Coord_Error;
+
+    if (memcmp(line, "CHUNK ", 6) == 0 && coord_numbers(line, n, 4, 0) == 4) {
+        worker->chunk = (int64_t)n[0];
+        *begin = n[1];
+        *end = n[2];
+        *done = n[3];
+        return Coord_Chunk;
+    }
+    if (memcmp(line, "WAIT ", 5) == 0 && coord_numbers(line, n, 1, 0) == 1) {
+        *done = n[0];
+        return Coord_Wait;
+    }
+    if (strcmp(line, "DONE") == 0)
+        return Coord_Done;
+    LOG(0, "[-] worker: coordinator: %s\n", line);
+    return Coord_Error;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+coord_worker_progress(struct CoordWorker *worker, uint64_t next,
+                      uint64_t packets)
+{
+    if (worker->chunk < 0)
+        return;
+    coord_send(worker->fd, "PROGRESS %lld %llu %llu\n",
+               (long long)worker->chunk,
+               (unsigned long long)next,
+               (unsigned long long)packets);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+coord_worker_close(struct CoordWorker *worker)
+{
+    if (worker == NULL)
+        return;
+    if (worker->fd != -1)
+        close_socket((SOCKET)worker->fd);
+    free(worker);
+}
+
+/***************************************************************************
+ * Hands out chunks to pretend workers, one of which goes away, and
+ * checks that between them every index gets scanned exactly once, even
+ * across a save and restore.
+ ***************************************************************************/
+int
+coordinator_selftest(void)
+{
+    struct CoordChunks *chunks;
+    struct Masscan *masscan;
+    unsigned char *seen;
+    const uint64_t range = 10000;
+    int64_t a, b, c;
+    uint64_t i;
+    int err = 0;
+
+    masscan = CALLOC(1, sizeof(*masscan));
+    seen = CALLOC(range, 1);
+    chunks = chunks_create(range, 300);
+    if (chunks->count != 34 || chunks->list[33].end != range)
+        err = 1;
+
+    /* Worker 'a' dies halfway through its chunk, so the rest of it goes
+     * to the next worker to ask */
+    a = chunks_assign(chunks, 1);
+    b = chunks_assign(chunks, 1);
+    if (a != 0 || b != 1)
+        err = 1;
+    for (i=0; i<150; i++)
+        seen[i]++;
+    chunks_progress(chunks, (uint64_t)a, 150, 2);
+    chunks_release(chunks, (uint64_t)a);
+    c = chunks_assign(chunks, 3);
+    if (c != 0 || chunks->list[c].next != 150)
+        err = 1;
+    for (i=chunks->list[c].next; i<chunks->list[c].end; i++)
+        seen[i]++;
+    chunks_progress(chunks, (uint64_t)c, chunks->list[c].end, 4);
+
+    /* Worker 'b' gets half way, then we save and restore */
+    for (i=chunks->list[b].next; i<450; i++)
+        seen[i]++;
+    chunks_progress(chunks, (uint64_t)b, 450, 4);
+    chunks_save(chunks, masscan);
+    if (masscan->coord.saved_count != 2
+        || masscan->coord.saved[0].next != UINT64_MAX
+        || masscan->coord.saved[1].next != 450)
+        err = 1;
+    chunks_destroy(chunks);
+    chunks = chunks_create(range, 300);
+    chunks_restore(chunks, masscan);
+    if (chunks->done != 450 || chunks->remaining != 33)
+        err = 1;
+
+    /* Finish off the rest */
+    while ((a = chunks_assign(chunks, 5)) >= 0) {
+        for (i=chunks->list[a].next; i<chunks->list[a].end; i++)
+            seen[i]++;
+        chunks_progress(chunks, (uint64_t)a, chunks->list[a].end, 6);
+    }
+    if (chunks->remaining != 0 || chunks->done != range)
+        err = 1;
+    for (i=0; i<range; i++) {
+        if (seen[i] != 1)
+            err = 1;
+    }
+
+    /* Numbers in protocol lines */
+    {
+        uint64_t n[3];
+        const char *rest;
+        if (coord_numbers("HELLO 12 3 4 box/1", n, 3, &rest) != 3
+            || n[0] != 12 || n[1] != 3 || strcmp(rest, "box/1") != 0)
+            err = 1;
+        if (coord_numbers("NEXT", n, 1, 0) != 0)
+            err = 1;
+    }
+
+    chunks_destroy(chunks);
+    free(masscan->coord.saved);
+    free(masscan);
+    free(seen);
+    if (err)
+        fprintf(stderr, "[-] coordinator: selftest failed\n");
+    return err;
+}
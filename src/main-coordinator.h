@@ -0,0 +1,115 @@
+/*
+    Dynamic work distribution: a coordinator handing out chunks
+
+    With --shard 1/3, 2/3 and 3/3, each machine scans a fixed third of
+    the index space, so a scan is only as fast as its slowest machine.
+    Instead, one masscan runs as a coordinator:
+
+        masscan --coordinator 7000 10.0.0.0/8 -p80,443
+
+    which sends nothing itself. The scanning machines run as workers,
+    with the same targets and ports:
+
+        masscan --worker 192.168.1.5:7000 10.0.0.0/8 -p80,443 --rate 100000
+
+    The index space (the one the transmit thread counts through and
+    shuffles with blackrock) is split into chunks, and each transmit
+    thread of each worker asks for a chunk, scans it, and asks for the
+    next, so faster workers simply do more chunks.
+
+    Workers report how far they've got about once a second. A worker
+    that disconnects, or goes quiet for --worker-timeout seconds, loses
+    its chunk, which goes back to be handed out again from the last
+    point reported. That progress is also what --checkpoint and <ctrl-c>
+    save, so a coordinator can be resumed with --resume.
+
+    The protocol is lines of text over TCP, or a Unix socket when the
+    address contains a '/':
+
+        worker:  HELLO <count> <retries> <fingerprint> <name>
+        coord:   OK <seed> <stride>         or  ERROR <reason>
+        worker:  NEXT [<finished-chunk>]
+        coord:   CHUNK <id> <begin> <end> <done>  or  WAIT <done>  or  DONE
+        worker:  PROGRESS <id> <next> <packets>   (no reply)
+
+    The coordinator chooses the --seed, so that all the workers shuffle
+    the same way, and the 'stride' that spaces out retries, which would
+    otherwise depend on each worker's --rate.
+*/
+#ifndef MAIN_COORDINATOR_H
+#define MAIN_COORDINATOR_H
+#include <stdint.h>
+#include <stdio.h>
+struct Masscan;
+struct MassIP;
+
+/* The default number of chunks, when there's no --chunk-size */
+#define COORD_CHUNKS 1024
+
+/* The smallest chunk, so that tiny scans aren't all protocol */
+#define COORD_CHUNK_MIN 256
+
+/* Default seconds of silence before a worker's chunk is given away */
+#define COORD_TIMEOUT 30
+
+/**
+ * Runs the coordinator until every chunk is done, or <ctrl-c>.
+ * @return 0 when the scan completed, 1 otherwise
+ */
+int
+coordinator_run(struct Masscan *masscan);
+
+/**
+ * A transmit thread's connection to the coordinator.
+ */
+struct CoordWorker;
+
+enum CoordNext {
+    Coord_Error = -1,   /* lost the coordinator */
+    Coord_Done = 0,     /* every chunk is done */
+    Coord_Chunk = 1,    /* here's one to scan */
+    Coord_Wait = 2,     /* the rest are being scanned by other workers */
+};
+
+/**
+ * Connects, and checks that the worker is doing the same scan as the
+ * coordinator.
+ * @param targets
+ *      The targets and ports, which must be the same as the coordinator's.
+ * @param seed
+ *      Receives the coordinator's seed, which the worker must use.
+ * @param stride
+ *      Receives the spacing of retries, used instead of the --rate.
+ * @return
+ *      the connection, or NULL on failure, which has been logged
+ */
+struct CoordWorker *
+coord_worker_connect(const char *address, const struct MassIP *targets,
+                     unsigned retries, const char *name,
+                     uint64_t *seed, uint64_t *stride);
+
+/**
+ * Reports the current chunk (if any) as finished, and asks for another.
+ * @param done
+ *      Receives how many indexes the whole scan has finished, for the
+ *      status line.
+ */
+enum CoordNext
+coord_worker_next(struct CoordWorker *worker,
+                  uint64_t *begin, uint64_t *end, uint64_t *done);
+
+/**
+ * Tells the coordinator that every index before 'next' in the current
+ * chunk has been sent.
+ */
+void
+coord_worker_progress(struct CoordWorker *worker, uint64_t next,
+                      uint64_t packets);
+
+void
+coord_worker_close(struct CoordWorker *worker);
+
+int
+coordinator_selftest(void);
+
+#endif
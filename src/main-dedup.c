@@ -20,283 +20,253 @@
  
     We call this "deduplication" as it's simply removing duplicate
     responses.
+
+    The table needs to remember responses for as long as a slow host
+    may take to retransmit its SYN-ACK, which is a second or more. At
+    millions of packets-per-second, that's millions of responses, so
+    the table is sized from the --rate (see --dedup-window), and holds
+    only a small fingerprint of each response.
 */
 #include "main-dedup.h"
 #include "util-malloc.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include "syn-cookie.h"
 
-/**
- * This is the number of entries in our table. More entries does a better job at the
- * cost of using more memory.
- */
-#define DEDUP_ENTRIES 65536
-
-struct DedupEntry_IPv4
-{
-    unsigned ip_them;
-    unsigned port_them;
-    unsigned ip_me;
-    unsigned port_me;
-};
-
-struct DedupEntry_IPv6
-{
-    ipv6address ip_them;
-    ipv6address ip_me;
-    unsigned short port_them;
-    unsigned short port_me;
-};
-
-/**
- * This is simply the array of entries. We have two arrays, one for IPv4
- * and another for IPv6.
- */
-struct DedupTable
-{
-    struct DedupEntry_IPv4 entries[DEDUP_ENTRIES][4];
-    struct DedupEntry_IPv6 entries6[DEDUP_ENTRIES][4];
-};
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DEDUP_SSE2 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 /**
- * We use the FNv1a hash algorithm, which starts with this seed value.
+ * Each bucket is one cache-line, holding the fingerprints of 15 recent
+ * responses, with the 16th lane holding which of the 15 slots is the
+ * next one to be replaced. Thus, a lookup touches a single cache-line,
+ * and all the slots are compared at once.
  */
-const unsigned fnv1a_seed  = 0x811C9DC5; /* 2166136261 */
+#define DEDUP_LANES 16
+#define DEDUP_SLOTS 15
+#define DEDUP_NEXT  15
 
 /**
- * Hash one byte, the other hash functions of multiple bytes call this function.
- * @param hash
- *      The current hash value that we keep updating as we repeatedly
- *      call this function, or the `fnv1a_seed   value on the first call to
- *      this function.
+ * The smallest and largest tables, in buckets. The largest is 256
+ * megabytes per receive thread.
  */
-static inline unsigned fnv1a(unsigned char c, unsigned hash)
-{
-  const unsigned prime = 0x01000193; /* 16777619 */
-  return (c ^ hash) * prime;
-}
+#define DEDUP_MIN_BUCKETS (1<<6)
+#define DEDUP_MAX_BUCKETS (1<<22)
 
-static unsigned fnv1a_string(const void *v_buf, size_t length, unsigned hash)
+struct DedupBucket
 {
-    const unsigned char *buf = (const unsigned char *)v_buf;
-    size_t i;
-    for (i=0; i<length; i++)
-        hash = fnv1a(buf[i], hash);
-    return hash;
-}
+    uint32_t lanes[DEDUP_LANES];
+};
 
-static inline unsigned fnv1a_short(unsigned data, unsigned hash)
-{
-    hash = fnv1a((data>>0)&0xFF, hash);
-    hash = fnv1a((data>>8)&0xFF, hash);
-    return hash;
-}
-static inline unsigned fnv1a_longlong(unsigned long long data, unsigned hash)
+struct DedupTable
 {
-    return fnv1a_string(&data, 8, hash);
-}
+    struct DedupBucket *buckets;
+    uint64_t mask;
+    uint64_t key;
+    struct DedupStats stats;
+};
 
 /**
- * Create a new table, which means simply allocating the object
- * and setting it to zero.
+ * Create a new table, with room for (at least) the given number of
+ * responses, rounded up to a power of two number of buckets.
  */
 struct DedupTable *
-dedup_create(void)
+dedup_create(size_t entry_count, uint64_t entropy)
 {
     struct DedupTable *dedup;
+    size_t bucket_count = DEDUP_MIN_BUCKETS;
+
+    while (bucket_count * DEDUP_SLOTS < entry_count && bucket_count < DEDUP_MAX_BUCKETS)
+        bucket_count *= 2;
 
     dedup = CALLOC(1, sizeof(*dedup));
+    dedup->key = entropy;
+
+    /* If we can't allocate enough memory, then shrink the table */
+    while (dedup->buckets == NULL) {
+        dedup->buckets = huge_calloc_try(bucket_count, sizeof(*dedup->buckets));
+        if (dedup->buckets == NULL) {
+            if (bucket_count <= DEDUP_MIN_BUCKETS) {
+                fprintf(stderr, "[-] out of memory, aborting\n");
+                abort();
+            }
+            bucket_count >>= 1;
+        }
+    }
+    dedup->mask = bucket_count - 1;
 
     return dedup;
 }
 
-/**
- * There's nothing special we need to do to free the structure
- * since it's all contained in the single allocation.
- */
 void
 dedup_destroy(struct DedupTable *dedup)
 {
+    if (dedup == NULL)
+        return;
+    HUGE_FREE(dedup->buckets);
     free(dedup);
 }
 
-/**
- * Create a hash of the IPv6 socket. This doesn't have to be
- * cryptographically secure, so we are going to use the FNv1a algorithm.
- */
-static inline unsigned
-dedup_hash_ipv6(ipaddress ip_them, unsigned port_them, ipaddress ip_me, unsigned port_me)
+size_t
+dedup_capacity(const struct DedupTable *dedup)
 {
-    unsigned hash = fnv1a_seed;
-    hash = fnv1a_longlong(ip_them.ipv6.hi, hash);
-    hash = fnv1a_longlong(ip_them.ipv6.lo, hash);
-    hash = fnv1a_short(port_them, hash);
-    hash = fnv1a_longlong(ip_me.ipv6.hi, hash);
-    hash = fnv1a_longlong(ip_me.ipv6.lo, hash);
-    hash = fnv1a_short(port_me, hash);
-    return hash;
+    return (size_t)(dedup->mask + 1) * DEDUP_SLOTS;
 }
 
-/**
- * If two IPv6 addresses are equal.
- */
-static inline int
-is_equal6(ipv6address lhs, ipv6address rhs)
+void
+dedup_get_stats(const struct DedupTable *dedup, struct DedupStats *stats)
 {
-    return lhs.hi == rhs.hi && lhs.lo == rhs.lo;
+    *stats = dedup->stats;
 }
 
 /**
- * Swap two addresses in the table. This uses the classic XOR trick
- * rather than using a swap variable.
+ * Hashes the socket a 64-bit word at a time, rather than a byte at a
+ * time. This doesn't have to be cryptographically secure, but it's
+ * keyed with a random value so that somebody sending us responses can't
+ * predict which ones collide.
  */
-static inline void
-swap6(struct DedupEntry_IPv6 *lhs, struct DedupEntry_IPv6 *rhs)
+static inline uint64_t
+dedup_mix(uint64_t hash, uint64_t word)
 {
-    lhs->ip_them.hi ^= rhs->ip_them.hi;
-    lhs->ip_them.lo ^= rhs->ip_them.lo;
-    lhs->port_them ^= rhs->port_them;
-    lhs->ip_me.hi ^= rhs->ip_me.hi;
-    lhs->ip_me.lo ^= rhs->ip_me.lo;
-    lhs->port_me ^= rhs->port_me;
-
-    rhs->ip_them.hi ^= lhs->ip_them.hi;
-    rhs->ip_them.lo ^= lhs->ip_them.lo;
-    rhs->port_them ^= lhs->port_them;
-    rhs->ip_me.hi ^= lhs->ip_me.hi;
-    rhs->ip_me.lo ^= lhs->ip_me.lo;
-    rhs->port_me ^= lhs->port_me;
-
-    lhs->ip_them.hi ^= rhs->ip_them.hi;
-    lhs->ip_them.lo ^= rhs->ip_them.lo;
-    lhs->port_them ^= rhs->port_them;
-    lhs->ip_me.hi ^= rhs->ip_me.hi;
-    lhs->ip_me.lo ^= rhs->ip_me.lo;
-    lhs->port_me ^= rhs->port_me;
+    hash ^= word;
+    hash *= 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
 }
 
-/**
- * This implements the same algorithm as for IPv4 addresses, but for
- * IPv6 addresses instead.
- */
-static unsigned
-dedup_is_duplicate_ipv6(struct DedupTable *dedup,
-                   ipaddress ip_them, unsigned port_them,
-                   ipaddress ip_me, unsigned port_me)
+static inline uint64_t
+dedup_final(uint64_t hash)
 {
-    unsigned hash;
-    struct DedupEntry_IPv6 *bucket;
-    unsigned i;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    return hash ^ (hash >> 32);
+}
 
-    /* THREAT: probably need to secure this hash, though the syn-cookies
-     * provides some protection */
-    hash = dedup_hash_ipv6(ip_them, port_them, ip_me, port_me);
-    hash &= DEDUP_ENTRIES-1;
-
-    /* Search in this bucket */
-    bucket = dedup->entries6[hash];
-
-    /* If we find the entry in our table, move it to the front, so
-     * that it won't be aged out as quickly. We keep prepending new
-     * addresses to front, aging older addresses that haven't been
-     * seen in a while. */
-    for (i = 0; i < 4; i++) {
-        if (is_equal6(bucket[i].ip_them, ip_them.ipv6) && bucket[i].port_them == port_them
-            && is_equal6(bucket[i].ip_me, ip_me.ipv6) && bucket[i].port_me == port_me) {
-            /* move to end of list so constant repeats get ignored */
-            if (i > 0) {
-                swap6(&bucket[0], &bucket[i]);
-            }
-            return 1;
-        }
+/* Ports also hold the Templ_UDP/Templ_SCTP/Templ_ICMP_echo bits in
+ * the upper part, so that a UDP and TCP response aren't confused */
+static uint64_t
+dedup_hash(const struct DedupTable *dedup,
+           ipaddress ip_them, unsigned port_them,
+           ipaddress ip_me, unsigned port_me)
+{
+    uint64_t hash = dedup->key ^ ip_them.version;
+
+    if (ip_them.version == 6) {
+        hash = dedup_mix(hash, ip_them.ipv6.hi);
+        hash = dedup_mix(hash, ip_them.ipv6.lo);
+        hash = dedup_mix(hash, ip_me.ipv6.hi);
+        hash = dedup_mix(hash, ip_me.ipv6.lo);
+    } else {
+        hash = dedup_mix(hash, (uint64_t)ip_them.ipv4 << 32 | ip_me.ipv4);
     }
-
-    /* We didn't find it, so add it to our list. This will push
-     * older entries at this bucket off the list */
-    memmove(bucket, bucket+1, 3*sizeof(*bucket));
-    bucket[0].ip_them.hi = ip_them.ipv6.hi;
-    bucket[0].ip_them.lo = ip_them.ipv6.lo;
-    bucket[0].port_them = (unsigned short)port_them;
-    bucket[0].ip_me.hi = ip_me.ipv6.hi;
-    bucket[0].ip_me.lo = ip_me.ipv6.lo;
-    bucket[0].port_me = (unsigned short)port_me;
-
-    return 0;
-
+    hash = dedup_mix(hash, (uint64_t)port_them << 32 | port_me);
+    return dedup_final(hash);
 }
 
-/***************************************************************************
- ***************************************************************************/
-static unsigned
-dedup_is_duplicate_ipv4(struct DedupTable *dedup,
-                   ipaddress ip_them, unsigned port_them,
-                   ipaddress ip_me, unsigned port_me)
+/**
+ * Compares the fingerprint against all the slots in the bucket.
+ * @return a bitmask of the slots that match
+ */
+static inline unsigned
+bucket_match(const struct DedupBucket *bucket, uint32_t fingerprint)
 {
-    unsigned hash;
-    struct DedupEntry_IPv4 *bucket;
+#if defined(DEDUP_SSE2)
+    const __m128i *lanes = (const __m128i *)bucket->lanes;
+    __m128i key = _mm_set1_epi32((int)fingerprint);
+    __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128(lanes + 0), key);
+    __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128(lanes + 1), key);
+    __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128(lanes + 2), key);
+    __m128i d = _mm_cmpeq_epi32(_mm_loadu_si128(lanes + 3), key);
+    unsigned mask;
+
+    /* Narrow the 16 compares down to a byte each, keeping their order */
+    mask = _mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(a, b),
+                                             _mm_packs_epi32(c, d)));
+    return mask & ((1 << DEDUP_SLOTS) - 1);
+#else
+    unsigned mask = 0;
     unsigned i;
+    for (i = 0; i < DEDUP_SLOTS; i++)
+        mask |= (unsigned)(bucket->lanes[i] == fingerprint) << i;
+    return mask;
+#endif
+}
 
-    /* THREAT: probably need to secure this hash, though the syn-cookies
-     * provides some protection */
-    hash = (ip_them.ipv4 + port_them) ^ ((ip_me.ipv4) + (ip_them.ipv4>>16)) ^ (ip_them.ipv4>>24) ^ port_me;
-    hash &= DEDUP_ENTRIES-1;
-
-    /* Search in this bucket */
-    bucket = dedup->entries[hash];
-
-    /* If we find the entry in our table, move it to the front, so
-     * that it won't be aged out as quickly. We keep prepending new
-     * addresses to front, aging older addresses that haven't been
-     * seen in a while. */
-    for (i = 0; i < 4; i++) {
-        if (bucket[i].ip_them == ip_them.ipv4 && bucket[i].port_them == port_them
-            && bucket[i].ip_me == ip_me.ipv4 && bucket[i].port_me == port_me) {
-            /* move to end of list so constant repeats get ignored */
-            if (i > 0) {
-                bucket[i].ip_them ^= bucket[0].ip_them;
-                bucket[i].port_them ^= bucket[0].port_them;
-                bucket[i].ip_me ^= bucket[0].ip_me;
-                bucket[i].port_me ^= bucket[0].port_me;
-
-                bucket[0].ip_them ^= bucket[i].ip_them;
-                bucket[0].port_them ^= bucket[i].port_them;
-                bucket[0].ip_me ^= bucket[i].ip_me;
-                bucket[0].port_me ^= bucket[i].port_me;
-
-                bucket[i].ip_them ^= bucket[0].ip_them;
-                bucket[i].port_them ^= bucket[0].port_them;
-                bucket[i].ip_me ^= bucket[0].ip_me;
-                bucket[i].port_me ^= bucket[0].port_me;
-            }
-            return 1;
-        }
+static inline unsigned
+lowest_bit(unsigned mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#elif defined(__GNUC__)
+    return (unsigned)__builtin_ctz(mask);
+#else
+    unsigned index = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
     }
-
-    /* We didn't find it, so add it to our list. This will push
-     * older entries at this bucket off the list */
-    memmove(bucket, bucket+1, 3*sizeof(*bucket));
-    bucket[0].ip_them = ip_them.ipv4;
-    bucket[0].port_them = port_them;
-    bucket[0].ip_me = ip_me.ipv4;
-    bucket[0].port_me = port_me;
-
-    return 0;
-
+    return index;
+#endif
 }
 
 /***************************************************************************
+ * We only remember a 32-bit fingerprint of each response, with the
+ * bucket number being another 6 to 22 bits of the hash. Two different
+ * responses will be mistaken for each other only about once in every
+ * few billion lookups, which is a lot less often than responses are
+ * lost in the network.
  ***************************************************************************/
 unsigned
 dedup_is_duplicate(struct DedupTable *dedup,
                    ipaddress ip_them, unsigned port_them,
                    ipaddress ip_me, unsigned port_me)
 {
-    if (ip_them.version == 6)
-        return dedup_is_duplicate_ipv6(dedup, ip_them, port_them, ip_me, port_me);
-    else
-        return dedup_is_duplicate_ipv4(dedup, ip_them, port_them, ip_me, port_me);
+    uint64_t hash;
+    uint32_t fingerprint;
+    struct DedupBucket *bucket;
+    unsigned next;
+    unsigned match;
+
+    hash = dedup_hash(dedup, ip_them, port_them, ip_me, port_me);
+    bucket = &dedup->buckets[hash & dedup->mask];
+
+    /* Zero marks an empty slot */
+    fingerprint = (uint32_t)(hash >> 32);
+    if (fingerprint == 0)
+        fingerprint = 1;
+
+    next = bucket->lanes[DEDUP_NEXT];
+    match = bucket_match(bucket, fingerprint);
+
+    if (match) {
+        unsigned i = lowest_bit(match);
+        unsigned newest = (next + DEDUP_SLOTS - 1) % DEDUP_SLOTS;
+
+        /* If we find the entry in our table, swap it with the newest
+         * one, so that it won't be aged out as quickly. This way, a host
+         * that keeps sending the same response keeps getting ignored */
+        bucket->lanes[i] = bucket->lanes[newest];
+        bucket->lanes[newest] = fingerprint;
+        dedup->stats.hits++;
+        return 1;
+    }
+
+    /* We didn't find it, so add it to our list, replacing the oldest
+     * entry in this bucket */
+    if (bucket->lanes[next])
+        dedup->stats.evictions++;
+    bucket->lanes[next] = fingerprint;
+    bucket->lanes[DEDUP_NEXT] = (next + 1) % DEDUP_SLOTS;
+    dedup->stats.misses++;
+
+    return 0;
 }
 
 
@@ -338,7 +308,7 @@ dedup_selftest(void)
     unsigned found_match = 0;
     unsigned line = 0;
     
-    dedup = dedup_create();
+    dedup = dedup_create(1<<18, 0);
     
     /* Deterministic test.
      *
@@ -388,6 +358,18 @@ dedup_selftest(void)
             line = __LINE__;
             goto fail;
         }
+
+        /* A UDP response on the same port is a different response */
+        if (dedup_is_duplicate(dedup, ip_them, port_them | 0x10000, ip_me, port_me)) {
+            line = __LINE__;
+            goto fail;
+        }
+        ip_them.version = 4;
+        ip_me.version = 4;
+        if (dedup_is_duplicate(dedup, ip_them, port_them | 0x10000, ip_me, port_me)) {
+            line = __LINE__;
+            goto fail;
+        }
         
     }
     
@@ -457,6 +439,54 @@ dedup_selftest(void)
         goto fail;
     }
     
+    dedup_destroy(dedup);
+
+    /* Deterministic test of aging out. A small table forgets old
+     * responses, but one that keeps getting repeated is remembered. */
+    {
+        struct DedupStats stats;
+        ipaddress ip_me;
+        ipaddress ip_them;
+        unsigned port_me = 1234;
+        unsigned port_them = 80;
+
+        dedup = dedup_create(0, 1);
+        ip_me.version = 4;
+        ip_them.version = 4;
+        ip_me.ipv4 = 0x0a000001;
+        ip_them.ipv4 = 0x01010101;
+
+        dedup_is_duplicate(dedup, ip_them, port_them, ip_me, port_me);
+        for (i=0; i<100000; i++) {
+            ipaddress ip_other = ip_them;
+            ip_other.ipv4 = 0x02000000 + (unsigned)i;
+            if (dedup_is_duplicate(dedup, ip_other, port_them, ip_me, port_me)) {
+                line = __LINE__;
+                goto fail;
+            }
+            if (!dedup_is_duplicate(dedup, ip_them, port_them, ip_me, port_me)) {
+                line = __LINE__;
+                goto fail;
+            }
+        }
+
+        /* The first of those others has long since been forgotten */
+        ip_them.ipv4 = 0x02000000;
+        if (dedup_is_duplicate(dedup, ip_them, port_them, ip_me, port_me)) {
+            line = __LINE__;
+            goto fail;
+        }
+
+        dedup_get_stats(dedup, &stats);
+        if (stats.hits != 100000 || stats.misses != 100002
+            || stats.evictions == 0
+            || stats.misses > stats.evictions + dedup_capacity(dedup)) {
+            line = __LINE__;
+            goto fail;
+        }
+        dedup_destroy(dedup);
+    }
+
     /* All tests have passed */
     return 0; /* success :) */
 
@@ -1,13 +1,38 @@
 #ifndef MAIN_DEDUP_H
 #define MAIN_DEDUP_H
 #include "massip-addr.h"
+#include <stddef.h>
+#include <stdint.h>
 
+struct DedupStats
+{
+    uint64_t hits;      /* duplicates that were filtered */
+    uint64_t misses;    /* new responses */
+    uint64_t evictions; /* old responses forgotten to make room */
+};
+
+/**
+ * @param entry_count
+ *      The number of recent responses to remember. This is rounded up,
+ *      and limited to about 60-million.
+ * @param entropy
+ *      A random value, so that the hash can't be predicted.
+ */
 struct DedupTable *
-dedup_create(void);
+dedup_create(size_t entry_count, uint64_t entropy);
 
 void
 dedup_destroy(struct DedupTable *table);
 
+/**
+ * The number of responses the table actually holds.
+ */
+size_t
+dedup_capacity(const struct DedupTable *table);
+
+void
+dedup_get_stats(const struct DedupTable *table, struct DedupStats *stats);
+
 unsigned
 dedup_is_duplicate(         struct DedupTable *dedup,
                             ipaddress ip_them, unsigned port_them,
@@ -0,0 +1,539 @@
+/*
+    Pipelined discovery: find live hosts, then port scan only those
+
+    See main-discover.h for the overview. This file holds the live-host
+    set that the receive threads add to and the transmit threads take
+    from.
+
+    The set is an open-addressed hash table whose slots are claimed with
+    a compare-and-swap, so the receive threads never take a lock. Each
+    newly claimed slot is also pushed onto a multi-producer/multi-consumer
+    ring, which is how the transmit threads find out about new hosts
+    without walking the table.
+*/
+#include "main-discover.h"
+#include "massip-port.h"
+#include "massip-rangesv4.h"
+#include "proto-preprocess.h"
+#include "proto-icmp.h"
+#include "proto-udp.h"
+#include "templ-payloads.h"
+#include "pixie-threads.h"
+#include "rte-ring.h"
+#include "syn-cookie.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/* Keep the table from taking hundreds of megabytes for Internet-wide
+ * scans. Hosts past this are dropped (and counted) rather than scanned. */
+#define DISCOVER_MAX_SLOTS (1 << 22)
+#define DISCOVER_MIN_SLOTS (1 << 8)
+
+struct LiveSlot {
+    /** Zero when empty. For IPv4 this is the address itself, so lookups
+     * are exact; for IPv6 it's a 63-bit hash with the top bit set. Two
+     * IPv6 hosts with the same hash look like one, so the second is never
+     * scanned. With at most DISCOVER_MAX_SLOTS hosts, the odds of that
+     * are about one in a million per scan, which we accept rather than
+     * compare full addresses that another thread may still be writing */
+    volatile uint64_t key;
+    ipaddress ip;
+};
+
+struct LiveHosts {
+    struct LiveSlot *slots;
+    uint64_t mask;
+    unsigned max_found;
+    struct rte_ring *queue;
+
+    volatile unsigned found;
+    volatile unsigned completed;
+    volatile unsigned dropped;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static inline uint64_t
+mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static uint64_t
+live_key(ipaddress ip)
+{
+    if (ip.version == 4)
+        return (1ULL << 32) | ip.ipv4;
+    else
+        return (1ULL << 63) | (mix64(ip.ipv6.hi ^ mix64(ip.ipv6.lo)) >> 1);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct LiveHosts *
+discover_create(uint64_t count_ips)
+{
+    struct LiveHosts *live;
+    uint64_t slot_count = DISCOVER_MIN_SLOTS;
+
+    /* Twice the targets, so the table never gets more than half full
+     * unless every single target answers */
+    while (slot_count < count_ips * 2 && slot_count < DISCOVER_MAX_SLOTS)
+        slot_count *= 2;
+
+    live = CALLOC(1, sizeof(*live));
+    live->slots = HUGE_CALLOC((size_t)slot_count, sizeof(live->slots[0]));
+    live->mask = slot_count - 1;
+    live->max_found = (unsigned)(slot_count / 4 * 3);
+    live->queue = rte_ring_create((unsigned)slot_count, 0);
+
+    LOG(1, "[+] discover: room for %u live hosts\n", live->max_found);
+    return live;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+discover_destroy(struct LiveHosts *live)
+{
+    if (live == NULL)
+        return;
+    HUGE_FREE(live->slots);
+    free(live->queue);
+    free(live);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+discover_entropy(uint64_t entropy)
+{
+    return entropy ^ 0x6a09e667f3bcc908ULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_add(struct LiveHosts *live, ipaddress ip)
+{
+    uint64_t key = live_key(ip);
+    uint64_t i = mix64(key) & live->mask;
+
+    for (;;) {
+        struct LiveSlot *slot = &live->slots[i];
+        uint64_t current = slot->key;
+        int is_claimed;
+
+        if (current == key)
+            return 0; /* already known */
+
+        if (current == 0) {
+            if (live->found >= live->max_found) {
+                pixie_locked_add_u32(&live->dropped, 1);
+                return 0;
+            }
+
+            /* Another receive thread may be adding a host to this same
+             * slot right now, in which case we look at the slot again */
+            is_claimed = pixie_locked_CAS64(&slot->key, key, 0);
+            if (!is_claimed)
+                continue;
+
+            slot->ip = ip;
+            pixie_locked_add_u32(&live->found, 1);
+            if (rte_ring_mp_enqueue(live->queue, slot) != 0) {
+                /* can't happen, the ring is as big as the table */
+                pixie_locked_add_u32(&live->dropped, 1);
+            }
+            return 1;
+        }
+
+        i = (i + 1) & live->mask;
+    }
+}
+
+/***************************************************************************
+ * Same tests as handle_udp() and handle_icmp(), but with the discovery
+ * secret.
+ ***************************************************************************/
+static enum DiscoverReply
+discover_is_udp_reply(const unsigned char *px,
+                      const struct PreprocessedInfo *parsed,
+                      const struct PayloadsUDP *payloads,
+                      uint64_t entropy)
+{
+    const unsigned char *px2;
+    unsigned length2;
+    unsigned source_port2;
+    uint64_t xsum2;
+    SET_COOKIE set_cookie = 0;
+    uint64_t cookie;
+
+    if (payloads == NULL
+        || !payloads_udp_lookup(payloads, parsed->port_src,
+                                &px2, &length2, &source_port2, &xsum2, &set_cookie)
+        || !udp_cookie_is_checked(set_cookie))
+        return Discover_MaybeReply;
+
+    cookie = syn_cookie(parsed->src_ip, parsed->port_src | Templ_UDP,
+                        parsed->dst_ip, parsed->port_dst, entropy);
+    if (udp_cookie_is_valid(set_cookie, px + parsed->app_offset,
+                            parsed->app_length, cookie))
+        return Discover_Reply;
+    return Discover_NotReply;
+}
+
+static enum DiscoverReply
+discover_is_unreachable(const unsigned char *px, unsigned length,
+                        const struct PreprocessedInfo *parsed,
+                        uint64_t entropy)
+{
+    unsigned offset = parsed->transport_offset + 8;
+    unsigned ip_me, ip_them;
+    unsigned port_me, port_them;
+    unsigned ip_proto;
+    unsigned seqno;
+    ipaddress ip_them2;
+    ipaddress ip_me2;
+    unsigned cookie;
+
+    /* Only IPv4 "port unreachable" or "protocol unreachable", which
+     * come from the host itself, rather than a router telling us that
+     * the host isn't there */
+    if (parsed->src_ip.version != 4 || parsed->port_src != 3)
+        return Discover_NotReply;
+    if (parsed->port_dst != 2 && parsed->port_dst != 3)
+        return Discover_NotReply;
+    if (length <= offset)
+        return Discover_NotReply;
+    if (parse_port_unreachable(px + offset, length - offset,
+                               &ip_me, &ip_them, &port_me, &port_them,
+                               &ip_proto, &seqno) != 0)
+        return Discover_NotReply;
+    if (ip_them != parsed->src_ip.ipv4 || ip_me != parsed->dst_ip.ipv4)
+        return Discover_NotReply;
+
+    switch (ip_proto) {
+    case 6:
+        memset(&ip_them2, 0, sizeof(ip_them2));
+        memset(&ip_me2, 0, sizeof(ip_me2));
+        ip_them2.version = 4;
+        ip_them2.ipv4 = ip_them;
+        ip_me2.version = 4;
+        ip_me2.ipv4 = ip_me;
+        cookie = (unsigned)syn_cookie(ip_them2, port_them, ip_me2, port_me,
+                                      entropy);
+        return (cookie == seqno) ? Discover_Reply : Discover_NotReply;
+    case 17:
+    case 132:
+        return Discover_MaybeReply;
+    default:
+        return Discover_NotReply;
+    }
+}
+
+enum DiscoverReply
+discover_is_reply(const unsigned char *px, unsigned length,
+                  const struct PreprocessedInfo *parsed,
+                  const struct PayloadsUDP *payloads,
+                  uint64_t entropy)
+{
+    unsigned seqno_me;
+    unsigned cookie;
+
+    if (parsed->ip_protocol == 17)
+        return discover_is_udp_reply(px, parsed, payloads, entropy);
+
+    switch (parsed->port_src) {
+    case 0: /* ICMP echo reply */
+    case 129:
+        seqno_me = px[parsed->transport_offset+4]<<24
+                    | px[parsed->transport_offset+5]<<16
+                    | px[parsed->transport_offset+6]<<8
+                    | px[parsed->transport_offset+7]<<0;
+        cookie = (unsigned)syn_cookie(parsed->src_ip, Templ_ICMP_echo,
+                                      parsed->dst_ip, 0, entropy);
+        return (cookie == seqno_me) ? Discover_Reply : Discover_NotReply;
+    case 3: /* destination unreachable */
+        return discover_is_unreachable(px, length, parsed, entropy);
+    default:
+        return Discover_NotReply;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_next(struct LiveHosts *live, struct DiscoverQueue *queue,
+              const struct RangeList *ports, unsigned retries,
+              uint64_t seed, unsigned rounds,
+              ipaddress *ip, unsigned *port)
+{
+    uint64_t count_ports;
+    uint64_t index;
+    unsigned n;
+
+    if (queue->count_ports == 0)
+        queue->count_ports = rangelist_count(ports);
+    count_ports = queue->count_ports;
+
+    /* Take on new hosts as slots free up */
+    while (queue->count < DISCOVER_ACTIVE) {
+        struct LiveSlot *slot;
+
+        if (rte_ring_mc_dequeue(live->queue, (void**)&slot) != 0)
+            break;
+        n = queue->count++;
+        queue->host[n].ip = slot->ip;
+        queue->host[n].index = 0;
+        queue->host[n].end = count_ports * (retries + 1);
+        blackrock_init(&queue->host[n].blackrock, count_ports,
+                       seed ^ slot->key, rounds);
+    }
+    if (queue->count == 0)
+        return 0;
+
+    /* Round-robin across the hosts, each in its own random port order */
+    if (queue->next >= queue->count)
+        queue->next = 0;
+    n = queue->next;
+    index = queue->host[n].index++;
+    *ip = queue->host[n].ip;
+    *port = rangelist_pick(ports,
+                blackrock_shuffle(&queue->host[n].blackrock, index % count_ports));
+
+    if (queue->host[n].index >= queue->host[n].end) {
+        /* This host is done, move the last one into its place */
+        queue->host[n] = queue->host[--queue->count];
+        pixie_locked_add_u32(&live->completed, 1);
+    } else
+        queue->next++;
+
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+discover_stats(const struct LiveHosts *live,
+               uint64_t *found, uint64_t *pending, uint64_t *dropped)
+{
+    unsigned x = live->found;
+    unsigned y = live->completed;
+
+    *found = x;
+    *pending = (x > y) ? (x - y) : 0;
+    *dropped = live->dropped;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_is_finished(const struct LiveHosts *live, time_t *when)
+{
+    uint64_t found, pending, dropped;
+    time_t now = time(0);
+
+    if (*when == 0)
+        *when = now;
+    if (now < *when + DISCOVER_GRACE)
+        return 0;
+
+    discover_stats(live, &found, &pending, &dropped);
+    return pending == 0;
+}
+
+/***************************************************************************
+ * Writes the 20 byte IPv4 header of a packet, for the selftest.
+ ***************************************************************************/
+static void
+selftest_ipv4(unsigned char *px, unsigned ip_proto,
+              unsigned ip_src, unsigned ip_dst, unsigned total_length)
+{
+    memset(px, 0, 20);
+    px[0] = 0x45;
+    px[2] = (unsigned char)(total_length>>8);
+    px[3] = (unsigned char)(total_length>>0);
+    px[8] = 64; /* TTL */
+    px[9] = (unsigned char)ip_proto;
+    px[12] = (unsigned char)(ip_src>>24);
+    px[13] = (unsigned char)(ip_src>>16);
+    px[14] = (unsigned char)(ip_src>> 8);
+    px[15] = (unsigned char)(ip_src>> 0);
+    px[16] = (unsigned char)(ip_dst>>24);
+    px[17] = (unsigned char)(ip_dst>>16);
+    px[18] = (unsigned char)(ip_dst>> 8);
+    px[19] = (unsigned char)(ip_dst>> 0);
+}
+
+/***************************************************************************
+ * A DNS reply, or an ICMP unreachable quoting a TCP or UDP probe,
+ * checked against the discovery secret.
+ ***************************************************************************/
+static int
+selftest_reply(struct PayloadsUDP *payloads, uint64_t entropy,
+               unsigned is_unreachable, unsigned ip_proto,
+               unsigned ip_src, unsigned cookie)
+{
+    unsigned char px[256];
+    unsigned char payload[128];
+    unsigned length;
+    unsigned ip_me = 0x0a090909;
+    unsigned ip_them = 0x0a000001;
+    struct PreprocessedInfo parsed;
+
+    memset(payload, 0, sizeof(payload));
+    if (!is_unreachable) {
+        /* DNS reply from port 53 to port 40000 */
+        payload[0] = 0;     payload[1] = 53;
+        payload[2] = 0x9c;  payload[3] = 0x40;
+        payload[4] = 0;     payload[5] = 8 + 12;
+        payload[8] = (unsigned char)(cookie>>8);
+        payload[9] = (unsigned char)(cookie>>0);
+        payload[10] = 0x81; payload[11] = 0x80; /* response */
+        length = 8 + 12;
+    } else {
+        /* port unreachable, quoting our probe from port 40000 to
+         * port 80 (TCP) or port 53 (UDP) */
+        payload[0] = 3;
+        payload[1] = 3;
+        selftest_ipv4(payload + 8, ip_proto, ip_me, ip_them, 40);
+        payload[28] = 0x9c; payload[29] = 0x40;
+        payload[31] = (ip_proto == 6) ? 80 : 53;
+        payload[32] = (unsigned char)(cookie>>24);
+        payload[33] = (unsigned char)(cookie>>16);
+        payload[34] = (unsigned char)(cookie>> 8);
+        payload[35] = (unsigned char)(cookie>> 0);
+        length = 8 + 20 + 8;
+    }
+
+    memset(px, 0, 14);
+    px[12] = 0x08; /* IPv4 */
+    selftest_ipv4(px + 14, is_unreachable ? 1 : 17, ip_src, ip_me,
+                  20 + length);
+    memcpy(px + 14 + 20, payload, length);
+    length += 14 + 20;
+
+    if (!preprocess_frame(px, length, 1, &parsed))
+        return -1;
+    return discover_is_reply(px, length, &parsed, payloads, entropy);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+discover_selftest(void)
+{
+    struct LiveHosts *live;
+    struct DiscoverQueue *queue;
+    struct RangeList ports = {0};
+    unsigned counts[2][3] = {{0}};
+    uint64_t found, pending, dropped;
+    ipaddress ip4;
+    ipaddress ip6;
+    ipaddress ip;
+    unsigned port;
+    unsigned is_error = 0;
+    unsigned i;
+    int err = 0;
+
+    memset(&ip4, 0, sizeof(ip4));
+    memset(&ip6, 0, sizeof(ip6));
+    ip4.version = 4;
+    ip4.ipv4 = 0x0a000001;
+    ip6.version = 6;
+    ip6.ipv6.hi = 0x20010db800000000ULL;
+    ip6.ipv6.lo = 1;
+
+    rangelist_parse_ports(&ports, "80,443,8080", &is_error, 0);
+    rangelist_optimize(&ports);
+    queue = CALLOC(1, sizeof(*queue));
+
+    /* Hosts are added once, no matter how many replies */
+    live = discover_create(4);
+    if (discover_add(live, ip4) != 1 || discover_add(live, ip4) != 0)
+        err = 1;
+    if (discover_add(live, ip6) != 1 || discover_add(live, ip6) != 0)
+        err = 1;
+
+    /* Every port on every host, twice with --retries 1, then nothing */
+    while (discover_next(live, queue, &ports, 1, 1, 14, &ip, &port)) {
+        unsigned h = (ip.version == 6);
+        switch (port) {
+        case 80:   counts[h][0]++; break;
+        case 443:  counts[h][1]++; break;
+        case 8080: counts[h][2]++; break;
+        default:   err = 1; break;
+        }
+        if (counts[h][0] + counts[h][1] + counts[h][2] > 6)
+            break;
+    }
+    for (i=0; i<3; i++) {
+        if (counts[0][i] != 2 || counts[1][i] != 2)
+            err = 1;
+    }
+    discover_stats(live, &found, &pending, &dropped);
+    if (found != 2 || pending != 0 || dropped != 0)
+        err = 1;
+
+    /* Once the table is full, new hosts are counted as dropped */
+    for (i=0; i<1000; i++) {
+        ip4.ipv4 = 0x0b000000 + i;
+        discover_add(live, ip4);
+    }
+    discover_stats(live, &found, &pending, &dropped);
+    if (found != live->max_found || found + dropped != 1002)
+        err = 1;
+    discover_destroy(live);
+
+    rangelist_remove_all(&ports);
+    free(queue);
+
+    /* UDP replies and unreachables count, if they're for our probes */
+    {
+        struct PayloadsUDP *payloads = payloads_udp_create();
+        uint64_t entropy = discover_entropy(0x1234);
+        ipaddress me;
+        ipaddress them;
+        unsigned dns, tcp;
+
+        memset(&me, 0, sizeof(me));
+        memset(&them, 0, sizeof(them));
+        me.version = 4;
+        me.ipv4 = 0x0a090909;
+        them.version = 4;
+        them.ipv4 = 0x0a000001;
+        dns = (unsigned)syn_cookie(them, 53 | Templ_UDP, me, 40000, entropy);
+        tcp = (unsigned)syn_cookie(them, 80, me, 40000, entropy);
+
+        if (selftest_reply(payloads, entropy, 0, 17, them.ipv4, dns) != Discover_Reply)
+            err = 1;
+        if (selftest_reply(payloads, entropy, 0, 17, them.ipv4, dns + 1) != Discover_NotReply)
+            err = 1;
+        if (selftest_reply(payloads, entropy, 1, 6, them.ipv4, tcp) != Discover_Reply)
+            err = 1;
+        if (selftest_reply(payloads, entropy, 1, 6, them.ipv4, tcp + 1) != Discover_NotReply)
+            err = 1;
+        if (selftest_reply(payloads, entropy, 1, 17, them.ipv4, 0) != Discover_MaybeReply)
+            err = 1;
+        /* ...but not when a router says the host isn't there */
+        if (selftest_reply(payloads, entropy, 1, 6, 0x0a0000fe, tcp) != Discover_NotReply)
+            err = 1;
+
+        payloads_udp_destroy(payloads);
+    }
+
+    if (err)
+        fprintf(stderr, "[-] discover: selftest failed\n");
+    return err;
+}
@@ -0,0 +1,151 @@
+/*
+    Pipelined discovery: find live hosts, then port scan only those
+
+    A full-port scan of a large, sparse range normally means two runs:
+    a quick sweep of a few ports (or ping) to find which hosts are up,
+    then a second scan of all ports against the survivors, with a file
+    in between and an idle tail while the first run waits for stragglers.
+
+    With --discover-ports, both happen in the same run. The first phase
+    sweeps the targets on the discovery ports. Any reply (SYN-ACK, RST,
+    a UDP response, an ICMP echo reply, or an ICMP unreachable that the
+    host itself sent about one of our probes) puts that host into a shared live-host set, from
+    which the transmit threads immediately start the second phase: every
+    --ports port on that host, in a per-host random order. Dead hosts
+    never see the full port scan, and the second phase overlaps with the
+    first instead of following it.
+
+    Discovery probes carry SYN cookies made with a different secret than
+    the port scan, so the receive thread can tell the two kinds of reply
+    apart even when the same port is in both lists.
+*/
+#ifndef MAIN_DISCOVER_H
+#define MAIN_DISCOVER_H
+#include "massip-addr.h"
+#include "crypto-blackrock.h"
+#include <stdint.h>
+#include <time.h>
+struct RangeList;
+struct PreprocessedInfo;
+struct PayloadsUDP;
+
+/* How many discovered hosts each transmit thread scans at once. The
+ * probes are interleaved across them so that no single host gets
+ * all of a thread's packets back-to-back. */
+#define DISCOVER_ACTIVE 64
+
+/* Seconds to keep listening for late replies to the discovery pass
+ * before deciding that no more hosts will turn up */
+#define DISCOVER_GRACE 2
+
+/**
+ * The set of hosts found so far, shared by all threads.
+ */
+struct LiveHosts;
+
+/**
+ * The hosts one transmit thread is currently port scanning.
+ */
+struct DiscoverQueue {
+    struct {
+        ipaddress ip;
+        struct BlackRock blackrock;
+        uint64_t index;
+        uint64_t end;
+    } host[DISCOVER_ACTIVE];
+    unsigned count;
+    unsigned next;
+    uint64_t count_ports;
+};
+
+/**
+ * @param count_ips
+ *      The number of target addresses, which sizes the table. It's
+ *      capped so that huge scans don't allocate gigabytes up front;
+ *      hosts beyond the cap are counted and dropped.
+ */
+struct LiveHosts *
+discover_create(uint64_t count_ips);
+
+void
+discover_destroy(struct LiveHosts *live);
+
+/**
+ * The secret used for the SYN cookies of discovery probes, derived from
+ * the scan's --seed.
+ */
+uint64_t
+discover_entropy(uint64_t entropy);
+
+/**
+ * Called by the receive threads when a discovery probe is answered.
+ * Thread-safe.
+ * @return 1 if this host is newly discovered, 0 if already known
+ */
+int
+discover_add(struct LiveHosts *live, ipaddress ip);
+
+enum DiscoverReply {
+    Discover_NotReply = 0,
+    Discover_Reply,         /* only a reply to discovery */
+    Discover_MaybeReply,    /* might be for the port scan too */
+};
+
+/**
+ * Whether a UDP or ICMP packet is a reply to one of our discovery
+ * probes. (SYN-ACKs and RSTs are checked by the receive thread.)
+ * @param payloads
+ *      The UDP payloads, which say where each protocol's reply carries
+ *      the cookie of our request.
+ * @return
+ *      Discover_Reply if the packet carries the discovery cookie, so
+ *      it's for nothing else. Discover_MaybeReply for UDP replies, and
+ *      unreachables about UDP probes, which have no cookie we can
+ *      check, so the host is alive but the packet should be handled as
+ *      usual as well.
+ */
+enum DiscoverReply
+discover_is_reply(const unsigned char *px, unsigned length,
+                  const struct PreprocessedInfo *parsed,
+                  const struct PayloadsUDP *payloads,
+                  uint64_t discover_entropy);
+
+/**
+ * Called by a transmit thread to get the next port-scan probe,
+ * taking on newly discovered hosts as others finish.
+ * @param ports
+ *      The --ports to scan on each host
+ * @param retries
+ *      How many extra times to probe each port
+ * @return 1 if 'ip' and 'port' were filled in, or 0 if there's
+ *      nothing to do at the moment
+ */
+int
+discover_next(struct LiveHosts *live, struct DiscoverQueue *queue,
+              const struct RangeList *ports, unsigned retries,
+              uint64_t seed, unsigned rounds,
+              ipaddress *ip, unsigned *port);
+
+/**
+ * For the status line.
+ * @param found
+ *      The number of hosts discovered so far
+ * @param pending
+ *      Discovered hosts whose port scan hasn't finished, so when this
+ *      is zero after the discovery phase ends, we are done
+ */
+void
+discover_stats(const struct LiveHosts *live,
+               uint64_t *found, uint64_t *pending, uint64_t *dropped);
+
+/**
+ * Called once the discovery pass is over, to find out if the port scans
+ * of the hosts it found are too. The first call starts the clock on
+ * DISCOVER_GRACE, which is kept in 'when'.
+ */
+int
+discover_is_finished(const struct LiveHosts *live, time_t *when);
+
+int discover_selftest(void);
+
+#endif
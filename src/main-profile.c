@@ -0,0 +1,179 @@
+/*
+    Scan profiles: several scans in one process
+
+    See main-profile.h for the configuration. This file contains the
+    weighted fair scheduler the transmit threads use to interleave
+    profiles, and the helpers for matching responses to profiles.
+*/
+#include "main-profile.h"
+#include "massip-port.h"
+#include "util-logger.h"
+#include <string.h>
+#include <stdio.h>
+
+/* The stride of a weight-1 profile. Large enough that integer division
+ * by any reasonable weight doesn't lose precision */
+#define STRIDE_ONE (1ULL << 20)
+
+/***************************************************************************
+ ***************************************************************************/
+void
+profsched_init(struct ProfileScheduler *sched,
+               const unsigned *weights, unsigned count)
+{
+    unsigned i;
+
+    memset(sched, 0, sizeof(*sched));
+    if (count > MAX_PROFILES)
+        count = MAX_PROFILES;
+    sched->count = count;
+
+    for (i=0; i<count; i++) {
+        unsigned weight = weights[i];
+        if (weight == 0)
+            weight = 1;
+        sched->stride[i] = STRIDE_ONE / weight;
+        if (sched->stride[i] == 0)
+            sched->stride[i] = 1;
+
+        /* Start each at half a stride, so that heavier profiles go
+         * first rather than everyone starting in lock-step */
+        sched->pass[i] = sched->stride[i] / 2;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+profsched_next(struct ProfileScheduler *sched)
+{
+    int best = -1;
+    unsigned i;
+
+    for (i=0; i<sched->count; i++) {
+        if (sched->is_done[i])
+            continue;
+        if (sched->is_sequential)
+            return (int)i;
+        if (best < 0 || sched->pass[i] < sched->pass[best])
+            best = (int)i;
+    }
+    if (best >= 0)
+        sched->pass[best] += sched->stride[best];
+    return best;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+profsched_set_sequential(struct ProfileScheduler *sched)
+{
+    sched->is_sequential = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+profsched_done(struct ProfileScheduler *sched, unsigned index)
+{
+    if (index < sched->count)
+        sched->is_done[index] = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+profile_is_target(const struct ScanProfile *profile,
+                  ipaddress ip, unsigned ip_proto, unsigned port)
+{
+    if (!massip_has_ip(&profile->targets, ip))
+        return 0;
+
+    switch (ip_proto) {
+    case 6: /* TCP */
+        return massip_has_port(&profile->targets, port);
+    case 17: /* UDP */
+        return massip_has_port(&profile->targets, port + Templ_UDP);
+    case 132: /* SCTP */
+        return massip_has_port(&profile->targets, port + Templ_SCTP);
+    default:
+        /* ICMP, ARP, and other protocols are matched on address alone */
+        return 1;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+profile_range(const struct ScanProfile *profile)
+{
+    uint64_t count_ports = rangelist_count(&profile->targets.ports);
+
+    return rangelist_count(&profile->targets.ipv4) * count_ports
+            + range6list_count(&profile->targets.ipv6).lo * count_ports;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+profile_selftest(void)
+{
+    struct ProfileScheduler sched;
+    unsigned weights[3] = {1, 3, 0};
+    unsigned counts[3] = {0, 0, 0};
+    unsigned i;
+    int k;
+
+    /* A 1:3 split stays 1:3, and a weight of 0 is treated as 1 */
+    profsched_init(&sched, weights, 2);
+    for (i=0; i<400; i++)
+        counts[profsched_next(&sched)]++;
+    if (counts[0] != 100 || counts[1] != 300)
+        goto fail;
+
+    /* Interleaved rather than in bursts: in any 4 picks, the light
+     * profile goes at least once */
+    profsched_init(&sched, weights, 2);
+    for (i=0; i<100; i++) {
+        unsigned light = 0;
+        unsigned j;
+        for (j=0; j<4; j++)
+            light += (profsched_next(&sched) == 0);
+        if (light != 1)
+            goto fail;
+    }
+
+    /* When one finishes, the others get everything */
+    profsched_init(&sched, weights, 3);
+    profsched_done(&sched, 1);
+    memset(counts, 0, sizeof(counts));
+    for (i=0; i<100; i++)
+        counts[profsched_next(&sched)]++;
+    if (counts[1] != 0 || counts[0] != 50 || counts[2] != 50)
+        goto fail;
+
+    /* And then nothing */
+    profsched_done(&sched, 0);
+    profsched_done(&sched, 2);
+    k = profsched_next(&sched);
+    if (k != -1)
+        goto fail;
+
+    /* Sequential: the first that isn't done, regardless of weight */
+    profsched_init(&sched, weights, 3);
+    profsched_set_sequential(&sched);
+    if (profsched_next(&sched) != 0 || profsched_next(&sched) != 0)
+        goto fail;
+    profsched_done(&sched, 0);
+    if (profsched_next(&sched) != 1)
+        goto fail;
+    profsched_done(&sched, 1);
+    profsched_done(&sched, 2);
+    if (profsched_next(&sched) != -1)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "[-] profile: scheduler selftest failed\n");
+    return 1;
+}
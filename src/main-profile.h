@@ -0,0 +1,118 @@
+/*
+    Scan profiles: several scans in one process
+
+    Instead of running separate masscan processes for (say) a daily
+    full-port sweep of our own ranges and a top-100-ports Internet scan,
+    each fighting over the same NIC with its own ARP state and rate
+    limit, both can be described as profiles in one configuration:
+
+        profile = own
+        weight = 1
+        range = 10.0.0.0/8
+        ports = 0-65535
+        output-filename = own.xml
+
+        profile = inet
+        weight = 3
+        range = 0.0.0.0/0
+        ports = 80,443,22
+        output-filename = inet.xml
+
+    The transmit threads interleave probes from the profiles with a
+    weighted fair (stride) scheduler under the one global --max-rate.
+    Each profile has its own targets, ports, seed, retries, output and
+    resume point.
+*/
+#ifndef MAIN_PROFILE_H
+#define MAIN_PROFILE_H
+#include "massip.h"
+#include "massip-addr.h"
+#include <stdint.h>
+
+#define MAX_PROFILES 16
+
+struct ScanProfile {
+    char name[32];
+
+    /** What this profile scans. Global excludes are applied to it */
+    struct MassIP targets;
+
+    /** Order of the scan, defaults to the global --seed */
+    uint64_t seed;
+
+    /** Defaults to the global --retries */
+    unsigned retries;
+
+    /** Share of the --max-rate relative to the other profiles */
+    unsigned weight;
+
+    /** Where results for these targets go, or empty for the global
+     * --output-filename */
+    char output_filename[256];
+
+    /** Where to restart this profile with --resume */
+    uint64_t resume_index;
+
+    unsigned is_seed:1;
+    unsigned is_retries:1;
+};
+
+/**
+ * Weighted fair scheduler across profiles. Each profile advances a
+ * 'pass' value by a stride inversely proportional to its weight, and
+ * the one furthest behind goes next. This is deterministic, costs a
+ * few compares per packet, and a profile that finishes simply drops
+ * out so the others share its bandwidth.
+ */
+struct ProfileScheduler {
+    unsigned count;
+    uint64_t pass[MAX_PROFILES];
+    uint64_t stride[MAX_PROFILES];
+    unsigned char is_done[MAX_PROFILES];
+
+    /** Instead of interleaving, finish each before starting the next,
+     * as with --port-tiers */
+    unsigned is_sequential:1;
+};
+
+void
+profsched_init(struct ProfileScheduler *sched,
+               const unsigned *weights, unsigned count);
+
+/**
+ * Runs them one after another, in order, instead of interleaving.
+ */
+void
+profsched_set_sequential(struct ProfileScheduler *sched);
+
+/**
+ * @return the index of the profile that sends the next probe, or -1
+ *      if every profile is done
+ */
+int
+profsched_next(struct ProfileScheduler *sched);
+
+/**
+ * Removes a profile from the rotation once it has sent everything.
+ */
+void
+profsched_done(struct ProfileScheduler *sched, unsigned index);
+
+/**
+ * Whether a response belongs to a profile's targets. The port is the
+ * one on the wire, translated using 'ip_proto' to the way ports are
+ * stored in the target list (UDP ports offset by Templ_UDP, etc.).
+ */
+int
+profile_is_target(const struct ScanProfile *profile,
+                  ipaddress ip, unsigned ip_proto, unsigned port);
+
+/**
+ * Number of probes in one pass over the profile's targets.
+ */
+uint64_t
+profile_range(const struct ScanProfile *profile);
+
+int profile_selftest(void);
+
+#endif
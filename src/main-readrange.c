@@ -88,7 +88,7 @@ main_readrange(struct Masscan *masscan)
     }
 
     for (i=0; i<list6->count; i++) {
-        struct Range6 range = list6->list[i];
+        struct Range6 range = range6list_at(list6, i);
         ipaddress_formatted_t fmt = ipv6address_fmt(range.begin);
         fprintf(fp, "%s", fmt.string);
         if (!ipv6address_is_equal(range.begin, range.end)) {
@@ -227,7 +227,7 @@ status_print(
             if (json_status == 1)
                 fmt = json_fmt_waiting;
             else
-                fmt = "rate:%6.2f-kpps, %5.2f%% done, waiting %d-secs, found=%" PRIu64 "       \r";
+                fmt = "rate:%6.2f-kpps, %5.2f%% done, waiting %d-secs, found=%" PRIu64;
 
             fprintf(stderr,
                     fmt,
@@ -244,7 +244,7 @@ status_print(
             if (json_status == 1)
                 fmt = json_fmt_running;
             else
-                fmt = "rate:%6.2f-kpps, %5.2f%% done,%4u:%02u:%02u remaining, found=%" PRIu64 "       \r";
+                fmt = "rate:%6.2f-kpps, %5.2f%% done,%4u:%02u:%02u remaining, found=%" PRIu64;
 
             fprintf(stderr,
                 fmt,
@@ -259,6 +259,11 @@ status_print(
                 max_count,
                 max_count-count);
         }
+        if (json_status != 1) {
+            if (status->extra[0])
+                fprintf(stderr, " [%s]", status->extra);
+            fprintf(stderr, "       \r");
+        }
     }
     fflush(stderr);
 
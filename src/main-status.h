@@ -22,6 +22,9 @@ struct Status
     uint64_t total_tcbs;
     uint64_t total_synacks;
     uint64_t total_syns;
+
+    /* Appended to the status line, like each --profile's progress */
+    char extra[256];
 };
 
 
@@ -21,6 +21,8 @@
 #include "massip-parse.h"
 #include "massip-port.h"
 #include "main-status.h"        /* printf() regular status updates */
+#include "main-discover.h"      /* --discover-ports */
+#include "main-coordinator.h"   /* --coordinator, --worker */
 #include "main-throttle.h"      /* rate limit */
 #include "main-dedup.h"         /* ignore duplicate responses */
 #include "main-ptrace.h"        /* for nmap --packet-trace feature */
@@ -36,7 +38,9 @@
 #include "stack-arpv4.h"        /* Handle ARP resolution and requests */
 #include "rawsock.h"            /* API on top of Linux, Windows, Mac OS X*/
 #include "rawsock-adapter.h"    /* Get Ethernet adapter configuration */
-#include "rawsock-pcapfile.h"   /* for saving pcap files w/ raw packets */
+#include "rawsock-pcapwriter.h" /* for saving pcap files w/ raw packets */
+#include "rawsock-xdp.h"        /* AF_XDP kernel bypass (Linux) */
+#include "rawsock-vnet.h"       /* checksum offload (Linux) */
 #include "syn-cookie.h"         /* for SYN-cookies on send */
 #include "output.h"             /* for outputting results */
 #include "rte-ring.h"           /* producer/consumer ring buffer */
@@ -44,6 +48,7 @@
 #include "smack.h"              /* Aho-corasick state-machine pattern-matcher */
 #include "pixie-timer.h"        /* portable time functions */
 #include "pixie-threads.h"      /* portable threads */
+#include "pixie-topology.h"     /* CPU layout for --pin-threads */
 #include "pixie-backtrace.h"    /* maybe print backtrace on crash */
 #include "templ-payloads.h"     /* UDP packet payloads */
 #include "in-binary.h"          /* convert binary output to XML/JSON */
@@ -55,6 +60,10 @@
 #include "proto-arp.h"          /* for responding to ARP requests */
 #include "proto-banner1.h"      /* for snatching banners from systems */
 #include "stack-tcp-core.h"          /* for TCP/IP connection table */
+#include "stack-tcp-stateless.h"     /* --stateless-banners */
+#include "stack-tcp-learn.h"         /* --hello-learn */
+#include "in-analytics.h"           /* --readscan-stats */
+#include "out-compress.h"           /* --output-compress */
 #include "proto-preprocess.h"   /* quick parse of packets */
 #include "proto-icmp.h"         /* handle ICMP responses */
 #include "proto-udp.h"          /* handle UDP responses */
@@ -96,6 +105,57 @@ time_t global_now;
 uint64_t usec_start;
 
 
+struct ThreadPair;
+
+/***************************************************************************
+ * Each network adapter has one or more receive threads (--rx-threads).
+ * When there are more than one, each opens its own handle on the adapter
+ * and joins a PACKET_FANOUT group, so that the kernel splits the incoming
+ * flows between them. Each has its own stack (for queuing packets to the
+ * transmit thread), TCP connection table, dedup table, and output.
+ ***************************************************************************/
+struct RecvThread {
+    /** The transmit/receive thread-pair that this belongs to */
+    struct ThreadPair *parms;
+
+    /** The handle we receive on. For the first receive thread, this is
+     * the same as the transmit thread's adapter */
+    struct Adapter *adapter;
+
+    /** Packets going to the transmit thread, such as RSTs, ARP
+     * responses, and --banners TCP packets */
+    struct stack_t *stack;
+
+    /** Index within this adapter's receive threads */
+    unsigned rx_index;
+
+    /** Index across all adapters' receive threads, used for naming
+     * per-thread output files */
+    unsigned thread_index;
+
+    unsigned done_receiving;
+
+    /** The CPU to pin this thread to (--pin-threads), or -1 */
+    int cpu;
+
+    uint64_t *total_synacks;
+    uint64_t *total_tcbs;
+
+    /** With --script, what this thread's own Lua VM has been doing */
+    struct ScriptingStats *script_stats;
+    struct BannerPoolStats *banner_stats;
+    struct TcpHandshakeStats *handshake_stats;
+
+    /** Whether servers speak first, as seen by this thread. This outlives
+     * the thread, so that the main thread can save it (--hello-learn) */
+    struct HelloLearn *hello_learn;
+
+    /** With --pcap, what the writer thread has done */
+    struct PcapWriterStats *pcap_stats;
+
+    size_t thread_handle_recv;
+};
+
 /***************************************************************************
  * We create a pair of transmit/receive threads for each network adapter.
  * This structure contains the parameters we send to each pair.
@@ -111,7 +171,20 @@ struct ThreadPair {
      * clustering. */
     struct Adapter *adapter;
 
-    struct stack_t *stack;
+    /**
+     * The receive threads for this adapter (--rx-threads). The transmit
+     * thread drains all of their stacks.
+     */
+    struct RecvThread *recv;
+    unsigned recv_count;
+
+    /**
+     * A receive thread of our own that only captures ARP requests and
+     * NDP solicitations, so that they don't queue up behind a flood of
+     * SYN-ACKs (--neighbor-thread). NULL when the main receive threads
+     * answer them instead.
+     */
+    struct RecvThread *neighbor;
 
     /**
      * The index of the network adapter that we are using for this
@@ -129,6 +202,30 @@ struct ThreadPair {
      */
     volatile uint64_t my_index;
 
+    /** The same, for each --profile */
+    volatile uint64_t my_profile_index[MAX_PROFILES];
+
+    /** Along with 'my_index', where the transmit thread is in its retries
+     * and --infinite passes, for --checkpoint. They're all changed
+     * together while 'my_seqno' is odd, so that a reader can tell when
+     * it's seen half of an update */
+    volatile unsigned my_seqno;
+    volatile unsigned my_retry;
+    volatile uint64_t my_repeats;
+
+    /** Where the transmit thread starts, copied from the --resume
+     * settings before it starts, since checkpoints change those */
+    uint64_t resume_index;
+    uint64_t resume_profile[MAX_PROFILES];
+    struct ResumeThread resume;
+
+    /** With --worker, our connection to the coordinator, which says
+     * which chunk of indexes to scan next, and how far the whole scan
+     * has got, for the status line */
+    struct CoordWorker *coord;
+    uint64_t coord_stride;
+    volatile uint64_t coord_done;
+
 
     /* This is used both by the transmit and receive thread for
      * formatting packets */
@@ -144,18 +241,17 @@ struct ThreadPair {
     macaddress_t router_mac_ipv6;
 
     unsigned done_transmitting;
-    unsigned done_receiving;
 
     double pt_start;
 
     struct Throttler throttler[1];
 
-    uint64_t *total_synacks;
-    uint64_t *total_tcbs;
     uint64_t *total_syns;
 
+    /** The CPU to pin the transmit thread to (--pin-threads), or -1 */
+    int cpu;
+
     size_t thread_handle_xmit;
-    size_t thread_handle_recv;
 };
 
 struct source_t {
@@ -193,6 +289,83 @@ adapter_get_source_addresses(const struct Masscan *masscan,
 }
 
 
+/***************************************************************************
+ * Transmit the packets queued up by all the receive threads belonging to
+ * this adapter.
+ ***************************************************************************/
+static void
+flush_recv_stacks(struct ThreadPair *parms, struct Adapter *adapter,
+                  uint64_t *packets_sent, uint64_t *batch_size)
+{
+    unsigned i;
+
+    if (parms->neighbor)
+        stack_flush_packets(parms->neighbor->stack, adapter,
+                            packets_sent, batch_size);
+    for (i=0; i<parms->recv_count; i++)
+        stack_flush_packets(parms->recv[i].stack, adapter,
+                            packets_sent, batch_size);
+}
+
+/***************************************************************************
+ * One pass over a set of targets within a transmit thread. Without
+ * --profile, there's just one of these, for the global targets.
+ ***************************************************************************/
+struct ScanRun {
+    const struct MassIP *targets;
+    uint64_t count_ipv4;
+    uint64_t count_ipv6;
+    uint64_t range;
+    uint64_t range_ipv6;
+    struct BlackRock blackrock;
+    uint64_t seed;
+    uint64_t retries;
+    uint64_t i;
+    uint64_t end;
+    unsigned r;
+};
+
+/***************************************************************************
+ * --worker
+ * Gets the next chunk of indexes from the coordinator. When the last
+ * chunks are all being scanned by other workers, keep asking, in case
+ * one of them dies and its chunk comes back.
+ * @return 1 with the chunk in [run->i..run->end), or 0 when there's
+ *      nothing more to do
+ ***************************************************************************/
+static int
+worker_next_chunk(struct ThreadPair *parms, struct ScanRun *run)
+{
+    for (;;) {
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        uint64_t done = 0;
+
+        switch (coord_worker_next(parms->coord, &begin, &end, &done)) {
+        case Coord_Chunk:
+            LOG(3, "THREAD: xmit: chunk [%llu..%llu]\n",
+                (unsigned long long)begin, (unsigned long long)end);
+            parms->coord_done = done;
+            run->i = begin;
+            run->end = end;
+            run->r = (unsigned)run->retries + 1;
+            return 1;
+        case Coord_Wait:
+            parms->coord_done = done;
+            if (is_tx_done)
+                return 0;
+            pixie_mssleep(250);
+            continue;
+        case Coord_Done:
+            return 0;
+        case Coord_Error:
+        default:
+            LOG(0, "[-] worker: lost the coordinator, stopping\n");
+            return 0;
+        }
+    }
+}
+
 /***************************************************************************
  * This thread spews packets as fast as it can
  *
@@ -204,33 +377,52 @@ static void
 transmit_thread(void *v) /*aka. scanning_thread() */
 {
     struct ThreadPair *parms = (struct ThreadPair *)v;
-    uint64_t i;
-    uint64_t start;
-    uint64_t end;
     const struct Masscan *masscan = parms->masscan;
-    uint64_t retries = masscan->retries;
     uint64_t rate = (uint64_t)masscan->max_rate;
-    unsigned r = (unsigned)retries + 1;
-    uint64_t range;
-    uint64_t range_ipv6;
-    struct BlackRock blackrock;
-    uint64_t count_ipv4 = rangelist_count(&masscan->targets.ipv4);
-    uint64_t count_ipv6 = range6list_count(&masscan->targets.ipv6).lo;
+    struct ScanRun runs[MAX_PROFILES];
+    unsigned run_count = masscan->profile_count ? masscan->profile_count : 1;
+    unsigned run_active;
+    uint64_t tier_offset[MAX_PROFILES];
+    uint64_t tiered;
+    struct ProfileScheduler sched;
+    unsigned weights_of_runs[MAX_PROFILES];
+    unsigned k;
     struct Throttler *throttler = parms->throttler;
     struct TemplateSet pkt_template = templ_copy(parms->tmplset);
     struct Adapter *adapter = parms->adapter;
     uint64_t packets_sent = 0;
     unsigned increment = masscan->shard.of * masscan->nic_count;
     struct source_t src;
-    uint64_t seed = masscan->seed;
-    uint64_t repeats = 0; /* --infinite repeats */
+    uint64_t repeats = parms->resume.repeats; /* --infinite repeats */
     uint64_t *status_syn_count;
     uint64_t entropy = masscan->seed;
+    uint64_t run_entropy = entropy;
+    struct TemplateSet discover_template;
+    struct TemplateSet *run_template = &pkt_template;
+    struct LiveHosts *live = masscan->discover.live;
+    struct DiscoverQueue *discovered = NULL;
+    time_t when_discovered = 0;
+    uint64_t when_reported = 0;
+
+    /* With --worker, each chunk is scanned in order by this thread
+     * alone, and retries are spaced as the coordinator says, so that
+     * all the workers agree on the order */
+    if (parms->coord) {
+        increment = 1;
+        rate = parms->coord_stride;
+    }
 
     /* Wait to make sure receive_thread is ready */
     pixie_usleep(1000000);
     LOG(1, "[+] starting transmit thread #%u\n", parms->nic_index);
 
+    /* Lock this thread to a CPU (--pin-threads) */
+    if (parms->cpu >= 0) {
+        pixie_cpu_set_affinity((unsigned)parms->cpu);
+        LOG(1, "[+] transmit thread #%u pinned to CPU %d\n",
+                parms->nic_index, parms->cpu);
+    }
+
     /* export a pointer to this variable outside this threads so
      * that the 'status' system can print the rate of syns we are
      * sending */
@@ -248,36 +440,126 @@ transmit_thread(void *v) /*aka. scanning_thread() */
      * --max-rate parameter */
     throttler_start(throttler, masscan->max_rate/masscan->nic_count);
 
+    /* With --discover-ports, the pass over the targets is just the
+     * discovery phase. Its probes use a different SYN cookie, so that
+     * the receive thread can tell their replies apart */
+    if (live) {
+        discovered = CALLOC(1, sizeof(*discovered));
+        run_entropy = discover_entropy(entropy);
+
+        /* Some templates, like ICMP, make their own cookie. This shares
+         * the packet buffers, which is fine within this thread */
+        discover_template = pkt_template;
+        discover_template.entropy = run_entropy;
+        run_template = &discover_template;
+    }
+
 infinite:
-    
-    /* Create the shuffler/randomizer. This creates the 'range' variable,
-     * which is simply the number of IP addresses times the number of
-     * ports.
-     * IPv6: low index will pick addresses from the IPv6 ranges, and high
-     * indexes will pick addresses from the IPv4 ranges. */
-    range = count_ipv4 * rangelist_count(&masscan->targets.ports)
-            + count_ipv6 * rangelist_count(&masscan->targets.ports);
-    range_ipv6 = count_ipv6 * rangelist_count(&masscan->targets.ports);
-    blackrock_init(&blackrock, range, seed, masscan->blackrock_rounds);
-
-    /* Calculate the 'start' and 'end' of a scan. One reason to do this is
-     * to support --shard, so that multiple machines can co-operate on
-     * the same scan. Another reason to do this is so that we can bleed
-     * a little bit past the end when we have --retries. Yet another
-     * thing to do here is deal with multiple network adapters, which
-     * is essentially the same logic as shards. */
-    start = masscan->resume.index + (masscan->shard.one-1) * masscan->nic_count + parms->nic_index;
-    end = range;
-    if (masscan->resume.count && end > start + masscan->resume.count)
-        end = start + masscan->resume.count;
-    end += retries * range;
+
+    /*
+     * Set up a pass over the targets. Normally, there's just the one,
+     * but with --profile, there's a pass per profile, and we interleave
+     * them by weight. With --port-tiers, there's a pass per tier, run
+     * one after the other.
+     */
+    run_active = 0;
+    tiered = 0;
+    if (masscan->tiers.count)
+        run_count = masscan->tiers.count;
+    for (k=0; k<run_count; k++) {
+        struct ScanRun *run = &runs[k];
+        const struct ScanProfile *profile = NULL;
+        uint64_t resume_index = parms->resume_index;
+        uint64_t count_ports;
+        unsigned weight = 1;
+
+        run->targets = &masscan->targets;
+        if (live)
+            run->targets = &masscan->discover.targets;
+        run->seed = masscan->seed;
+        run->retries = masscan->retries;
+        if (masscan->profile_count) {
+            profile = &masscan->profile[k];
+            run->targets = &profile->targets;
+            run->seed = profile->seed;
+            run->retries = profile->retries;
+            resume_index = parms->resume_profile[k];
+            weight = profile->weight;
+        }
+        if (masscan->tiers.count)
+            run->targets = &masscan->tiers.targets[k];
+        run->seed += repeats;
+        run->r = (unsigned)run->retries + 1;
+
+        /* Create the shuffler/randomizer. This creates the 'range' variable,
+         * which is simply the number of IP addresses times the number of
+         * ports.
+         * IPv6: low index will pick addresses from the IPv6 ranges, and high
+         * indexes will pick addresses from the IPv4 ranges. */
+        count_ports = rangelist_count(&run->targets->ports);
+        run->count_ipv4 = rangelist_count(&run->targets->ipv4);
+        run->count_ipv6 = range6list_count(&run->targets->ipv6).lo;
+        run->range = run->count_ipv4 * count_ports
+                    + run->count_ipv6 * count_ports;
+        run->range_ipv6 = run->count_ipv6 * count_ports;
+        blackrock_init(&run->blackrock, run->range, run->seed, masscan->blackrock_rounds);
+
+        /* With --port-tiers, the index (and so the --resume point) counts
+         * through each tier in turn. Tiers before the resume point are
+         * already done, and those after it start from the beginning */
+        if (masscan->tiers.count) {
+            tier_offset[k] = tiered;
+            resume_index = 0;
+            if (parms->resume_index > tiered)
+                resume_index = parms->resume_index - tiered;
+            tiered += run->range * (run->retries + 1);
+        }
+
+        /* Calculate the 'start' and 'end' of a scan. One reason to do this is
+         * to support --shard, so that multiple machines can co-operate on
+         * the same scan. Another reason to do this is so that we can bleed
+         * a little bit past the end when we have --retries. Yet another
+         * thing to do here is deal with multiple network adapters, which
+         * is essentially the same logic as shards. */
+        run->i = resume_index + (masscan->shard.one-1) * masscan->nic_count + parms->nic_index;
+
+        /* When we know exactly where this thread was, rather than just the
+         * slowest thread, start right there. That index already includes
+         * the offset for shards and adapters */
+        if (parms->resume.is_valid && !masscan->profile_count) {
+            uint64_t offset = masscan->tiers.count ? tier_offset[k] : 0;
+            if (parms->resume.index >= offset) {
+                run->i = parms->resume.index - offset;
+                if (parms->resume.retry >= 1 && parms->resume.retry <= run->retries + 1)
+                    run->r = parms->resume.retry;
+            }
+        }
+        run->end = run->range;
+        if (masscan->resume.count && run->end > run->i + masscan->resume.count)
+            run->end = run->i + masscan->resume.count;
+        run->end += run->retries * run->range;
+        if (parms->coord && !worker_next_chunk(parms, run))
+            run->i = run->end = 0;
+
+        weights_of_runs[k] = weight;
+        LOG(3, "THREAD: xmit: run #%u: [%llu..%llu]\n", k, run->i, run->end);
+    }
+    profsched_init(&sched, weights_of_runs, run_count);
+    if (masscan->tiers.count)
+        profsched_set_sequential(&sched);
+    for (k=0; k<run_count; k++) {
+        if (runs[k].i >= runs[k].end)
+            profsched_done(&sched, k);
+        else
+            run_active++;
+    }
 
 
     /* -----------------
      * the main loop
      * -----------------*/
-    LOG(3, "THREAD: xmit: starting main loop: [%llu..%llu]\n", start, end);
-    for (i=start; i<end; ) {
+    LOG(3, "THREAD: xmit: starting main loop\n");
+    while (run_active || live) {
         uint64_t batch_size;
 
         /*
@@ -295,8 +577,7 @@ infinite:
          * then "batch_size" will get decremented to zero, and we won't be
          * able to transmit SYN packets.
          */
-        stack_flush_packets(parms->stack, adapter,
-                        &packets_sent, &batch_size);
+        flush_recv_stacks(parms, adapter, &packets_sent, &batch_size);
 
 
         /*
@@ -309,10 +590,64 @@ infinite:
          * very precise packet-timing for low rates below 100,000 pps,
          * while not incurring the overhead for high packet rates.
          */
-        while (batch_size && i < end) {
+        while (batch_size && (run_active || live)) {
+            struct ScanRun *run;
             uint64_t xXx;
             uint64_t cookie;
-            
+            int next;
+            ipaddress target;
+            unsigned target_port;
+
+            /*
+             * PIPELINED PORT SCAN:
+             *  With --discover-ports, scanning the ports of hosts that
+             *  have answered takes priority over discovering more. This
+             *  also keeps the backlog of discovered hosts bounded by
+             *  how fast we can scan them.
+             */
+            if (live && discover_next(live, discovered,
+                                      &masscan->targets.ports, masscan->retries,
+                                      entropy, masscan->blackrock_rounds,
+                                      &target, &target_port)) {
+                if (target.version == 6) {
+                    cookie = syn_cookie_ipv6(target.ipv6, target_port,
+                                             src.ipv6, src.port, entropy);
+                    rawsock_send_probe_ipv6(adapter,
+                            target.ipv6, target_port, src.ipv6, src.port,
+                            (unsigned)cookie, !batch_size, &pkt_template);
+                } else {
+                    unsigned ip_me = src.ipv4;
+                    unsigned port_me = src.port;
+
+                    /* Spread over the source addresses and ports, like
+                     * the probes below */
+                    if (src.ipv4_mask > 1 || src.port_mask > 1) {
+                        uint64_t ck = syn_cookie_ipv4(target.ipv4, target_port,
+                                            (unsigned)packets_sent,
+                                            (unsigned)(packets_sent>>32),
+                                            entropy);
+                        port_me = src.port + (ck & src.port_mask);
+                        ip_me = src.ipv4 + ((ck>>16) & src.ipv4_mask);
+                    }
+                    cookie = syn_cookie_ipv4(target.ipv4, target_port,
+                                             ip_me, port_me, entropy);
+                    rawsock_send_probe_ipv4(adapter,
+                            target.ipv4, target_port, ip_me, port_me,
+                            (unsigned)cookie, !batch_size, &pkt_template);
+                }
+                batch_size--;
+                packets_sent++;
+                (*status_syn_count)++;
+                continue;
+            }
+            if (!run_active)
+                break;
+
+            /* Pick whose turn it is (--profile weight) */
+            next = profsched_next(&sched);
+            if (next < 0)
+                break;
+            run = &runs[next];
 
 
             /*
@@ -325,27 +660,27 @@ infinite:
              *  order. Then, once we've shuffled the index, we "pick" the
              *  IP address and port that the index refers to.
              */
-            xXx = (i + (r--) * rate);
-            if (rate > range)
-                xXx %= range;
+            xXx = (run->i + (run->r--) * rate);
+            if (rate > run->range)
+                xXx %= run->range;
             else
-                while (xXx >= range)
-                    xXx -= range;
-            xXx = blackrock_shuffle(&blackrock,  xXx);
+                while (xXx >= run->range)
+                    xXx -= run->range;
+            xXx = blackrock_shuffle(&run->blackrock,  xXx);
             
-            if (xXx < range_ipv6) {
+            if (xXx < run->range_ipv6) {
                 ipv6address ip_them;
                 unsigned port_them;
                 ipv6address ip_me;
                 unsigned port_me;
 
-                ip_them = range6list_pick(&masscan->targets.ipv6, xXx % count_ipv6);
-                port_them = rangelist_pick(&masscan->targets.ports, xXx / count_ipv6);
+                ip_them = range6list_pick(&run->targets->ipv6, xXx % run->count_ipv6);
+                port_them = rangelist_pick(&run->targets->ports, xXx / run->count_ipv6);
 
                 ip_me = src.ipv6;
                 port_me = src.port;
                 
-                cookie = syn_cookie_ipv6(ip_them, port_them, ip_me, port_me, entropy);
+                cookie = syn_cookie_ipv6(ip_them, port_them, ip_me, port_me, run_entropy);
 
                 rawsock_send_probe_ipv6(
                         adapter,
@@ -353,7 +688,7 @@ infinite:
                         ip_me, port_me,
                         (unsigned)cookie,
                         !batch_size, /* flush queue on last packet in batch */
-                        &pkt_template
+                        run_template
                         );
 
                 /* Our index selects an IPv6 target */
@@ -366,18 +701,18 @@ infinite:
                 unsigned ip_me;
                 unsigned port_me;
 
-                xXx -= range_ipv6;
+                xXx -= run->range_ipv6;
 
-                ip_them = rangelist_pick(&masscan->targets.ipv4, xXx % count_ipv4);
-                port_them = rangelist_pick(&masscan->targets.ports, xXx / count_ipv4);
+                ip_them = rangelist_pick(&run->targets->ipv4, xXx % run->count_ipv4);
+                port_them = rangelist_pick(&run->targets->ports, xXx / run->count_ipv4);
 
                 /*
                  * SYN-COOKIE LOGIC
                  *  Figure out the source IP/port, and the SYN cookie
                  */
                 if (src.ipv4_mask > 1 || src.port_mask > 1) {
-                    uint64_t ck = syn_cookie_ipv4((unsigned)(i+repeats),
-                                            (unsigned)((i+repeats)>>32),
+                    uint64_t ck = syn_cookie_ipv4((unsigned)(run->i+repeats),
+                                            (unsigned)((run->i+repeats)>>32),
                                             (unsigned)xXx, (unsigned)(xXx>>32),
                                             entropy);
                     port_me = src.port + (ck & src.port_mask);
@@ -386,7 +721,7 @@ infinite:
                     ip_me = src.ipv4;
                     port_me = src.port;
                 }
-                cookie = syn_cookie_ipv4(ip_them, port_them, ip_me, port_me, entropy);
+                cookie = syn_cookie_ipv4(ip_them, port_them, ip_me, port_me, run_entropy);
 
                 /*
                  * SEND THE PROBE
@@ -401,7 +736,7 @@ infinite:
                         ip_me, port_me,
                         (unsigned)cookie,
                         !batch_size, /* flush queue on last packet in batch */
-                        &pkt_template
+                        run_template
                         );
             }
 
@@ -418,17 +753,59 @@ infinite:
              *  number, we can do lots of creative stuff, like doing clever
              *  retransmits and sharding.
              */
-            if (r == 0) {
-                i += increment; /* <------ increment by 1 normally, more with shards/nics */
-                r = (unsigned)retries + 1;
+            if (run->r == 0) {
+                run->i += increment; /* <------ increment by 1 normally, more with shards/nics */
+                run->r = (unsigned)run->retries + 1;
+                if (run->i >= run->end
+                    && !(parms->coord && worker_next_chunk(parms, run))) {
+                    profsched_done(&sched, (unsigned)next);
+                    run_active--;
+                }
             }
 
         } /* end of batch */
 
 
         /* save our current location for resuming, if the user pressed
-         * <ctrl-c> to exit early */
-        parms->my_index = i;
+         * <ctrl-c> to exit early, or for --checkpoint */
+        parms->my_seqno++;
+        rte_wmb();
+        for (k=0; k<run_count; k++)
+            parms->my_profile_index[k] = runs[k].i;
+        parms->my_index = runs[0].i;
+        parms->my_retry = runs[0].r;
+        if (masscan->tiers.count) {
+            for (k=0; k+1<run_count && runs[k].i >= runs[k].end; k++)
+                ;
+            parms->my_index = tier_offset[k] + runs[k].i;
+            parms->my_retry = runs[k].r;
+        }
+        parms->my_repeats = repeats;
+        rte_wmb();
+        parms->my_seqno++;
+
+        /* With --worker, the status shows the progress of the whole
+         * scan, and the coordinator hears how far we've got, which is
+         * also how it knows we're still alive */
+        if (parms->coord) {
+            uint64_t now = pixie_gettime();
+            parms->my_index = parms->coord_done;
+            if (!run_active)
+                parms->my_index = runs[0].range * (runs[0].retries + 1);
+            if (run_active && now >= when_reported) {
+                coord_worker_progress(parms->coord, runs[0].i, packets_sent);
+                when_reported = now + 1000000;
+            }
+        }
+
+        /* Once discovery is over, keep going until every host found
+         * has been scanned, sleeping while there's nothing to do */
+        if (live && !run_active) {
+            if (discover_is_finished(live, &when_discovered))
+                break;
+            if (batch_size)
+                pixie_usleep(1000);
+        }
 
         /* If the user pressed <ctrl-c>, then we need to exit. In case
          * the user wants to --resume the scan later, we save the current
@@ -438,15 +815,25 @@ infinite:
         }
     }
 
+    /* Let the coordinator know how far we got through the chunk, so
+     * that only the rest of it is given to another worker */
+    if (parms->coord && run_active)
+        coord_worker_progress(parms->coord, runs[0].i, packets_sent);
+
     /*
      * --infinite
      *  For load testing, go around and do this again
      */
     if (masscan->is_infinite && !is_tx_done) {
-        seed++;
         repeats++;
+
+        /* Where we resumed from only applies to the first pass */
+        parms->resume_index = 0;
+        memset(parms->resume_profile, 0, sizeof(parms->resume_profile));
+        parms->resume.is_valid = 0;
         goto infinite;
     }
+    free(discovered);
 
     /*
      * Flush any untransmitted packets. High-speed mechanisms like Windows
@@ -481,9 +868,7 @@ infinite:
 
 
             /* Transmit packets from the receive thread */
-            stack_flush_packets(  parms->stack, adapter,
-                            &packets_sent,
-                            &batch_size);
+            flush_recv_stacks(parms, adapter, &packets_sent, &batch_size);
 
             /* Make sure they've actually been transmitted, not just queued up for
              * transmit */
@@ -532,19 +917,26 @@ is_ipv6_multicast(ipaddress ip_me)
 static void
 receive_thread(void *v)
 {
-    struct ThreadPair *parms = (struct ThreadPair *)v;
+    struct RecvThread *recv = (struct RecvThread *)v;
+    struct ThreadPair *parms = recv->parms;
     const struct Masscan *masscan = parms->masscan;
-    struct Adapter *adapter = parms->adapter;
+    struct Adapter *adapter = recv->adapter;
     int data_link = stack_if_datalink(adapter);
     struct Output *out;
     struct DedupTable *dedup;
-    struct PcapFile *pcapfile = NULL;
+    struct UdpAggregate *udpagg = NULL;
+    struct PcapWriter *pcapfile = NULL;
     struct TCP_ConnectionTable *tcpcon = 0;
+    struct StatelessGrab *stateless = NULL;
+    struct ScriptingVM *scripting_vm = NULL;
+    struct BannerPool *banner_pool = NULL;
     uint64_t *status_synack_count;
     uint64_t *status_tcb_count;
     uint64_t entropy = masscan->seed;
+    struct LiveHosts *live = masscan->discover.live;
+    uint64_t discover_seed = discover_entropy(entropy);
     struct ResetFilter *rf;
-    struct stack_t *stack = parms->stack;
+    struct stack_t *stack = recv->stack;
     struct source_t src = {0};
 
     
@@ -555,54 +947,106 @@ receive_thread(void *v)
     /* some status variables */
     status_synack_count = MALLOC(sizeof(uint64_t));
     *status_synack_count = 0;
-    parms->total_synacks = status_synack_count;
+    recv->total_synacks = status_synack_count;
 
     status_tcb_count = MALLOC(sizeof(uint64_t));
     *status_tcb_count = 0;
-    parms->total_tcbs = status_tcb_count;
+    recv->total_tcbs = status_tcb_count;
 
-    LOG(1, "[+] starting receive thread #%u\n", parms->nic_index);
+    if (masscan->is_scripting)
+        recv->script_stats = CALLOC(1, sizeof(*recv->script_stats));
+    if (masscan->is_banners)
+        recv->banner_stats = CALLOC(1, sizeof(*recv->banner_stats));
+    if (masscan->is_banners)
+        recv->handshake_stats = CALLOC(1, sizeof(*recv->handshake_stats));
+    if (masscan->is_banners && !masscan->is_stateless_banners
+        && masscan->hello_learn.filename)
+        recv->hello_learn = hellolearn_create();
+    if (masscan->pcap_filename[0])
+        recv->pcap_stats = CALLOC(1, sizeof(*recv->pcap_stats));
+
+    LOG(1, "[+] starting receive thread #%u.%u\n", parms->nic_index, recv->rx_index);
     
-    /* Lock this thread to a CPU. Transmit threads are on even CPUs,
-     * receive threads on odd CPUs */
-    if (pixie_cpu_get_count() > 1) {
-        unsigned cpu_count = pixie_cpu_get_count();
-        unsigned cpu = parms->nic_index * 2 + 1;
-        while (cpu >= cpu_count) {
-            cpu -= cpu_count;
-            cpu++;
-        }
-        //TODO:
-        //pixie_cpu_set_affinity(cpu);
+    /* Lock this thread to a CPU (--pin-threads) */
+    if (recv->cpu >= 0) {
+        pixie_cpu_set_affinity((unsigned)recv->cpu);
+        LOG(1, "[+] receive thread #%u.%u pinned to CPU %d\n",
+                parms->nic_index, recv->rx_index, recv->cpu);
+    }
+
+    /* Spin rather than sleep waiting for packets (--busy-poll) */
+    if (masscan->is_busy_poll) {
+        if (rawsock_set_busy_poll(recv->adapter) != 0)
+            LOG(0, "[-] receive thread #%u.%u: busy-poll not supported\n",
+                    parms->nic_index, recv->rx_index);
     }
 
     /*
      * If configured, open a --pcap file for saving raw packets. This is
      * so that we can debug scans, but also so that we can look at the
      * strange things people send us. Note that we don't record transmitted
-     * packets, just the packets we've received.
+     * packets, just the packets we've received. The writing happens in a
+     * thread of its own, so that a slow disk doesn't slow us down.
      */
     if (masscan->pcap_filename[0]) {
-        pcapfile = pcapfile_openwrite(masscan->pcap_filename, 1);
+        if (parms->recv_count > 1) {
+            char *filename = output_indexed_filename(masscan->pcap_filename,
+                                                     recv->thread_index);
+            pcapfile = pcapwriter_create(filename, 1,
+                                         masscan->pcap.snaplen,
+                                         masscan->pcap.rotate_bytes,
+                                         recv->pcap_stats);
+            free(filename);
+        } else
+            pcapfile = pcapwriter_create(masscan->pcap_filename, 1,
+                                         masscan->pcap.snaplen,
+                                         masscan->pcap.rotate_bytes,
+                                         recv->pcap_stats);
     }
 
     /*
      * Open output. This is where results are reported when saving
      * the --output-format to the --output-filename
      */
-    out = output_create(masscan, parms->nic_index);
+    out = output_create(masscan, recv->thread_index);
 
     /*
      * Create deduplication table. This is so when somebody sends us
-     * multiple responses, we only record the first one.
+     * multiple responses, we only record the first one. It needs to
+     * remember the last several seconds of responses, which at high
+     * rates is a lot of them.
      */
-    dedup = dedup_create();
+    {
+        uint64_t entries = masscan->dedup.entries;
+        if (entries == 0) {
+            unsigned window = masscan->dedup.window ? masscan->dedup.window : 5;
+            entries = (uint64_t)(masscan->max_rate * window
+                                 / masscan->nic_count / parms->recv_count);
+            if (entries < (1<<18))
+                entries = (1<<18);
+        }
+        dedup = dedup_create((size_t)entries, get_entropy());
+    }
+
+    /*
+     * UDP responses can be many packets, whose banners we report together
+     */
+    if (masscan->is_banners)
+        udpagg = udpagg_create();
+
+    /*
+     * With --stateless-banners, we only ever see the first segment of each
+     * connection, so there's no connection table, and no hello to send
+     */
+    if (masscan->is_stateless_banners)
+        stateless = stateless_create(&parms->tmplset->pkts[Proto_TCP],
+                                     stack, out);
 
     /*
      * Create a TCP connection table (per thread pair) for interacting with live
      * connections when doing --banners
      */
-    if (masscan->is_banners) {
+    if (masscan->is_banners && !masscan->is_stateless_banners) {
         struct TcpCfgPayloads *pay;
         size_t i;
 
@@ -610,8 +1054,8 @@ receive_thread(void *v)
          * Create TCP connection table
          */
         tcpcon = tcpcon_create_table(
-            (size_t)((masscan->max_rate/5) / masscan->nic_count),
-            parms->stack,
+            (size_t)((masscan->max_rate/5) / masscan->nic_count / parms->recv_count),
+            stack,
             &parms->tmplset->pkts[Proto_TCP],
             output_report_banner,
             out,
@@ -620,9 +1064,21 @@ receive_thread(void *v)
             );
         
         /*
-         * Initialize TCP scripting
+         * Initialize TCP scripting, with a Lua VM of our own, since they
+         * can't be shared between threads
          */
-        scripting_init_tcp(tcpcon, masscan->scripting.L);
+        if (masscan->is_scripting)
+            scripting_vm = scripting_vm_create(masscan, recv->script_stats);
+        scripting_init_tcp(tcpcon, scripting_vm);
+
+        /*
+         * Banner buffers come from a pool of our own, rather than malloc()
+         */
+        banner_pool = banout_pool_create(recv->banner_stats);
+        tcpcon_set_banner_pool(tcpcon, banner_pool);
+        tcpcon_set_handshake_stats(tcpcon, recv->handshake_stats);
+        tcpcon_set_hello_learn(tcpcon, recv->hello_learn,
+                               masscan->hello_learn.prior);
 
         /*
          * Get the possible source IP addresses and ports that masscan
@@ -693,6 +1149,14 @@ receive_thread(void *v)
                                  strlen(foo),
                                  foo);
         }
+        if (masscan->tcp_banner_limit) {
+            char foo[64];
+            snprintf(foo, sizeof(foo), "%u", masscan->tcp_banner_limit);
+            tcpcon_set_parameter(   tcpcon,
+                                 "banner-limit",
+                                 strlen(foo),
+                                 foo);
+        }
         if (masscan->tcp_hello_timeout) {
             char foo[64];
             snprintf(foo, sizeof(foo), "%u", masscan->tcp_hello_timeout);
@@ -742,7 +1206,7 @@ receive_thread(void *v)
     if (masscan->is_offline) {
         while (!is_rx_done)
             pixie_usleep(10000);
-        parms->done_receiving = 1;
+        recv->done_receiving = 1;
         goto end;
     }
 
@@ -783,6 +1247,7 @@ receive_thread(void *v)
         if (err != 0) {
             if (tcpcon)
                 tcpcon_timeouts(tcpcon, (unsigned)time(0), 0);
+            udpagg_flush(udpagg, out, time(0));
             continue;
         }
         
@@ -795,6 +1260,7 @@ receive_thread(void *v)
         if (tcpcon) {
             tcpcon_timeouts(tcpcon, secs, usecs);
         }
+        udpagg_flush(udpagg, out, secs);
 
         if (length > 1514)
             continue;
@@ -829,7 +1295,7 @@ receive_thread(void *v)
         if (!is_my_ip(stack->src, ip_me)) {
             /* NDP Neighbor Solicitations don't come to our IP address, but to
              * a multicast address */
-            if (is_ipv6_multicast(ip_me)) {
+            if (is_ipv6_multicast(ip_me) && parms->neighbor == NULL) {
                 if (parsed.found == FOUND_NDPv6 && parsed.opcode == 135) {
                     stack_ndpv6_incoming_request(stack, &parsed, px, length);
                 }
@@ -856,7 +1322,8 @@ receive_thread(void *v)
                      * these packets. We need to respond to them, so that the router
                      * can then forward the packets to us. If we don't respond, we'll
                      * get no responses. */
-                    stack_ndpv6_incoming_request(stack, &parsed, px, length);
+                    if (parms->neighbor == NULL)
+                        stack_ndpv6_incoming_request(stack, &parsed, px, length);
                     continue;
                 case 136: /* Neighbor Advertisement */
                     /* TODO: If doing an --ndpscan, the scanner subsystem needs to deal
@@ -880,6 +1347,8 @@ receive_thread(void *v)
                      * for our IP address (as part of our user-mode TCP/IP).
                      * Since we completely bypass the TCP/IP stack, we  have to handle ARPs
                      * ourself, or the router will lose track of us.*/
+                    if (parms->neighbor)
+                        break; /* the neighbor thread already answered */
                      stack_arp_incoming_request(stack,
                                       ip_me.ipv4,
                                       parms->source_mac,
@@ -912,13 +1381,33 @@ receive_thread(void *v)
                     continue;
                 if (parms->masscan->nmap.packet_trace)
                     packet_trace(stdout, parms->pt_start, px, length, 0);
-                handle_udp(out, secs, px, length, &parsed, entropy);
+                /* A reply to a --discover-ports probe */
+                if (live) {
+                    enum DiscoverReply r;
+                    r = discover_is_reply(px, length, &parsed,
+                                          masscan->payloads.udp, discover_seed);
+                    if (r != Discover_NotReply)
+                        discover_add(live, ip_them);
+                    if (r == Discover_Reply)
+                        continue;
+                }
+                handle_udp(out, secs, px, length, &parsed, entropy, dedup, udpagg);
                 continue;
             case FOUND_ICMP:
-                handle_icmp(out, secs, px, length, &parsed, entropy);
+                /* A reply to a --discover-ports ping or probe */
+                if (live) {
+                    enum DiscoverReply r;
+                    r = discover_is_reply(px, length, &parsed,
+                                          masscan->payloads.udp, discover_seed);
+                    if (r != Discover_NotReply)
+                        discover_add(live, ip_them);
+                    if (r == Discover_Reply)
+                        continue;
+                }
+                handle_icmp(out, secs, px, length, &parsed, entropy, dedup);
                 continue;
             case FOUND_SCTP:
-                handle_sctp(out, secs, px, length, cookie, &parsed, entropy);
+                handle_sctp(out, secs, px, length, cookie, &parsed, entropy, dedup);
                 break;
             case FOUND_OPROTO: /* other IP proto */
                 handle_oproto(out, secs, px, length, &parsed, entropy);
@@ -937,15 +1426,35 @@ receive_thread(void *v)
         if (parms->masscan->nmap.packet_trace)
             packet_trace(stdout, parms->pt_start, px, length, 0);
 
+        /* A reply to a --discover-ports probe only tells us that the host
+         * is alive. Its ports get reported by the port scan that follows */
+        if (live && (TCP_IS_SYNACK(px, parsed.transport_offset)
+                    || TCP_IS_RST(px, parsed.transport_offset))) {
+            unsigned discover_cookie;
+
+            discover_cookie = syn_cookie(ip_them, port_them, ip_me, port_me,
+                                         discover_seed) & 0xFFFFFFFF;
+            if (discover_cookie == seqno_me - 1) {
+                discover_add(live, ip_them);
+                if (TCP_IS_SYNACK(px, parsed.transport_offset) && !masscan->is_noreset)
+                    tcp_send_RST(
+                        &parms->tmplset->pkts[Proto_TCP],
+                        stack,
+                        ip_them, ip_me,
+                        port_them, port_me,
+                        0, seqno_me);
+                continue;
+            }
+        }
+
         Q = 0;
 
         /* Save raw packet in --pcap file */
         if (pcapfile) {
-            pcapfile_writeframe(
+            pcapwriter_frame(
                 pcapfile,
                 px,
                 length,
-                length,
                 secs,
                 usecs);
         }
@@ -958,6 +1467,24 @@ receive_thread(void *v)
                 reason_string(TCP_FLAGS(px, parsed.transport_offset), buf, sizeof(buf)));
         }
 
+        /* With --stateless-banners, a SYN-ACK gets an ACK, even when it's a
+         * retransmission, since that means ours was lost. The data that
+         * follows is the banner */
+        if (stateless) {
+            if (TCP_IS_SYNACK(px, parsed.transport_offset)) {
+                if (cookie == seqno_me - 1)
+                    stateless_synack(stateless, ip_them, port_them,
+                                     ip_me, port_me, seqno_them, seqno_me);
+            } else if (parsed.app_length
+                        && !TCP_IS_RST(px, parsed.transport_offset)) {
+                stateless_data(stateless, dedup, global_now,
+                               ip_them, port_them, ip_me, port_me,
+                               seqno_them, seqno_me, cookie, parsed.ip_ttl,
+                               px + parsed.app_offset, parsed.app_length);
+                continue;
+            }
+        }
+
         /* If recording --banners, create a new "TCP Control Block (TCB)" */
         if (tcpcon) {
             struct TCP_Control_Block *tcb;
@@ -1091,10 +1618,10 @@ receive_thread(void *v)
              * Send RST so other side isn't left hanging (only doing this in
              * complete stateless mode where we aren't tracking banners)
              */
-            if (tcpcon == NULL && !masscan->is_noreset)
+            if (tcpcon == NULL && stateless == NULL && !masscan->is_noreset)
                 tcp_send_RST(
                     &parms->tmplset->pkts[Proto_TCP],
-                    parms->stack,
+                    stack,
                     ip_them, ip_me,
                     port_them, port_me,
                     0, seqno_me);
@@ -1103,7 +1630,24 @@ receive_thread(void *v)
     }
 
 
-    LOG(1, "[+] exiting receive thread #%u                    \n", parms->nic_index);
+    LOG(1, "[+] exiting receive thread #%u.%u                    \n",
+        parms->nic_index, recv->rx_index);
+
+    /* If duplicates are being evicted too soon, this shows that the
+     * table should be bigger, with --dedup-window or --dedup-size */
+    {
+        struct DedupStats stats;
+        uint64_t total;
+
+        dedup_get_stats(dedup, &stats);
+        total = stats.hits + stats.misses;
+        LOG(1, "[+] dedup #%u.%u: %llu responses, %.1f%% duplicates, %llu evicted, %llu slots\n",
+            parms->nic_index, recv->rx_index,
+            (unsigned long long)total,
+            total ? 100.0 * stats.hits / total : 0.0,
+            (unsigned long long)stats.evictions,
+            (unsigned long long)dedup_capacity(dedup));
+    }
     
     /*
      * cleanup
@@ -1111,17 +1655,585 @@ receive_thread(void *v)
 end:
     if (tcpcon)
         tcpcon_destroy_table(tcpcon);
+    stateless_destroy(stateless);
+    scripting_vm_destroy(scripting_vm);
+    banout_pool_destroy(banner_pool);
+    udpagg_destroy(udpagg, out);
     dedup_destroy(dedup);
     output_destroy(out);
-    if (pcapfile)
-        pcapfile_close(pcapfile);
+    pcapwriter_destroy(pcapfile);
 
     /*TODO: free stack packet buffers */
 
     /* Thread is about to exit */
-    parms->done_receiving = 1;
+    recv->done_receiving = 1;
+}
+
+
+/***************************************************************************
+ * This thread answers ARP requests and NDP neighbor solicitations for
+ * our (spoofed) source addresses. It has its own capture handle,
+ * filtered down to just those packets, so that a reply isn't stuck
+ * behind a million SYN-ACKs in the main receive queue while the
+ * router's neighbor entry for us expires. Replies go on the priority
+ * lane of its own stack, which the transmit thread drains first.
+ ***************************************************************************/
+static void
+neighbor_thread(void *v)
+{
+    struct RecvThread *recv = (struct RecvThread *)v;
+    struct ThreadPair *parms = recv->parms;
+    struct Adapter *adapter = recv->adapter;
+    struct stack_t *stack = recv->stack;
+    int data_link = stack_if_datalink(adapter);
+
+    LOG(1, "[+] starting neighbor thread #%u\n", parms->nic_index);
+
+    while (!is_rx_done) {
+        struct PreprocessedInfo parsed;
+        unsigned length;
+        unsigned secs;
+        unsigned usecs;
+        const unsigned char *px;
+        int err;
+
+        err = rawsock_recv_packet(adapter, &length, &secs, &usecs, &px);
+        if (err != 0 || length > 1514)
+            continue;
+        if (!preprocess_frame(px, length, data_link, &parsed))
+            continue;
+
+        switch (parsed.found) {
+        case FOUND_ARP:
+            if (parsed.opcode == 1 && is_my_ip(stack->src, parsed.dst_ip))
+                stack_arp_incoming_request(stack,
+                                           parsed.dst_ip.ipv4,
+                                           parms->source_mac,
+                                           px, length);
+            break;
+        case FOUND_NDPv6:
+            if (parsed.opcode == 135)
+                stack_ndpv6_incoming_request(stack, &parsed, px, length);
+            break;
+        default:
+            break;
+        }
+    }
+
+    recv->done_receiving = 1;
+}
+
+/***************************************************************************
+ * Open the extra capture handle for the neighbor thread. If the adapter
+ * can't do capture filters (PF_RING, AF_XDP, offline), we don't bother,
+ * and the main receive threads keep answering ARP/NDP themselves.
+ ***************************************************************************/
+static void
+neighbor_thread_create(struct Masscan *masscan, struct ThreadPair *parms)
+{
+    unsigned index = parms->nic_index;
+    struct Adapter *adapter;
+    const char *filter;
+
+    if (!masscan->is_neighbor_thread || masscan->is_offline
+        || masscan->is_pfring || masscan->nic[index].xdp_mode
+        || memcmp(parms->adapter->ifname, "file:", 5) == 0)
+        return;
+
+    adapter = rawsock_init_adapter(
+                                parms->adapter->ifname,
+                                0,
+                                0,
+                                0,
+                                0,
+                                0,
+                                masscan->nic[index].is_vlan,
+                                masscan->nic[index].vlan_id);
+    if (adapter == NULL)
+        return;
+
+    if (masscan->nic[index].is_vlan)
+        filter = "vlan and (arp or (icmp6 and ip6[40] == 135))";
+    else
+        filter = "arp or (icmp6 and ip6[40] == 135)";
+    if (rawsock_set_filter(adapter, filter) != 0) {
+        LOG(1, "[-] if(%s): no capture filter, ARP/NDP handled inline\n",
+            parms->adapter->ifname);
+        rawsock_close_adapter(adapter);
+        return;
+    }
+    rawsock_ignore_transmits(adapter, parms->adapter->ifname);
+
+    parms->neighbor = CALLOC(1, sizeof(*parms->neighbor));
+    parms->neighbor->parms = parms;
+    parms->neighbor->adapter = adapter;
+    parms->neighbor->cpu = -1;
+    parms->neighbor->stack = stack_create(parms->source_mac,
+                                          &masscan->nic[index].src);
+}
+
+/***************************************************************************
+ * Saves what the receive threads learned about servers speaking first,
+ * along with what was loaded before the scan (--hello-learn), then frees
+ * the threads' tables.
+ ***************************************************************************/
+static void
+hello_learn_finish(struct Masscan *masscan, struct ThreadPair *parms_array)
+{
+    struct HelloLearn **tables;
+    size_t count = 0;
+    size_t max = 1;
+    unsigned i;
+    unsigned j;
+
+    for (i=0; i<masscan->nic_count; i++)
+        max += parms_array[i].recv_count;
+    tables = CALLOC(max, sizeof(*tables));
+
+    tables[count++] = masscan->hello_learn.prior;
+    for (i=0; i<masscan->nic_count; i++) {
+        for (j=0; j<parms_array[i].recv_count; j++)
+            tables[count++] = parms_array[i].recv[j].hello_learn;
+    }
+
+    if (masscan->hello_learn.filename && masscan->is_banners)
+        hellolearn_save(masscan->hello_learn.filename, tables, count);
+
+    for (i=0; i<masscan->nic_count; i++) {
+        for (j=0; j<parms_array[i].recv_count; j++) {
+            hellolearn_destroy(parms_array[i].recv[j].hello_learn);
+            parms_array[i].recv[j].hello_learn = NULL;
+        }
+    }
+    free(tables);
+}
+
+/***************************************************************************
+ * Print how quickly we answered the router's ARP/NDP requests. If the
+ * latency gets into the seconds, responses will be lost.
+ ***************************************************************************/
+static void
+neighbor_stats_print(const struct Masscan *masscan,
+                     const struct ThreadPair *parms_array)
+{
+    struct NeighborStats total = {0};
+    unsigned i;
+    unsigned j;
+
+    for (i=0; i<masscan->nic_count; i++) {
+        const struct ThreadPair *parms = &parms_array[i];
+        for (j=0; j<parms->recv_count + 1; j++) {
+            const struct stack_t *stack;
+
+            if (j < parms->recv_count)
+                stack = parms->recv[j].stack;
+            else if (parms->neighbor)
+                stack = parms->neighbor->stack;
+            else
+                continue;
+            total.replies += stack->neighbor.replies;
+            total.dropped += stack->neighbor.dropped;
+            total.latency_total += stack->neighbor.latency_total;
+            if (total.latency_max < stack->neighbor.latency_max)
+                total.latency_max = stack->neighbor.latency_max;
+        }
+    }
+
+    if (total.replies == 0 && total.dropped == 0)
+        return;
+    LOG(1, "[+] ARP/NDP: %llu replies, latency avg=%lluus max=%lluus, %llu dropped\n",
+        (unsigned long long)total.replies,
+        (unsigned long long)(total.replies ? total.latency_total / total.replies : 0),
+        (unsigned long long)total.latency_max,
+        (unsigned long long)total.dropped);
+}
+
+/***************************************************************************
+ * Create the receive threads for an adapter (--rx-threads). The first
+ * uses the adapter the transmit thread uses. The others open their own
+ * handles on the same interface, and then all of them join a
+ * PACKET_FANOUT group so that each sees only a share of the flows. If
+ * this isn't possible (wrong platform, PF_RING, offline), we fall back
+ * to a single receive thread.
+ ***************************************************************************/
+static void
+recv_threads_create(struct Masscan *masscan, struct ThreadPair *parms,
+                    unsigned rx_count, unsigned *thread_index)
+{
+    unsigned index = parms->nic_index;
+    unsigned group_id = ((unsigned)(masscan->seed >> 16) + index) & 0xFFFF;
+    unsigned i;
+
+    /* An AF_XDP socket is bound to a single queue, so there's nothing
+     * to fan out */
+    if (masscan->nic[index].xdp_mode)
+        rx_count = 1;
+
+    parms->recv = CALLOC(rx_count, sizeof(parms->recv[0]));
+    parms->recv_count = rx_count;
+
+    for (i=0; i<rx_count; i++) {
+        struct RecvThread *recv = &parms->recv[i];
+
+        recv->parms = parms;
+        recv->rx_index = i;
+        recv->cpu = -1;
+        recv->stack = stack_create(parms->source_mac, &masscan->nic[index].src);
+
+        if (i == 0) {
+            recv->adapter = parms->adapter;
+            continue;
+        }
+        recv->adapter = rawsock_init_adapter(
+                                    parms->adapter->ifname,
+                                    masscan->is_pfring,
+                                    masscan->is_sendq,
+                                    masscan->nmap.packet_trace,
+                                    masscan->is_offline,
+                                    (void*)masscan->bpf_filter,
+                                    masscan->nic[index].is_vlan,
+                                    masscan->nic[index].vlan_id);
+        if (recv->adapter == NULL)
+            break;
+        rawsock_ignore_transmits(recv->adapter, parms->adapter->ifname);
+    }
+
+    /* Join them all into the same fanout group */
+    if (i == rx_count) {
+        for (i=0; i<rx_count; i++) {
+            if (rawsock_set_fanout(parms->recv[i].adapter, group_id) != 0)
+                break;
+        }
+    }
+    if (i != rx_count) {
+        /* Something failed, so undo the extra handles and go back to
+         * just the one receive thread */
+        LOG(0, "[-] if(%s): --rx-threads unsupported, using 1 receive thread\n",
+            parms->adapter->ifname);
+        for (i=1; i<rx_count; i++) {
+            if (parms->recv[i].adapter)
+                rawsock_close_adapter(parms->recv[i].adapter);
+            stack_destroy(parms->recv[i].stack);
+            memset(&parms->recv[i], 0, sizeof(parms->recv[i]));
+        }
+        parms->recv_count = 1;
+    }
+
+    /* Numbered across all adapters, for the output filenames */
+    for (i=0; i<parms->recv_count; i++)
+        parms->recv[i].thread_index = (*thread_index)++;
+}
+
+/***************************************************************************
+ * For --pin-threads, give each transmit and receive thread a CPU of its
+ * own. Each adapter's threads are placed on the NUMA node that the NIC
+ * is attached to, spread across separate physical cores, so that a
+ * transmit thread and a receive thread don't end up fighting over the
+ * two hyperthreads of the same core.
+ ***************************************************************************/
+static void
+threads_plan_cpus(const struct Masscan *masscan, struct ThreadPair *parms_array)
+{
+    struct CpuTopology *topo;
+    unsigned char *is_used;
+    unsigned index;
+
+    topo = pixie_topology_read();
+    is_used = CALLOC(topo->count, 1);
+
+    for (index=0; index<masscan->nic_count; index++) {
+        struct ThreadPair *parms = &parms_array[index];
+        unsigned count = 1 + parms->recv_count;
+        unsigned *cpus;
+        int node;
+        unsigned i;
+
+        node = pixie_topology_nic_node(parms->adapter->ifname);
+        cpus = CALLOC(count, sizeof(cpus[0]));
+        pixie_topology_plan(topo, node, is_used, count, cpus);
+
+        parms->cpu = (int)cpus[0];
+        for (i=0; i<parms->recv_count; i++)
+            parms->recv[i].cpu = (int)cpus[1 + i];
+
+        LOG(1, "[+] if(%s): NUMA node %d, transmit on CPU %u\n",
+            parms->adapter->ifname, node, cpus[0]);
+        free(cpus);
+    }
+
+    if (masscan->nic_count * (1 + parms_array[0].recv_count) > topo->count)
+        LOG(0, "[-] --pin-threads: more threads than CPUs, some will share\n");
+
+    free(is_used);
+    pixie_topology_free(topo);
+}
+
+/***************************************************************************
+ * With --profile, each profile's progress is the minimum of its index
+ * across the transmit threads, and the scan's progress is the sum of
+ * those. Also formats each profile's percentage for the status line.
+ ***************************************************************************/
+static uint64_t
+profiles_progress(const struct Masscan *masscan,
+                  const struct ThreadPair *parms_array,
+                  uint64_t *mins, struct Status *status)
+{
+    uint64_t total = 0;
+    size_t offset = 0;
+    unsigned i;
+    unsigned k;
+
+    for (k=0; k<masscan->profile_count; k++) {
+        const struct ScanProfile *profile = &masscan->profile[k];
+        uint64_t min_index = UINT64_MAX;
+        uint64_t range;
+
+        for (i=0; i<masscan->nic_count; i++) {
+            if (min_index > parms_array[i].my_profile_index[k])
+                min_index = parms_array[i].my_profile_index[k];
+        }
+        mins[k] = min_index;
+        total += min_index;
+
+        range = profile_range(profile) * (1 + profile->retries);
+        if (status && offset < sizeof(status->extra)) {
+            double percent = range ? (min_index * 100.0 / range) : 100.0;
+            if (percent > 100.0)
+                percent = 100.0;
+            offset += snprintf(status->extra + offset,
+                               sizeof(status->extra) - offset,
+                               "%s%s:%.0f%%", k?" ":"", profile->name, percent);
+        }
+    }
+    return total;
 }
 
+/***************************************************************************
+ * Copies where each transmit thread is into the --resume settings, so
+ * that they can be saved. Each thread changes its index, retry and
+ * repeat count together, so we read them again if the thread was in the
+ * middle of changing them.
+ * @return
+ *      the index of the slowest thread, or with --profile, the sum of
+ *      each profile's slowest index
+ ***************************************************************************/
+static uint64_t
+resume_collect(struct Masscan *masscan, const struct ThreadPair *parms_array)
+{
+    uint64_t min_index = UINT64_MAX;
+    unsigned i;
+
+    if (masscan->profile_count) {
+        uint64_t mins[MAX_PROFILES];
+        unsigned k;
+
+        min_index = profiles_progress(masscan, parms_array, mins, NULL);
+        for (k=0; k<masscan->profile_count; k++)
+            masscan->profile[k].resume_index = mins[k];
+        return min_index;
+    }
+
+    for (i=0; i<masscan->nic_count; i++) {
+        const struct ThreadPair *parms = &parms_array[i];
+        struct ResumeThread *t = &masscan->resume.threads[i];
+        unsigned seqno;
+
+        do {
+            seqno = parms->my_seqno;
+            rte_rmb();
+            t->index = parms->my_index;
+            t->retry = parms->my_retry;
+            t->repeats = parms->my_repeats;
+            rte_rmb();
+        } while ((seqno & 1) || seqno != parms->my_seqno);
+        t->is_valid = 1;
+
+        if (min_index > t->index)
+            min_index = t->index;
+    }
+    masscan->resume.index = min_index;
+    return min_index;
+}
+
+/***************************************************************************
+ * --checkpoint
+ *  Saves the resume file every so often while the scan runs, so that a
+ *  scan that crashes or is killed can still be resumed.
+ ***************************************************************************/
+struct CheckpointThread {
+    struct Masscan *masscan;
+    const struct ThreadPair *parms_array;
+    volatile unsigned is_done;
+    size_t thread_handle;
+};
+
+static void
+checkpoint_thread(void *v)
+{
+    struct CheckpointThread *cp = (struct CheckpointThread *)v;
+    struct Masscan *masscan = cp->masscan;
+    uint64_t next = pixie_gettime() + masscan->checkpoint.seconds * 1000000ULL;
+
+    while (!cp->is_done) {
+        const char *filename;
+
+        pixie_mssleep(100);
+        if (pixie_gettime() < next)
+            continue;
+        next = pixie_gettime() + masscan->checkpoint.seconds * 1000000ULL;
+
+        resume_collect(masscan, cp->parms_array);
+        filename = masscan_state_filename(masscan);
+        if (masscan_write_state(masscan, filename) != 0)
+            LOG(0, "[-] checkpoint: %s: %s\n", filename, strerror(errno));
+        else
+            LOG(1, "[+] checkpoint: saved %s\n", filename);
+    }
+}
+
+/***************************************************************************
+ * With --discover-ports, shows how many hosts have been found, and how
+ * many of those are still waiting for their port scan.
+ ***************************************************************************/
+static void
+discover_progress(const struct Masscan *masscan, struct Status *status)
+{
+    uint64_t found, pending, dropped;
+
+    discover_stats(masscan->discover.live, &found, &pending, &dropped);
+    snprintf(status->extra, sizeof(status->extra),
+             "live:%llu pending:%llu%s",
+             (unsigned long long)found, (unsigned long long)pending,
+             dropped ? " (table full)" : "");
+}
+
+/***************************************************************************
+ * With --port-tiers, shows which tier the scan is on, which is where the
+ * (slowest thread's) index falls when the tiers are laid end to end.
+ ***************************************************************************/
+static void
+tiers_progress(const struct Masscan *masscan, uint64_t index,
+               struct Status *status)
+{
+    unsigned k;
+
+    for (k=0; k+1<masscan->tiers.count; k++) {
+        const struct MassIP *targets = &masscan->tiers.targets[k];
+        uint64_t span = (targets->count_ipv4s + targets->count_ipv6s)
+                        * targets->count_ports * (1 + masscan->retries);
+        if (index < span)
+            break;
+        index -= span;
+    }
+    snprintf(status->extra, sizeof(status->extra), "tier:%u/%u",
+             k + 1, masscan->tiers.count);
+}
+
+/***************************************************************************
+ * With --script, shows how much CPU time the script has taken so far,
+ * across all the receive threads, and on average per call.
+ ***************************************************************************/
+static void
+scripting_progress(const struct ThreadPair *parms_array, unsigned nic_count,
+                   struct Status *status)
+{
+    struct ScriptingStats total = {0};
+    size_t offset;
+    unsigned i;
+    unsigned j;
+
+    for (i=0; i<nic_count; i++) {
+        for (j=0; j<parms_array[i].recv_count; j++) {
+            const struct ScriptingStats *stats = parms_array[i].recv[j].script_stats;
+            if (stats == NULL)
+                continue;
+            total.cpu_nanoseconds += stats->cpu_nanoseconds;
+            total.calls += stats->calls;
+            total.errors += stats->errors;
+        }
+    }
+
+    offset = strlen(status->extra);
+    snprintf(status->extra + offset, sizeof(status->extra) - offset,
+             "%sscript:%.2fs %.0fus/call%s",
+             offset?" ":"",
+             total.cpu_nanoseconds / 1000000000.0,
+             total.calls ? total.cpu_nanoseconds / 1000.0 / total.calls : 0.0,
+             total.errors ? " (errors)" : "");
+}
+
+/***************************************************************************
+ * Adds to the status line the most memory that banners have used at
+ * one time, per receive thread, added up, and how many handshakes had
+ * their ACK sent along with our first data.
+ ***************************************************************************/
+static void
+banners_progress(const struct ThreadPair *parms_array, unsigned nic_count,
+                 struct Status *status)
+{
+    uint64_t peak = 0;
+    uint64_t handshakes = 0;
+    uint64_t merged = 0;
+    size_t offset;
+    unsigned i;
+    unsigned j;
+
+    for (i=0; i<nic_count; i++) {
+        for (j=0; j<parms_array[i].recv_count; j++) {
+            const struct BannerPoolStats *stats = parms_array[i].recv[j].banner_stats;
+            const struct TcpHandshakeStats *hs = parms_array[i].recv[j].handshake_stats;
+            if (stats)
+                peak += stats->peak;
+            if (hs) {
+                handshakes += hs->handshakes;
+                merged += hs->acks_merged;
+            }
+        }
+    }
+
+    offset = strlen(status->extra);
+    snprintf(status->extra + offset, sizeof(status->extra) - offset,
+             "%sbanmem:%lluk",
+             offset?" ":"",
+             (unsigned long long)(peak + 1023) / 1024);
+
+    if (handshakes) {
+        offset = strlen(status->extra);
+        snprintf(status->extra + offset, sizeof(status->extra) - offset,
+                 " ackmerge:%u%%",
+                 (unsigned)(merged * 100 / handshakes));
+    }
+}
+
+/***************************************************************************
+ * Adds to the status line how many received packets couldn't be saved
+ * to the --pcap file because the disk couldn't keep up, if any.
+ ***************************************************************************/
+static void
+pcap_progress(const struct ThreadPair *parms_array, unsigned nic_count,
+              struct Status *status)
+{
+    uint64_t dropped = 0;
+    size_t offset;
+    unsigned i;
+    unsigned j;
+
+    for (i=0; i<nic_count; i++) {
+        for (j=0; j<parms_array[i].recv_count; j++) {
+            const struct PcapWriterStats *stats = parms_array[i].recv[j].pcap_stats;
+            if (stats)
+                dropped += stats->dropped;
+        }
+    }
+    if (dropped == 0)
+        return;
+
+    offset = strlen(status->extra);
+    snprintf(status->extra + offset, sizeof(status->extra) - offset,
+             "%spcapdrop:%llu",
+             offset?" ":"",
+             (unsigned long long)dropped);
+}
 
 /***************************************************************************
  * We trap the <ctrl-c> so that instead of exiting immediately, we sit in
@@ -1164,7 +2276,9 @@ static void control_c_handler(int x)
 static int
 main_scan(struct Masscan *masscan)
 {
-    struct ThreadPair parms_array[8];
+    struct ThreadPair *parms_array;
+    unsigned rx_count;
+    unsigned thread_index = 0;
     uint64_t count_ips;
     uint64_t count_ports;
     uint64_t range;
@@ -1173,9 +2287,21 @@ main_scan(struct Masscan *masscan)
     struct Status status;
     uint64_t min_index = UINT64_MAX;
     struct MassVulnCheck *vulncheck = NULL;
-    struct stack_t *stack;
+    time_t when_discovered = 0;
+    unsigned is_resume_threads;
+    struct CheckpointThread checkpoint = {0};
+    unsigned is_polling;
+
+    parms_array = CALLOC(masscan->nic_count, sizeof(parms_array[0]));
 
-    memset(parms_array, 0, sizeof(parms_array));
+    /*
+     * Number of receive threads per adapter. Only possible when we are
+     * actually receiving through libpcap.
+     */
+    rx_count = masscan->rx_thread_count;
+    if (rx_count == 0 || masscan->is_offline || masscan->is_pfring)
+        rx_count = 1;
+    masscan->rx_thread_count = rx_count;
 
     /*
      * Vuln check initialization
@@ -1218,6 +2344,66 @@ main_scan(struct Masscan *masscan)
     range = count_ips * count_ports;
     range += (uint64_t)(masscan->retries * range);
 
+    /* Start from what earlier scans learned about servers speaking first.
+     * It's fine if the file isn't there yet, since we'll create it */
+    if (masscan->hello_learn.filename && masscan->is_banners
+        && masscan->hello_learn.prior == NULL) {
+        masscan->hello_learn.prior = hellolearn_create();
+        if (hellolearn_load(masscan->hello_learn.prior,
+                            masscan->hello_learn.filename) != 0)
+            LOG(1, "[+] hello-learn: starting %s\n",
+                masscan->hello_learn.filename);
+    }
+
+    /* With --discover-ports, progress is that of the discovery pass,
+     * since we don't know in advance how many hosts will be port scanned */
+    if (masscan->discover.ports.count) {
+        masscan->discover.live = discover_create(count_ips);
+        count_ports = masscan->discover.targets.count_ports;
+        range = count_ips * count_ports;
+        range += (uint64_t)(masscan->retries * range);
+    }
+    if (masscan->profile_count) {
+        unsigned k;
+        range = 0;
+        for (k=0; k<masscan->profile_count; k++)
+            range += profile_range(&masscan->profile[k])
+                        * (1 + masscan->profile[k].retries);
+    }
+
+    /*
+     * With --worker, the coordinator says which indexes each transmit
+     * thread scans, and which --seed to use, so connect before anything
+     * uses the seed
+     */
+    if (masscan->coord.connect) {
+        char hostname[64] = "worker";
+
+        if (masscan->profile_count || masscan->tiers.count
+            || masscan->discover.ports.count || masscan->shard.of > 1
+            || masscan->is_infinite) {
+            LOG(0, "FAIL: --worker can't be used with --profile, --port-tiers, "
+                   "--discover-ports, --shard or --infinite\n");
+            return 1;
+        }
+        gethostname(hostname, sizeof(hostname) - 1);
+        hostname[sizeof(hostname) - 1] = '\0';
+        for (index=0; index<masscan->nic_count; index++) {
+            struct ThreadPair *parms = &parms_array[index];
+            char name[96];
+            uint64_t seed = 0;
+
+            snprintf(name, sizeof(name), "%s/%u", hostname, index);
+            parms->coord = coord_worker_connect(masscan->coord.connect,
+                                &masscan->targets, masscan->retries,
+                                name, &seed, &parms->coord_stride);
+            if (parms->coord == NULL)
+                return 1;
+            masscan->seed = seed;
+        }
+        LOG(1, "[+] worker: joined the coordinator at %s\n", masscan->coord.connect);
+    }
+
     /*
      * If doing an ARP scan, then don't allow port scanning
      */
@@ -1241,28 +2427,62 @@ main_scan(struct Masscan *masscan)
 
     /*
      * trim the nmap UDP payloads down to only those ports we are using. This
-     * makes lookups faster at high packet rates.
+     * makes lookups faster at high packet rates. With --discover-ports,
+     * the discovery probes need the payloads of their own ports too.
      */
-    payloads_udp_trim(masscan->payloads.udp, &masscan->targets);
-    payloads_oproto_trim(masscan->payloads.oproto, &masscan->targets);
+    if (masscan->discover.ports.count == 0) {
+        payloads_udp_trim(masscan->payloads.udp, &masscan->targets);
+        payloads_oproto_trim(masscan->payloads.oproto, &masscan->targets);
+    }
 
 
 #ifdef __AFL_HAVE_MANUAL_CONTROL
   __AFL_INIT();
 #endif
 
+    /*
+     * With a resume file that says where each thread was, use it only if
+     * it's for the same number of threads, since that changes which
+     * targets each thread gets
+     */
+    is_resume_threads = 0;
+    if (!masscan->profile_count && masscan->resume.threads[0].is_valid) {
+        unsigned count = 0;
+
+        while (count < sizeof(masscan->resume.threads)/sizeof(masscan->resume.threads[0])
+               && masscan->resume.threads[count].is_valid)
+            count++;
+        if (count == masscan->nic_count)
+            is_resume_threads = 1;
+        else
+            LOG(0, "[-] resume: saved for %u threads, not %u, resuming from the slowest\n",
+                count, masscan->nic_count);
+    }
+
     /*
      * Start scanning threats for each adapter
      */
     for (index=0; index<masscan->nic_count; index++) {
         struct ThreadPair *parms = &parms_array[index];
+        unsigned i;
         int err;
 
         parms->masscan = masscan;
         parms->nic_index = index;
         parms->my_index = masscan->resume.index;
+        parms->resume_index = masscan->resume.index;
+        for (i=0; i<masscan->profile_count; i++) {
+            parms->resume_profile[i] = masscan->profile[i].resume_index;
+            parms->my_profile_index[i] = masscan->profile[i].resume_index;
+        }
+        if (is_resume_threads) {
+            parms->resume = masscan->resume.threads[index];
+            parms->my_index = parms->resume.index;
+            parms->my_retry = parms->resume.retry;
+            parms->my_repeats = parms->resume.repeats;
+        }
         parms->done_transmitting = 0;
-        parms->done_receiving = 0;
+        parms->cpu = -1;
 
         /* needed for --packet-trace option so that we know when we started
          * the scan */
@@ -1319,8 +2539,38 @@ main_scan(struct Masscan *masscan)
             masscan->nic[index].src.port.range = 16;
         }
 
-        stack = stack_create(parms->source_mac, &masscan->nic[index].src);
-        parms->stack = stack;
+        /*
+         * Now that we know our source addresses/ports, switch to the
+         * AF_XDP socket if configured (--adapter-xdp)
+         */
+        if (masscan->nic[index].xdp_mode && !masscan->is_offline) {
+            err = rawsock_init_xdp(parms->adapter,
+                                   &masscan->nic[index].src,
+                                   masscan->nic[index].xdp_mode,
+                                   masscan->nic[index].xdp_queue);
+            if (err) {
+                LOG(0, "FAIL: could not use AF_XDP on adapter\n");
+                LOG(0, " [hint] needs Linux 5.9 or later, and root\n");
+                exit(1);
+            }
+        }
+
+        /*
+         * Let the NIC fill in TCP/UDP checksums (--adapter-offload). This
+         * is only an optimization, so if it's not available, we just keep
+         * calculating them ourselves.
+         */
+        if (masscan->nic[index].is_checksum_offload && !masscan->is_offline) {
+            if (parms->tmplset->vulncheck)
+                LOG(0, "[-] checksum offload not supported with vulnerability checks\n");
+            else if (rawsock_init_vnet(parms->adapter) == 0)
+                template_set_checksum_offload(parms->tmplset);
+            else
+                LOG(0, "[-] checksum offload unavailable, using software checksums\n");
+        }
+
+        recv_threads_create(masscan, parms, rx_count, &thread_index);
+        neighbor_thread_create(masscan, parms);
 
         /*
          * Set the "TTL" (IP time-to-live) of everything we send.
@@ -1339,6 +2589,12 @@ main_scan(struct Masscan *masscan)
 
     }
 
+    /*
+     * Choose which CPUs the threads run on (--pin-threads)
+     */
+    if (masscan->is_pin_threads)
+        threads_plan_cpus(masscan, parms_array);
+
     /*
      * Print helpful text
      */
@@ -1360,6 +2616,14 @@ main_scan(struct Masscan *masscan)
                 LOG(0, "Initiating ICMP Echo Scan\n");
                 LOG(0, "Scanning %u hosts\n",(unsigned)count_ips);
              }
+        else if (masscan->discover.live)
+            {
+                uint64_t scan_ports = rangelist_count(&masscan->targets.ports);
+                LOG(0, "Initiating SYN Stealth Scan\n");
+                LOG(0, "Discovering %u hosts [%u port%s/host], then scanning [%u port%s/live host]\n",
+                    (unsigned)count_ips, (unsigned)count_ports, (count_ports==1)?"":"s",
+                    (unsigned)scan_ports, (scan_ports==1)?"":"s");
+            }
         else /* This could actually also be a UDP only or mixed UDP/TCP/ICMP scan */
             {
                 //LOG(0, " -- forced options: -sS -Pn -n --randomize-hosts -v --send-eth\n");
@@ -1374,6 +2638,7 @@ main_scan(struct Masscan *masscan)
      */
     for (index=0; index<masscan->nic_count; index++) {
         struct ThreadPair *parms = &parms_array[index];
+        unsigned i;
         
         /*
          * Start the scanning thread.
@@ -1383,12 +2648,33 @@ main_scan(struct Masscan *masscan)
         parms->thread_handle_xmit = pixie_begin_thread(transmit_thread, 0, parms);
 
         /*
-         * Start the MATCHING receive thread. Transmit and receive threads
-         * come in matching pairs.
+         * Start the MATCHING receive threads. Normally, transmit and
+         * receive threads come in matching pairs, unless --rx-threads
+         * has split receive across several.
          */
-        parms->thread_handle_recv = pixie_begin_thread(receive_thread, 0, parms);
+        for (i=0; i<parms->recv_count; i++) {
+            struct RecvThread *recv = &parms->recv[i];
+            recv->thread_handle_recv = pixie_begin_thread(receive_thread, 0, recv);
+        }
+        if (parms->neighbor)
+            parms->neighbor->thread_handle_recv =
+                    pixie_begin_thread(neighbor_thread, 0, parms->neighbor);
     }
 
+    /*
+     * Save where we are every so often, so that the scan can be resumed
+     * even if we don't get to save it when exiting
+     */
+    if (masscan->checkpoint.seconds && !masscan->coord.connect) {
+        checkpoint.masscan = masscan;
+        checkpoint.parms_array = parms_array;
+        checkpoint.thread_handle = pixie_begin_thread(checkpoint_thread, 0, &checkpoint);
+    }
+
+    /* With --nostatus we normally just join the threads, but checkpoints
+     * need us to wait here, and to know where the threads got to */
+    is_polling = masscan->output.is_status_updates || checkpoint.masscan;
+
     /*
      * Now wait for <ctrl-c> to be pressed OR for threads to exit
      */
@@ -1396,8 +2682,8 @@ main_scan(struct Masscan *masscan)
     LOG(1, "[+] waiting for threads to finish\n");
     status_start(&status);
     status.is_infinite = masscan->is_infinite;
-    while (!is_tx_done && masscan->output.is_status_updates) {
-        unsigned i;
+    while (!is_tx_done && is_polling) {
+        unsigned i, j;
         double rate = 0;
         uint64_t total_tcbs = 0;
         uint64_t total_synacks = 0;
@@ -1414,17 +2700,39 @@ main_scan(struct Masscan *masscan)
 
             rate += parms->throttler->current_rate;
 
-            if (parms->total_tcbs)
-                total_tcbs += *parms->total_tcbs;
-            if (parms->total_synacks)
-                total_synacks += *parms->total_synacks;
+            for (j=0; j<parms->recv_count; j++) {
+                struct RecvThread *recv = &parms->recv[j];
+                if (recv->total_tcbs)
+                    total_tcbs += *recv->total_tcbs;
+                if (recv->total_synacks)
+                    total_synacks += *recv->total_synacks;
+            }
             if (parms->total_syns)
                 total_syns += *parms->total_syns;
         }
+        status.extra[0] = '\0';
+        if (masscan->profile_count) {
+            uint64_t mins[MAX_PROFILES];
+            min_index = profiles_progress(masscan, parms_array, mins, &status);
+        }
+        if (masscan->discover.live)
+            discover_progress(masscan, &status);
+        if (masscan->tiers.count)
+            tiers_progress(masscan, min_index, &status);
+        if (masscan->is_scripting)
+            scripting_progress(parms_array, masscan->nic_count, &status);
+        if (masscan->is_banners)
+            banners_progress(parms_array, masscan->nic_count, &status);
+        if (masscan->pcap_filename[0])
+            pcap_progress(parms_array, masscan->nic_count, &status);
 
         if (min_index >= range && !masscan->is_infinite) {
-            /* Note: This is how we can tell the scan has ended */
-            is_tx_done = 1;
+            /* Note: This is how we can tell the scan has ended. With
+             * --discover-ports, that's just the discovery pass, and we
+             * also wait for the hosts found to be port scanned */
+            if (masscan->discover.live == NULL
+                || discover_is_finished(masscan->discover.live, &when_discovered))
+                is_tx_done = 1;
         }
 
         /*
@@ -1440,15 +2748,38 @@ main_scan(struct Masscan *masscan)
         pixie_mssleep(750);
     }
 
+    if (checkpoint.masscan) {
+        checkpoint.is_done = 1;
+        pixie_thread_join(checkpoint.thread_handle);
+    }
+
     /*
      * If we haven't completed the scan, then save the resume
      * information.
      */
-    if (min_index < count_ips * count_ports) {
-        masscan->resume.index = min_index;
+    if (is_polling)
+        min_index = resume_collect(masscan, parms_array);
+    if (masscan->coord.connect) {
+        /* The coordinator keeps track of what's been done */
+    } else if (masscan->profile_count) {
+        unsigned is_incomplete = 0;
+        unsigned k;
 
+        for (k=0; k<masscan->profile_count; k++) {
+            if (masscan->profile[k].resume_index < profile_range(&masscan->profile[k]))
+                is_incomplete = 1;
+        }
+        if (is_incomplete)
+            masscan_save_state(masscan);
+        else if (checkpoint.masscan)
+            remove(masscan_state_filename(masscan));
+    } else if (min_index < count_ips * count_ports
+               || (masscan->tiers.count && min_index < range)) {
         /* Write current settings to "paused.conf" so that the scan can be restarted */
         masscan_save_state(masscan);
+    } else if (checkpoint.masscan) {
+        /* Finished, so the last checkpoint would only confuse things */
+        remove(masscan_state_filename(masscan));
     }
 
 
@@ -1460,7 +2791,8 @@ main_scan(struct Masscan *masscan)
     for (;;) {
         unsigned transmit_count = 0;
         unsigned receive_count = 0;
-        unsigned i;
+        unsigned receive_total = 0;
+        unsigned i, j;
         double rate = 0;
         uint64_t total_tcbs = 0;
         uint64_t total_synacks = 0;
@@ -1477,13 +2809,31 @@ main_scan(struct Masscan *masscan)
 
             rate += parms->throttler->current_rate;
 
-            if (parms->total_tcbs)
-                total_tcbs += *parms->total_tcbs;
-            if (parms->total_synacks)
-                total_synacks += *parms->total_synacks;
+            for (j=0; j<parms->recv_count; j++) {
+                struct RecvThread *recv = &parms->recv[j];
+                if (recv->total_tcbs)
+                    total_tcbs += *recv->total_tcbs;
+                if (recv->total_synacks)
+                    total_synacks += *recv->total_synacks;
+            }
             if (parms->total_syns)
                 total_syns += *parms->total_syns;
         }
+        status.extra[0] = '\0';
+        if (masscan->profile_count) {
+            uint64_t mins[MAX_PROFILES];
+            min_index = profiles_progress(masscan, parms_array, mins, &status);
+        }
+        if (masscan->discover.live)
+            discover_progress(masscan, &status);
+        if (masscan->tiers.count)
+            tiers_progress(masscan, min_index, &status);
+        if (masscan->is_scripting)
+            scripting_progress(parms_array, masscan->nic_count, &status);
+        if (masscan->is_banners)
+            banners_progress(parms_array, masscan->nic_count, &status);
+        if (masscan->pcap_filename[0])
+            pcap_progress(parms_array, masscan->nic_count, &status);
 
 
 
@@ -1496,18 +2846,24 @@ main_scan(struct Masscan *masscan)
             exit(0);
         }
 
-        if (masscan->output.is_status_updates) {
-            status_print(&status, min_index, range, rate,
-                total_tcbs, total_synacks, total_syns,
-                masscan->wait - (time(0) - now),
-                masscan->output.is_status_ndjson);
+        if (is_polling) {
+            if (masscan->output.is_status_updates)
+                status_print(&status, min_index, range, rate,
+                    total_tcbs, total_synacks, total_syns,
+                    masscan->wait - (time(0) - now),
+                    masscan->output.is_status_ndjson);
 
             for (i=0; i<masscan->nic_count; i++) {
                 struct ThreadPair *parms = &parms_array[i];
 
                 transmit_count += parms->done_transmitting;
-                receive_count += parms->done_receiving;
-
+                for (j=0; j<parms->recv_count; j++)
+                    receive_count += parms->recv[j].done_receiving;
+                receive_total += parms->recv_count;
+                if (parms->neighbor) {
+                    receive_count += parms->neighbor->done_receiving;
+                    receive_total++;
+                }
             }
 
             pixie_mssleep(250);
@@ -1516,7 +2872,7 @@ main_scan(struct Masscan *masscan)
                 continue;
             is_tx_done = 1;
             is_rx_done = 1;
-            if (receive_count < masscan->nic_count)
+            if (receive_count < receive_total)
                 continue;
 
         } else {
@@ -1529,8 +2885,14 @@ main_scan(struct Masscan *masscan)
 
                 pixie_thread_join(parms->thread_handle_xmit);
                 parms->thread_handle_xmit = 0;
-                pixie_thread_join(parms->thread_handle_recv);
-                parms->thread_handle_recv = 0;
+                for (j=0; j<parms->recv_count; j++) {
+                    pixie_thread_join(parms->recv[j].thread_handle_recv);
+                    parms->recv[j].thread_handle_recv = 0;
+                }
+                if (parms->neighbor) {
+                    pixie_thread_join(parms->neighbor->thread_handle_recv);
+                    parms->neighbor->thread_handle_recv = 0;
+                }
             }
             is_tx_done = 1;
             is_rx_done = 1;
@@ -1544,6 +2906,17 @@ main_scan(struct Masscan *masscan)
      * Now cleanup everything
      */
     status_finish(&status);
+    for (index=0; index<masscan->nic_count; index++)
+        coord_worker_close(parms_array[index].coord);
+    neighbor_stats_print(masscan, parms_array);
+    hello_learn_finish(masscan, parms_array);
+    if (masscan->discover.live) {
+        uint64_t found, pending, dropped;
+
+        discover_stats(masscan->discover.live, &found, &pending, &dropped);
+        LOG(1, "[+] discover: %llu live hosts, %llu dropped (table full)\n",
+            (unsigned long long)found, (unsigned long long)dropped);
+    }
 
     if (!masscan->output.is_status_updates) {
         uint64_t usec_now = pixie_gettime();
@@ -1608,6 +2981,7 @@ int main(int argc, char *argv[])
                 sizeof(masscan->output.rotate.directory),
                 ".");
     masscan->is_capture_cert = 1;
+    masscan->is_neighbor_thread = 1;
 
     /*
      * Pre-parse the command-line
@@ -1640,6 +3014,9 @@ int main(int argc, char *argv[])
     if (masscan->seed == 0)
         masscan->seed = get_entropy(); /* entropy for randomness */
 
+    /* Must be set before any of the big tables are allocated */
+    huge_set_policy(masscan->hugepages);
+
     /*
      * Load database files like "nmap-payloads" and "nmap-service-probes"
      */
@@ -1658,6 +3035,9 @@ int main(int argc, char *argv[])
         LOG(2, "libpcap: failed to load\n");
     rawsock_init();
 
+    /* zlib and libzstd, for compressed output and --readscan */
+    compress_init();
+
     /* Init some protocol parser data structures */
     snmp_init();
     x509_init();
@@ -1668,6 +3048,7 @@ int main(int argc, char *argv[])
      * of their ranges, and when doing wide scans, add the exclude list to
      * prevent them from being scanned.
      */
+    masscan_profiles_finalize(masscan);
     has_target_addresses = massip_has_ipv4_targets(&masscan->targets) || massip_has_ipv6_targets(&masscan->targets);
     has_target_ports = massip_has_target_ports(&masscan->targets);
     massip_apply_excludes(&masscan->targets, &masscan->exclude);
@@ -1682,6 +3063,8 @@ int main(int argc, char *argv[])
      * our --excludefile will chop up our pristine 0.0.0.0/0 range into
      * hundreds of subranges. This allows us to grab addresses faster. */
     massip_optimize(&masscan->targets);
+    masscan_discover_finalize(masscan);
+    masscan_tiers_finalize(masscan);
     
     /* FIXME: we only support 63-bit scans at the current time.
      * This is big enough for the IPv4 Internet, where scanning
@@ -1742,6 +3125,25 @@ int main(int argc, char *argv[])
         }
         return main_scan(masscan);
 
+    case Operation_Coordinator:
+        /*
+         * Hand out chunks of the scan to --worker instances
+         */
+        if (rangelist_count(&masscan->targets.ports) == 0
+            || (rangelist_count(&masscan->targets.ipv4) == 0
+                && massint128_is_zero(range6list_count(&masscan->targets.ipv6)))) {
+            LOG(0, "FAIL: coordinator: needs the same targets and ports as the workers\n");
+            return 1;
+        }
+        if (masscan->profile_count || masscan->tiers.count
+            || masscan->discover.ports.count || masscan->shard.of > 1) {
+            LOG(0, "FAIL: coordinator: can't be used with --profile, --port-tiers, "
+                   "--discover-ports or --shard\n");
+            return 1;
+        }
+        signal(SIGINT, control_c_handler);
+        return coordinator_run(masscan);
+
     case Operation_ListScan:
         /* Create a randomized list of IP addresses */
         main_listscan(masscan);
@@ -1768,7 +3170,7 @@ int main(int argc, char *argv[])
 
             /* find first file */
             for (start=1; start<(unsigned)argc; start++) {
-                if (memcmp(argv[start], "--readscan", 10) == 0) {
+                if (strcmp(argv[start], "--readscan") == 0) {
                     start++;
                     break;
                 }
@@ -1792,6 +3194,9 @@ int main(int argc, char *argv[])
         blackrock_benchmark(masscan->blackrock_rounds);
         blackrock2_benchmark(masscan->blackrock_rounds);
         smack_benchmark();
+        huge_benchmark();
+        checksum_benchmark();
+        ranges6_benchmark();
         exit(1);
         break;
 
@@ -1822,6 +3227,10 @@ int main(int argc, char *argv[])
             x += ranges6_selftest();
             x += dedup_selftest();
             x += checksum_selftest();
+            x += huge_selftest();
+            x += pixie_topology_selftest();
+            x += profile_selftest();
+            x += discover_selftest();
             x += ipv6address_selftest();
             x += proto_coap_selftest();
             x += smack_selftest();
@@ -1829,13 +3238,24 @@ int main(int argc, char *argv[])
             x += base64_selftest();
             x += banner1_selftest();
             x += output_selftest();
+            x += arrow_selftest();
+            x += compress_selftest();
             x += siphash24_selftest();
             x += ntp_selftest();
             x += snmp_selftest();
+            x += udp_selftest();
+            x += stateless_selftest();
+            x += tcpcon_selftest();
+            x += hellolearn_selftest();
+            x += pcapwriter_selftest();
+            x += analytics_selftest();
+            x += coordinator_selftest();
             x += proto_isakmp_selftest();
             x += templ_payloads_selftest();
             x += blackrock_selftest();
             x += rawsock_selftest();
+            x += xdpsock_selftest();
+            x += vnetsock_selftest();
             x += lcg_selftest();
             x += template_selftest();
             x += ranges_selftest();
@@ -12,11 +12,18 @@
 
 #include "massip.h"
 #include "stack-queue.h"
+#include "main-profile.h"
 
 struct Adapter;
 struct TemplateSet;
 struct Banner1;
 struct TemplateOptions;
+struct LiveHosts;
+struct HelloLearn;
+
+/* Each --port-tiers tier is a separate pass in the transmit thread, like
+ * a --profile, so there can't be more tiers than profiles */
+#define MAX_PORT_TIERS 8
 
 /**
  * This is the "operation" to be performed by masscan, which is almost always
@@ -38,6 +45,7 @@ enum Operation {
     Operation_Echo = 9,             /* --echo */
     Operation_EchoAll = 10,         /* --echo-all */
     Operation_EchoCidr = 11,        /* --echo-cidr */
+    Operation_Coordinator = 12,     /* --coordinator <[ip:]port> */
 };
 
 /**
@@ -62,6 +70,7 @@ enum OutputFormat {
     Output_None         = 0x0400,
     Output_Certs        = 0x0800,
     Output_Hostonly     = 0x1000,   /* -oH, "hostonly" */
+    Output_Arrow        = 0x2000,   /* "arrow", Arrow IPC stream */
     Output_All          = 0xFFBF,   /* not supported */
 };
 
@@ -144,9 +153,39 @@ struct Masscan
         unsigned vlan_id;
         unsigned is_vlan:1;
         unsigned is_usable:1;
+        unsigned xdp_mode;  /* --adapter-xdp, see enum XdpMode */
+        unsigned xdp_queue; /* --adapter-xdp-queue */
+        unsigned is_checksum_offload:1; /* --adapter-offload */
     } nic[8];
     unsigned nic_count;
 
+    /**
+     * --rx-threads <n>
+     * The number of receive threads per adapter. When more than one, the
+     * adapter is opened that many times and the handles joined into a
+     * PACKET_FANOUT group, so each thread sees only its share of the
+     * flows. Each thread has its own TCP connection table, dedup table,
+     * and output. Defaults to 1.
+     */
+    unsigned rx_thread_count;
+
+    /**
+     * --hugepages [off|auto|2m|1g]
+     * Put the big per-thread tables on hugepages, see enum HugePolicy
+     */
+    unsigned hugepages;
+
+    /**
+     * --dedup-size <n>, --dedup-window <secs>
+     * How many recent responses each receive thread remembers, in order
+     * to ignore duplicates. When zero, there's room for 'window' seconds
+     * of responses at the --rate, defaulting to 5 seconds.
+     */
+    struct {
+        uint64_t entries;
+        unsigned window;
+    } dedup;
+
     /**
      * The target ranges of IPv4 addresses that are included in the scan.
      * The user can specify anything here, and we'll resolve all overlaps
@@ -164,6 +203,44 @@ struct Masscan
      */
     struct MassIP exclude;
 
+    /**
+     * Several scans in one, interleaved by weight (--profile). When there
+     * are profiles, 'targets' above becomes the union of their targets.
+     * 'profile_current' is the one that parameters like --range apply to
+     * while parsing the configuration.
+     */
+    struct ScanProfile profile[MAX_PROFILES];
+    unsigned profile_count;
+    unsigned profile_current;
+
+    /**
+     * --discover-ports
+     * Pipelined scan: replies to a first pass over these ports feed live
+     * hosts to the full --ports scan, see main-discover.h. The 'targets'
+     * here share the address lists of the main 'targets'.
+     */
+    struct {
+        struct RangeList ports;
+        struct MassIP targets;
+        struct LiveHosts *live;
+    } discover;
+
+    /**
+     * --port-tiers
+     * Popular ports first: the ports are split into tiers by their rank
+     * in the --top-ports list (or a --port-frequency-file), and each tier
+     * is scanned in full, in the usual random order, before the next one
+     * starts. 'bounds' are the ranks where one tier ends and the next
+     * begins. The 'targets' share the address lists of the main 'targets'.
+     */
+    struct {
+        unsigned bounds[MAX_PORT_TIERS];
+        unsigned bound_count;
+        char *frequency_file;
+        struct MassIP targets[MAX_PORT_TIERS];
+        unsigned count;
+    } tiers;
+
     /**
      * Only output these types of banners
      */
@@ -188,6 +265,7 @@ struct Masscan
     unsigned is_sendq:1;        /* --sendq */
     unsigned is_banners:1;      /* --banners */
     unsigned is_banners_rawudp:1; /* --rawudp */
+    unsigned is_stateless_banners:1; /* --stateless-banners */
     unsigned is_offline:1;      /* --offline */
     unsigned is_noreset:1;      /* --noreset, don't transmit RST */
     unsigned is_gmt:1;          /* --gmt, all times in GMT */
@@ -206,6 +284,9 @@ struct Masscan
     unsigned is_hello_http:1;    /* --hello=http, use HTTP on all ports */
     unsigned is_scripting:1;    /* whether scripting is needed */
     unsigned is_capture_servername:1; /* --capture servername */
+    unsigned is_pin_threads:1;  /* --pin-threads, CPU affinity by topology */
+    unsigned is_busy_poll:1;    /* --busy-poll, spin instead of sleeping on receive */
+    unsigned is_neighbor_thread:1; /* --neighbor-thread, ARP/NDP on their own capture */
 
     /** Packet template options, such as whether we should add a TCP MSS
      * value, or remove it from the packet */
@@ -233,8 +314,28 @@ struct Masscan
             unsigned ip;
             unsigned port;
         } target;
+
+        /** Where each transmit thread was, so that it can start again
+         * exactly there, rather than all starting from the slowest one's
+         * 'index' above (resume-thread). There's one per adapter */
+        struct ResumeThread {
+            unsigned is_valid;
+            uint64_t index;     /* the thread's 'i' */
+            unsigned retry;     /* the thread's 'r', the retry phase */
+            uint64_t repeats;   /* --infinite passes done */
+        } threads[8];
     } resume;
 
+    /**
+     * --checkpoint <seconds>
+     * Saves the resume information every so often while scanning, so
+     * that even a crash loses only a few seconds of the scan.
+     */
+    struct {
+        unsigned seconds;
+        char *filename;         /* --checkpoint-file, or "paused.conf" */
+    } checkpoint;
+
     /**
      * --shard n/m
      * This is used for distributing a scan across multiple "shards". Every
@@ -248,6 +349,27 @@ struct Masscan
         unsigned of;
     } shard;
 
+    /**
+     * --coordinator, --worker
+     * Instead of fixed --shard slices, a coordinator hands out chunks of
+     * the index space to worker instances as they ask for them, see
+     * main-coordinator.h. 'saved' is how far each chunk got, for
+     * --resume of the coordinator.
+     */
+    struct {
+        char *listen;           /* --coordinator <[ip:]port|path> */
+        char *connect;          /* --worker <ip:port|path> */
+        uint64_t chunk_size;    /* --chunk-size, 0 for the default */
+        unsigned timeout;       /* --worker-timeout, seconds */
+        struct CoordSaved {
+            uint64_t first;     /* chunks [first..last] */
+            uint64_t last;
+            uint64_t next;      /* first index not yet scanned, or
+                                 * UINT64_MAX when they're all done */
+        } *saved;
+        size_t saved_count;
+    } coord;
+
     /**
      * The packet template set we are current using. We store a binary template
      * for TCP, UDP, SCTP, ICMP, and so on. All the scans using that protocol
@@ -293,6 +415,39 @@ struct Masscan
          * We should append to the output file rather than overwriting it.
          */
         unsigned is_append:1;
+
+        /**
+         * --output-compress, --output-compress-level
+         * Compress output files with gzip or zstd, or by default when the
+         * filename ends in .gz or .zst. See out-compress.h.
+         */
+        unsigned compress;
+        int compress_level;
+
+        /**
+         * --arrow-batch
+         * Rows per record batch with --output-format arrow
+         */
+        unsigned arrow_batch;
+
+        /**
+         * --output-sink, or a second -oX, -oB, etc.
+         * More files written at the same time as the one above, from the
+         * same results, each with its own format. Rotation is only what's
+         * set here, and the rest defaults to the options above.
+         */
+        struct OutputSink {
+            enum OutputFormat format;
+            char *filename;
+            unsigned rotate_timeout;
+            uint64_t rotate_filesize;
+            unsigned compress;
+            unsigned is_show_set:1;
+            unsigned is_show_open:1;
+            unsigned is_show_closed:1;
+            unsigned is_show_host:1;
+        } *sinks;
+        unsigned sink_count;
         
         /**
          * --json-status
@@ -380,6 +535,17 @@ struct Masscan
 
     char pcap_filename[256];
 
+    /**
+     * --pcap-snaplen, --pcap-rotate
+     * The most bytes saved from each packet, or zero for all of them, and
+     * the size at which a --pcap file is closed and the next one started,
+     * or zero for no limit.
+     */
+    struct {
+        unsigned snaplen;
+        uint64_t rotate_bytes;
+    } pcap;
+
     struct {
         unsigned timeout;
     } tcb;
@@ -452,6 +618,30 @@ struct Masscan
      * hellos, such as FTP or VNC */
     unsigned tcp_hello_timeout;
 
+    /**
+     * --hello-learn FILE
+     * Whether servers on each port speak first, loaded from the file
+     * before the scan, if it exists, and saved back to it afterwards.
+     */
+    struct {
+        char *filename;
+        struct HelloLearn *prior;
+    } hello_learn;
+
+    /**
+     * --readscan-stats: summarize the files being read, instead of
+     * writing them out again
+     */
+    struct {
+        unsigned is_enabled:1;
+        unsigned top;           /* --readscan-top, banners and networks */
+        unsigned threads;       /* --readscan-threads, or 0 for one per CPU */
+    } readscan_stats;
+
+    /** Most bytes of banners kept from one TCP connection, or zero for
+     * the default (--banner-limit) */
+    unsigned tcp_banner_limit;
+
 
     char *bpf_filter;
 
@@ -481,8 +671,13 @@ struct Masscan
         /* The name (filename) of the script to run */
         char *name;
         
-        /* The script VM */
+        /* The script VM, used at startup to configure the scan */
         struct lua_State *L;
+
+        /* The compiled script, from which each receive thread creates
+         * its own VM */
+        char *bytecode;
+        size_t bytecode_length;
     } scripting;
 
     
@@ -500,6 +695,35 @@ void masscan_read_config_file(struct Masscan *masscan, const char *filename);
 void masscan_command_line(struct Masscan *masscan, int argc, char *argv[]);
 void masscan_usage(void);
 void masscan_save_state(struct Masscan *masscan);
+
+/**
+ * Writes the resume information to the file, replacing it atomically.
+ * @return 0 on success, or -1 on error, with 'errno' set
+ */
+int masscan_write_state(struct Masscan *masscan, const char *filename);
+
+/**
+ * The file resume information is saved to, "paused.conf" unless
+ * --checkpoint-file says otherwise.
+ */
+const char *masscan_state_filename(const struct Masscan *masscan);
+
+/**
+ * After reading the configuration, apply excludes and defaults to each
+ * --profile, and set 'targets' to the union of all of them.
+ */
+void masscan_profiles_finalize(struct Masscan *masscan);
+
+/**
+ * Sets up the first phase of a --discover-ports scan, once the targets
+ * are final.
+ */
+void masscan_discover_finalize(struct Masscan *masscan);
+
+/**
+ * Splits the ports into --port-tiers, once the targets are final.
+ */
+void masscan_tiers_finalize(struct Masscan *masscan);
 void main_listscan(struct Masscan *masscan);
 
 /**
@@ -7,6 +7,7 @@
 #include "util-logger.h"
 #include "massip.h"
 #include "massip-parse.h"
+#include "pixie-timer.h"
 
 #include <assert.h>
 #include <ctype.h>
@@ -164,6 +165,180 @@ static ipv6address PLUS_ONE(const ipv6address ip)
     return result;
 }
 
+/***************************************************************************
+ * A list of single addresses, packed. The lower 64 bits of each address
+ * are in 'lo'. The upper 64 bits are either in 'hi' alongside, or when
+ * many addresses share the same /64, an index into the much shorter
+ * 'prefixes' array, taking 12 bytes per address rather than 16. In
+ * either case, the address at an index is found without a search.
+ ***************************************************************************/
+struct Range6Packed {
+    uint64_t *lo;
+    uint64_t *hi;
+    uint32_t *prefix;
+    uint64_t *prefixes;
+    size_t prefix_count;
+};
+
+/** Lists with fewer ranges than this aren't worth packing */
+#define RANGE6_PACK_MIN 1024
+
+static inline ipv6address
+packed_at(const struct Range6Packed *packed, size_t index)
+{
+    ipv6address result;
+
+    if (packed->hi)
+        result.hi = packed->hi[index];
+    else
+        result.hi = packed->prefixes[packed->prefix[index]];
+    result.lo = packed->lo[index];
+    return result;
+}
+
+static void
+packed_free(struct Range6Packed *packed)
+{
+    if (packed == NULL)
+        return;
+    free(packed->lo);
+    free(packed->hi);
+    free(packed->prefix);
+    free(packed->prefixes);
+    free(packed);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct Range6
+range6list_at(const struct Range6List *targets, size_t index)
+{
+    struct Range6 result;
+
+    if (targets->packed) {
+        result.begin = packed_at(targets->packed, index);
+        result.end = result.begin;
+        return result;
+    }
+    return targets->list[index];
+}
+
+/***************************************************************************
+ * Turns a packed list back into ranges, before it's changed.
+ ***************************************************************************/
+static void
+range6list_unpack(struct Range6List *targets)
+{
+    struct Range6Packed *packed = targets->packed;
+    size_t count = targets->count;
+    size_t i;
+
+    if (packed == NULL)
+        return;
+
+    targets->packed = NULL;
+    targets->list = NULL;
+    targets->count = 0;
+    targets->max = 0;
+    for (i=0; i<count; i++) {
+        ipv6address addr = packed_at(packed, i);
+        range6list_add_range(targets, addr, addr);
+    }
+    packed_free(packed);
+
+    /* They were added in order */
+    targets->is_sorted = 1;
+}
+
+/***************************************************************************
+ * Packs a sorted list, if it's nearly all single addresses, so that
+ * it doesn't grow by more than a quarter when every range becomes
+ * its addresses.
+ * @return
+ *      1 if the list was packed, 0 if it was left as it was
+ ***************************************************************************/
+static int
+range6list_pack(struct Range6List *targets)
+{
+    struct Range6Packed *packed;
+    ipv6address total = {0,0};
+    size_t count;
+    size_t prefix_count = 0;
+    size_t n = 0;
+    size_t i;
+    uint64_t prev_hi = 0;
+
+    if (targets->count < RANGE6_PACK_MIN)
+        return 0;
+
+    for (i=0; i<targets->count; i++) {
+        ipv6address x;
+        x = _int128_subtract(targets->list[i].end, targets->list[i].begin);
+        if (x.hi)
+            return 0;
+        x = _int128_add64(x, 1);
+        total = _int128_add(total, x);
+        if (total.hi || total.lo > targets->count + targets->count/4)
+            return 0;
+    }
+    count = (size_t)total.lo;
+
+    /* Count the distinct /64s */
+    for (i=0; i<targets->count; i++) {
+        ipv6address addr = targets->list[i].begin;
+        for (;;) {
+            if (prefix_count == 0 || addr.hi != prev_hi) {
+                prefix_count++;
+                prev_hi = addr.hi;
+            }
+            if (EQUAL(addr, targets->list[i].end))
+                break;
+            addr = PLUS_ONE(addr);
+        }
+    }
+
+    packed = CALLOC(1, sizeof(*packed));
+    packed->lo = REALLOCARRAY(NULL, count, sizeof(packed->lo[0]));
+    if (prefix_count * 2 <= count && count <= 0xFFFFFFFF) {
+        packed->prefix = REALLOCARRAY(NULL, count, sizeof(packed->prefix[0]));
+        packed->prefixes = REALLOCARRAY(NULL, prefix_count, sizeof(packed->prefixes[0]));
+        packed->prefix_count = prefix_count;
+    } else
+        packed->hi = REALLOCARRAY(NULL, count, sizeof(packed->hi[0]));
+
+    prefix_count = 0;
+    for (i=0; i<targets->count; i++) {
+        ipv6address addr = targets->list[i].begin;
+        for (;;) {
+            packed->lo[n] = addr.lo;
+            if (packed->hi)
+                packed->hi[n] = addr.hi;
+            else {
+                if (prefix_count == 0 || packed->prefixes[prefix_count-1] != addr.hi)
+                    packed->prefixes[prefix_count++] = addr.hi;
+                packed->prefix[n] = (uint32_t)(prefix_count - 1);
+            }
+            n++;
+            if (EQUAL(addr, targets->list[i].end))
+                break;
+            addr = PLUS_ONE(addr);
+        }
+    }
+
+    LOG(1, "[+] range6: packed %llu ranges into %llu addresses (%llu /64s)\n",
+        (unsigned long long)targets->count, (unsigned long long)count,
+        (unsigned long long)(packed->hi ? 0 : packed->prefix_count));
+
+    free(targets->list);
+    free(targets->picker);
+    targets->list = NULL;
+    targets->picker = NULL;
+    targets->max = 0;
+    targets->count = count;
+    targets->packed = packed;
+    return 1;
+}
+
 /***************************************************************************
  ***************************************************************************/
 massint128_t 
@@ -186,6 +361,25 @@ range6list_is_contains(const struct Range6List *targets, const ipv6address ip)
 {
     unsigned i;
 
+    /* A packed list is in order, so binary search it */
+    if (targets->packed) {
+        size_t min = 0;
+        size_t max = targets->count;
+
+        while (min < max) {
+            size_t mid = min + (max - min)/2;
+            ipv6address addr = packed_at(targets->packed, mid);
+
+            if (EQUAL(addr, ip))
+                return 1;
+            else if (LESS(addr, ip))
+                min = mid + 1;
+            else
+                max = mid;
+        }
+        return 0;
+    }
+
     for (i=0; i<targets->count; i++) {
         struct Range6 *range = &targets->list[i];
 
@@ -297,6 +491,9 @@ range6list_sort(struct Range6List *targets)
     struct Range6List newlist = {0};
     size_t original_count = targets->count;
 
+    if (targets->packed)
+        return;
+
     /* Empty lists are, of course, sorted. We need to set this
      * to avoid an error later on in the code which asserts that
      * the lists are sorted */
@@ -349,6 +546,8 @@ range6list_add_range(struct Range6List *targets, ipv6address begin, ipv6address
     range.begin = begin;
     range.end = end;
 
+    range6list_unpack(targets);
+
     /* auto-expand the list if necessary */
     if (targets->count + 1 >= targets->max) {
         targets->max = targets->max * 2 + 1;
@@ -387,6 +586,7 @@ range6list_remove_all(struct Range6List *targets)
         free(targets->list);
     if (targets->picker)
         free(targets->picker);
+    packed_free(targets->packed);
     memset(targets, 0, sizeof(*targets));
 }
 
@@ -398,7 +598,8 @@ range6list_merge(struct Range6List *list1, const struct Range6List *list2)
     unsigned i;
     
     for (i=0; i<list2->count; i++) {
-        range6list_add_range(list1, list2->list[i].begin, list2->list[i].end);
+        struct Range6 range = range6list_at(list2, i);
+        range6list_add_range(list1, range.begin, range.end);
     }
 }
 
@@ -413,6 +614,8 @@ range6list_remove_range(struct Range6List *targets, const ipv6address begin, con
     x.begin = begin;
     x.end = end;
 
+    range6list_unpack(targets);
+
     /* See if the range overlaps any exist range already in the
      * list */
     for (i = 0; i < targets->count; i++) {
@@ -471,7 +674,7 @@ range6list_exclude(  struct Range6List *targets,
     unsigned i;
     
     for (i=0; i<excludes->count; i++) {
-        struct Range6 range = excludes->list[i];
+        struct Range6 range = range6list_at(excludes, i);
         ipv6address x;
         
         x = _int128_subtract(range.end, range.begin);
@@ -493,6 +696,11 @@ range6list_count(const struct Range6List *targets)
     unsigned i;
     ipv6address result = {0,0};
 
+    if (targets->packed) {
+        result.lo = targets->count;
+        return result;
+    }
+
     for (i=0; i<targets->count; i++) {
         ipv6address x;
 
@@ -518,6 +726,9 @@ range6list_pick(const struct Range6List *targets, uint64_t index)
     size_t mid;
     const size_t *picker = targets->picker;
 
+    if (targets->packed)
+        return packed_at(targets->packed, (size_t)index);
+
     if (picker == NULL) {
         fprintf(stderr, "[-] ipv6 picker is null\n");
         exit(1);
@@ -550,21 +761,13 @@ range6list_pick(const struct Range6List *targets, uint64_t index)
  * it's the most cache-efficient, having the least overhead to fit within
  * the cache.
  ***************************************************************************/
-void
-range6list_optimize(struct Range6List *targets)
+static void
+range6list_make_picker(struct Range6List *targets)
 {
     size_t *picker;
     size_t i;
     ipv6address total = {0,0};
 
-    if (targets->count == 0)
-        return;
-
-    /* This technique only works when the targets are in
-     * ascending order */
-    if (!targets->is_sorted)
-        range6list_sort(targets);
-
     if (targets->picker)
         free(targets->picker);
 
@@ -581,6 +784,24 @@ range6list_optimize(struct Range6List *targets)
     targets->picker = picker;
 }
 
+void
+range6list_optimize(struct Range6List *targets)
+{
+    if (targets->count == 0 || targets->packed)
+        return;
+
+    /* This technique only works when the targets are in
+     * ascending order */
+    if (!targets->is_sorted)
+        range6list_sort(targets);
+
+    /* Hitlists of single addresses don't need searching at all */
+    if (range6list_pack(targets))
+        return;
+
+    range6list_make_picker(targets);
+}
+
 
 
 /***************************************************************************
@@ -690,6 +911,174 @@ regress_pick2()
 
 
 
+/***************************************************************************
+ * Checks that a hitlist gets packed, that picking from it gives the same
+ * addresses as the ranges it was made from, and that it's unpacked
+ * correctly when changed afterwards.
+ ***************************************************************************/
+static int
+regress_pack(unsigned prefix_step)
+{
+    struct Range6List targets[1];
+    struct Range6List expected[1];
+    struct Range6List duplicate[1];
+    ipv6address addr = {0x20010db800000000ULL, 0};
+    ipv6address prev = {0,0};
+    unsigned seed = prefix_step;
+    size_t count;
+    size_t j;
+
+    memset(targets, 0, sizeof(targets[0]));
+    memset(expected, 0, sizeof(expected[0]));
+    memset(duplicate, 0, sizeof(duplicate[0]));
+
+    /* Single addresses, a few in each /64, with the odd small range, added
+     * out of order */
+    for (j=0; j<3000; j++) {
+        ipv6address end;
+        if (r_rand(&seed) % prefix_step == 0) {
+            addr.hi++;
+            addr.lo = r_rand(&seed);
+        }
+        addr.lo += 2 + r_rand(&seed) % 1000;
+        end = addr;
+        if (j % 100 == 0)
+            end.lo += 2;
+        range6list_add_range(targets, end, end);
+        range6list_add_range(targets, addr, end);
+        range6list_add_range(expected, addr, end);
+        addr = end;
+    }
+    range6list_sort(expected);
+    count = (size_t)range6list_count(expected).lo;
+
+    range6list_optimize(targets);
+    REGRESS(prefix_step, targets->packed != NULL);
+    REGRESS(prefix_step, targets->count == count);
+    REGRESS(prefix_step, range6list_count(targets).lo == count);
+    REGRESS(prefix_step, (targets->packed->hi == NULL) == (prefix_step > 2));
+
+    for (j=0; j<count; j++) {
+        ipv6address x = range6list_pick(targets, j);
+        ipv6address y = PLUS_ONE(x);
+
+        REGRESS(j, j == 0 || LESS(prev, x));
+        REGRESS(j, range6list_is_contains(targets, x));
+        REGRESS(j, range6list_is_contains(targets, y)
+                    == range6list_is_contains(expected, y));
+        range6list_add_range(duplicate, x, x);
+        prev = x;
+    }
+    REGRESS(prefix_step, duplicate->count == expected->count);
+    REGRESS(prefix_step, memcmp(duplicate->list, expected->list,
+                          expected->count * sizeof(expected->list[0])) == 0);
+
+    /* Reading the entries, as --readrange and the config echo do, gives
+     * the same addresses as the ranges */
+    range6list_remove_all(duplicate);
+    for (j=0; j<targets->count; j++) {
+        struct Range6 range = range6list_at(targets, j);
+
+        REGRESS(j, !LESS(range.end, range.begin));
+        REGRESS(j, j == 0 || LESS(prev, range.begin));
+        range6list_add_range(duplicate, range.begin, range.end);
+        prev = range.end;
+    }
+    REGRESS(prefix_step, duplicate->count == expected->count);
+    REGRESS(prefix_step, memcmp(duplicate->list, expected->list,
+                          expected->count * sizeof(expected->list[0])) == 0);
+
+    /* Removing an address unpacks the list */
+    addr = range6list_pick(targets, 5);
+    range6list_remove_range(targets, addr, addr);
+    range6list_remove_range(expected, addr, addr);
+    REGRESS(prefix_step, targets->packed == NULL);
+    REGRESS(prefix_step, targets->count == expected->count);
+    REGRESS(prefix_step, memcmp(targets->list, expected->list,
+                          expected->count * sizeof(expected->list[0])) == 0);
+
+    range6list_remove_all(targets);
+    range6list_remove_all(expected);
+    range6list_remove_all(duplicate);
+    return 0;
+}
+
+/***************************************************************************
+ * Benchmark picking from a hitlist of 50-million addresses, first with
+ * the ordinary binary search, then packed.
+ ***************************************************************************/
+void
+ranges6_benchmark(void)
+{
+    static const size_t count = 50000000;
+    static const size_t picks = 10000000;
+    struct Range6List targets[1];
+    ipv6address addr = {0x20010db800000000ULL, 0};
+    unsigned seed = 1;
+    uint64_t x = 0;
+    unsigned pass;
+    size_t i;
+
+    printf("-- ipv6 hitlist --\n");
+
+    memset(targets, 0, sizeof(targets[0]));
+    targets->list = REALLOCARRAY(NULL, count, sizeof(targets->list[0]));
+    targets->max = count;
+    for (i=0; i<count; i++) {
+        if (r_rand(&seed) % 4 == 0) {
+            addr.hi++;
+            addr.lo = (uint64_t)r_rand(&seed) << 48;
+        }
+        addr.lo += 2 + r_rand(&seed);
+        targets->list[i].begin = addr;
+        targets->list[i].end = addr;
+    }
+    targets->count = count;
+    targets->is_sorted = 1;
+
+    for (pass=0; pass<2; pass++) {
+        uint64_t start;
+        uint64_t stop;
+        size_t bytes;
+
+        if (pass == 0) {
+            range6list_make_picker(targets);
+            bytes = count * (sizeof(targets->list[0]) + sizeof(targets->picker[0]));
+        } else {
+            free(targets->picker);
+            targets->picker = NULL;
+            range6list_pack(targets);
+            if (targets->packed == NULL)
+                break;
+            bytes = count * sizeof(uint64_t);
+            if (targets->packed->hi)
+                bytes += count * sizeof(uint64_t);
+            else
+                bytes += count * sizeof(uint32_t)
+                        + targets->packed->prefix_count * sizeof(uint64_t);
+        }
+
+        start = pixie_nanotime();
+        for (i=0; i<picks; i++) {
+            ipv6address a;
+            a = range6list_pick(targets, (i * 2654435761ULL) % count);
+            x += a.lo;
+        }
+        stop = pixie_nanotime();
+
+        printf("%12s: %6.1f nanoseconds/pick, %5.1f bytes/address\n",
+               pass ? "packed" : "ranges",
+               (double)(stop - start) / (double)picks,
+               (double)bytes / (double)count);
+    }
+
+    /* use the result so the loop isn't optimized away */
+    if (x == 1)
+        printf("%llu\n", (unsigned long long)x);
+
+    range6list_remove_all(targets);
+}
+
 /***************************************************************************
  * Called during "make regress" to run a regression test over this module.
  ***************************************************************************/
@@ -701,6 +1090,8 @@ ranges6_selftest(void)
     int err;
 
     REGRESS(0, regress_pick2() == 0);
+    REGRESS(0, regress_pack(1) == 0);
+    REGRESS(0, regress_pack(8) == 0);
 
     memset(targets, 0, sizeof(targets[0]));
 #define ERROR() fprintf(stderr, "selftest: failed %s:%u\n", __FILE__, __LINE__);
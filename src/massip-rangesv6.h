@@ -20,6 +20,8 @@ struct Range6
     ipv6address end; 
 };
 
+struct Range6Packed;
+
 /**
  * An array of ranges in sorted order
  */
@@ -29,9 +31,25 @@ struct Range6List
     size_t count;
     size_t max;
     size_t *picker;
+
+    /**
+     * For lists that are nearly all single addresses, like hitlists,
+     * 'range6list_optimize()' replaces 'list' and 'picker' with a packed
+     * array of the addresses themselves. Then 'list' is NULL, and 'count'
+     * is the number of addresses. Use 'range6list_at()' to read entries
+     * of either kind of list.
+     */
+    struct Range6Packed *packed;
     unsigned is_sorted:1;
 };
 
+/**
+ * Returns the range at the given index, which for a packed list is a
+ * range of one address.
+ */
+struct Range6
+range6list_at(const struct Range6List *targets, size_t index);
+
 /**
  * Adds the given range to the targets list. The given range can be a duplicate
  * or overlap with an existing range, which will get combined with existing
@@ -161,9 +179,11 @@ range6list_merge(struct Range6List *list1, const struct Range6List *list2);
 
 /**
  * Optimizes the target list, so that when we call "rangelist_pick()"
- * from an index, it runs faster. It currently configures this for 
- * a binary-search, though in the future some more efficient
- * algorithm may be chosen.
+ * from an index, it runs faster. Usually this configures it for a
+ * binary-search, but when nearly all the ranges are single addresses,
+ * the list is packed into an array of addresses, so that picking is
+ * a direct index into the array. Adding or removing ranges afterwards
+ * unpacks it again.
  */
 void
 range6list_optimize(struct Range6List *targets);
@@ -184,5 +204,11 @@ range6list_sort(struct Range6List *targets);
 int
 ranges6_selftest(void);
 
+/**
+ * Times picking from a large list of single addresses, packed and not.
+ */
+void
+ranges6_benchmark(void);
+
 
 #endif
@@ -0,0 +1,782 @@
+/*
+    Apache Arrow IPC stream output (--output-format arrow)
+
+    For loading results into DataFrames (pandas, polars, DuckDB, etc.),
+    which read Arrow directly without parsing anything:
+
+        import pyarrow as pa
+        table = pa.ipc.open_stream("scan.arrow").read_all()
+
+    Records are collected a column at a time, and every --arrow-batch
+    rows are written out as a "record batch". Each file (including each
+    --rotate file) is a complete stream: a schema, the batches, and an
+    end-of-stream marker. The columns are:
+
+        timestamp   timestamp[s, UTC]
+        ip          fixed_size_binary[16], IPv4 as ::ffff:a.b.c.d
+        port        uint16
+        proto       uint8, the IP protocol, 6 for TCP, 17 for UDP, ...
+        ttl         uint8
+        status      utf8, "open" or "closed", null for banners
+        app         utf8, the banner's protocol, null for status
+        banner      binary, null for status
+
+    The format is described at https://arrow.apache.org/docs/format/Columnar.html.
+    Each message is a FlatBuffers-encoded header followed by the column
+    data. Rather than depend on the FlatBuffers library, we encode the
+    few tables we need by hand below. Everything is little-endian.
+*/
+#include "output.h"
+#include "masscan.h"
+#include "masscan-app.h"
+#include "masscan-status.h"
+#include "util-malloc.h"
+#include "util-logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** The largest message header: the schema is about 1k */
+#define ARROW_META_MAX 4096
+
+/* Arrow's Type union, from Schema.fbs */
+#define ARROW_TYPE_INT              2
+#define ARROW_TYPE_BINARY           4
+#define ARROW_TYPE_UTF8             5
+#define ARROW_TYPE_TIMESTAMP        10
+#define ARROW_TYPE_FIXEDSIZEBINARY  15
+
+/* Arrow's MessageHeader union, from Message.fbs */
+#define ARROW_MSG_SCHEMA            1
+#define ARROW_MSG_RECORDBATCH       3
+
+/* MetadataVersion.V5 */
+#define ARROW_VERSION               4
+
+enum ArrowColumnType {
+    Column_Timestamp,
+    Column_Ip,
+    Column_Uint16,
+    Column_Uint8,
+    Column_Utf8,
+    Column_Binary,
+};
+
+static const struct {
+    const char *name;
+    enum ArrowColumnType type;
+} arrow_columns[] = {
+    {"timestamp",   Column_Timestamp},
+    {"ip",          Column_Ip},
+    {"port",        Column_Uint16},
+    {"proto",       Column_Uint8},
+    {"ttl",         Column_Uint8},
+    {"status",      Column_Utf8},
+    {"app",         Column_Utf8},
+    {"banner",      Column_Binary},
+};
+#define ARROW_COLUMNS (sizeof(arrow_columns)/sizeof(arrow_columns[0]))
+
+enum {
+    COL_TIMESTAMP, COL_IP, COL_PORT, COL_PROTO, COL_TTL,
+    COL_STATUS, COL_APP, COL_BANNER
+};
+
+struct ArrowBuffer {
+    unsigned char *px;
+    size_t length;
+    size_t max;
+};
+
+struct ArrowColumn {
+    struct ArrowBuffer validity;    /* only for strings */
+    struct ArrowBuffer offsets;     /* only for strings */
+    struct ArrowBuffer data;
+    uint64_t null_count;
+};
+
+struct ArrowBatch {
+    unsigned count;
+    struct ArrowColumn columns[ARROW_COLUMNS];
+};
+
+/***************************************************************************
+ * A growable buffer, for the column data
+ ***************************************************************************/
+static unsigned char *
+buffer_append(struct ArrowBuffer *buf, size_t length)
+{
+    unsigned char *result;
+
+    if (buf->length + length > buf->max) {
+        size_t max = buf->max ? buf->max * 2 : 4096;
+        while (max < buf->length + length)
+            max *= 2;
+        buf->px = REALLOC(buf->px, max);
+        buf->max = max;
+    }
+    result = buf->px + buf->length;
+    buf->length += length;
+    return result;
+}
+
+static void
+put_le(unsigned char *p, uint64_t x, unsigned size)
+{
+    unsigned i;
+    for (i=0; i<size; i++)
+        p[i] = (unsigned char)(x >> (8*i));
+}
+
+/***************************************************************************
+ * Adds a string to a column, or a null if 'px' is NULL. The validity
+ * bitmap has one bit per row, the offsets one 32-bit number per row plus
+ * the first one.
+ ***************************************************************************/
+static void
+column_string(struct ArrowColumn *col, unsigned row,
+              const void *px, size_t length)
+{
+    unsigned char *valid;
+
+    if (row == 0)
+        put_le(buffer_append(&col->offsets, 4), 0, 4);
+    if (row % 8 == 0)
+        *buffer_append(&col->validity, 1) = 0;
+    valid = &col->validity.px[row / 8];
+
+    if (px == NULL) {
+        col->null_count++;
+        length = 0;
+    } else {
+        *valid |= (unsigned char)(1 << (row % 8));
+        memcpy(buffer_append(&col->data, length), px, length);
+    }
+    put_le(buffer_append(&col->offsets, 4), col->data.length, 4);
+}
+
+static void
+column_number(struct ArrowColumn *col, uint64_t x, unsigned size)
+{
+    put_le(buffer_append(&col->data, size), x, size);
+}
+
+static void
+column_ip(struct ArrowColumn *col, ipaddress ip)
+{
+    unsigned char *p = buffer_append(&col->data, 16);
+
+    if (ip.version == 6) {
+        unsigned i;
+        for (i=0; i<8; i++) {
+            p[i] = (unsigned char)(ip.ipv6.hi >> (56 - 8*i));
+            p[8+i] = (unsigned char)(ip.ipv6.lo >> (56 - 8*i));
+        }
+    } else {
+        memset(p, 0, 10);
+        p[10] = 0xFF;
+        p[11] = 0xFF;
+        p[12] = (unsigned char)(ip.ipv4 >> 24);
+        p[13] = (unsigned char)(ip.ipv4 >> 16);
+        p[14] = (unsigned char)(ip.ipv4 >> 8);
+        p[15] = (unsigned char)(ip.ipv4 >> 0);
+    }
+}
+
+/***************************************************************************
+ * FLATBUFFERS
+ *
+ * Normally, FlatBuffers are built back to front, but as we know the shape
+ * of everything beforehand, we go front to back: a table first, then the
+ * things it points to, going back to fill in the offsets. Offsets to
+ * tables, vectors, and strings always point forward, and each table's
+ * "vtable", which says where its fields are, goes just before it.
+ ***************************************************************************/
+struct FlatBuf {
+    unsigned char buf[ARROW_META_MAX];
+    size_t length;
+    unsigned is_overflow;
+};
+
+struct FlatField {
+    unsigned id;        /* field number in the .fbs schema */
+    unsigned size;      /* 1, 2, 4, or 8 bytes */
+    uint64_t value;     /* for offsets, filled in later */
+    size_t at;          /* where it was put */
+};
+
+static size_t
+fb_reserve(struct FlatBuf *fb, size_t length)
+{
+    size_t at = fb->length;
+    if (at + length > sizeof(fb->buf)) {
+        fb->is_overflow = 1;
+        return 0;
+    }
+    memset(fb->buf + at, 0, length);
+    fb->length += length;
+    return at;
+}
+
+/** Pads so that 'extra' bytes from now we'll be aligned */
+static void
+fb_align(struct FlatBuf *fb, size_t align, size_t extra)
+{
+    while ((fb->length + extra) % align)
+        fb_reserve(fb, 1);
+}
+
+/** Points the offset at 'at' to 'target', which comes after it */
+static void
+fb_patch(struct FlatBuf *fb, size_t at, size_t target)
+{
+    if (fb->is_overflow)
+        return;
+    put_le(fb->buf + at, target - at, 4);
+}
+
+/***************************************************************************
+ * Writes a table's vtable and then the table, the bigger fields first so
+ * that each is aligned.
+ * @return where the table starts, to point offsets at
+ ***************************************************************************/
+static size_t
+fb_table(struct FlatBuf *fb, struct FlatField *fields, unsigned count)
+{
+    unsigned slots = 0;
+    size_t vtable;
+    size_t table;
+    size_t end;
+    unsigned size;
+    unsigned i;
+
+    for (i=0; i<count; i++) {
+        if (fields[i].id + 1 > slots)
+            slots = fields[i].id + 1;
+    }
+
+    /* The table starts 8-byte aligned, right after the vtable */
+    fb_align(fb, 8, 4 + 2*slots);
+    vtable = fb_reserve(fb, 4 + 2*slots);
+    table = fb_reserve(fb, 4);
+    if (fb->is_overflow)
+        return 0;
+    put_le(fb->buf + table, table - vtable, 4);
+
+    for (size=8; size; size/=2) {
+        for (i=0; i<count; i++) {
+            if (fields[i].size != size)
+                continue;
+            fb_align(fb, size, 0);
+            fields[i].at = fb_reserve(fb, size);
+            if (fb->is_overflow)
+                return 0;
+            put_le(fb->buf + fields[i].at, fields[i].value, size);
+            put_le(fb->buf + vtable + 4 + 2*fields[i].id, fields[i].at - table, 2);
+        }
+    }
+    end = fb->length;
+
+    put_le(fb->buf + vtable + 0, 4 + 2*slots, 2);
+    put_le(fb->buf + vtable + 2, end - table, 2);
+    return table;
+}
+
+/** Starts a vector, whose elements are then appended.
+ * @return where it starts, to point offsets at */
+static size_t
+fb_vector(struct FlatBuf *fb, unsigned count, unsigned align)
+{
+    size_t at;
+
+    fb_align(fb, align > 4 ? align : 4, 4);
+    at = fb_reserve(fb, 4);
+    if (!fb->is_overflow)
+        put_le(fb->buf + at, count, 4);
+    return at;
+}
+
+static size_t
+fb_string(struct FlatBuf *fb, const char *str)
+{
+    size_t length = strlen(str);
+    size_t at;
+
+    fb_align(fb, 4, 0);
+    at = fb_reserve(fb, 4 + length + 1);
+    if (!fb->is_overflow) {
+        put_le(fb->buf + at, length, 4);
+        memcpy(fb->buf + at + 4, str, length);
+    }
+    return at;
+}
+
+/***************************************************************************
+ * Starts a Message, with the root offset pointing to it.
+ * @return where to put the offset to the header table
+ ***************************************************************************/
+static size_t
+fb_message(struct FlatBuf *fb, unsigned header_type, uint64_t body_length)
+{
+    struct FlatField msg[] = {
+        {0, 2, ARROW_VERSION, 0},       /* version */
+        {1, 1, header_type, 0},         /* header_type */
+        {2, 4, 0, 0},                   /* header */
+        {3, 8, body_length, 0},         /* bodyLength */
+    };
+    size_t root;
+    size_t table;
+
+    fb->length = 0;
+    fb->is_overflow = 0;
+    root = fb_reserve(fb, 4);
+    table = fb_table(fb, msg, 4);
+    fb_patch(fb, root, table);
+    return msg[2].at;
+}
+
+/***************************************************************************
+ * Writes one message: a marker, the length of the header, the header,
+ * and then the body, which the caller writes.
+ ***************************************************************************/
+static int
+arrow_write_header(FILE *fp, struct FlatBuf *fb)
+{
+    unsigned char prefix[8];
+
+    if (fb->is_overflow) {
+        LOG(0, "[-] arrow: message header too big\n");
+        return -1;
+    }
+    fb_align(fb, 8, 0);
+    put_le(prefix + 0, 0xFFFFFFFF, 4);  /* continuation marker */
+    put_le(prefix + 4, fb->length, 4);
+    if (fwrite(prefix, 1, 8, fp) != 8)
+        return -1;
+    if (fwrite(fb->buf, 1, fb->length, fp) != fb->length)
+        return -1;
+    return 0;
+}
+
+/***************************************************************************
+ * The Schema message, naming the columns and their types
+ ***************************************************************************/
+static int
+arrow_write_schema(FILE *fp)
+{
+    struct FlatBuf fb;
+    size_t header;
+    size_t schema;
+    size_t vector;
+    unsigned i;
+
+    header = fb_message(&fb, ARROW_MSG_SCHEMA, 0);
+    {
+        struct FlatField fields[] = {
+            {1, 4, 0, 0},   /* fields */
+        };
+        schema = fb_table(&fb, fields, 1);
+        fb_patch(&fb, header, schema);
+        vector = fb_vector(&fb, ARROW_COLUMNS, 4);
+        fb_patch(&fb, fields[0].at, vector);
+    }
+    fb_reserve(&fb, 4 * ARROW_COLUMNS);
+
+    for (i=0; i<ARROW_COLUMNS; i++) {
+        unsigned type_type = 0;
+        unsigned is_nullable = 0;
+        struct FlatField field[] = {
+            {0, 4, 0, 0},   /* name */
+            {1, 1, 0, 0},   /* nullable */
+            {2, 1, 0, 0},   /* type_type */
+            {3, 4, 0, 0},   /* type */
+            {5, 4, 0, 0},   /* children, must be there even if empty */
+        };
+        size_t table;
+        size_t type;
+
+        switch (arrow_columns[i].type) {
+        case Column_Timestamp:  type_type = ARROW_TYPE_TIMESTAMP; break;
+        case Column_Ip:         type_type = ARROW_TYPE_FIXEDSIZEBINARY; break;
+        case Column_Uint16:
+        case Column_Uint8:      type_type = ARROW_TYPE_INT; break;
+        case Column_Utf8:       type_type = ARROW_TYPE_UTF8; is_nullable = 1; break;
+        case Column_Binary:     type_type = ARROW_TYPE_BINARY; is_nullable = 1; break;
+        }
+        field[1].value = is_nullable;
+        field[2].value = type_type;
+
+        table = fb_table(&fb, field, 5);
+        fb_patch(&fb, vector + 4 + 4*i, table);
+        fb_patch(&fb, field[0].at, fb_string(&fb, arrow_columns[i].name));
+
+        switch (arrow_columns[i].type) {
+        case Column_Timestamp: {
+            struct FlatField ts[] = {
+                {0, 2, 0, 0},   /* unit = SECOND */
+                {1, 4, 0, 0},   /* timezone */
+            };
+            type = fb_table(&fb, ts, 2);
+            fb_patch(&fb, ts[1].at, fb_string(&fb, "UTC"));
+            break;
+        }
+        case Column_Ip: {
+            struct FlatField fsb[] = {
+                {0, 4, 16, 0},  /* byteWidth */
+            };
+            type = fb_table(&fb, fsb, 1);
+            break;
+        }
+        case Column_Uint16:
+        case Column_Uint8: {
+            struct FlatField integer[] = {
+                {0, 4, 0, 0},   /* bitWidth */
+                {1, 1, 0, 0},   /* is_signed */
+            };
+            integer[0].value = arrow_columns[i].type == Column_Uint16 ? 16 : 8;
+            type = fb_table(&fb, integer, 2);
+            break;
+        }
+        default:
+            /* Utf8 and Binary have no fields */
+            type = fb_table(&fb, NULL, 0);
+            break;
+        }
+        fb_patch(&fb, field[3].at, type);
+        fb_patch(&fb, field[4].at, fb_vector(&fb, 0, 4));
+    }
+
+    return arrow_write_header(fp, &fb);
+}
+
+/***************************************************************************
+ * The buffers of a column, in the order Arrow wants them
+ ***************************************************************************/
+static unsigned
+column_buffers(struct ArrowColumn *col, enum ArrowColumnType type,
+               const struct ArrowBuffer *list[3])
+{
+    static const struct ArrowBuffer none = {0};
+
+    switch (type) {
+    case Column_Utf8:
+    case Column_Binary:
+        list[0] = col->null_count ? &col->validity : &none;
+        list[1] = &col->offsets;
+        list[2] = &col->data;
+        return 3;
+    default:
+        list[0] = &none;
+        list[1] = &col->data;
+        return 2;
+    }
+}
+
+/***************************************************************************
+ * Writes the rows collected so far as a RecordBatch message, and empties
+ * the columns for the next batch.
+ ***************************************************************************/
+static int
+arrow_write_batch(FILE *fp, struct ArrowBatch *batch)
+{
+    static const unsigned char zeroes[8] = {0};
+    const struct ArrowBuffer *buffers[ARROW_COLUMNS * 3];
+    unsigned buffer_count = 0;
+    struct FlatBuf fb;
+    uint64_t body = 0;
+    size_t header;
+    size_t nodes;
+    size_t bufs;
+    unsigned i;
+
+    if (batch->count == 0)
+        return 0;
+
+    for (i=0; i<ARROW_COLUMNS; i++)
+        buffer_count += column_buffers(&batch->columns[i],
+                                       arrow_columns[i].type,
+                                       buffers + buffer_count);
+    for (i=0; i<buffer_count; i++)
+        body += (buffers[i]->length + 7) & ~(uint64_t)7;
+
+    header = fb_message(&fb, ARROW_MSG_RECORDBATCH, body);
+    {
+        struct FlatField fields[] = {
+            {0, 8, 0, 0},   /* length */
+            {1, 4, 0, 0},   /* nodes */
+            {2, 4, 0, 0},   /* buffers */
+        };
+        size_t table;
+
+        fields[0].value = batch->count;
+        table = fb_table(&fb, fields, 3);
+        fb_patch(&fb, header, table);
+
+        /* FieldNode { length, null_count } per column */
+        nodes = fb_vector(&fb, ARROW_COLUMNS, 8);
+        fb_patch(&fb, fields[1].at, nodes);
+        for (i=0; i<ARROW_COLUMNS; i++) {
+            size_t at = fb_reserve(&fb, 16);
+            if (fb.is_overflow)
+                break;
+            put_le(fb.buf + at + 0, batch->count, 8);
+            put_le(fb.buf + at + 8, batch->columns[i].null_count, 8);
+        }
+
+        /* Buffer { offset, length } within the body */
+        bufs = fb_vector(&fb, buffer_count, 8);
+        fb_patch(&fb, fields[2].at, bufs);
+        body = 0;
+        for (i=0; i<buffer_count; i++) {
+            size_t at = fb_reserve(&fb, 16);
+            if (fb.is_overflow)
+                break;
+            put_le(fb.buf + at + 0, body, 8);
+            put_le(fb.buf + at + 8, buffers[i]->length, 8);
+            body += (buffers[i]->length + 7) & ~(uint64_t)7;
+        }
+    }
+
+    if (arrow_write_header(fp, &fb) != 0)
+        return -1;
+    for (i=0; i<buffer_count; i++) {
+        size_t length = buffers[i]->length;
+        size_t pad = ((length + 7) & ~(size_t)7) - length;
+
+        if (length && fwrite(buffers[i]->px, 1, length, fp) != length)
+            return -1;
+        if (pad && fwrite(zeroes, 1, pad, fp) != pad)
+            return -1;
+    }
+
+    /* Keep the memory for the next batch */
+    for (i=0; i<ARROW_COLUMNS; i++) {
+        struct ArrowColumn *col = &batch->columns[i];
+        col->validity.length = 0;
+        col->offsets.length = 0;
+        col->data.length = 0;
+        col->null_count = 0;
+    }
+    batch->count = 0;
+    return 0;
+}
+
+static void
+arrow_flush(struct Output *out, FILE *fp)
+{
+    if (arrow_write_batch(fp, out->arrow.batch) != 0) {
+        LOG(0, "[-] arrow: write failed\n");
+        perror("output");
+        exit(1);
+    }
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+arrow_out_open(struct Output *out, FILE *fp)
+{
+    if (out->arrow.batch == NULL)
+        out->arrow.batch = CALLOC(1, sizeof(*out->arrow.batch));
+    if (arrow_write_schema(fp) != 0) {
+        perror("output");
+        exit(1);
+    }
+}
+
+/****************************************************************************
+ * Writes the last rows and the end-of-stream marker, so that every file
+ * can be read by itself.
+ ****************************************************************************/
+static void
+arrow_out_close(struct Output *out, FILE *fp)
+{
+    static const unsigned char eos[8] = {0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+    struct ArrowBatch *batch = out->arrow.batch;
+    unsigned i;
+
+    if (batch == NULL)
+        return;
+    arrow_flush(out, fp);
+    if (fwrite(eos, 1, sizeof(eos), fp) != sizeof(eos))
+        perror("output");
+
+    for (i=0; i<ARROW_COLUMNS; i++) {
+        free(batch->columns[i].validity.px);
+        free(batch->columns[i].offsets.px);
+        free(batch->columns[i].data.px);
+    }
+    free(batch);
+    out->arrow.batch = NULL;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static void
+arrow_add_row(struct Output *out, FILE *fp, time_t timestamp,
+              ipaddress ip, unsigned ip_proto, unsigned port, unsigned ttl,
+              const char *status, const char *app,
+              const unsigned char *px, size_t length)
+{
+    struct ArrowBatch *batch = out->arrow.batch;
+    struct ArrowColumn *col = batch->columns;
+    unsigned row = batch->count;
+    unsigned batch_size = out->masscan->output.arrow_batch;
+
+    column_number(&col[COL_TIMESTAMP], (uint64_t)(int64_t)timestamp, 8);
+    column_ip(&col[COL_IP], ip);
+    column_number(&col[COL_PORT], port, 2);
+    column_number(&col[COL_PROTO], ip_proto, 1);
+    column_number(&col[COL_TTL], ttl, 1);
+    column_string(&col[COL_STATUS], row, status, status?strlen(status):0);
+    column_string(&col[COL_APP], row, app, app?strlen(app):0);
+    column_string(&col[COL_BANNER], row, px, length);
+    batch->count++;
+
+    if (batch->count >= (batch_size ? batch_size : 65536))
+        arrow_flush(out, fp);
+}
+
+static void
+arrow_out_status(struct Output *out, FILE *fp, time_t timestamp, int status,
+                 ipaddress ip, unsigned ip_proto, unsigned port,
+                 unsigned reason, unsigned ttl)
+{
+    UNUSEDPARM(reason);
+    arrow_add_row(out, fp, timestamp, ip, ip_proto, port, ttl,
+                  status_string(status), NULL, NULL, 0);
+}
+
+static void
+arrow_out_banner(struct Output *out, FILE *fp, time_t timestamp,
+                 ipaddress ip, unsigned ip_proto, unsigned port,
+                 enum ApplicationProtocol proto, unsigned ttl,
+                 const unsigned char *px, unsigned length)
+{
+    arrow_add_row(out, fp, timestamp, ip, ip_proto, port, ttl,
+                  NULL, masscan_app_to_string(proto),
+                  px?px:(const unsigned char *)"", length);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+const struct OutputType arrow_output = {
+    "arrow",
+    0,
+    arrow_out_open,
+    arrow_out_close,
+    arrow_out_status,
+    arrow_out_banner,
+};
+
+/****************************************************************************
+ ****************************************************************************/
+static uint64_t
+get_le(const unsigned char *p, unsigned size)
+{
+    uint64_t x = 0;
+
+    while (size--)
+        x = x << 8 | p[size];
+    return x;
+}
+
+/****************************************************************************
+ * Writes two batches, then walks the messages of the stream: each one a
+ * continuation marker and header length, starting on an 8 byte boundary,
+ * followed by a body of the length the header says, then the
+ * end-of-stream marker at the very end.
+ ****************************************************************************/
+int
+arrow_selftest(void)
+{
+    struct Masscan *masscan;
+    struct Output *out;
+    unsigned char *px = NULL;
+    long length;
+    long offset = 0;
+    unsigned messages = 0;
+    ipaddress ip;
+    FILE *fp;
+    unsigned i;
+    int err = 1;
+
+    fp = tmpfile();
+    if (fp == NULL)
+        return 0; /* can't test here */
+
+    masscan = CALLOC(1, sizeof(*masscan));
+    masscan->output.arrow_batch = 2;
+    out = CALLOC(1, sizeof(*out));
+    out->masscan = masscan;
+
+    memset(&ip, 0, sizeof(ip));
+    ip.version = 4;
+    arrow_out_open(out, fp);
+    for (i=0; i<3; i++) {
+        ip.ipv4 = 0x0a000001 + i;
+        arrow_out_status(out, fp, 1700000000, PortStatus_Open, ip, 6, 80, 0, 64);
+    }
+    arrow_out_banner(out, fp, 1700000000, ip, 6, 80, PROTO_HTTP, 64,
+                     (const unsigned char *)"HTTP/1.0 200 OK", 15);
+    arrow_out_close(out, fp);
+
+    length = ftell(fp);
+    if (length <= 0)
+        goto end;
+    px = MALLOC(length);
+    rewind(fp);
+    if (fread(px, 1, length, fp) != (size_t)length)
+        goto end;
+
+    for (;;) {
+        uint64_t meta;
+        uint64_t body = 0;
+        unsigned type = 0;
+        size_t table;
+        size_t vtable;
+        unsigned vtable_size;
+
+        if (offset % 8 != 0 || offset + 8 > length)
+            goto end;
+        if (get_le(px + offset, 4) != 0xFFFFFFFF)
+            goto end;
+        meta = get_le(px + offset + 4, 4);
+        offset += 8;
+        if (meta == 0)
+            break; /* end-of-stream */
+        if (meta % 8 != 0 || offset + meta > (uint64_t)length)
+            goto end;
+
+        /* The Message table: its header type, field 1, and the
+         * length of its body, field 3 */
+        table = (size_t)get_le(px + offset, 4);
+        vtable = table - (int32_t)get_le(px + offset + table, 4);
+        vtable_size = (unsigned)get_le(px + offset + vtable, 2);
+        if (vtable_size >= 4 + 2*2 && get_le(px + offset + vtable + 4 + 2*1, 2))
+            type = px[offset + table + get_le(px + offset + vtable + 4 + 2*1, 2)];
+        if (vtable_size >= 4 + 2*4 && get_le(px + offset + vtable + 4 + 2*3, 2))
+            body = get_le(px + offset + table
+                          + get_le(px + offset + vtable + 4 + 2*3, 2), 8);
+        offset += (long)meta;
+
+        if (type != (messages ? ARROW_MSG_RECORDBATCH : ARROW_MSG_SCHEMA))
+            goto end;
+        if (body % 8 != 0 || offset + body > (uint64_t)length)
+            goto end;
+        offset += (long)body;
+        messages++;
+    }
+
+    /* The schema, and batches of 2 and 2 rows */
+    if (messages == 3 && offset == length)
+        err = 0;
+
+end:
+    if (err)
+        fprintf(stderr, "[-] arrow: selftest failed\n");
+    free(px);
+    free(out);
+    free(masscan);
+    fclose(fp);
+    return err;
+}
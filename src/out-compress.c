@@ -0,0 +1,659 @@
+/*
+    Streaming compression of output files
+
+    See out-compress.h. Each stream has a pipe and a thread. The pipe is
+    the only thing shared with the thread that uses the stream, so
+    there's no locking: closing our end of the pipe is what tells the
+    thread the stream is over.
+*/
+#include "out-compress.h"
+#include "stub-zlib.h"
+#include "stub-zstd.h"
+#include "pixie-threads.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(WIN32)
+#include <io.h>
+#include <fcntl.h>
+#define pipe_read _read
+#define pipe_write _write
+#define pipe_close _close
+#define pipe_fdopen _fdopen
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#define pipe_read read
+#define pipe_write write
+#define pipe_close close
+#define pipe_fdopen fdopen
+#endif
+
+/** How much is read or written at a time */
+#define COMPRESS_BUF (256*1024)
+
+/** How much can be waiting in the pipe. When the compressing thread
+ * falls behind by more than this, the receive thread waits for it */
+#define COMPRESS_PIPE_SIZE (1024*1024)
+
+struct CompressWriter {
+    enum OutputCompress method;
+    FILE *fp;
+    FILE *fp_pipe;
+    int fd;
+    unsigned is_failed;
+    volatile uint64_t bytes;
+
+    z_stream z;
+    ZSTD_CCtx *cctx;
+
+    unsigned char *inbuf;
+    unsigned char *outbuf;
+    size_t thread_handle;
+};
+
+struct CompressReader {
+    enum OutputCompress method;
+    FILE *fp;
+    int fd;
+    volatile unsigned is_closing;
+
+    z_stream z;
+    ZSTD_DCtx *dctx;
+
+    unsigned char *inbuf;
+    unsigned char *outbuf;
+    size_t thread_handle;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+void
+compress_init(void)
+{
+    stubzlib_init();
+    stubzstd_init();
+}
+
+int
+compress_is_available(enum OutputCompress method)
+{
+    switch (method) {
+    case Compress_Gzip:
+        return ZLIB.is_available;
+    case Compress_Zstd:
+        return ZSTD.is_available;
+    default:
+        return 1;
+    }
+}
+
+int
+compress_parse(const char *name)
+{
+    if (strcmp(name, "gzip") == 0 || strcmp(name, "gz") == 0)
+        return Compress_Gzip;
+    if (strcmp(name, "zstd") == 0 || strcmp(name, "zst") == 0)
+        return Compress_Zstd;
+    if (strcmp(name, "none") == 0 || strcmp(name, "false") == 0)
+        return Compress_None;
+    return -1;
+}
+
+const char *
+compress_name(enum OutputCompress method)
+{
+    switch (method) {
+    case Compress_Gzip: return "gzip";
+    case Compress_Zstd: return "zstd";
+    case Compress_None: return "none";
+    default:            return "";
+    }
+}
+
+enum OutputCompress
+compress_from_filename(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+
+    if (ext == NULL)
+        return Compress_None;
+    if (strcmp(ext, ".gz") == 0)
+        return Compress_Gzip;
+    if (strcmp(ext, ".zst") == 0 || strcmp(ext, ".zstd") == 0)
+        return Compress_Zstd;
+    return Compress_None;
+}
+
+/***************************************************************************
+ * Makes a pipe that can hold a good amount, so that the other thread
+ * doesn't have to keep up write by write.
+ ***************************************************************************/
+static int
+compress_pipe(int fds[2])
+{
+#if defined(WIN32)
+    return _pipe(fds, COMPRESS_PIPE_SIZE, _O_BINARY);
+#else
+    if (pipe(fds) != 0)
+        return -1;
+#if defined(F_SETPIPE_SZ)
+    /* Not an error if we can't, it's just 64k then */
+    fcntl(fds[1], F_SETPIPE_SZ, COMPRESS_PIPE_SIZE);
+#endif
+    return 0;
+#endif
+}
+
+/***************************************************************************
+ * Writes all of it, unless the pipe has been closed.
+ ***************************************************************************/
+static int
+write_all(int fd, const unsigned char *buf, size_t length)
+{
+    while (length) {
+        int n = (int)pipe_write(fd, buf, (unsigned)length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+writer_output(struct CompressWriter *writer, size_t length)
+{
+    if (length == 0 || writer->is_failed)
+        return;
+    if (fwrite(writer->outbuf, 1, length, writer->fp) != length) {
+        LOG(0, "[-] FAIL: writing compressed output: %s\n", strerror(errno));
+        writer->is_failed = 1;
+        return;
+    }
+    writer->bytes += length;
+}
+
+/***************************************************************************
+ * Compresses what was read from the pipe, or ends the stream.
+ ***************************************************************************/
+static void
+writer_compress(struct CompressWriter *writer,
+                const unsigned char *buf, size_t length, int is_end)
+{
+    if (writer->is_failed)
+        return;
+
+    if (writer->method == Compress_Gzip) {
+        z_stream *z = &writer->z;
+        int flush = is_end ? Z_FINISH : Z_NO_FLUSH;
+        int err;
+
+        z->next_in = buf;
+        z->avail_in = (unsigned)length;
+        do {
+            z->next_out = writer->outbuf;
+            z->avail_out = COMPRESS_BUF;
+            err = ZLIB.deflate(z, flush);
+            if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+                LOG(0, "[-] FAIL: gzip: deflate() returned %d\n", err);
+                writer->is_failed = 1;
+                return;
+            }
+            writer_output(writer, COMPRESS_BUF - z->avail_out);
+        } while (z->avail_out == 0 || (is_end && err != Z_STREAM_END));
+    } else {
+        ZSTD_inBuffer in;
+        int op = is_end ? ZSTD_e_end : ZSTD_e_continue;
+        size_t remaining;
+
+        in.src = buf;
+        in.size = length;
+        in.pos = 0;
+        do {
+            ZSTD_outBuffer out;
+
+            out.dst = writer->outbuf;
+            out.size = COMPRESS_BUF;
+            out.pos = 0;
+            remaining = ZSTD.compressStream2(writer->cctx, &out, &in, op);
+            if (ZSTD.isError(remaining)) {
+                LOG(0, "[-] FAIL: zstd: %s\n", ZSTD.getErrorName(remaining));
+                writer->is_failed = 1;
+                return;
+            }
+            writer_output(writer, out.pos);
+        } while (in.pos < in.size || (is_end && remaining != 0));
+    }
+}
+
+/***************************************************************************
+ * Reads the pipe until the other end is closed. If writing fails, we
+ * keep reading anyway, so that the receive thread doesn't get stuck.
+ ***************************************************************************/
+static void
+compress_writer_thread(void *v)
+{
+    struct CompressWriter *writer = (struct CompressWriter *)v;
+
+    for (;;) {
+        int n = (int)pipe_read(writer->fd, writer->inbuf, COMPRESS_BUF);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        writer_compress(writer, writer->inbuf, n, 0);
+    }
+    writer_compress(writer, NULL, 0, 1);
+    fflush(writer->fp);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static struct CompressWriter *
+writer_alloc(FILE *fp, enum OutputCompress method, int level)
+{
+    struct CompressWriter *writer;
+
+    if (!compress_is_available(method)) {
+        LOG(0, "[-] FAIL: %s compression needs %s, which isn't installed\n",
+            compress_name(method), method==Compress_Gzip?"zlib":"libzstd");
+        return NULL;
+    }
+
+    writer = CALLOC(1, sizeof(*writer));
+    writer->method = method;
+    writer->fp = fp;
+    writer->fd = -1;
+    writer->inbuf = MALLOC(COMPRESS_BUF);
+    writer->outbuf = MALLOC(COMPRESS_BUF);
+
+    if (method == Compress_Gzip) {
+        if (level == 0)
+            level = 6;
+        else if (level > 9)
+            level = 9;
+        /* 15 bits of window, plus 16 for a gzip header rather than zlib */
+        if (ZLIB_deflateInit2(&writer->z, level, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            goto fail;
+    } else {
+        writer->cctx = ZSTD.createCCtx();
+        if (writer->cctx == NULL)
+            goto fail;
+        if (level)
+            ZSTD.CCtx_setParameter(writer->cctx, ZSTD_c_compressionLevel, level);
+    }
+    return writer;
+fail:
+    LOG(0, "[-] FAIL: %s: could not start compression\n", compress_name(method));
+    free(writer->inbuf);
+    free(writer->outbuf);
+    free(writer);
+    return NULL;
+}
+
+static void
+writer_free(struct CompressWriter *writer)
+{
+    if (writer->method == Compress_Gzip)
+        ZLIB.deflateEnd(&writer->z);
+    else
+        ZSTD.freeCCtx(writer->cctx);
+    free(writer->inbuf);
+    free(writer->outbuf);
+    free(writer);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+FILE *
+compress_writer_open(FILE *fp, enum OutputCompress method, int level,
+                     struct CompressWriter **r_writer)
+{
+    struct CompressWriter *writer;
+    int fds[2];
+
+    *r_writer = NULL;
+    writer = writer_alloc(fp, method, level);
+    if (writer == NULL)
+        return NULL;
+
+    if (compress_pipe(fds) != 0) {
+        LOG(0, "[-] FAIL: pipe(): %s\n", strerror(errno));
+        writer_free(writer);
+        return NULL;
+    }
+    writer->fd = fds[0];
+    writer->fp_pipe = pipe_fdopen(fds[1], "wb");
+    if (writer->fp_pipe == NULL) {
+        pipe_close(fds[0]);
+        pipe_close(fds[1]);
+        writer_free(writer);
+        return NULL;
+    }
+    setvbuf(writer->fp_pipe, NULL, _IOFBF, 64*1024);
+
+    writer->thread_handle = pixie_begin_thread(compress_writer_thread, 0, writer);
+    *r_writer = writer;
+    return writer->fp_pipe;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+FILE *
+compress_writer_close(struct CompressWriter *writer)
+{
+    FILE *fp;
+
+    if (writer == NULL)
+        return NULL;
+
+    /* The thread sees the end of the pipe, and finishes the stream */
+    fclose(writer->fp_pipe);
+    pixie_thread_join(writer->thread_handle);
+    pipe_close(writer->fd);
+
+    fp = writer->fp;
+    writer_free(writer);
+    return fp;
+}
+
+uint64_t
+compress_writer_bytes(const struct CompressWriter *writer)
+{
+    return writer->bytes;
+}
+
+/***************************************************************************
+ * Decompresses one buffer's worth read from the file. Files may have more
+ * than one stream one after another, like when written with --append.
+ * @return 0 to keep going, or -1 when done, because of error or because
+ * the reader has been closed
+ ***************************************************************************/
+static int
+reader_decompress(struct CompressReader *reader, size_t length)
+{
+    if (reader->method == Compress_Gzip) {
+        z_stream *z = &reader->z;
+
+        z->next_in = reader->inbuf;
+        z->avail_in = (unsigned)length;
+        do {
+            int err;
+
+            z->next_out = reader->outbuf;
+            z->avail_out = COMPRESS_BUF;
+            err = ZLIB.inflate(z, Z_NO_FLUSH);
+            if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+                LOG(0, "[-] gzip: corrupt input: %s\n", z->msg?z->msg:"");
+                return -1;
+            }
+            if (write_all(reader->fd, reader->outbuf, COMPRESS_BUF - z->avail_out) != 0)
+                return -1;
+            if (reader->is_closing)
+                return -1;
+            if (err == Z_STREAM_END)
+                ZLIB.inflateReset(z);
+        } while (z->avail_in || z->avail_out == 0);
+    } else {
+        ZSTD_inBuffer in;
+
+        in.src = reader->inbuf;
+        in.size = length;
+        in.pos = 0;
+        for (;;) {
+            ZSTD_outBuffer out;
+            size_t err;
+
+            out.dst = reader->outbuf;
+            out.size = COMPRESS_BUF;
+            out.pos = 0;
+            err = ZSTD.decompressStream(reader->dctx, &out, &in);
+            if (ZSTD.isError(err)) {
+                LOG(0, "[-] zstd: corrupt input: %s\n", ZSTD.getErrorName(err));
+                return -1;
+            }
+            if (write_all(reader->fd, reader->outbuf, out.pos) != 0)
+                return -1;
+            if (reader->is_closing)
+                return -1;
+            if (in.pos == in.size && out.pos < out.size)
+                break;
+        }
+    }
+    return 0;
+}
+
+static void
+compress_reader_thread(void *v)
+{
+    struct CompressReader *reader = (struct CompressReader *)v;
+
+    for (;;) {
+        size_t n = fread(reader->inbuf, 1, COMPRESS_BUF, reader->fp);
+        if (n == 0)
+            break;
+        if (reader_decompress(reader, n) != 0)
+            break;
+    }
+
+    /* This is what ends the file for whoever is reading it */
+    pipe_close(reader->fd);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+reader_free(struct CompressReader *reader)
+{
+    if (reader->method == Compress_Gzip)
+        ZLIB.inflateEnd(&reader->z);
+    else if (reader->dctx)
+        ZSTD.freeDCtx(reader->dctx);
+    if (reader->fp)
+        fclose(reader->fp);
+    free(reader->inbuf);
+    free(reader->outbuf);
+    free(reader);
+}
+
+FILE *
+compress_reader_open(FILE *fp, const char *filename,
+                     struct CompressReader **r_reader)
+{
+    struct CompressReader *reader;
+    unsigned char magic[4] = {0};
+    enum OutputCompress method;
+    FILE *fp_pipe;
+    int fds[2];
+    size_t n;
+
+    *r_reader = NULL;
+
+    n = fread(magic, 1, sizeof(magic), fp);
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        method = Compress_Gzip;
+    else if (n == 4 && magic[0] == 0x28 && magic[1] == 0xb5
+             && magic[2] == 0x2f && magic[3] == 0xfd)
+        method = Compress_Zstd;
+    else {
+        rewind(fp);
+        return fp;
+    }
+    rewind(fp);
+
+    if (!compress_is_available(method)) {
+        LOG(0, "[-] %s: %s compressed, but %s isn't installed\n", filename,
+            compress_name(method), method==Compress_Gzip?"zlib":"libzstd");
+        fclose(fp);
+        return NULL;
+    }
+
+    reader = CALLOC(1, sizeof(*reader));
+    reader->method = method;
+    reader->fp = fp;
+    reader->inbuf = MALLOC(COMPRESS_BUF);
+    reader->outbuf = MALLOC(COMPRESS_BUF);
+    if (method == Compress_Gzip) {
+        /* 15 bits of window, plus 32 to accept either gzip or zlib */
+        if (ZLIB_inflateInit2(&reader->z, 15 + 32) != Z_OK) {
+            reader->method = Compress_None;
+            reader_free(reader);
+            return NULL;
+        }
+    } else {
+        reader->dctx = ZSTD.createDCtx();
+        if (reader->dctx == NULL) {
+            reader_free(reader);
+            return NULL;
+        }
+    }
+
+    if (compress_pipe(fds) != 0) {
+        LOG(0, "[-] FAIL: pipe(): %s\n", strerror(errno));
+        reader_free(reader);
+        return NULL;
+    }
+    fp_pipe = pipe_fdopen(fds[0], "rb");
+    if (fp_pipe == NULL) {
+        pipe_close(fds[0]);
+        pipe_close(fds[1]);
+        reader_free(reader);
+        return NULL;
+    }
+    reader->fd = fds[1];
+
+    LOG(1, "[+] %s: %s compressed\n", filename, compress_name(method));
+    reader->thread_handle = pixie_begin_thread(compress_reader_thread, 0, reader);
+    *r_reader = reader;
+    return fp_pipe;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+compress_reader_close(FILE *fp, struct CompressReader *reader)
+{
+    unsigned char buf[4096];
+
+    if (reader == NULL) {
+        if (fp)
+            fclose(fp);
+        return;
+    }
+
+    /* If we stopped before the end, the thread may be waiting for us to
+     * read more, so read until it notices it should stop */
+    reader->is_closing = 1;
+    while (fread(buf, 1, sizeof(buf), fp) > 0)
+        ;
+    fclose(fp);
+    pixie_thread_join(reader->thread_handle);
+    reader_free(reader);
+}
+
+/***************************************************************************
+ * Writes a couple of streams into one file, as --append does, then reads
+ * them back. Methods whose library isn't installed are skipped.
+ ***************************************************************************/
+static int
+compress_selftest_method(enum OutputCompress method)
+{
+    struct CompressWriter *writer;
+    struct CompressReader *reader;
+    FILE *fp;
+    FILE *fp_out;
+    FILE *fp_in;
+    char line[64];
+    char expected[64];
+    unsigned stream;
+    unsigned i;
+
+    fp = tmpfile();
+    if (fp == NULL)
+        return 0; /* can't test here */
+
+    for (stream=0; stream<2; stream++) {
+        fp_out = compress_writer_open(fp, method, 0, &writer);
+        if (fp_out == NULL)
+            goto fail;
+        for (i=0; i<20000; i++)
+            fprintf(fp_out, "%u.%u open 10.0.%u.%u\n", stream, i, i>>8, i&0xFF);
+        fp = compress_writer_close(writer);
+    }
+    if (ftell(fp) <= 0 || ftell(fp) > 2*20000*24/4)
+        goto fail; /* nothing written, or it didn't compress */
+
+    /* Read it back, stopping early the first time */
+    for (i=0; i<2; i++) {
+        unsigned count = 0;
+
+        rewind(fp);
+        if (i == 0) {
+            /* The reader closes the file, so give it a copy of ours */
+            FILE *fp2 = tmpfile();
+            size_t n;
+            if (fp2 == NULL)
+                break;
+            while ((n = fread(line, 1, sizeof(line), fp)) > 0)
+                fwrite(line, 1, n, fp2);
+            rewind(fp2);
+            fp_in = compress_reader_open(fp2, "selftest", &reader);
+        } else {
+            fp_in = compress_reader_open(fp, "selftest", &reader);
+            fp = NULL;
+        }
+        if (fp_in == NULL || reader == NULL)
+            goto fail;
+
+        while (fgets(line, sizeof(line), fp_in)) {
+            snprintf(expected, sizeof(expected), "%u.%u open 10.0.%u.%u\n",
+                     count/20000, count%20000,
+                     (count%20000)>>8, (count%20000)&0xFF);
+            if (strcmp(line, expected) != 0)
+                goto fail;
+            count++;
+            if (i == 0 && count == 100)
+                break;
+        }
+        compress_reader_close(fp_in, reader);
+        if (count != (i==0 ? 100u : 40000u))
+            goto fail_closed;
+    }
+    return 0;
+fail:
+    if (fp)
+        fclose(fp);
+fail_closed:
+    fprintf(stderr, "[-] compress: %s: selftest failed\n", compress_name(method));
+    return 1;
+}
+
+int
+compress_selftest(void)
+{
+    int x = 0;
+
+    if (compress_from_filename("scan.xml.gz") != Compress_Gzip
+        || compress_from_filename("a.b/scan.zst") != Compress_Zstd
+        || compress_from_filename("scan.json") != Compress_None
+        || compress_from_filename("scan") != Compress_None) {
+        fprintf(stderr, "[-] compress: selftest failed\n");
+        return 1;
+    }
+
+    compress_init();
+    if (compress_is_available(Compress_Gzip))
+        x += compress_selftest_method(Compress_Gzip);
+    if (compress_is_available(Compress_Zstd))
+        x += compress_selftest_method(Compress_Zstd);
+    return x;
+}
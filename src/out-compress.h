@@ -0,0 +1,124 @@
+/*
+    Streaming compression of output files (--output-compress)
+
+    Scan results compress very well, often 10 to 1, so for big scans it
+    makes sense to write them compressed rather than compress them later.
+    But compressing is slow compared to formatting a record, and we don't
+    want the receive thread, which is what writes the output, to be
+    slowed down by it.
+
+    So a compressed file is written through a pipe: the output formats
+    write plain text (or binary) to the pipe with fprintf() as they
+    always have, and a thread of its own reads the other end, compresses,
+    and writes to the actual file. Closing the pipe ends the stream, so
+    each file (including each --rotate file) is a complete gzip or zstd
+    stream that can be read by itself.
+
+    The same is done in reverse for --readscan, so that compressed binary
+    files can be read without decompressing them first.
+
+    The libraries, zlib for gzip and libzstd for zstd, are loaded at
+    runtime, see stub-zlib.c and stub-zstd.c.
+*/
+#ifndef OUT_COMPRESS_H
+#define OUT_COMPRESS_H
+#include <stdio.h>
+#include <stdint.h>
+
+enum OutputCompress {
+    Compress_Default = 0,   /* decided by the file extension */
+    Compress_None,
+    Compress_Gzip,          /* .gz */
+    Compress_Zstd,          /* .zst */
+};
+
+/**
+ * Loads whichever of the libraries are installed. Not thread safe, so
+ * call once at startup.
+ */
+void
+compress_init(void);
+
+/**
+ * Whether we can write (and read) this kind of compression.
+ */
+int
+compress_is_available(enum OutputCompress method);
+
+/**
+ * Parses "gzip", "zstd", or "none".
+ * @return the method, or -1 if unknown
+ */
+int
+compress_parse(const char *name);
+
+const char *
+compress_name(enum OutputCompress method);
+
+/**
+ * Looks at the extension, like "scan.xml.gz"
+ */
+enum OutputCompress
+compress_from_filename(const char *filename);
+
+struct CompressWriter;
+
+/**
+ * Starts compressing to a file.
+ * @param fp
+ *      The opened file that compressed data is written to.
+ * @param level
+ *      The compression level, or 0 for the library's default.
+ * @param writer
+ *      Receives the stream, to pass to compress_writer_close().
+ * @return
+ *      the file to write uncompressed data to, or NULL on failure
+ */
+FILE *
+compress_writer_open(FILE *fp, enum OutputCompress method, int level,
+                     struct CompressWriter **writer);
+
+/**
+ * Closes the file returned by compress_writer_open(), waits for the
+ * rest to be compressed, and ends the stream.
+ * @return
+ *      the file that was passed to compress_writer_open(), which the
+ *      caller closes
+ */
+FILE *
+compress_writer_close(struct CompressWriter *writer);
+
+/**
+ * How many compressed bytes have been written, for --rotate-size.
+ */
+uint64_t
+compress_writer_bytes(const struct CompressWriter *writer);
+
+struct CompressReader;
+
+/**
+ * Looks at the start of a file opened for reading, and if it's gzip or
+ * zstd, starts decompressing it.
+ * @param fp
+ *      The file, which is now owned by the reader.
+ * @param reader
+ *      Receives the stream if the file was compressed, or NULL if not.
+ * @return
+ *      the file to read uncompressed data from, which is 'fp' itself
+ *      if it wasn't compressed, or NULL on failure
+ */
+FILE *
+compress_reader_open(FILE *fp, const char *filename,
+                     struct CompressReader **reader);
+
+/**
+ * Closes the file returned by compress_reader_open(), even if it wasn't
+ * read to the end.
+ */
+void
+compress_reader_close(FILE *fp, struct CompressReader *reader);
+
+int
+compress_selftest(void);
+
+#endif
@@ -26,12 +26,20 @@
     then go create the "foobar" directory, at which point rotating will now
     work -- it's just that the first rotated file will contain several
     periods of data.
+
+    COMPRESSION
+
+    With --output-compress, or a filename ending in .gz or .zst, the
+    formats write to a pipe instead of the file, and another thread
+    compresses (see out-compress.c). Every file, including each rotated
+    one, is closed as a complete stream.
 */
 
 /* Needed for Linux to make offsets 64 bits */
 #define _FILE_OFFSET_BITS 64
 
 #include "output.h"
+#include "out-compress.h"
 #include "masscan.h"
 #include "masscan-status.h"
 #include "proto-banner1.h"
@@ -163,14 +171,20 @@ normalize_string(const unsigned char *px, size_t length,
  * Windows POSIX functions open the file without the "share-delete" flag,
  * meaning they can't be renamed while open. Therefore, we need to
  * construct our own open flag.
+ *
+ * When compressing, what's returned is the pipe to the compressing thread,
+ * which is returned in 'compress'.
  *****************************************************************************/
 static FILE *
-open_rotate(struct Output *out, const char *filename)
+open_rotate(struct Output *out, const char *filename,
+            struct CompressWriter **compress)
 {
     FILE *fp = 0;
     unsigned is_append = out->is_append;
     int x;
 
+    *compress = NULL;
+
     /*
      * KLUDGE: do something special for redis
      */
@@ -216,11 +230,20 @@ open_rotate(struct Output *out, const char *filename)
         }
     }
 
-    /*
-     * Mark the file as newly opened. That way, before writing any data
-     * to it, we'll first have to write headers
-     */
-    out->is_virgin_file = 1;
+    if (out->compress_method == Compress_Gzip
+        || out->compress_method == Compress_Zstd) {
+        FILE *fp_pipe;
+
+        fp_pipe = compress_writer_open(fp, out->compress_method,
+                                       out->compress_level, compress);
+        if (fp_pipe == NULL) {
+            fprintf(stderr, "out: could not compress: %s\n", filename);
+            fclose(fp);
+            is_tx_done = 1;
+            return NULL;
+        }
+        fp = fp_pipe;
+    }
 
     return fp;
 }
@@ -232,7 +255,7 @@ open_rotate(struct Output *out, const char *filename)
  * how it's used in the rotate process.
  *****************************************************************************/
 static void
-close_rotate(struct Output *out, FILE *fp)
+close_rotate(struct Output *out, FILE *fp, struct CompressWriter *compress)
 {
     if (out == NULL)
         return;
@@ -251,6 +274,10 @@ close_rotate(struct Output *out, FILE *fp)
     if (out->format == Output_Redis)
         return;
 
+    /* Ends the compressed stream, giving us back the file itself */
+    if (compress)
+        fp = compress_writer_close(compress);
+
     fflush(fp);
     fclose(fp);
 }
@@ -331,8 +358,8 @@ duplicate_string(const char *str)
  * extension, it preserves the file type. By prepending a zero on the index,
  * it allows up to 100 files while still being able to easily sort the files.
  *****************************************************************************/
-static char *
-indexed_filename(const char *filename, unsigned index)
+char *
+output_indexed_filename(const char *filename, unsigned index)
 {
     size_t len = strlen(filename);
     size_t ext;
@@ -372,9 +399,14 @@ indexed_filename(const char *filename, unsigned index)
  * Create an "output" structure. If we are writing a file, we create the
  * file now, so that any errors creating the file are caught immediately,
  * rather than later in the scan when it might fail.
+ * @param sink
+ *      For an --output-sink, its own options, or NULL to use the global
+ *      ones.
  *****************************************************************************/
-struct Output *
-output_create(const struct Masscan *masscan, unsigned thread_index)
+static struct Output *
+output_create_file(const struct Masscan *masscan, unsigned thread_index,
+                   const char *filename, unsigned format,
+                   const struct OutputSink *sink)
 {
     struct Output *out;
     unsigned i;
@@ -402,12 +434,29 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
     out->is_show_closed = masscan->output.is_show_closed;
     out->is_show_host = masscan->output.is_show_host;
     out->is_append = masscan->output.is_append;
+    out->compress_method = masscan->output.compress;
+    if (out->compress_method == Compress_Default)
+        out->compress_method = compress_from_filename(filename);
+    out->compress_level = masscan->output.compress_level;
+    if (sink) {
+        out->rotate.period = sink->rotate_timeout;
+        out->rotate.filesize = sink->rotate_filesize;
+        if (sink->compress)
+            out->compress_method = sink->compress;
+        if (sink->is_show_set) {
+            out->is_show_open = sink->is_show_open;
+            out->is_show_closed = sink->is_show_closed;
+            out->is_show_host = sink->is_show_host;
+        }
+        out->is_interactive = 0;
+    }
     out->xml.stylesheet = duplicate_string(masscan->output.stylesheet);
     out->rotate.directory = duplicate_string(masscan->output.rotate.directory);
-    if (masscan->nic_count <= 1)
-        out->filename = duplicate_string(masscan->output.filename);
+    if ((masscan->nic_count <= 1 && masscan->rx_thread_count <= 1)
+        || strcmp(filename, "-") == 0)
+        out->filename = duplicate_string(filename);
     else
-        out->filename = indexed_filename(masscan->output.filename, thread_index);
+        out->filename = output_indexed_filename(filename, thread_index);
 
     for (i=0; i<8; i++) {
         out->src[i] = masscan->nic[i].src;
@@ -417,7 +466,7 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
      * Link the appropriate output module.
      * TODO: support multiple output modules
      */
-    out->format = masscan->output.format;
+    out->format = format;
     switch (out->format) {
     case Output_List:
         out->funcs = &text_output;
@@ -449,6 +498,9 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
     case Output_Hostonly:
         out->funcs = &hostonly_output;
         break;
+    case Output_Arrow:
+        out->funcs = &arrow_output;
+        break;
     case Output_None:
         out->funcs = &null_output;
         break;
@@ -462,12 +514,12 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
      * so that we can immediately notify the user of an error, rather than
      * waiting midway through a long scan and have it fail.
      */
-    if (masscan->output.filename[0] && out->funcs != &null_output) {
+    if (filename[0] && out->funcs != &null_output) {
         FILE *fp;
 
-        fp = open_rotate(out, masscan->output.filename);
+        fp = open_rotate(out, out->filename, &out->compress);
         if (fp == NULL) {
-            perror(masscan->output.filename);
+            perror(out->filename);
             exit(1);
         }
 
@@ -480,7 +532,7 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
      * this time will be set at "infinity" in the future.
      * TODO: this code isn't Y2036 compliant.
      */
-    if (masscan->output.rotate.timeout == 0) {
+    if (out->rotate.period == 0) {
         /* TODO: how does one find the max time_t value??*/
         out->rotate.next = (time_t)LONG_MAX;
     } else {
@@ -500,6 +552,51 @@ output_create(const struct Masscan *masscan, unsigned thread_index)
     return out;
 }
 
+/*****************************************************************************
+ * Creates the output for a thread, plus one for each --profile that has
+ * its own --output-filename.
+ *****************************************************************************/
+struct Output *
+output_create(const struct Masscan *masscan, unsigned thread_index)
+{
+    struct Output *out;
+    unsigned k;
+
+    out = output_create_file(masscan, thread_index,
+                             masscan->output.filename, masscan->output.format,
+                             NULL);
+
+    for (k=0; k<masscan->profile_count; k++) {
+        const struct ScanProfile *profile = &masscan->profile[k];
+        unsigned format = masscan->output.format;
+
+        if (profile->output_filename[0] == '\0')
+            continue;
+
+        /* A profile's results always go to its file, as with the
+         * --output-filename default */
+        if (format == Output_Default || format == Output_Interactive)
+            format = Output_XML;
+        out->profiles[k] = output_create_file(masscan, thread_index,
+                                              profile->output_filename, format,
+                                              NULL);
+        out->profiles[k]->is_interactive = 0;
+    }
+
+    if (masscan->output.sink_count) {
+        out->sinks = CALLOC(masscan->output.sink_count, sizeof(out->sinks[0]));
+        for (k=0; k<masscan->output.sink_count; k++) {
+            const struct OutputSink *sink = &masscan->output.sinks[k];
+            out->sinks[k] = output_create_file(masscan, thread_index,
+                                               sink->filename, sink->format,
+                                               sink);
+        }
+        out->sink_count = masscan->output.sink_count;
+    }
+
+    return out;
+}
+
 
 /*****************************************************************************
  * Rotate the file, moving it from the local directory to a remote directory
@@ -631,17 +728,25 @@ again:
     /*
      * Now create a new file
      */
-    if (is_closing)
-        out->fp = NULL; /* program shutting down, so don't create new file */
-    else {
+    if (is_closing) {
+        /* program shutting down, so don't create new file */
+        close_rotate(out, out->fp, out->compress);
+        out->fp = NULL;
+        out->compress = NULL;
+    } else {
         FILE *fp;
+        struct CompressWriter *compress;
 
-        fp = open_rotate(out, filename);
+        fp = open_rotate(out, filename, &compress);
         if (fp == NULL) {
             LOG(0, "rotate: %s: failed: %s\n", filename, strerror(errno));
         } else {
-            close_rotate(out, out->fp);
+            /* The old file gets its trailer before the new one is
+             * marked as needing a header */
+            close_rotate(out, out->fp, out->compress);
             out->fp = fp;
+            out->compress = compress;
+            out->is_virgin_file = 1;
             out->rotate.last = time(0);
             LOG(1, "rotate: started new file: %s\n", filename);
         }
@@ -658,8 +763,14 @@ is_rotate_time(const struct Output *out, time_t now, FILE *fp)
         return 0;
     if (now >= out->rotate.next)
         return 1;
-    if (out->rotate.filesize != 0 &&
-        ftell_x(fp) >= (int64_t)out->rotate.filesize)
+    if (out->rotate.filesize == 0)
+        return 0;
+
+    /* For compressed files, it's the size on disk that matters */
+    if (out->compress) {
+        if (compress_writer_bytes(out->compress) >= out->rotate.filesize)
+            return 1;
+    } else if (ftell_x(fp) >= (int64_t)out->rotate.filesize)
         return 1;
     return 0;
 }
@@ -725,69 +836,23 @@ oui_from_mac(const unsigned char mac[6])
 }
 
 /***************************************************************************
- * Report simply "open" or "closed", with little additional information.
- * This is called directly from the receive thread when responses come
- * back.
+ * Writes a status record to one file: the main output, or one of the
+ * --output-sink files, each of which has its own filters and rotation.
  ***************************************************************************/
-void
-output_report_status(struct Output *out, time_t timestamp, int status,
-        ipaddress ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl,
-        const unsigned char mac[6])
+static void
+output_write_status(struct Output *out, time_t now, time_t timestamp,
+        int status, ipaddress ip, unsigned ip_proto, unsigned port,
+        unsigned reason, unsigned ttl)
 {
     FILE *fp = out->fp;
-    time_t now = time(0);
-    ipaddress_formatted_t fmt = ipaddress_fmt(ip);
-
-    global_now = now;
 
-    /* if "--open"/"--open-only" parameter specified on command-line, then
-     * don't report the status of closed-ports */
+    if (fp == NULL)
+        return;
     if (!out->is_show_closed && status == PortStatus_Closed)
         return;
     if (!out->is_show_open && status == PortStatus_Open)
         return;
 
-    /* If in "--interactive" mode, then print the banner to the command
-     * line screen */
-    if (out->is_interactive || out->format == 0 || out->format == Output_Interactive) {
-        unsigned count;
-
-        switch (ip_proto) {
-        case 0: /* ARP */
-            count = fprintf(stdout, "Discovered %s port %u/%s on %s (%02x:%02x:%02x:%02x:%02x:%02x) %s",
-                        status_string(status),
-                        port,
-                        name_from_ip_proto(ip_proto),
-                        fmt.string,
-                        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-                        oui_from_mac(mac)
-                        );
-            break;
-        default:
-            count = fprintf(stdout, "Discovered %s port %u/%s on %s",
-                        status_string(status),
-                        port,
-                        name_from_ip_proto(ip_proto),
-                        fmt.string
-                        );
-        }
-
-        /* Because this line may overwrite the "%done" status line, print
-         * some spaces afterward to completely cover up the line */
-        if (count < 80)
-            fprintf(stdout, "%.*s", (int)(79-count),
-                    "                                          "
-                    "                                          ");
-
-        fprintf(stdout, "\n");
-        fflush(stdout);
-
-    } else if (fp == NULL) {
-        ERRMSG("no output file, use `--output-filename <filename>` to set one\n");
-        ERRMSG("for `stdout`, use `--output-filename -`\n");
-        return;
-    }
-
     /* Rotate, if we've pass the time limit. Rotating the log files happens
      * inline while writing output, whenever there's output to write to the
      * file, rather than in a separate thread right at the time interval.
@@ -862,6 +927,141 @@ output_report_status(struct Output *out, time_t timestamp, int status,
     out->funcs->status(out, fp, timestamp, status, ip, ip_proto, port, reason, ttl);
 }
 
+/***************************************************************************
+ * Writes a banner to one file, like output_write_status().
+ ***************************************************************************/
+static void
+output_write_banner(struct Output *out, time_t now,
+                ipaddress ip, unsigned ip_proto, unsigned port,
+                unsigned proto, unsigned ttl,
+                const unsigned char *px, unsigned length)
+{
+    FILE *fp = out->fp;
+
+    /* If not outputting to a file, then don't do anything */
+    if (fp == NULL)
+        return;
+
+    /* Rotate, if we've pass the time limit. Rotating the log files happens
+     * inline while writing output, whenever there's output to write to the
+     * file, rather than in a separate thread right at the time interval.
+     * Thus, if results are coming in slowly, the rotation won't happen
+     * on precise boundaries */
+    if (is_rotate_time(out, now, fp)) {
+        fp = output_do_rotate(out, 0);
+        if (fp == NULL)
+            return;
+    }
+
+    /*
+     * If this is a newly opened file, then write file headers
+     */
+    if (out->is_virgin_file) {
+        out->funcs->open(out, fp);
+        out->is_virgin_file = 0;
+    }
+
+    /*
+     * Now do the actual output, whether it be XML, binary, JSON, ndjson, Redis,
+     * and so on.
+     */
+    out->funcs->banner(out, fp, now, ip, ip_proto, port, proto, ttl, px, length);
+}
+
+/***************************************************************************
+ * Report simply "open" or "closed", with little additional information.
+ * This is called directly from the receive thread when responses come
+ * back.
+ ***************************************************************************/
+void
+output_report_status(struct Output *out, time_t timestamp, int status,
+        ipaddress ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl,
+        const unsigned char mac[6])
+{
+    FILE *fp = out->fp;
+    time_t now = time(0);
+    ipaddress_formatted_t fmt = ipaddress_fmt(ip);
+    unsigned is_routed = 0;
+    unsigned is_shown = 1;
+    unsigned k;
+
+    global_now = now;
+
+    /* With --profile, results for a profile's targets go to its own
+     * output file instead of this one */
+    for (k=0; k<out->masscan->profile_count; k++) {
+        if (out->profiles[k] == NULL)
+            continue;
+        if (!profile_is_target(&out->masscan->profile[k], ip, ip_proto, port))
+            continue;
+        output_report_status(out->profiles[k], timestamp, status,
+                             ip, ip_proto, port, reason, ttl, mac);
+        is_routed = 1;
+    }
+
+    /* if "--open"/"--open-only" parameter specified on command-line, then
+     * don't report the status of closed-ports. The --output-sink files
+     * have their own filters */
+    if (!out->is_show_closed && status == PortStatus_Closed)
+        is_shown = 0;
+    if (!out->is_show_open && status == PortStatus_Open)
+        is_shown = 0;
+    if (!is_shown && out->sink_count == 0)
+        return;
+
+    /* If in "--interactive" mode, then print the banner to the command
+     * line screen */
+    if (!is_shown)
+        ;
+    else if (out->is_interactive || out->format == 0 || out->format == Output_Interactive) {
+        unsigned count;
+
+        switch (ip_proto) {
+        case 0: /* ARP */
+            count = fprintf(stdout, "Discovered %s port %u/%s on %s (%02x:%02x:%02x:%02x:%02x:%02x) %s",
+                        status_string(status),
+                        port,
+                        name_from_ip_proto(ip_proto),
+                        fmt.string,
+                        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                        oui_from_mac(mac)
+                        );
+            break;
+        default:
+            count = fprintf(stdout, "Discovered %s port %u/%s on %s",
+                        status_string(status),
+                        port,
+                        name_from_ip_proto(ip_proto),
+                        fmt.string
+                        );
+        }
+
+        /* Because this line may overwrite the "%done" status line, print
+         * some spaces afterward to completely cover up the line */
+        if (count < 80)
+            fprintf(stdout, "%.*s", (int)(79-count),
+                    "                                          "
+                    "                                          ");
+
+        fprintf(stdout, "\n");
+        fflush(stdout);
+
+    } else if (fp == NULL && !is_routed && out->sink_count == 0) {
+        ERRMSG("no output file, use `--output-filename <filename>` to set one\n");
+        ERRMSG("for `stdout`, use `--output-filename -`\n");
+        return;
+    }
+    /* The record goes to each file, which formats it its own way. The
+     * --output-sink files get every result, even those routed to a
+     * --profile's file instead of this one */
+    if (!is_routed)
+        output_write_status(out, now, timestamp, status,
+                            ip, ip_proto, port, reason, ttl);
+    for (k=0; k<out->sink_count; k++)
+        output_write_status(out->sinks[k], now, timestamp, status,
+                            ip, ip_proto, port, reason, ttl);
+}
+
 
 /***************************************************************************
  ***************************************************************************/
@@ -872,8 +1072,9 @@ output_report_banner(struct Output *out, time_t now,
                 unsigned ttl, 
                 const unsigned char *px, unsigned length)
 {
-    FILE *fp = out->fp;
     ipaddress_formatted_t fmt = ipaddress_fmt(ip);
+    unsigned is_routed = 0;
+    unsigned k;
 
     /* If we aren't doing banners, then don't do anything. That's because
      * when doing UDP scans, we'll still get banner information from
@@ -881,6 +1082,30 @@ output_report_banner(struct Output *out, time_t now,
     if (!out->is_banner)
         return;
 
+    /* Collecting the banners from a multi-packet UDP response */
+    if (out->banner_capture) {
+        /* Tagged, since a 'proto' of zero (PROTO_NONE) would otherwise
+         * look like an unused entry to banout_append() */
+        proto |= 0x40000000;
+        if (banout_string_length(out->banner_capture, proto) + length + 1
+                > MAX_BANNER_LENGTH)
+            return;
+        banout_newline(out->banner_capture, proto);
+        banout_append(out->banner_capture, proto, px, length);
+        return;
+    }
+
+    /* With --profile, banners go to the profile's output file */
+    for (k=0; k<out->masscan->profile_count; k++) {
+        if (out->profiles[k] == NULL)
+            continue;
+        if (!profile_is_target(&out->masscan->profile[k], ip, ip_proto, port))
+            continue;
+        output_report_banner(out->profiles[k], now, ip, ip_proto, port,
+                             proto, ttl, px, length);
+        is_routed = 1;
+    }
+
     /* If in "--interactive" mode, then print the banner to the command
      * line screen */
     if (out->is_interactive || out->format == 0 || out->format == Output_Interactive) {
@@ -905,35 +1130,11 @@ output_report_banner(struct Output *out, time_t now,
         fprintf(stdout, "\n");
     }
 
-    /* If not outputting to a file, then don't do anything */
-    if (fp == NULL)
-        return;
-
-    /* Rotate, if we've pass the time limit. Rotating the log files happens
-     * inline while writing output, whenever there's output to write to the
-     * file, rather than in a separate thread right at the time interval.
-     * Thus, if results are coming in slowly, the rotation won't happen
-     * on precise boundaries */
-    if (is_rotate_time(out, now, fp)) {
-        fp = output_do_rotate(out, 0);
-        if (fp == NULL)
-            return;
-    }
-
-    /*
-     * If this is a newly opened file, then write file headers
-     */
-    if (out->is_virgin_file) {
-        out->funcs->open(out, fp);
-        out->is_virgin_file = 0;
-    }
-
-    /*
-     * Now do the actual output, whether it be XML, binary, JSON, ndjson, Redis,
-     * and so on.
-     */
-    out->funcs->banner(out, fp, now, ip, ip_proto, port, proto, ttl, px, length);
-
+    if (!is_routed)
+        output_write_banner(out, now, ip, ip_proto, port, proto, ttl, px, length);
+    for (k=0; k<out->sink_count; k++)
+        output_write_banner(out->sinks[k], now, ip, ip_proto, port,
+                            proto, ttl, px, length);
 }
 
 
@@ -943,9 +1144,17 @@ output_report_banner(struct Output *out, time_t now,
 void
 output_destroy(struct Output *out)
 {
+    unsigned k;
+
     if (out == NULL)
         return;
 
+    for (k=0; k<MAX_PROFILES; k++)
+        output_destroy(out->profiles[k]);
+    for (k=0; k<out->sink_count; k++)
+        output_destroy(out->sinks[k]);
+    free(out->sinks);
+
     /* If rotating files, then do one last rotate of this file to the
      * destination directory */
     if (out->rotate.period || out->rotate.filesize) {
@@ -957,7 +1166,7 @@ output_destroy(struct Output *out)
      * that some files will write closing information before closing
      * the file */
     if (out->fp)
-        close_rotate(out, out->fp);
+        close_rotate(out, out->fp, out->compress);
 
 
 
@@ -977,21 +1186,21 @@ output_selftest(void)
 {
     char *f;
 
-    f = indexed_filename("foo.bar", 1);
+    f = output_indexed_filename("foo.bar", 1);
     if (strcmp(f, "foo.01.bar") != 0) {
         fprintf(stderr, "output: failed selftest\n");
         return 1;
     }
     free(f);
 
-    f = indexed_filename("foo.b/ar", 2);
+    f = output_indexed_filename("foo.b/ar", 2);
     if (strcmp(f, "foo.b/ar.02") != 0) {
         fprintf(stderr, "output: failed selftest\n");
         return 1;
     }
     free(f);
 
-    f = indexed_filename(".foobar", 3);
+    f = output_indexed_filename(".foobar", 3);
     if (strcmp(f, ".03.foobar") != 0) {
         fprintf(stderr, "output: failed selftest\n");
         return 1;
@@ -8,6 +8,9 @@
 #include "stack-src.h"
 #include "unusedparm.h"
 #include "masscan-app.h"
+#include "main-profile.h"
+struct BannerOutput;
+struct ArrowBatch;
 
 #define MAX_BANNER_LENGTH 8192
 
@@ -52,6 +55,13 @@ struct Output
     const struct OutputType *funcs;
     unsigned format;
 
+    /**
+     * When compressing, 'fp' is a pipe to this, see out-compress.h
+     */
+    struct CompressWriter *compress;
+    unsigned compress_method;
+    int compress_level;
+
     /**
      * The timestamp when this scan started. This is preserved in output files
      * because that's what nmap does, and a lot of tools parse this.
@@ -89,6 +99,14 @@ struct Output
     unsigned is_show_closed:1; /* show closed ports */
     unsigned is_show_host:1; /* show host status info, like up/down */
     unsigned is_append:1; /* append to file */
+
+    /**
+     * While set, banners are appended here instead of being written, so
+     * that a response spread across several UDP packets is reported as
+     * one record, see handle_udp()
+     */
+    struct BannerOutput *banner_capture;
+
     struct {
         struct {
             uint64_t open;
@@ -127,6 +145,22 @@ struct Output
     struct {
         char *stylesheet;
     } xml;
+    struct {
+        struct ArrowBatch *batch;
+    } arrow;
+
+    /**
+     * With --profile, results for a profile that has its own
+     * --output-filename go to these instead of this output.
+     */
+    struct Output *profiles[MAX_PROFILES];
+
+    /**
+     * With --output-sink, results also go to these, each with its own
+     * file, format, rotation, and --show filters.
+     */
+    struct Output **sinks;
+    unsigned sink_count;
 };
 
 const char *name_from_ip_proto(unsigned ip_proto);
@@ -147,6 +181,7 @@ extern const struct OutputType null_output;
 extern const struct OutputType redis_output;
 extern const struct OutputType hostonly_output;
 extern const struct OutputType grepable_output;
+extern const struct OutputType arrow_output;
 
 /**
  * Creates an "output" object. This is called by the receive thread in order
@@ -165,6 +200,14 @@ output_create(const struct Masscan *masscan, unsigned thread_index);
 
 void output_destroy(struct Output *output);
 
+/**
+ * Inserts an index number before the file extension, such as turning
+ * "foo.xml" into "foo.01.xml", so that each receive thread can write
+ * its own file. The caller must free() the result.
+ */
+char *
+output_indexed_filename(const char *filename, unsigned index);
+
 void output_report_status(struct Output *output, time_t timestamp,
     int status, ipaddress ip, unsigned ip_proto, unsigned port, unsigned reason, unsigned ttl,
     const unsigned char mac[6]);
@@ -192,6 +235,12 @@ void output_report_banner(
 int
 output_selftest(void);
 
+/**
+ * Regression tests the framing of the Arrow output (out-arrow.c).
+ */
+int
+arrow_selftest(void);
+
 
 
 
@@ -65,3 +65,34 @@ pixie_fopen_shareable(FILE **in_fp, const char *filename, unsigned is_append)
     *in_fp = fp;
     return 0;
 }
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_fsync(FILE *fp)
+{
+    if (fflush(fp) != 0)
+        return -1;
+#if defined(WIN32)
+    if (_commit(_fileno(fp)) != 0)
+        return -1;
+#else
+    if (fsync(fileno(fp)) != 0)
+        return -1;
+#endif
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_rename_replace(const char *from, const char *to)
+{
+#if defined(WIN32)
+    if (!MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        return -1;
+    return 0;
+#else
+    return rename(from, to) == 0 ? 0 : -1;
+#endif
+}
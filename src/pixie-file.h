@@ -16,4 +16,21 @@
 int
 pixie_fopen_shareable(FILE **in_fp, const char *filename, unsigned is_append);
 
+/**
+ * Flushes the file all the way to the disk, not just out of our buffers,
+ * so that it survives a crash of the system, not just of the program.
+ * @return 0 on success, or -1 on error
+ */
+int
+pixie_fsync(FILE *fp);
+
+/**
+ * Renames 'from' to 'to', replacing 'to' if it exists. On POSIX this
+ * is atomic, so that anyone reading 'to' sees either the old file
+ * or the new one, never something in between.
+ * @return 0 on success, or -1 on error
+ */
+int
+pixie_rename_replace(const char *from, const char *to);
+
 #endif
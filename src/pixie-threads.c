@@ -66,8 +66,6 @@ pixie_cpu_set_affinity(unsigned processor)
 #if defined WIN32
     DWORD_PTR mask;
     DWORD_PTR result;
-    if (processor > 0)
-        processor--;
     mask = ((size_t)1)<<processor;
 
     //printf("mask(%u) = 0x%08x\n", processor, mask);
@@ -82,15 +80,15 @@ pixie_cpu_set_affinity(unsigned processor)
 
     CPU_ZERO(&cpuset);
 
-    CPU_SET(processor+1, &cpuset);
+    CPU_SET(processor, &cpuset);
 
     x = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
     if (x != 0) {
-        fprintf(stderr, "set_affinity: returned error linux:%d\n", errno);
+        fprintf(stderr, "set_affinity: returned error linux:%d\n", x);
     }
 #elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
     /* FIXME: add code here */
-    UNUSEDPARM(x);
+    UNUSEDPARM(processor);
 #endif
 }
 
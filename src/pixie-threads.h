@@ -23,6 +23,10 @@ size_t pixie_begin_thread(void (*worker_thread)(void*),
 
 void pixie_thread_join(size_t thread_handle);
 
+/**
+ * Pins the calling thread to a single CPU, numbered from 0 the way
+ * the operating system numbers them.
+ */
 void pixie_cpu_set_affinity(unsigned processor);
 void pixie_cpu_raise_priority(void);
 
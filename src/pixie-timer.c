@@ -254,6 +254,31 @@ pixie_nanotime(void)
 }
 #endif
 
+/***************************************************************************
+ ***************************************************************************/
+uint64_t
+pixie_thread_cputime(void)
+{
+#if defined(WIN32)
+    FILETIME created, exited, kernel, user;
+    uint64_t k, u;
+
+    if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+        return pixie_nanotime();
+    k = (uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime;
+    u = (uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime;
+    return (k + u) * 100; /* 100-nanosecond units */
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec tv;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tv) != 0)
+        return pixie_nanotime();
+    return tv.tv_sec * 1000000000ULL + tv.tv_nsec;
+#else
+    return pixie_nanotime();
+#endif
+}
+
 /*
  * Timing is incredibly importatn to masscan because we need to throttle
  * how fast we spew packets. Every platofrm has slightly different timing
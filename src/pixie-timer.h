@@ -12,6 +12,14 @@ uint64_t pixie_gettime(void);
  */
 uint64_t pixie_nanotime(void);
 
+/**
+ * The CPU time used by the calling thread, in nanoseconds. This doesn't
+ * advance while the thread is blocked or waiting for a CPU, so it's for
+ * measuring how much work something did rather than how long it took.
+ * Where that isn't available, this is the same as pixie_nanotime().
+ */
+uint64_t pixie_thread_cputime(void);
+
 /**
  * Wait the specified number of microseconds
  */
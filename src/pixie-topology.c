@@ -0,0 +1,352 @@
+/*
+    CPU topology discovery and thread placement
+
+    On Linux, we read everything from sysfs:
+        /sys/devices/system/cpu/cpuN/topology/physical_package_id
+        /sys/devices/system/cpu/cpuN/topology/core_id
+        /sys/devices/system/cpu/cpuN/nodeM
+        /sys/devices/system/cpu/isolated
+        /sys/class/net/<ifname>/device/numa_node
+*/
+#define _GNU_SOURCE
+#include "pixie-topology.h"
+#include "pixie-threads.h"
+#include "util-malloc.h"
+#include "util-logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#define MAX_CPUS 4096
+
+/***************************************************************************
+ * Parses the kernel's "cpulist" format, like "0-3,8,10-11".
+ ***************************************************************************/
+static void
+parse_cpulist(const char *str, unsigned char *set, unsigned max)
+{
+    while (*str) {
+        unsigned first;
+        unsigned last;
+        unsigned i;
+
+        while (*str && !isdigit(*str & 0xFF))
+            str++;
+        if (*str == '\0')
+            break;
+        first = (unsigned)strtoul(str, (char **)&str, 10);
+        last = first;
+        if (*str == '-') {
+            str++;
+            last = (unsigned)strtoul(str, (char **)&str, 10);
+        }
+        for (i=first; i<=last && i<max; i++)
+            set[i] = 1;
+    }
+}
+
+#if defined(__linux__)
+/***************************************************************************
+ ***************************************************************************/
+static int
+read_sysfs_int(const char *filename, int default_value)
+{
+    FILE *fp;
+    int x;
+
+    fp = fopen(filename, "r");
+    if (fp == NULL)
+        return default_value;
+    if (fscanf(fp, "%d", &x) != 1)
+        x = default_value;
+    fclose(fp);
+    return x;
+}
+
+static int
+read_cpu_node(unsigned cpu)
+{
+    char dirname[256];
+    DIR *dir;
+    struct dirent *ent;
+    int node = -1;
+
+    snprintf(dirname, sizeof(dirname), "/sys/devices/system/cpu/cpu%u", cpu);
+    dir = opendir(dirname);
+    if (dir == NULL)
+        return -1;
+    while ((ent = readdir(dir)) != NULL) {
+        if (memcmp(ent->d_name, "node", 4) == 0 && isdigit(ent->d_name[4] & 0xFF)) {
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+struct CpuTopology *
+pixie_topology_read(void)
+{
+    struct CpuTopology *topo;
+
+    topo = CALLOC(1, sizeof(*topo));
+
+#if defined(__linux__)
+    {
+        cpu_set_t mask;
+        unsigned char *isolated;
+        unsigned cpu;
+        char buf[1024];
+        FILE *fp;
+
+        isolated = CALLOC(MAX_CPUS, 1);
+        fp = fopen("/sys/devices/system/cpu/isolated", "r");
+        if (fp) {
+            if (fgets(buf, sizeof(buf), fp))
+                parse_cpulist(buf, isolated, MAX_CPUS);
+            fclose(fp);
+        }
+
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+            topo->cpus = CALLOC(CPU_SETSIZE, sizeof(topo->cpus[0]));
+            for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+                struct CpuInfo *info;
+                char filename[256];
+
+                if (!CPU_ISSET(cpu, &mask))
+                    continue;
+                info = &topo->cpus[topo->count++];
+                info->cpu = cpu;
+                snprintf(filename, sizeof(filename),
+                    "/sys/devices/system/cpu/cpu%u/topology/physical_package_id", cpu);
+                info->package = read_sysfs_int(filename, 0);
+                snprintf(filename, sizeof(filename),
+                    "/sys/devices/system/cpu/cpu%u/topology/core_id", cpu);
+                info->core = read_sysfs_int(filename, (int)cpu);
+                info->node = read_cpu_node(cpu);
+                info->is_isolated = (cpu < MAX_CPUS) ? isolated[cpu] : 0;
+            }
+        }
+        free(isolated);
+    }
+#endif
+
+    /* Unknown system, so assume every CPU is a separate core */
+    if (topo->count == 0) {
+        unsigned i;
+        unsigned count = pixie_cpu_get_count();
+
+        if (count == 0)
+            count = 1;
+        free(topo->cpus);
+        topo->cpus = CALLOC(count, sizeof(topo->cpus[0]));
+        topo->count = count;
+        for (i=0; i<count; i++) {
+            topo->cpus[i].cpu = i;
+            topo->cpus[i].package = 0;
+            topo->cpus[i].core = (int)i;
+            topo->cpus[i].node = -1;
+        }
+    }
+
+    return topo;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pixie_topology_free(struct CpuTopology *topo)
+{
+    if (topo == NULL)
+        return;
+    free(topo->cpus);
+    free(topo);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_topology_nic_node(const char *ifname)
+{
+#if defined(__linux__)
+    char filename[256];
+
+    if (ifname == NULL || ifname[0] == '\0' || strchr(ifname, '/'))
+        return -1;
+    snprintf(filename, sizeof(filename),
+             "/sys/class/net/%s/device/numa_node", ifname);
+    return read_sysfs_int(filename, -1);
+#else
+    (void)ifname;
+    return -1;
+#endif
+}
+
+/***************************************************************************
+ * Lower is better. Being on the NIC's node matters most, then being on
+ * a core the kernel won't schedule other things on, then staying off
+ * the core that handles CPU 0's housekeeping.
+ ***************************************************************************/
+static unsigned
+cpu_cost(const struct CpuTopology *topo, const struct CpuInfo *info, int node)
+{
+    const struct CpuInfo *cpu0 = NULL;
+    unsigned cost = 0;
+    unsigned i;
+
+    for (i=0; i<topo->count; i++) {
+        if (topo->cpus[i].cpu == 0) {
+            cpu0 = &topo->cpus[i];
+            break;
+        }
+    }
+
+    if (node >= 0 && info->node != node)
+        cost += 4;
+    if (!info->is_isolated)
+        cost += 2;
+    if (cpu0 && cpu0->package == info->package && cpu0->core == info->core)
+        cost += 1;
+    return cost;
+}
+
+static unsigned
+is_core_used(const struct CpuTopology *topo, const unsigned char *is_used,
+             const struct CpuInfo *info)
+{
+    unsigned i;
+    for (i=0; i<topo->count; i++) {
+        if (is_used[i]
+            && topo->cpus[i].package == info->package
+            && topo->cpus[i].core == info->core)
+            return 1;
+    }
+    return 0;
+}
+
+void
+pixie_topology_plan(const struct CpuTopology *topo, int node,
+                    unsigned char *is_used,
+                    unsigned count, unsigned *cpus)
+{
+    unsigned n;
+
+    for (n=0; n<count; n++) {
+        unsigned best = ~0U;
+        unsigned best_cost = ~0U;
+        unsigned pass;
+        unsigned i;
+
+        /* pass 0: a whole unused physical core
+         * pass 1: an unused SMT sibling
+         * pass 2: anything, since we have more threads than CPUs */
+        for (pass=0; pass<3 && best == ~0U; pass++) {
+            for (i=0; i<topo->count; i++) {
+                const struct CpuInfo *info = &topo->cpus[i];
+                unsigned cost;
+
+                if (pass < 2 && is_used[i])
+                    continue;
+                if (pass == 0 && is_core_used(topo, is_used, info))
+                    continue;
+                cost = cpu_cost(topo, info, node);
+                if (pass == 2)
+                    cost = cost * 1024 + is_used[i];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = i;
+                }
+            }
+        }
+
+        if (best == ~0U)
+            best = 0;
+        if (is_used[best] < 255)
+            is_used[best]++;
+        cpus[n] = topo->cpus[best].cpu;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+pixie_topology_selftest(void)
+{
+    struct CpuTopology topo;
+    struct CpuInfo cpus[16];
+    unsigned char is_used[16];
+    unsigned char set[16];
+    unsigned chosen[20];
+    unsigned i;
+    unsigned j;
+
+    /* cpulist parsing */
+    memset(set, 0, sizeof(set));
+    parse_cpulist("1-3,7,14-15\n", set, 16);
+    if (!set[1] || !set[3] || set[4] || !set[7] || !set[15] || set[0])
+        goto fail;
+
+    /* Two sockets (nodes), four cores each, two hyperthreads per core,
+     * numbered the way Linux does: CPU N and N+8 are siblings */
+    for (i=0; i<16; i++) {
+        cpus[i].cpu = i;
+        cpus[i].package = (i % 8) / 4;
+        cpus[i].core = (int)(i % 4);
+        cpus[i].node = cpus[i].package;
+        cpus[i].is_isolated = 0;
+    }
+    topo.count = 16;
+    topo.cpus = cpus;
+
+    /* NIC on node 1: the first four threads get separate physical cores
+     * on socket 1, and never a pair of siblings */
+    memset(is_used, 0, sizeof(is_used));
+    pixie_topology_plan(&topo, 1, is_used, 4, chosen);
+    for (i=0; i<4; i++) {
+        if (cpus[chosen[i]].package != 1)
+            goto fail;
+        for (j=0; j<i; j++) {
+            if (cpus[chosen[i]].core == cpus[chosen[j]].core)
+                goto fail;
+        }
+    }
+
+    /* A second adapter on node 0 avoids CPU 0's core until last */
+    pixie_topology_plan(&topo, 0, is_used, 3, chosen);
+    for (i=0; i<3; i++) {
+        if (cpus[chosen[i]].package != 0 || cpus[chosen[i]].core == 0)
+            goto fail;
+    }
+
+    /* More threads than CPUs still works */
+    memset(is_used, 0, sizeof(is_used));
+    pixie_topology_plan(&topo, -1, is_used, 20, chosen);
+    for (i=0; i<16; i++) {
+        if (is_used[i] == 0)
+            goto fail;
+    }
+
+    /* isolated cores are preferred */
+    cpus[6].is_isolated = 1;
+    memset(is_used, 0, sizeof(is_used));
+    pixie_topology_plan(&topo, -1, is_used, 1, chosen);
+    if (chosen[0] != 6)
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "[-] topology: selftest failed\n");
+    return 1;
+}
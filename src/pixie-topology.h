@@ -0,0 +1,66 @@
+/*
+    CPU topology discovery and thread placement
+
+    At high packet rates, where our threads run matters. If the
+    transmit and receive threads land on the two hyperthreads of the
+    same physical core, they fight over the same execution units and
+    L1 cache. If they land on a different socket than the NIC, every
+    packet crosses the inter-socket link. And if the scheduler migrates
+    them, their caches go cold.
+
+    This module reads the layout of the system (sockets, physical cores,
+    SMT siblings, NUMA nodes) and picks CPUs for our threads: each on its
+    own physical core, preferring cores on the NIC's NUMA node (--pin-threads).
+*/
+#ifndef PIXIE_TOPOLOGY_H
+#define PIXIE_TOPOLOGY_H
+
+struct CpuInfo {
+    unsigned cpu;           /* logical CPU number, for pixie_cpu_set_affinity() */
+    int package;            /* physical socket */
+    int core;               /* physical core within the socket */
+    int node;               /* NUMA node, or -1 if unknown */
+    unsigned is_isolated:1; /* in the isolcpus= list, so nothing else runs there */
+};
+
+struct CpuTopology {
+    unsigned count;
+    struct CpuInfo *cpus;
+};
+
+/**
+ * Reads the topology of the CPUs that this process is allowed to run on.
+ * On systems without the Linux sysfs, each CPU is treated as its own
+ * physical core.
+ * @return a topology that must be freed with pixie_topology_free()
+ */
+struct CpuTopology *pixie_topology_read(void);
+
+void pixie_topology_free(struct CpuTopology *topo);
+
+/**
+ * Finds the NUMA node that a network adapter is attached to.
+ * @return the node number, or -1 if unknown
+ */
+int pixie_topology_nic_node(const char *ifname);
+
+/**
+ * Chooses CPUs for 'count' threads. Each goes on a different physical
+ * core when possible, preferring (in order) cores on 'node', isolated
+ * cores, and cores other than the one with CPU 0, which tends to get
+ * the interrupts. Only once every physical core is used do we double up
+ * on SMT siblings.
+ * @param is_used
+ *      An array of 'topo->count' flags, marking CPUs already given to
+ *      other threads. Updated with the CPUs we pick, so that successive
+ *      calls (one per adapter) don't overlap.
+ * @param cpus
+ *      Receives the chosen CPU numbers
+ */
+void pixie_topology_plan(const struct CpuTopology *topo, int node,
+                         unsigned char *is_used,
+                         unsigned count, unsigned *cpus);
+
+int pixie_topology_selftest(void);
+
+#endif
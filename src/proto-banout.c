@@ -18,6 +18,130 @@
 #include <stdlib.h>
 #include <stdarg.h>
 
+/**
+ * Buffers double in size each time they grow, so there's one free list
+ * for each size: 200, 400, 800, and so on.
+ */
+#define BANOUT_POOL_SIZES 16
+
+/**
+ * The most buffers of each size we hold onto. More than that and we
+ * free them, so that a burst of big banners doesn't tie up the memory.
+ */
+#define BANOUT_POOL_KEEP 64
+
+struct BannerPool {
+    struct BannerOutput *freed[BANOUT_POOL_SIZES];
+    unsigned freed_count[BANOUT_POOL_SIZES];
+    struct BannerPoolStats *stats;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static size_t
+banout_node_size(unsigned max_length)
+{
+    return offsetof(struct BannerOutput, banner) + max_length;
+}
+
+/***************************************************************************
+ * Which free list a buffer of this size goes on, or BANOUT_POOL_SIZES
+ * if it's too big to keep.
+ ***************************************************************************/
+static unsigned
+banout_size_index(unsigned max_length)
+{
+    unsigned i;
+    for (i=0; i<BANOUT_POOL_SIZES; i++) {
+        if (max_length == sizeof(((struct BannerOutput*)0)->banner) << i)
+            return i;
+    }
+    return BANOUT_POOL_SIZES;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static struct BannerOutput *
+banout_alloc(struct BannerPool *pool, unsigned max_length)
+{
+    struct BannerOutput *p = NULL;
+    unsigned i;
+
+    if (pool == NULL)
+        return MALLOC(banout_node_size(max_length));
+
+    i = banout_size_index(max_length);
+    if (i < BANOUT_POOL_SIZES && pool->freed[i]) {
+        p = pool->freed[i];
+        pool->freed[i] = p->next;
+        pool->freed_count[i]--;
+    } else
+        p = MALLOC(banout_node_size(max_length));
+
+    if (pool->stats) {
+        pool->stats->bytes += banout_node_size(max_length);
+        if (pool->stats->peak < pool->stats->bytes)
+            pool->stats->peak = pool->stats->bytes;
+    }
+    return p;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+banout_free(struct BannerPool *pool, struct BannerOutput *p)
+{
+    unsigned i;
+
+    if (pool == NULL) {
+        free(p);
+        return;
+    }
+
+    if (pool->stats)
+        pool->stats->bytes -= banout_node_size(p->max_length);
+
+    i = banout_size_index(p->max_length);
+    if (i < BANOUT_POOL_SIZES && pool->freed_count[i] < BANOUT_POOL_KEEP) {
+        p->next = pool->freed[i];
+        pool->freed[i] = p;
+        pool->freed_count[i]++;
+    } else
+        free(p);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct BannerPool *
+banout_pool_create(struct BannerPoolStats *stats)
+{
+    struct BannerPool *pool;
+
+    pool = CALLOC(1, sizeof(*pool));
+    pool->stats = stats;
+    return pool;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+banout_pool_destroy(struct BannerPool *pool)
+{
+    unsigned i;
+
+    if (pool == NULL)
+        return;
+
+    for (i=0; i<BANOUT_POOL_SIZES; i++) {
+        while (pool->freed[i]) {
+            struct BannerOutput *p = pool->freed[i];
+            pool->freed[i] = p->next;
+            free(p);
+        }
+    }
+    free(pool);
+}
+
 /***************************************************************************
  ***************************************************************************/
 void
@@ -27,6 +151,20 @@ banout_init(struct BannerOutput *banout)
     banout->protocol = 0;
     banout->next = 0;
     banout->max_length = sizeof(banout->banner);
+    banout->pool = 0;
+    banout->total = 0;
+    banout->limit = 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+banout_init_pool(struct BannerOutput *banout, struct BannerPool *pool,
+                 unsigned limit)
+{
+    banout_init(banout);
+    banout->pool = pool;
+    banout->limit = limit;
 }
 
 /***************************************************************************
@@ -34,12 +172,38 @@ banout_init(struct BannerOutput *banout)
 void
 banout_release(struct BannerOutput *banout)
 {
+    struct BannerPool *pool = banout->pool;
+    unsigned limit = banout->limit;
+
     while (banout->next) {
         struct BannerOutput *next = banout->next->next;
-        free(banout->next);
+        banout_free(pool, banout->next);
         banout->next = next;
     }
-    banout_init(banout);
+    banout_init_pool(banout, pool, limit);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+banout_discard(struct BannerOutput *banout, struct BannerOutput *p)
+{
+    struct BannerOutput *prev;
+
+    /* The first one is part of something else, like the TCB, so it's
+     * just emptied, to be reused by the next banner */
+    if (p == banout) {
+        p->protocol = 0;
+        p->length = 0;
+        return;
+    }
+
+    for (prev = banout; prev->next != p; prev = prev->next) {
+        if (prev->next == NULL)
+            return;
+    }
+    prev->next = p->next;
+    banout_free(banout->pool, p);
 }
 
 
@@ -244,7 +408,8 @@ banout_new_proto(struct BannerOutput *banout, unsigned proto)
         return banout;
     }
 
-    p = CALLOC(1, sizeof(*p));
+    p = banout_alloc(banout->pool, sizeof(p->banner));
+    memset(p, 0, offsetof(struct BannerOutput, banner));
     p->protocol = proto;
     p->max_length = sizeof(p->banner);
     p->next = banout->next;
@@ -261,8 +426,7 @@ banout_expand(struct BannerOutput *banout, struct BannerOutput *p)
     struct BannerOutput *n;
 
     /* Double the space */
-    n = MALLOC(  offsetof(struct BannerOutput, banner)
-                 + 2 * p->max_length);
+    n = banout_alloc(banout->pool, 2 * p->max_length);
 
     /* Copy the old structure */
     memcpy(n, p, offsetof(struct BannerOutput, banner) + p->max_length);
@@ -279,7 +443,7 @@ banout_expand(struct BannerOutput *banout, struct BannerOutput *p)
         while (banout->next != p)
             banout = banout->next;
         banout->next = n;
-        free(p);
+        banout_free(banout->pool, p);
     }
 
     return n;
@@ -330,6 +494,15 @@ banout_append(struct BannerOutput *banout, unsigned proto,
 
     if (length == AUTO_LEN)
         length = strlen((const char*)px);
+
+    /* Keep within the limit for this connection (--banner-limit) */
+    if (banout->limit) {
+        if (banout->total >= banout->limit)
+            return;
+        if (length > banout->limit - banout->total)
+            length = banout->limit - banout->total;
+    }
+    banout->total += (unsigned)length;
     
     /*
      * Get the matching record for the protocol (e.g. HTML, SSL, etc.).
@@ -486,6 +659,50 @@ banout_selftest(void)
             return 1;
     }
     
+    /*
+     * Pooled buffers, with a limit
+     */
+    {
+        struct BannerOutput banout[1];
+        struct BannerPoolStats stats = {0};
+        struct BannerPool *pool;
+        uint64_t peak;
+        unsigned i;
+
+        pool = banout_pool_create(&stats);
+        banout_init_pool(banout, pool, 1000);
+
+        for (i=0; i<200; i++) {
+            banout_append(banout, 1, "xxxx", 4);
+            banout_append(banout, 2, "yyyyy", 5);
+        }
+        if (banout->total != 1000 || stats.bytes == 0)
+            return 1;
+        if (banout_string_length(banout, 1) + banout_string_length(banout, 2) != 1000)
+            return 1;
+        peak = stats.peak;
+
+        /* Discarding returns the memory. (The first in the list was
+         * left empty when it grew) */
+        while (banout->next)
+            banout_discard(banout, banout->next);
+        if (banout_string_length(banout, 1) + banout_string_length(banout, 2) != 0)
+            return 1;
+        banout_release(banout);
+        if (stats.bytes != 0 || banout->pool != pool || banout->limit != 1000)
+            return 1;
+
+        /* ...and it gets reused */
+        for (i=0; i<200; i++) {
+            banout_append(banout, 1, "xxxx", 4);
+            banout_append(banout, 2, "yyyyy", 5);
+        }
+        if (stats.peak != peak)
+            return 1;
+        banout_release(banout);
+        banout_pool_destroy(pool);
+    }
+
     /*
      * Test BASE64 encoding. We are going to do strings of various lengths
      * in order to test the boundary condition of finalizing various strings
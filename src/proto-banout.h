@@ -1,6 +1,8 @@
 #ifndef PROTO_BANOUT_H
 #define PROTO_BANOUT_H
+#include <stdint.h>
 struct BannerBase64;
+struct BannerPool;
 
 /**
  * A structure for tracking one or more banners from a target.
@@ -17,9 +19,24 @@ struct BannerOutput {
     unsigned protocol;
     unsigned length;
     unsigned max_length;
+
+    /* These are only used in the first one of the list */
+    struct BannerPool *pool;    /* where the rest of the list comes from */
+    unsigned total;             /* bytes appended so far */
+    unsigned limit;             /* most bytes we'll take, 0 for no limit */
+
     unsigned char banner[200];
 };
 
+/**
+ * Memory used for banners by one thread, which the status line
+ * reports.
+ */
+struct BannerPoolStats {
+    uint64_t bytes;
+    uint64_t peak;
+};
+
 /**
  * Initialize the list of banners. This doesn't allocate any
  * memory, such sets it to zero.
@@ -27,6 +44,40 @@ struct BannerOutput {
 void
 banout_init(struct BannerOutput *banout);
 
+/**
+ * Initialize the list of banners, taking any more memory it needs from
+ * a pool instead of malloc(), and accepting at most 'limit' bytes
+ * altogether. Anything appended beyond that is dropped.
+ */
+void
+banout_init_pool(struct BannerOutput *banout, struct BannerPool *pool,
+                 unsigned limit);
+
+/**
+ * Creates a pool of banner buffers for one thread. They aren't locked,
+ * so they must only be used by that thread.
+ * @param stats
+ *      Updated with how much memory banners are using. It must outlive
+ *      the pool, since other threads read it.
+ */
+struct BannerPool *
+banout_pool_create(struct BannerPoolStats *stats);
+
+/**
+ * Frees the pool and the buffers it holds. All the banner lists using
+ * it must have been released first.
+ */
+void
+banout_pool_destroy(struct BannerPool *pool);
+
+/**
+ * Removes one banner from the list, once it's been written out. The
+ * pointer 'p' is no longer valid afterwards, unless it was the first
+ * in the list.
+ */
+void
+banout_discard(struct BannerOutput *banout, struct BannerOutput *p);
+
 /**
  * Release any memory. If the list contains only one short
  * banner, then no memory was allocated, so nothing gets
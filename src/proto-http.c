@@ -944,7 +944,8 @@ http_selftest(void)
 /***************************************************************************
  ***************************************************************************/
 struct ProtocolParserStream banner_http = {
-    "http", 80, http_hello, sizeof(http_hello)-1, 0,
+    "http", 80, http_hello, sizeof(http_hello)-1,
+    SF__nowait_hello, /* servers never speak first */
     http_selftest,
     http_init,
     http_parse,
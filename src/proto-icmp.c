@@ -24,27 +24,37 @@ matches_me(struct Output *out, ipaddress ip, unsigned port)
 
 /***************************************************************************
  ***************************************************************************/
-static int
+int
 parse_port_unreachable(const unsigned char *px, unsigned length,
         unsigned *r_ip_me, unsigned *r_ip_them,
         unsigned *r_port_me, unsigned *r_port_them,
-        unsigned *r_ip_proto)
+        unsigned *r_ip_proto, unsigned *r_seqno)
 {
+    unsigned header_length;
+
     if (length < 24)
         return -1;
     *r_ip_me = px[12]<<24 | px[13]<<16 | px[14]<<8 | px[15];
     *r_ip_them = px[16]<<24 | px[17]<<16 | px[18]<<8 | px[19];
     *r_ip_proto = px[9]; /* TCP=6, UDP=17 */
 
-    px += (px[0]&0xF)<<2;
-    length -= (px[0]&0xF)<<2;
-
-    if (length < 4)
+    header_length = (px[0]&0xF)<<2;
+    if (length < header_length + 4)
         return -1;
+    px += header_length;
+    length -= header_length;
 
     *r_port_me = px[0]<<8 | px[1];
     *r_port_them = px[2]<<8 | px[3];
 
+    /* The TCP sequence number, if the router quoted enough of our
+     * packet, which it should (RFC 792 says 8 bytes) */
+    *r_seqno = 0;
+    if (length >= 8)
+        *r_seqno = px[4]<<24 | px[5]<<16 | px[6]<<8 | px[7];
+    else if (*r_ip_proto == 6)
+        return -1;
+
     return 0;
 }
 
@@ -57,7 +67,8 @@ void
 handle_icmp(struct Output *out, time_t timestamp,
             const unsigned char *px, unsigned length,
             struct PreprocessedInfo *parsed,
-            uint64_t entropy)
+            uint64_t entropy,
+            struct DedupTable *dedup)
 {
     unsigned type = parsed->port_src;
     unsigned code = parsed->port_dst;
@@ -66,13 +77,6 @@ handle_icmp(struct Output *out, time_t timestamp,
     ipaddress ip_them = parsed->src_ip;
     unsigned cookie;
 
-    /* dedup ICMP echo replies as well as SYN/ACK replies */
-    static struct DedupTable *echo_reply_dedup = NULL;
-
-
-    if (!echo_reply_dedup)
-        echo_reply_dedup = dedup_create();
-
     seqno_me = px[parsed->transport_offset+4]<<24
                 | px[parsed->transport_offset+5]<<16
                 | px[parsed->transport_offset+6]<<8
@@ -85,7 +89,7 @@ handle_icmp(struct Output *out, time_t timestamp,
         if ((cookie & 0xFFFFFFFF) != seqno_me)
             return; /* not my response */
 
-        if (dedup_is_duplicate(echo_reply_dedup, ip_them, 0, ip_me, 0))
+        if (dedup_is_duplicate(dedup, ip_them, Templ_ICMP_echo, ip_me, 0))
             break;
 
         //if (syn_hash(ip_them, Templ_ICMP_echo) != seqno_me)
@@ -123,6 +127,8 @@ handle_icmp(struct Output *out, time_t timestamp,
                 ipaddress ip_them2;
                 unsigned port_me2, port_them2;
                 unsigned ip_proto;
+                unsigned seqno2;
+                unsigned templ;
                 int err;
 
                 ip_me2.version = 4;
@@ -130,9 +136,9 @@ handle_icmp(struct Output *out, time_t timestamp,
 
                 err = parse_port_unreachable(
                     px + parsed->transport_offset + 8,
-                    length - parsed->transport_offset + 8,
+                    length - parsed->transport_offset - 8,
                     &ip_me2.ipv4, &ip_them2.ipv4, &port_me2, &port_them2,
-                    &ip_proto);
+                    &ip_proto, &seqno2);
 
                 if (err)
                     return;
@@ -140,6 +146,31 @@ handle_icmp(struct Output *out, time_t timestamp,
                 if (!matches_me(out, ip_me2, port_me2))
                     return;
 
+                switch (ip_proto) {
+                case 6:
+                    /* Our SYN carried the cookie as its sequence number */
+                    cookie = (unsigned)syn_cookie(ip_them2, port_them2,
+                                            ip_me2, port_me2, entropy);
+                    if (cookie != seqno2)
+                        return;
+                    templ = 0;
+                    break;
+                case 17:
+                    templ = Templ_UDP;
+                    break;
+                case 132:
+                    templ = Templ_SCTP;
+                    break;
+                default:
+                    return;
+                }
+
+                /* Keyed the same as a direct response, so that a port
+                 * is reported just once however we find out about it */
+                if (dedup_is_duplicate(dedup, ip_them2, port_them2 | templ,
+                                       ip_me2, port_me2))
+                    return;
+
                 switch (ip_proto) {
                 case 6:
                     output_report_status(
@@ -4,10 +4,33 @@
 #include <stdint.h>
 struct PreprocessedInfo;
 struct Output;
+struct DedupTable;
 
+/**
+ * Handles echo replies to our pings, and "port unreachable" messages
+ * about our probes. Both have their cookies checked and are
+ * deduplicated through 'dedup' before anything is reported.
+ */
 void handle_icmp(struct Output *out, time_t timestamp,
         const unsigned char *px, unsigned length, 
         struct PreprocessedInfo *parsed,
-        uint64_t entropy);
+        uint64_t entropy,
+        struct DedupTable *dedup);
+
+/**
+ * Pulls out the addresses and ports of our packet that an IPv4
+ * "destination unreachable" quotes back to us.
+ * @param px
+ *      The quoted IP header and what follows, after the 8 byte ICMP
+ *      header.
+ * @param r_seqno
+ *      The TCP sequence number, if quoted, or zero.
+ * @return 0 on success, or -1 if too little was quoted
+ */
+int
+parse_port_unreachable(const unsigned char *px, unsigned length,
+        unsigned *r_ip_me, unsigned *r_ip_them,
+        unsigned *r_port_me, unsigned *r_port_them,
+        unsigned *r_ip_proto, unsigned *r_seqno);
 
 #endif
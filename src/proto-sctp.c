@@ -2,6 +2,8 @@
 #include "proto-preprocess.h"
 #include "masscan-status.h"
 #include "output.h"
+#include "main-dedup.h"
+#include "massip-port.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -138,7 +140,8 @@ handle_sctp(struct Output *out, time_t timestamp,
             const unsigned char *px, unsigned length, 
             unsigned cookie,
             struct PreprocessedInfo *parsed,
-            uint64_t entropy)
+            uint64_t entropy,
+            struct DedupTable *dedup)
 {
     ipaddress ip_them = parsed->src_ip;
     unsigned port_them = parsed->port_src;
@@ -155,6 +158,13 @@ handle_sctp(struct Output *out, time_t timestamp,
     if (offset + 16 > length)
         return;
 
+    /* Only the first INIT-ACK or ABORT, since retransmits are common */
+    if (px[offset + 12] == 2 || px[offset + 12] == 6) {
+        if (dedup && dedup_is_duplicate(dedup, ip_them, port_them | Templ_SCTP,
+                                        parsed->dst_ip, parsed->port_dst))
+            return;
+    }
+
     switch (px[offset + 12]) {
     case 2: /* init ACK */
         output_report_status(
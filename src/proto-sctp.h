@@ -5,6 +5,7 @@
 
 struct PreprocessedInfo;
 struct Output;
+struct DedupTable;
 
 /**
  * Calculate the "CRC32c" checksum used in SCTP. This is a non-destructive
@@ -15,13 +16,17 @@ sctp_checksum(const void *vbuffer, size_t length);
 
 /**
  * Handle incoming SCTP response
+ * @param dedup
+ *      So that a port is reported only once when the response is
+ *      repeated. May be NULL.
  */
 void
 handle_sctp(struct Output *out, time_t timestamp,
             const unsigned char *px, unsigned length,
             unsigned cookie,
             struct PreprocessedInfo *parsed,
-            uint64_t entropy);
+            uint64_t entropy,
+            struct DedupTable *dedup);
 
 int
 sctp_selftest(void);
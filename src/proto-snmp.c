@@ -471,6 +471,53 @@ snmp_set_cookie(unsigned char *px, size_t length, uint64_t seqno)
     return 0;
 }
 
+/****************************************************************************
+ * The reverse of snmp_set_cookie(), for checking a response before we
+ * report it. Responses are re-encoded by the agent, so the request-id
+ * can be a different number of bytes than what we sent.
+ * @return 1 if a request-id was found, 0 if this isn't SNMP
+ ****************************************************************************/
+unsigned
+snmp_get_cookie(const unsigned char *px, size_t length, uint64_t *r_cookie)
+{
+    uint64_t offset=0;
+    uint64_t outer_length;
+    uint64_t tag;
+
+    /* tag */
+    if (asn1_tag(px, length, &offset) != 0x30)
+        return 0;
+
+    /* length */
+    outer_length = asn1_length(px, length, &offset);
+    if (length > outer_length + offset)
+        length = (size_t)(outer_length + offset);
+
+    /* Version */
+    if (offset >= length)
+        return 0;
+    asn1_integer(px, length, &offset);
+
+    /* Community */
+    if (asn1_tag(px, length, &offset) != 0x04)
+        return 0;
+    offset += asn1_length(px, length, &offset);
+
+    /* PDU */
+    tag = asn1_tag(px, length, &offset);
+    if (tag < 0xA0 || 0xA8 < tag)
+        return 0;
+    outer_length = asn1_length(px, length, &offset);
+    if (length > outer_length + offset)
+        length = (size_t)(outer_length + offset);
+
+    /* Request ID */
+    if (offset >= length)
+        return 0;
+    *r_cookie = asn1_integer(px, length, &offset);
+    return offset < length;
+}
+
 #define TWO_BYTE       ((unsigned long long)(~0)<<7)
 #define THREE_BYTE     ((unsigned long long)(~0)<<14)
 #define FOUR_BYTE      ((unsigned long long)(~0)<<21)
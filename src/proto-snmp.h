@@ -19,6 +19,13 @@ int snmp_selftest(void);
 
 unsigned snmp_set_cookie(unsigned char *px, size_t length, uint64_t seqno);
 
+/**
+ * Extracts the request-id from an SNMP message, which is where
+ * snmp_set_cookie() put the cookie.
+ * @return 1 if found, 0 if this doesn't look like SNMP
+ */
+unsigned snmp_get_cookie(const unsigned char *px, size_t length, uint64_t *r_cookie);
+
 unsigned
 handle_snmp(struct Output *out, time_t timestamp,
             const unsigned char *px, unsigned length,
@@ -1433,7 +1433,8 @@ ssl_selftest(void)
  * the main system.
  *****************************************************************************/
 struct ProtocolParserStream banner_ssl_12 = {
-    "ssl", 443, ssl_12_hello_template, sizeof(ssl_12_hello_template)-1, 0,
+    "ssl", 443, ssl_12_hello_template, sizeof(ssl_12_hello_template)-1,
+    SF__nowait_hello, /* the client always speaks first */
     ssl_selftest,
     ssl_init,
     ssl_parse_record,
@@ -1441,7 +1442,8 @@ struct ProtocolParserStream banner_ssl_12 = {
 
 struct ProtocolParserStream banner_ssl = {
     "ssl", 443, ssl_hello_template, sizeof(ssl_hello_template)-1,
-    SF__close, /* send FIN after the hello */
+    SF__close|SF__nowait_hello, /* send FIN after the hello, which is sent
+                                 * right away, since the client speaks first */
     ssl_selftest,
     ssl_init,
     ssl_parse_record,
@@ -8,11 +8,48 @@
 #include "proto-ntp.h"
 #include "proto-zeroaccess.h"
 #include "proto-preprocess.h"
+#include "proto-banout.h"
+#include "templ-payloads.h"
 #include "syn-cookie.h"
+#include "main-dedup.h"
+#include "massip-port.h"
+#include "masscan.h"
 #include "util-logger.h"
+#include "util-malloc.h"
 #include "output.h"
 #include "masscan-status.h"
 #include "unusedparm.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of responses we can be collecting at the same time. When two
+ * collide in the table, the older one is written out early.
+ */
+#define UDPAGG_ENTRIES 4096
+
+/**
+ * A response is done once no more packets for it have arrived for
+ * this many seconds.
+ */
+#define UDPAGG_QUIET 2
+
+struct UdpAggregateEntry {
+    ipaddress ip_them;
+    unsigned port_them;
+    unsigned ttl;
+    unsigned packets;
+    time_t first;
+    time_t last;
+    unsigned is_used:1;
+    struct BannerOutput banout;
+};
+
+struct UdpAggregate {
+    time_t last_flush;
+    uint64_t count_merged;
+    struct UdpAggregateEntry entries[UDPAGG_ENTRIES];
+};
 
 
 /****************************************************************************
@@ -49,19 +86,236 @@ default_udp_parse(struct Output *out, time_t timestamp,
     return 0;
 }
 
+/****************************************************************************
+ * Checks the cookie in a response, which the server copied from our
+ * request. Where it is depends on which set_cookie() function filled
+ * in the request. Protocols without one have nothing to check.
+ * @return 1 if valid, or if there's no cookie, 0 if it doesn't match
+ ****************************************************************************/
+unsigned
+udp_cookie_is_valid(SET_COOKIE set_cookie,
+                    const unsigned char *px, unsigned length,
+                    uint64_t cookie)
+{
+    uint64_t resp_cookie;
+    unsigned i;
+
+    if (set_cookie == dns_set_cookie || set_cookie == memcached_udp_set_cookie) {
+        /* DNS, NetBIOS, and RPC "xid", or memcached "request id" */
+        if (length < 2)
+            return 0;
+        return (unsigned)(px[0]<<8 | px[1]) == (cookie & 0xFFFF);
+    } else if (set_cookie == coap_udp_set_cookie) {
+        /* CoAP "message id" */
+        if (length < 4)
+            return 0;
+        return (unsigned)(px[2]<<8 | px[3]) == (cookie & 0xFFFF);
+    } else if (set_cookie == isakmp_set_cookie) {
+        /* ISAKMP initiator cookie */
+        if (length < 8)
+            return 0;
+        resp_cookie = 0;
+        for (i=0; i<8; i++)
+            resp_cookie = resp_cookie<<8 | px[i];
+        return resp_cookie == (cookie & 0xFFFFFFFF);
+    } else if (set_cookie == snmp_set_cookie) {
+        /* SNMP "request id" */
+        if (!snmp_get_cookie(px, length, &resp_cookie))
+            return 0;
+        return resp_cookie == (cookie & 0x7FFFFFFF);
+    }
+    return 1;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+unsigned
+udp_cookie_is_checked(SET_COOKIE set_cookie)
+{
+    return set_cookie == dns_set_cookie
+        || set_cookie == memcached_udp_set_cookie
+        || set_cookie == coap_udp_set_cookie
+        || set_cookie == isakmp_set_cookie
+        || set_cookie == snmp_set_cookie;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static unsigned
+udp_cookie_check(struct Output *out,
+                 const unsigned char *px,
+                 struct PreprocessedInfo *parsed,
+                 uint64_t entropy)
+{
+    const unsigned char *px2;
+    unsigned length2;
+    unsigned source_port2;
+    uint64_t xsum2;
+    SET_COOKIE set_cookie = 0;
+    uint64_t cookie;
+
+    if (out->masscan == NULL)
+        return 1;
+    if (!payloads_udp_lookup(out->masscan->payloads.udp, parsed->port_src,
+                        &px2, &length2, &source_port2, &xsum2, &set_cookie))
+        return 1;
+    if (set_cookie == NULL)
+        return 1;
+
+    cookie = syn_cookie(parsed->src_ip, parsed->port_src | Templ_UDP,
+                        parsed->dst_ip, parsed->port_dst, entropy);
+    return udp_cookie_is_valid(set_cookie,
+                            px + parsed->app_offset, parsed->app_length,
+                            (unsigned)cookie);
+}
+
+/****************************************************************************
+ ****************************************************************************/
+struct UdpAggregate *
+udpagg_create(void)
+{
+    struct UdpAggregate *agg;
+    size_t i;
+
+    agg = CALLOC(1, sizeof(*agg));
+    for (i=0; i<UDPAGG_ENTRIES; i++)
+        banout_init(&agg->entries[i].banout);
+    return agg;
+}
+
+/****************************************************************************
+ * Write out everything collected for one response, as one banner record
+ * for each protocol.
+ ****************************************************************************/
+static void
+udpagg_emit(struct UdpAggregate *agg, struct Output *out,
+            struct UdpAggregateEntry *entry)
+{
+    struct BannerOutput *banout;
+
+    for (banout = &entry->banout; banout != NULL; banout = banout->next) {
+        if (banout->length == 0)
+            continue;
+        output_report_banner(out, entry->first,
+                             entry->ip_them, 17, entry->port_them,
+                             banout->protocol & 0x0FFFFFFF,
+                             entry->ttl,
+                             banout->banner, banout->length);
+    }
+    if (entry->packets > 1)
+        agg->count_merged += entry->packets - 1;
+
+    banout_release(&entry->banout);
+    entry->is_used = 0;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+static struct UdpAggregateEntry *
+udpagg_lookup(struct UdpAggregate *agg, struct Output *out,
+              ipaddress ip_them, unsigned port_them,
+              unsigned ttl, time_t now)
+{
+    struct UdpAggregateEntry *entry;
+    unsigned hash;
+
+    if (ip_them.version == 6)
+        hash = (unsigned)(ip_them.ipv6.hi ^ ip_them.ipv6.hi>>32
+                          ^ ip_them.ipv6.lo ^ ip_them.ipv6.lo>>32);
+    else
+        hash = ip_them.ipv4;
+    hash = (hash ^ hash>>16) * 0x45d9f3b;
+    hash ^= port_them * 0x9E3779B1;
+    hash ^= hash>>16;
+    entry = &agg->entries[hash & (UDPAGG_ENTRIES-1)];
+
+    if (entry->is_used) {
+        if (entry->port_them == port_them
+            && ipaddress_is_equal(entry->ip_them, ip_them))
+            return entry;
+
+        /* Collision, so this one is finished early */
+        udpagg_emit(agg, out, entry);
+    }
+
+    entry->is_used = 1;
+    entry->ip_them = ip_them;
+    entry->port_them = port_them;
+    entry->ttl = ttl;
+    entry->packets = 0;
+    entry->first = now;
+    entry->last = now;
+    return entry;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+void
+udpagg_flush(struct UdpAggregate *agg, struct Output *out, time_t now)
+{
+    size_t i;
+
+    if (agg == NULL || agg->last_flush == now)
+        return;
+    agg->last_flush = now;
+
+    for (i=0; i<UDPAGG_ENTRIES; i++) {
+        struct UdpAggregateEntry *entry = &agg->entries[i];
+        if (entry->is_used && entry->last + UDPAGG_QUIET <= now)
+            udpagg_emit(agg, out, entry);
+    }
+}
+
+/****************************************************************************
+ ****************************************************************************/
+void
+udpagg_destroy(struct UdpAggregate *agg, struct Output *out)
+{
+    size_t i;
+
+    if (agg == NULL)
+        return;
+
+    for (i=0; i<UDPAGG_ENTRIES; i++) {
+        if (agg->entries[i].is_used)
+            udpagg_emit(agg, out, &agg->entries[i]);
+    }
+    LOG(2, "[+] udp: %llu extra packets merged into earlier responses\n",
+        (unsigned long long)agg->count_merged);
+    free(agg);
+}
+
 /****************************************************************************
  ****************************************************************************/
 void 
 handle_udp(struct Output *out, time_t timestamp,
         const unsigned char *px, unsigned length, 
-        struct PreprocessedInfo *parsed, uint64_t entropy)
+        struct PreprocessedInfo *parsed, uint64_t entropy,
+        struct DedupTable *dedup, struct UdpAggregate *agg)
 {
     ipaddress ip_them = parsed->src_ip;
     unsigned port_them = parsed->port_src;
     unsigned status = 0;
+    unsigned is_duplicate = 0;
+    struct UdpAggregateEntry *entry = NULL;
+
+    /* Ignore responses that don't carry the cookie from our request.
+     * These are to somebody else's probes, or spoofed */
+    if (!udp_cookie_check(out, px, parsed, entropy)) {
+        ipaddress_formatted_t fmt = ipaddress_fmt(ip_them);
+        LOG(2, "%s:%u - bad cookie\n", fmt.string, port_them);
+        return;
+    }
 
-    /* Report "open" status regardless  */
-    output_report_status(
+    /* Amplifiers (DNS, NTP, memcached, SSDP) often send many packets
+     * in response to one probe, but we report "open" only once */
+    if (dedup)
+        is_duplicate = dedup_is_duplicate(dedup,
+                                ip_them, port_them | Templ_UDP,
+                                parsed->dst_ip, parsed->port_dst);
+
+    if (!is_duplicate) {
+        output_report_status(
                              out,
                              timestamp,
                              PortStatus_Open,
@@ -71,7 +325,20 @@ handle_udp(struct Output *out, time_t timestamp,
                              0,
                              parsed->ip_ttl,
                              parsed->mac_src);
+    } else if (!out->is_banner || agg == NULL) {
+        /* With nothing to add to, the rest would just be repeated */
+        return;
+    }
 
+    /* Banners from all the packets of a response are collected and
+     * written out together once they stop arriving */
+    if (agg && out->is_banner) {
+        entry = udpagg_lookup(agg, out, ip_them, port_them,
+                              parsed->ip_ttl, timestamp);
+        entry->packets++;
+        entry->last = timestamp;
+        out->banner_capture = &entry->banout;
+    }
 
     switch (port_them) {
         case 53: /* DNS - Domain Name System (amplifier) */
@@ -129,4 +396,84 @@ handle_udp(struct Output *out, time_t timestamp,
                     px + parsed->app_offset,
                     parsed->app_length);
     }
+
+    out->banner_capture = NULL;
+}
+
+/****************************************************************************
+ ****************************************************************************/
+int
+udp_selftest(void)
+{
+    static const unsigned char snmp_request[] =
+        "\x30\x26"
+        "\x02\x01\x00"
+        "\x04\x06" "public"
+        "\xa0\x19"
+        "\x02\x04\x00\x00\x00\x00"
+        "\x02\x01\x00"
+        "\x02\x01\x00"
+        "\x30\x0b"
+        "\x30\x09"
+        "\x06\x05\x2b\x06\x01\x02\x01"
+        "\x05\x00";
+    static const unsigned char snmp_response[] =
+        "\x30\x24"
+        "\x02\x01\x00"
+        "\x04\x06" "public"
+        "\xa2\x17"
+        "\x02\x02\x12\x34"  /* re-encoded in fewer bytes */
+        "\x02\x01\x00"
+        "\x02\x01\x00"
+        "\x30\x0b"
+        "\x30\x09"
+        "\x06\x05\x2b\x06\x01\x02\x01"
+        "\x05\x00";
+    static const struct {
+        SET_COOKIE set_cookie;
+        size_t length;
+    } tests[] = {
+        {dns_set_cookie, 12},
+        {memcached_udp_set_cookie, 8},
+        {coap_udp_set_cookie, 8},
+        {isakmp_set_cookie, 28},
+        {snmp_set_cookie, sizeof(snmp_request)-1},
+        {0,0}
+    };
+    unsigned char buf[64];
+    uint64_t cookie = 0x81234567;
+    size_t i;
+
+    /* What set_cookie() puts in the request, we should find in a reply
+     * that echoes it, but not a different cookie */
+    for (i=0; tests[i].set_cookie; i++) {
+        memset(buf, 0, sizeof(buf));
+        if (tests[i].set_cookie == snmp_set_cookie)
+            memcpy(buf, snmp_request, tests[i].length);
+        tests[i].set_cookie(buf, tests[i].length, cookie);
+        if (!udp_cookie_is_valid(tests[i].set_cookie, buf, (unsigned)tests[i].length, cookie))
+            goto fail;
+        if (udp_cookie_is_valid(tests[i].set_cookie, buf, (unsigned)tests[i].length, cookie ^ 0x100))
+            goto fail;
+        /* truncated */
+        if (udp_cookie_is_valid(tests[i].set_cookie, buf, 1, cookie))
+            goto fail;
+    }
+
+    /* SNMP agents encode the request-id however they like */
+    if (!udp_cookie_is_valid(snmp_set_cookie, snmp_response, sizeof(snmp_response)-1, 0x1234))
+        goto fail;
+    if (udp_cookie_is_valid(snmp_set_cookie, snmp_response, sizeof(snmp_response)-1, 0x1235))
+        goto fail;
+
+    /* Protocols without cookies are always accepted */
+    if (!udp_cookie_is_valid(ntp_set_cookie, buf, 0, cookie))
+        goto fail;
+    if (!udp_cookie_is_valid(NULL, buf, 0, cookie))
+        goto fail;
+
+    return 0;
+fail:
+    fprintf(stderr, "[-] udp: cookie selftest failed, test #%u\n", (unsigned)i);
+    return 1;
 }
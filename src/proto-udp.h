@@ -2,20 +2,71 @@
 #define PROTO_UDP_H
 #include <time.h>
 #include <stdint.h>
+#include "templ-payloads.h"
 struct PreprocessedInfo;
 struct Output;
+struct DedupTable;
+struct UdpAggregate;
 
 /**
  * Parse an incoming UDP response. We parse the basics, then hand it off
  * to a protocol parser (SNMP, NetBIOS, NTP, etc.)
  * @param entropy
  *      The random seed, used in calculating syn-cookies.
+ * @param dedup
+ *      So that a response of several packets is reported "open" only
+ *      once. May be NULL.
+ * @param agg
+ *      Where banners are collected from all the packets of a response,
+ *      or NULL to report each packet's banner separately.
  */
 void 
 handle_udp(struct Output *out, time_t timestamp,
     const unsigned char *px, unsigned length,
     struct PreprocessedInfo *parsed,
-    uint64_t entropy);
+    uint64_t entropy,
+    struct DedupTable *dedup,
+    struct UdpAggregate *agg);
+
+/**
+ * Checks that a response carries the cookie that 'set_cookie' put into
+ * our request.
+ * @return 1 if it does, or the protocol has no cookie, 0 otherwise
+ */
+unsigned
+udp_cookie_is_valid(SET_COOKIE set_cookie,
+                    const unsigned char *px, unsigned length,
+                    uint64_t cookie);
+
+/**
+ * Whether udp_cookie_is_valid() knows where replies of this protocol
+ * carry the cookie, so that it actually checks something.
+ */
+unsigned
+udp_cookie_is_checked(SET_COOKIE set_cookie);
+
+/**
+ * Per receive-thread table of the UDP responses that are still arriving,
+ * so that all their packets are reported as a single banner.
+ */
+struct UdpAggregate *
+udpagg_create(void);
+
+/**
+ * Writes out the responses that have gone quiet. Call this regularly,
+ * it only does any work once per second.
+ */
+void
+udpagg_flush(struct UdpAggregate *agg, struct Output *out, time_t now);
+
+/**
+ * Writes out everything remaining, then frees the table.
+ */
+void
+udpagg_destroy(struct UdpAggregate *agg, struct Output *out);
+
+int
+udp_selftest(void);
 
 /**
  * Default banner for UDP, consisting of the first 64 bytes, when it isn't
@@ -6,11 +6,14 @@ struct Adapter
     struct pcap *pcap;
     struct pcap_send_queue *sendq;
     struct __pfring *ring;
+    struct XdpSocket *xdp;
+    struct VnetSocket *vnet; /* transmit with checksum offload */
     unsigned is_packet_trace:1; /* is --packet-trace option set? */
     unsigned is_vlan:1;
     unsigned vlan_id;
     double pt_start;
     int link_type;
+    char ifname[256]; /* name this was opened with, for opening siblings */
 };
 
 
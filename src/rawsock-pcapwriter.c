@@ -0,0 +1,439 @@
+/*
+    Asynchronous --pcap writer
+
+    See rawsock-pcapwriter.h. The ring has one producer (the receive
+    thread) and one consumer (our writer thread), so all that's needed
+    between them is a pair of counters and memory barriers: the producer
+    only moves 'tail', and the consumer only moves 'head'.
+
+    Records are never split across the end of the ring, so that the
+    writer can hand whole runs of them to fwrite() as they are. When a
+    record doesn't fit in what's left before the end, the producer skips
+    to the start, leaving padding the writer knows to skip. If there's
+    room, the padding starts with a record header whose length is
+    PCAPWRITER_PAD, otherwise it's too short to hold a header at all.
+*/
+#include "rawsock-pcapwriter.h"
+#include "output.h"
+#include "pixie-threads.h"
+#include "pixie-timer.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(rte_wmb)
+#include <intrin.h>
+#define rte_wmb() _WriteBarrier()
+#define rte_rmb() _ReadBarrier()
+#endif
+
+/** Size of the ring, which should hold a few seconds' worth of frames
+ * at a high rate, must be a power of 2 */
+#define PCAPWRITER_RING (16*1024*1024)
+
+/** Marks the padding at the end of the ring */
+#define PCAPWRITER_PAD 0xFFFFFFFF
+
+struct PcapWriter {
+    unsigned char *ring;
+    size_t ring_size;
+    volatile uint64_t head;
+    volatile uint64_t tail;
+    volatile unsigned is_done;
+
+    unsigned snaplen;
+    unsigned linktype;
+    uint64_t rotate_bytes;
+
+    char *filename;
+    FILE *fp;
+    uint64_t file_bytes;
+    unsigned file_index;
+
+    struct PcapWriterStats *stats;
+    struct PcapWriterStats stats_private;
+    size_t thread_handle;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+put32le(unsigned char *p, unsigned x)
+{
+    p[0] = (unsigned char)(x>> 0);
+    p[1] = (unsigned char)(x>> 8);
+    p[2] = (unsigned char)(x>>16);
+    p[3] = (unsigned char)(x>>24);
+}
+
+static unsigned
+get32le(const unsigned char *p)
+{
+    return p[0] | p[1]<<8 | p[2]<<16 | (unsigned)p[3]<<24;
+}
+
+/***************************************************************************
+ * Writes the 24-byte file header.
+ ***************************************************************************/
+static int
+pcapwriter_header(struct PcapWriter *writer)
+{
+    unsigned char buf[24];
+
+    put32le(buf+0, 0xa1b2c3d4);
+    buf[4] = 2; buf[5] = 0;
+    buf[6] = 4; buf[7] = 0;
+    put32le(buf+8, 0);
+    put32le(buf+12, 0);
+    put32le(buf+16, writer->snaplen?writer->snaplen:65535);
+    put32le(buf+20, writer->linktype);
+
+    if (fwrite(buf, 1, sizeof(buf), writer->fp) != sizeof(buf))
+        return -1;
+    writer->file_bytes = sizeof(buf);
+    return 0;
+}
+
+/***************************************************************************
+ * Opens the next file, the first having the name we were given, and the
+ * rest numbered.
+ ***************************************************************************/
+static int
+pcapwriter_open(struct PcapWriter *writer)
+{
+    char *filename;
+
+    if (writer->file_index == 0)
+        filename = STRDUP(writer->filename);
+    else
+        filename = output_indexed_filename(writer->filename, writer->file_index);
+    writer->file_index++;
+
+    writer->fp = fopen(filename, "wb");
+    if (writer->fp == NULL) {
+        LOG(0, "[-] FAIL: could not open capture file: %s\n", filename);
+        perror(filename);
+        free(filename);
+        return -1;
+    }
+    setvbuf(writer->fp, NULL, _IOFBF, 1024*1024);
+    if (pcapwriter_header(writer) != 0) {
+        LOG(0, "[-] FAIL: could not write capture file: %s\n", filename);
+        fclose(writer->fp);
+        writer->fp = NULL;
+        free(filename);
+        return -1;
+    }
+
+    writer->stats->files++;
+    LOG(2, "[+] pcap: writing %s\n", filename);
+    free(filename);
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pcapwriter_frame(struct PcapWriter *writer,
+                 const unsigned char *px, unsigned length,
+                 unsigned secs, unsigned usecs)
+{
+    uint64_t head;
+    uint64_t tail = writer->tail;
+    size_t offset = (size_t)(tail & (writer->ring_size - 1));
+    size_t room = writer->ring_size - offset;
+    unsigned caplen = length;
+    size_t need;
+    size_t pad = 0;
+
+    if (writer->snaplen && caplen > writer->snaplen)
+        caplen = writer->snaplen;
+    need = 16 + caplen;
+    if (need > room)
+        pad = room;
+
+    head = writer->head;
+    rte_rmb();
+    if (tail + pad + need - head > writer->ring_size) {
+        writer->stats->dropped++;
+        return;
+    }
+
+    if (pad) {
+        if (pad >= 16)
+            put32le(writer->ring + offset + 8, PCAPWRITER_PAD);
+        offset = 0;
+    }
+
+    put32le(writer->ring + offset + 0, secs);
+    put32le(writer->ring + offset + 4, usecs);
+    put32le(writer->ring + offset + 8, caplen);
+    put32le(writer->ring + offset + 12, length);
+    memcpy(writer->ring + offset + 16, px, caplen);
+
+    /* The record must be in memory before the writer sees it */
+    rte_wmb();
+    writer->tail = tail + pad + need;
+    writer->stats->frames++;
+}
+
+/***************************************************************************
+ * Writes out whatever is in the ring, up to the end of the ring, or up
+ * to where a file has to be rotated.
+ * @return
+ *      the number of bytes taken from the ring, or 0 if it was empty
+ ***************************************************************************/
+static size_t
+pcapwriter_drain(struct PcapWriter *writer)
+{
+    uint64_t tail;
+    uint64_t head;
+    size_t offset;
+    size_t span = 0;
+    int is_rotate = 0;
+
+    tail = writer->tail;
+    rte_rmb();
+    head = writer->head;
+    if (head == tail)
+        return 0;
+
+    /* If we couldn't open or write the file, the capture has stopped, so
+     * throw the records away to keep the receive thread going */
+    if (writer->fp == NULL) {
+        rte_wmb();
+        writer->head = tail;
+        return 0;
+    }
+    offset = (size_t)(head & (writer->ring_size - 1));
+
+    /* Find the run of whole records that we can write together */
+    while (head + span < tail) {
+        size_t at = offset + span;
+        size_t room = writer->ring_size - at;
+        unsigned caplen;
+
+        if (room < 16)
+            break;
+        caplen = get32le(writer->ring + at + 8);
+        if (caplen == PCAPWRITER_PAD)
+            break;
+        if (writer->rotate_bytes
+            && writer->file_bytes + span + 16 + caplen > writer->rotate_bytes
+            && writer->file_bytes + span > 24) {
+            is_rotate = 1;
+            break;
+        }
+        span += 16 + caplen;
+    }
+
+    /* At the padding at the end of the ring, so start over at the start */
+    if (span == 0 && !is_rotate) {
+        rte_wmb();
+        writer->head = head + (writer->ring_size - offset);
+        return writer->ring_size - offset;
+    }
+
+    if (span && writer->fp) {
+        if (fwrite(writer->ring + offset, 1, span, writer->fp) != span) {
+            LOG(0, "[-] FAIL: could not write capture file: %s\n", writer->filename);
+            perror(writer->filename);
+            fclose(writer->fp);
+            writer->fp = NULL;
+            writer->file_bytes = 0;
+        } else {
+            writer->file_bytes += span;
+            writer->stats->bytes += span;
+        }
+    }
+
+    /* We're done reading those bytes before the receive thread gets them */
+    rte_wmb();
+    writer->head = head + span;
+
+    if (is_rotate && writer->fp) {
+        fclose(writer->fp);
+        writer->fp = NULL;
+        writer->file_bytes = 0;
+        if (pcapwriter_open(writer) != 0)
+            LOG(0, "[-] pcap: capture stopped\n");
+    }
+    return span?span:1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+pcapwriter_thread(void *v)
+{
+    struct PcapWriter *writer = (struct PcapWriter *)v;
+
+    for (;;) {
+        unsigned is_done = writer->is_done;
+
+        if (pcapwriter_drain(writer))
+            continue;
+        if (is_done)
+            break;
+        pixie_usleep(1000);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static struct PcapWriter *
+pcapwriter_alloc(size_t ring_size, unsigned linktype, unsigned snaplen,
+                 uint64_t rotate_bytes, struct PcapWriterStats *stats)
+{
+    struct PcapWriter *writer;
+
+    writer = CALLOC(1, sizeof(*writer));
+    writer->ring_size = ring_size;
+    writer->ring = MALLOC(ring_size);
+    writer->linktype = linktype;
+    writer->snaplen = snaplen;
+    writer->rotate_bytes = rotate_bytes;
+    writer->stats = stats?stats:&writer->stats_private;
+    return writer;
+}
+
+static void
+pcapwriter_free(struct PcapWriter *writer)
+{
+    if (writer->fp)
+        fclose(writer->fp);
+    free(writer->filename);
+    free(writer->ring);
+    free(writer);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct PcapWriter *
+pcapwriter_create(const char *filename, unsigned linktype,
+                  unsigned snaplen, uint64_t rotate_bytes,
+                  struct PcapWriterStats *stats)
+{
+    struct PcapWriter *writer;
+
+    writer = pcapwriter_alloc(PCAPWRITER_RING, linktype, snaplen,
+                              rotate_bytes, stats);
+    writer->filename = STRDUP(filename);
+    if (pcapwriter_open(writer) != 0) {
+        pcapwriter_free(writer);
+        return NULL;
+    }
+
+    writer->thread_handle = pixie_begin_thread(pcapwriter_thread, 0, writer);
+    return writer;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+pcapwriter_destroy(struct PcapWriter *writer)
+{
+    if (writer == NULL)
+        return;
+
+    writer->is_done = 1;
+    pixie_thread_join(writer->thread_handle);
+
+    if (writer->stats->dropped)
+        LOG(0, "[-] pcap: %llu of %llu frames dropped, disk too slow\n",
+            (unsigned long long)writer->stats->dropped,
+            (unsigned long long)(writer->stats->frames + writer->stats->dropped));
+    pcapwriter_free(writer);
+}
+
+/***************************************************************************
+ * Runs frames of many sizes through a tiny ring, so that it wraps a lot,
+ * then reads back what was written to check they're all there, in order.
+ ***************************************************************************/
+int
+pcapwriter_selftest(void)
+{
+    struct PcapWriter *writer;
+    unsigned char px[100];
+    unsigned char buf[16 + 100];
+    unsigned written[200];
+    unsigned count = 0;
+    unsigned i;
+    unsigned j;
+
+    writer = pcapwriter_alloc(256, 1, 64, 0, NULL);
+    writer->fp = tmpfile();
+    if (writer->fp == NULL) {
+        /* can't test here */
+        pcapwriter_free(writer);
+        return 0;
+    }
+    if (pcapwriter_header(writer) != 0)
+        goto fail;
+
+    for (i=0; i<200; i++) {
+        uint64_t dropped = writer->stats->dropped;
+        unsigned length = 1 + (i * 37) % 100;
+
+        memset(px, (unsigned char)i, sizeof(px));
+        pcapwriter_frame(writer, px, length, i, i * 2);
+        if (writer->stats->dropped == dropped)
+            written[count++] = i;
+
+        /* Let the ring fill up now and then */
+        if (i % 7 == 0) {
+            while (pcapwriter_drain(writer))
+                ;
+        }
+    }
+    while (pcapwriter_drain(writer))
+        ;
+    if (writer->stats->dropped == 0 || count + writer->stats->dropped != 200)
+        goto fail;
+
+    /* Read back the records */
+    rewind(writer->fp);
+    if (fread(buf, 1, 24, writer->fp) != 24 || get32le(buf) != 0xa1b2c3d4
+        || get32le(buf+16) != 64)
+        goto fail;
+    for (j=0; j<count; j++) {
+        unsigned n = written[j];
+        unsigned length = 1 + (n * 37) % 100;
+        unsigned caplen = length > 64 ? 64 : length;
+        unsigned k;
+
+        if (fread(buf, 1, 16, writer->fp) != 16)
+            goto fail;
+        if (get32le(buf) != n || get32le(buf+4) != n * 2
+            || get32le(buf+8) != caplen || get32le(buf+12) != length)
+            goto fail;
+        if (fread(buf, 1, caplen, writer->fp) != caplen)
+            goto fail;
+        for (k=0; k<caplen; k++) {
+            if (buf[k] != (unsigned char)n)
+                goto fail;
+        }
+    }
+    if (fread(buf, 1, 1, writer->fp) != 0)
+        goto fail;
+
+    /* Once the file is gone, such as when the next --pcap-rotate file
+     * couldn't be opened, records are thrown away rather than stuck */
+    fclose(writer->fp);
+    writer->fp = NULL;
+    writer->rotate_bytes = 100;
+    for (i=0; i<10; i++)
+        pcapwriter_frame(writer, px, 20, i, 0);
+    for (j=0; j<10 && pcapwriter_drain(writer); j++)
+        ;
+    if (j >= 10 || writer->head != writer->tail)
+        goto fail;
+
+    pcapwriter_free(writer);
+    return 0;
+fail:
+    fprintf(stderr, "[-] pcapwriter: selftest failed\n");
+    pcapwriter_free(writer);
+    return 1;
+}
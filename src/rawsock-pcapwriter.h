@@ -0,0 +1,68 @@
+/*
+    Asynchronous --pcap writer
+
+    Saving received packets with pcapfile_writeframe() means a couple of
+    fwrite() calls for every packet on the receive thread, so whenever
+    the disk is slow, so is reception. Instead, the receive thread copies
+    each frame, already formatted as a pcap record, into a large ring
+    buffer, and a thread of our own writes out as much of the ring as is
+    ready in one go.
+
+    If the ring fills up because the disk can't keep up, frames are
+    dropped and counted, rather than making the receive thread wait.
+*/
+#ifndef RAWSOCK_PCAPWRITER_H
+#define RAWSOCK_PCAPWRITER_H
+#include <stdint.h>
+#include <stdio.h>
+
+struct PcapWriter;
+
+/**
+ * Counts kept by the writer, which the status thread may read while
+ * it's running.
+ */
+struct PcapWriterStats {
+    uint64_t frames;    /* frames put into the ring */
+    uint64_t dropped;   /* frames lost because the ring was full */
+    uint64_t bytes;     /* bytes written to files */
+    unsigned files;     /* files opened, more than one when rotating */
+};
+
+/**
+ * Opens the file and starts the writer thread.
+ * @param snaplen
+ *      The most bytes saved from each frame, or 0 for all of them.
+ * @param rotate_bytes
+ *      When a file would grow past this size, it's closed and the next
+ *      one opened, named like "foo.01.pcap", "foo.02.pcap", and so on.
+ *      Zero means one file of any size.
+ * @param stats
+ *      Where to count things, may be NULL.
+ * @return
+ *      the writer, or NULL if the file couldn't be created
+ */
+struct PcapWriter *
+pcapwriter_create(const char *filename, unsigned linktype,
+                  unsigned snaplen, uint64_t rotate_bytes,
+                  struct PcapWriterStats *stats);
+
+/**
+ * Queues a frame to be written. This is called from one thread only,
+ * the receive thread, and never blocks.
+ */
+void
+pcapwriter_frame(struct PcapWriter *writer,
+                 const unsigned char *px, unsigned length,
+                 unsigned secs, unsigned usecs);
+
+/**
+ * Writes what's left in the ring, stops the thread, and closes the file.
+ */
+void
+pcapwriter_destroy(struct PcapWriter *writer);
+
+int
+pcapwriter_selftest(void);
+
+#endif
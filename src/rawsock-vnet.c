@@ -0,0 +1,322 @@
+/*
+    AF_PACKET transmit with checksum offload (PACKET_VNET_HDR)
+
+    See rawsock-vnet.h for why. The header we prepend is the one used
+    between virtio-net guests and hosts, which the Linux packet socket
+    also understands. We only use its checksum fields:
+
+        flags       = VIRTIO_NET_HDR_F_NEEDS_CSUM
+        csum_start  = offset of the TCP/UDP header within the frame
+        csum_offset = offset of the checksum field within that header
+
+    The kernel then sums everything from 'csum_start' to the end of the
+    frame, including what's already in the checksum field (which is why
+    that has to be the pseudo-header sum), and stores the result.
+
+    To test without special hardware:
+
+        ip link add vnet0 type veth peer name vnet1
+        ip link set vnet0 up; ip link set vnet1 up
+        masscan --adapter vnet0 --adapter-offload ...
+*/
+#include "rawsock-vnet.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include "unusedparm.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define VNET_NEEDS_CSUM 1   /* VIRTIO_NET_HDR_F_NEEDS_CSUM */
+
+/***************************************************************************
+ ***************************************************************************/
+int
+vnet_header_fill(struct VnetHeader *hdr,
+                 const unsigned char *px, unsigned length)
+{
+    unsigned offset = 14;
+    unsigned ethertype;
+    unsigned ip_proto;
+    unsigned offset_l4;
+
+    memset(hdr, 0, sizeof(*hdr));
+
+    if (length < 14)
+        return 0;
+    ethertype = px[12]<<8 | px[13];
+    if (ethertype == 0x8100) {
+        if (length < 18)
+            return 0;
+        ethertype = px[16]<<8 | px[17];
+        offset = 18;
+    }
+
+    switch (ethertype) {
+    case 0x0800:
+        if (length < offset + 20 || (px[offset]>>4) != 4)
+            return 0;
+        /* Fragments don't have the whole TCP/UDP segment */
+        if (((px[offset+6]&0x3F) | px[offset+7]) != 0)
+            return 0;
+        ip_proto = px[offset+9];
+        offset_l4 = offset + (px[offset]&0xF) * 4;
+        break;
+    case 0x86dd:
+        /* No extension headers, since we never send them */
+        if (length < offset + 40 || (px[offset]>>4) != 6)
+            return 0;
+        ip_proto = px[offset+6];
+        offset_l4 = offset + 40;
+        break;
+    default:
+        return 0;
+    }
+
+    switch (ip_proto) {
+    case 6:
+        if (length < offset_l4 + 20)
+            return 0;
+        hdr->csum_offset = 16;
+        break;
+    case 17:
+        if (length < offset_l4 + 8)
+            return 0;
+        hdr->csum_offset = 6;
+        break;
+    default:
+        return 0;
+    }
+
+    hdr->flags = VNET_NEEDS_CSUM;
+    hdr->csum_start = (uint16_t)offset_l4;
+    return 1;
+}
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifndef PACKET_VNET_HDR
+#define PACKET_VNET_HDR 15
+#endif
+
+struct VnetSocket {
+    int fd;
+    int ifindex;
+    uint64_t count_offloaded;
+    uint64_t count_other;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+struct VnetSocket *
+vnetsock_create(const char *ifname)
+{
+    struct VnetSocket *vs;
+    struct sockaddr_ll sll;
+    int one = 1;
+    int fd;
+    int ifindex;
+
+    ifindex = (int)if_nametoindex(ifname);
+    if (ifindex == 0) {
+        LOG(1, "[-] if(%s): vnet: %s\n", ifname, strerror(errno));
+        return NULL;
+    }
+
+    /* Protocol 0 means the kernel doesn't give us any received packets */
+    fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) {
+        LOG(1, "[-] if(%s): vnet: socket: %s\n", ifname, strerror(errno));
+        return NULL;
+    }
+    if (setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof(one)) != 0) {
+        LOG(1, "[-] if(%s): vnet: PACKET_VNET_HDR: %s\n", ifname, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_ifindex = ifindex;
+    sll.sll_protocol = 0;
+    if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) != 0) {
+        LOG(1, "[-] if(%s): vnet: bind: %s\n", ifname, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    vs = CALLOC(1, sizeof(*vs));
+    vs->fd = fd;
+    vs->ifindex = ifindex;
+    LOG(1, "[+] if(%s): TCP/UDP checksums offloaded\n", ifname);
+    return vs;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+vnetsock_destroy(struct VnetSocket *vs)
+{
+    if (vs == NULL)
+        return;
+    LOG(2, "[+] vnet: %llu frames offloaded, %llu others\n",
+        (unsigned long long)vs->count_offloaded,
+        (unsigned long long)vs->count_other);
+    close(vs->fd);
+    free(vs);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+vnetsock_send(struct VnetSocket *vs,
+              const unsigned char *packet, unsigned length)
+{
+    struct VnetHeader hdr;
+    struct sockaddr_ll sll;
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t x;
+
+    if (vnet_header_fill(&hdr, packet, length))
+        vs->count_offloaded++;
+    else
+        vs->count_other++;
+
+    /* Telling the kernel the EtherType means it doesn't have to parse
+     * the frame to decide whether the NIC can do the checksum */
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_ifindex = vs->ifindex;
+    if (length >= 14)
+        sll.sll_protocol = htons((uint16_t)(packet[12]<<8 | packet[13]));
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *)packet;
+    iov[1].iov_len = length;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &sll;
+    msg.msg_namelen = sizeof(sll);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    /* Like libpcap, retry when the transmit queue is full rather than
+     * dropping the packet */
+    do {
+        x = sendmsg(vs->fd, &msg, 0);
+    } while (x < 0 && (errno == ENOBUFS || errno == EAGAIN || errno == EINTR));
+
+    if (x < 0) {
+        LOG(1, "[-] vnet: send: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+struct VnetSocket *
+vnetsock_create(const char *ifname)
+{
+    LOG(1, "[-] if(%s): checksum offload needs Linux\n", ifname);
+    return NULL;
+}
+
+void
+vnetsock_destroy(struct VnetSocket *vs)
+{
+    UNUSEDPARM(vs);
+}
+
+int
+vnetsock_send(struct VnetSocket *vs,
+              const unsigned char *packet, unsigned length)
+{
+    UNUSEDPARM(vs);
+    UNUSEDPARM(packet);
+    UNUSEDPARM(length);
+    return -1;
+}
+
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+int
+vnetsock_selftest(void)
+{
+    unsigned char px[128];
+    struct VnetHeader hdr;
+    int line = 0;
+
+    /* Ethernet + IPv4 + TCP */
+    memset(px, 0, sizeof(px));
+    px[12] = 0x08; px[13] = 0x00;
+    px[14] = 0x45;
+    px[14+9] = 6;
+    if (!vnet_header_fill(&hdr, px, 54)
+        || hdr.flags != VNET_NEEDS_CSUM || hdr.csum_start != 34 || hdr.csum_offset != 16) {
+        line = __LINE__;
+        goto fail;
+    }
+
+    /* ... truncated before the end of the TCP header */
+    if (vnet_header_fill(&hdr, px, 53) || hdr.flags != 0) {line = __LINE__; goto fail;}
+
+    /* ... with IP options */
+    px[14] = 0x46;
+    if (!vnet_header_fill(&hdr, px, 58) || hdr.csum_start != 38) {line = __LINE__; goto fail;}
+    px[14] = 0x45;
+
+    /* ... but not fragments */
+    px[14+6] = 0x20;
+    if (vnet_header_fill(&hdr, px, 54)) {line = __LINE__; goto fail;}
+    px[14+6] = 0x00;
+
+    /* ICMP goes as-is */
+    px[14+9] = 1;
+    if (vnet_header_fill(&hdr, px, 54)) {line = __LINE__; goto fail;}
+
+    /* VLAN + IPv4 + UDP */
+    memset(px, 0, sizeof(px));
+    px[12] = 0x81; px[13] = 0x00;
+    px[16] = 0x08; px[17] = 0x00;
+    px[18] = 0x45;
+    px[18+9] = 17;
+    if (!vnet_header_fill(&hdr, px, 46)
+        || hdr.csum_start != 38 || hdr.csum_offset != 6) {
+        line = __LINE__;
+        goto fail;
+    }
+
+    /* Ethernet + IPv6 + TCP */
+    memset(px, 0, sizeof(px));
+    px[12] = 0x86; px[13] = 0xdd;
+    px[14] = 0x60;
+    px[14+6] = 6;
+    if (!vnet_header_fill(&hdr, px, 74)
+        || hdr.csum_start != 54 || hdr.csum_offset != 16) {
+        line = __LINE__;
+        goto fail;
+    }
+
+    /* ARP goes as-is */
+    memset(px, 0, sizeof(px));
+    px[12] = 0x08; px[13] = 0x06;
+    if (vnet_header_fill(&hdr, px, 60)) {line = __LINE__; goto fail;}
+
+    return 0;
+fail:
+    fprintf(stderr, "[-] vnet: selftest failed, line %d\n", line);
+    return 1;
+}
@@ -0,0 +1,75 @@
+/*
+    AF_PACKET transmit with checksum offload (PACKET_VNET_HDR)
+
+    Normally we calculate every TCP and UDP checksum ourselves. That's
+    cheap for SYN probes, which are patched incrementally, but not for
+    UDP payloads or TCP segments carrying HTTP requests and TLS hellos,
+    which are summed in full for every packet.
+
+    On Linux, an AF_PACKET socket with PACKET_VNET_HDR set takes a small
+    "virtio-net" header in front of each frame. In that header we can say
+    "the checksum starts at this offset, and goes in that field", in which
+    case the kernel passes the job on to the NIC, or does it itself at
+    the last moment if the NIC can't. All we have to put in the field is
+    the sum of the pseudo-header.
+
+    We open a separate socket just for transmit, since the header would
+    also be added to received packets, which libpcap wouldn't expect. It
+    receives nothing itself.
+
+    Every TCP and UDP frame sent this way is marked for offload, so once
+    this is enabled, whatever builds those packets must leave the partial
+    checksum in them, see template_set_checksum_offload().
+*/
+#ifndef RAWSOCK_VNET_H
+#define RAWSOCK_VNET_H
+#include <stdint.h>
+struct VnetSocket;
+
+/**
+ * The header in front of each frame. This has the same layout as the
+ * kernel's "struct virtio_net_hdr", in host byte order.
+ */
+struct VnetHeader {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+};
+
+/**
+ * Opens a transmit-only AF_PACKET socket on the interface with
+ * PACKET_VNET_HDR enabled.
+ * @return NULL if unsupported, such as on other operating systems, older
+ *      kernels, or without the privileges, in which case the caller keeps
+ *      sending the normal way.
+ */
+struct VnetSocket *
+vnetsock_create(const char *ifname);
+
+void
+vnetsock_destroy(struct VnetSocket *vs);
+
+/**
+ * Sends a frame, asking for its TCP or UDP checksum to be filled in.
+ * Other frames, like ARP or ICMP, are sent as they are.
+ * @return 0 on success, or -1 on error
+ */
+int
+vnetsock_send(struct VnetSocket *vs,
+              const unsigned char *packet, unsigned length);
+
+/**
+ * Fills in the header for a frame, finding the TCP/UDP header within
+ * it (Ethernet, with or without a VLAN tag, then IPv4 or IPv6).
+ * @return 1 if the checksum is to be offloaded, 0 otherwise
+ */
+int
+vnet_header_fill(struct VnetHeader *hdr,
+                 const unsigned char *packet, unsigned length);
+
+int vnetsock_selftest(void);
+
+#endif
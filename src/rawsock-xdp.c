@@ -0,0 +1,1138 @@
+/*
+    AF_XDP adapter backend
+
+    This is an alternative to libpcap/PF_RING on Linux. It consists of
+    three pieces:
+
+    1. The UMEM. This is a chunk of memory divided into fixed-size
+    frames that both the kernel and us can see. The first half of the
+    frames are used for receive, the second half for transmit.
+
+    2. Four rings. The "fill" ring is how we give empty receive frames
+    to the kernel, the "rx" ring is how the kernel gives them back full.
+    The "tx" ring is how we give full transmit frames to the kernel,
+    and the "completion" ring is how it gives them back once sent.
+    Each ring is single-producer/single-consumer, with the receive
+    thread owning fill+rx and the transmit thread owning tx+completion.
+
+    3. A tiny XDP program, generated at runtime from the --adapter-ip
+    and --adapter-port settings, that redirects packets addressed to us
+    into the socket and passes everything else up to the kernel. This
+    way, SSH sessions and such on the same interface keep working.
+
+    We don't depend upon libbpf or libxdp, since those aren't installed
+    on most systems. Instead, we use the raw system calls, and assemble
+    the eBPF program ourselves. It's only about 60 instructions.
+
+    To test without special hardware:
+
+        ip link add xdp0 type veth peer name xdp1
+        ip link set xdp0 up; ip link set xdp1 up
+        masscan --adapter xdp0 --adapter-xdp=generic ...
+*/
+#include "rawsock-xdp.h"
+#include "stack-src.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include "util-safefunc.h"
+#include "main-globals.h"
+#include "unusedparm.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/if_xdp.h>) && __has_include(<linux/bpf.h>)
+#define HAVE_AF_XDP 1
+#endif
+#endif
+
+int
+xdpsock_parse_mode(const char *value)
+{
+    static const struct {
+        const char *name;
+        int mode;
+    } modes[] = {
+        {"auto", Xdp_Auto}, {"1", Xdp_Auto}, {"yes", Xdp_Auto},
+        {"true", Xdp_Auto}, {"on", Xdp_Auto},
+        {"generic", Xdp_Generic}, {"skb", Xdp_Generic},
+        {"native", Xdp_Native}, {"drv", Xdp_Native}, {"driver", Xdp_Native},
+        {"0", Xdp_None}, {"no", Xdp_None}, {"false", Xdp_None},
+        {"off", Xdp_None}, {"none", Xdp_None},
+        {0, 0}
+    };
+    size_t i;
+
+    if (value == NULL || value[0] == '\0')
+        return Xdp_Auto;
+    for (i=0; modes[i].name; i++) {
+        if (strcasecmp(value, modes[i].name) == 0)
+            return modes[i].mode;
+    }
+    return -1;
+}
+
+#if defined(HAVE_AF_XDP)
+#include <linux/if_xdp.h>
+#include <linux/if_link.h>
+#include <linux/bpf.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <net/if.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/*
+ * Sizes. The frame size must be a power of two between 2048 and the
+ * page size. All the rings hold as many entries as there are frames on
+ * that side, so that posting a frame we own can never fail.
+ */
+#define XDP_FRAME_SIZE      2048
+#define XDP_RX_FRAMES       2048
+#define XDP_TX_FRAMES       2048
+#define XDP_FRAME_COUNT     (XDP_RX_FRAMES + XDP_TX_FRAMES)
+#define XDP_TX_BATCH        64
+#define XDP_MAX_INSNS       128
+
+/***************************************************************************
+ * A memory-mapped ring shared with the kernel. We cache the indexes of
+ * the other side so we don't touch the shared cache line on every
+ * packet.
+ ***************************************************************************/
+struct XdpRing {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t mask;
+    uint32_t size;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map;
+    size_t map_length;
+};
+
+struct XdpSocket {
+    int fd;
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+    unsigned ifindex;
+    unsigned queue_id;
+
+    unsigned char *umem;
+    size_t umem_length;
+
+    struct XdpRing fill;
+    struct XdpRing comp;
+    struct XdpRing rx;
+    struct XdpRing tx;
+
+    /* transmit frames not currently owned by the kernel */
+    uint64_t tx_free[XDP_TX_FRAMES];
+    unsigned tx_free_count;
+    unsigned tx_pending;
+
+    /* the receive frame we've handed to the caller, that goes back on
+     * the fill ring at the next call */
+    uint64_t rx_held;
+    unsigned is_rx_held:1;
+
+    /* --busy-poll: spin on the RX ring instead of sleeping in poll() */
+    unsigned is_busy_poll:1;
+};
+
+static inline uint32_t
+ring_load_acquire(const uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void
+ring_store_release(uint32_t *p, uint32_t value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/***************************************************************************
+ * Thin wrapper around the bpf() system call, since glibc doesn't have one.
+ ***************************************************************************/
+static int
+sys_bpf(int cmd, union bpf_attr *attr, unsigned size)
+{
+    return (int)syscall(__NR_bpf, cmd, attr, size);
+}
+
+
+/***************************************************************************
+ * A trivial assembler for the redirect program, with forward references
+ * to labels that get fixed up at the end.
+ ***************************************************************************/
+enum {
+    L_PASS, L_IPV4, L_PORTS4, L_ARP, L_IPV6, L_PORTS6, L_REDIRECT, L_MAX
+};
+struct XdpAsm {
+    struct bpf_insn insns[XDP_MAX_INSNS];
+    unsigned count;
+    int labels[L_MAX];
+    struct {
+        unsigned insn;
+        unsigned label;
+    } fixups[XDP_MAX_INSNS];
+    unsigned fixup_count;
+};
+
+static void
+emit(struct XdpAsm *a, unsigned code, unsigned dst, unsigned src,
+     int off, int imm)
+{
+    struct bpf_insn *insn;
+
+    if (a->count >= XDP_MAX_INSNS) {
+        a->count++; /* detected as an error in asm_finish() */
+        return;
+    }
+    insn = &a->insns[a->count++];
+    memset(insn, 0, sizeof(*insn));
+    insn->code = (uint8_t)code;
+    insn->dst_reg = dst & 0xF;
+    insn->src_reg = src & 0xF;
+    insn->off = (int16_t)off;
+    insn->imm = imm;
+}
+static void
+emit_jmp(struct XdpAsm *a, unsigned code, unsigned dst, unsigned src,
+         int imm, unsigned label)
+{
+    if (a->fixup_count < XDP_MAX_INSNS) {
+        a->fixups[a->fixup_count].insn = a->count;
+        a->fixups[a->fixup_count].label = label;
+        a->fixup_count++;
+    }
+    emit(a, code, dst, src, 0, imm);
+}
+static void
+emit_ld64(struct XdpAsm *a, unsigned dst, unsigned pseudo, uint64_t imm)
+{
+    emit(a, BPF_LD|BPF_DW|BPF_IMM, dst, pseudo, 0, (int)(uint32_t)imm);
+    emit(a, 0, 0, 0, 0, (int)(uint32_t)(imm >> 32));
+}
+static void
+asm_label(struct XdpAsm *a, unsigned label)
+{
+    a->labels[label] = (int)a->count;
+}
+static int
+asm_finish(struct XdpAsm *a)
+{
+    unsigned i;
+
+    if (a->count > XDP_MAX_INSNS)
+        return -1;
+    for (i=0; i<a->fixup_count; i++) {
+        unsigned insn = a->fixups[i].insn;
+        int target = a->labels[a->fixups[i].label];
+        if (target < 0)
+            return -1;
+        a->insns[insn].off = (int16_t)(target - (int)insn - 1);
+    }
+    return 0;
+}
+
+/* packet-bounds check: if (r2 + length > r3) goto pass; */
+static void
+emit_bounds(struct XdpAsm *a, unsigned length)
+{
+    emit(a, BPF_ALU64|BPF_MOV|BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+    emit(a, BPF_ALU64|BPF_ADD|BPF_K, BPF_REG_4, 0, 0, (int)length);
+    emit_jmp(a, BPF_JMP|BPF_JGT|BPF_X, BPF_REG_4, BPF_REG_3, 0, L_PASS);
+}
+
+/* r5 = ntohX(*(uintX_t*)(r2 + offset)) */
+static void
+emit_load_be(struct XdpAsm *a, unsigned size, unsigned src, int offset)
+{
+    unsigned bits = (size == BPF_H) ? 16 : (size == BPF_W) ? 32 : 8;
+
+    emit(a, BPF_LDX|size|BPF_MEM, BPF_REG_5, src, offset, 0);
+    if (bits > 8)
+        emit(a, BPF_ALU|BPF_END|BPF_TO_BE, BPF_REG_5, 0, 0, (int)bits);
+}
+
+/* if (r5 < first || r5 > last) goto pass; using 32-bit unsigned compares
+ * so that addresses with the high bit set work */
+static void
+emit_range32(struct XdpAsm *a, unsigned first, unsigned last)
+{
+    emit_jmp(a, BPF_JMP32|BPF_JLT|BPF_K, BPF_REG_5, 0, (int)first, L_PASS);
+    emit_jmp(a, BPF_JMP32|BPF_JGT|BPF_K, BPF_REG_5, 0, (int)last, L_PASS);
+}
+
+/* if protocol is one with ports, check them, else redirect */
+static void
+emit_proto_dispatch(struct XdpAsm *a, unsigned ports_label)
+{
+    emit_jmp(a, BPF_JMP|BPF_JEQ|BPF_K, BPF_REG_5, 0, 6, ports_label);   /* TCP */
+    emit_jmp(a, BPF_JMP|BPF_JEQ|BPF_K, BPF_REG_5, 0, 17, ports_label);  /* UDP */
+    emit_jmp(a, BPF_JMP|BPF_JEQ|BPF_K, BPF_REG_5, 0, 132, ports_label); /* SCTP */
+    emit_jmp(a, BPF_JMP|BPF_JA, 0, 0, 0, L_REDIRECT);
+}
+
+/* The value we'd get loading 8 bytes of an IPv6 address from the packet
+ * as a native integer */
+static uint64_t
+ipv6_raw64(uint64_t x)
+{
+    unsigned char buf[8];
+    uint64_t result;
+    unsigned i;
+
+    for (i=0; i<8; i++)
+        buf[i] = (unsigned char)(x >> (56 - 8*i));
+    memcpy(&result, buf, 8);
+    return result;
+}
+
+/***************************************************************************
+ * Generates the XDP program. Registers are:
+ *  r1 = context (struct xdp_md), never modified until the redirect
+ *  r2 = start of packet
+ *  r3 = end of packet
+ *  r4 = scratch pointer for bounds checks
+ *  r5 = the field being tested
+ *
+ * Which packets get redirected to us:
+ *  - IPv4 TCP/UDP/SCTP to our IP address range and port range
+ *  - IPv4 ICMP (and anything else) to our IP address range
+ *  - ARP requests for our IP address range
+ *  - IPv6 to our address, with the same port rules as IPv4
+ * Everything else is passed to the kernel. Packets on queues without
+ * a socket are also passed, via the fallback action of
+ * bpf_redirect_map().
+ ***************************************************************************/
+static int
+xdp_program_generate(struct XdpAsm *a, const struct stack_src_t *src, int map_fd)
+{
+    unsigned i;
+
+    memset(a, 0, sizeof(*a));
+    for (i=0; i<L_MAX; i++)
+        a->labels[i] = -1;
+
+    /* r2 = data, r3 = data_end */
+    emit(a, BPF_LDX|BPF_W|BPF_MEM, BPF_REG_2, BPF_REG_1,
+            offsetof(struct xdp_md, data), 0);
+    emit(a, BPF_LDX|BPF_W|BPF_MEM, BPF_REG_3, BPF_REG_1,
+            offsetof(struct xdp_md, data_end), 0);
+
+    /* Ethernet: dispatch on the ethertype */
+    emit_bounds(a, 14);
+    emit_load_be(a, BPF_H, BPF_REG_2, 12);
+    emit_jmp(a, BPF_JMP|BPF_JEQ|BPF_K, BPF_REG_5, 0, 0x0800, L_IPV4);
+    emit_jmp(a, BPF_JMP|BPF_JEQ|BPF_K, BPF_REG_5, 0, 0x0806, L_ARP);
+    emit_jmp(a, BPF_JMP|BPF_JEQ|BPF_K, BPF_REG_5, 0, 0x86dd, L_IPV6);
+    emit_jmp(a, BPF_JMP|BPF_JA, 0, 0, 0, L_PASS);
+
+    /* IPv4 */
+    asm_label(a, L_IPV4);
+    if (src->ipv4.range) {
+        emit_bounds(a, 14 + 20);
+        emit_load_be(a, BPF_W, BPF_REG_2, 14 + 16);
+        emit_range32(a, src->ipv4.first, src->ipv4.last);
+        emit_load_be(a, BPF_B, BPF_REG_2, 14 + 9);
+        emit_proto_dispatch(a, L_PORTS4);
+
+        /* r4 = start of transport header, from the IP header length */
+        asm_label(a, L_PORTS4);
+        emit_load_be(a, BPF_B, BPF_REG_2, 14);
+        emit(a, BPF_ALU64|BPF_AND|BPF_K, BPF_REG_5, 0, 0, 0x0F);
+        emit(a, BPF_ALU64|BPF_LSH|BPF_K, BPF_REG_5, 0, 0, 2);
+        emit(a, BPF_ALU64|BPF_MOV|BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+        emit(a, BPF_ALU64|BPF_ADD|BPF_X, BPF_REG_4, BPF_REG_5, 0, 0);
+        emit(a, BPF_ALU64|BPF_ADD|BPF_K, BPF_REG_4, 0, 0, 14);
+        emit(a, BPF_ALU64|BPF_MOV|BPF_X, BPF_REG_0, BPF_REG_4, 0, 0);
+        emit(a, BPF_ALU64|BPF_ADD|BPF_K, BPF_REG_0, 0, 0, 4);
+        emit_jmp(a, BPF_JMP|BPF_JGT|BPF_X, BPF_REG_0, BPF_REG_3, 0, L_PASS);
+        emit_load_be(a, BPF_H, BPF_REG_4, 2);
+        emit_range32(a, src->port.first, src->port.last);
+        emit_jmp(a, BPF_JMP|BPF_JA, 0, 0, 0, L_REDIRECT);
+
+        /* ARP requests for one of our addresses */
+        asm_label(a, L_ARP);
+        emit_bounds(a, 14 + 28);
+        emit_load_be(a, BPF_H, BPF_REG_2, 14 + 6);
+        emit_jmp(a, BPF_JMP|BPF_JNE|BPF_K, BPF_REG_5, 0, 1, L_PASS);
+        emit_load_be(a, BPF_W, BPF_REG_2, 14 + 24);
+        emit_range32(a, src->ipv4.first, src->ipv4.last);
+        emit_jmp(a, BPF_JMP|BPF_JA, 0, 0, 0, L_REDIRECT);
+    } else {
+        asm_label(a, L_PORTS4);
+        asm_label(a, L_ARP);
+        emit_jmp(a, BPF_JMP|BPF_JA, 0, 0, 0, L_PASS);
+    }
+
+    /* IPv6, to our one address. Note that multicast neighbor
+     * solicitations go to the kernel, so when spoofing an IPv6 address,
+     * --router-mac-ipv6 is needed. */
+    asm_label(a, L_IPV6);
+    if (src->ipv6.range) {
+        emit_bounds(a, 14 + 40);
+        emit(a, BPF_LDX|BPF_DW|BPF_MEM, BPF_REG_5, BPF_REG_2, 14 + 24, 0);
+        emit_ld64(a, BPF_REG_0, 0, ipv6_raw64(src->ipv6.first.hi));
+        emit_jmp(a, BPF_JMP|BPF_JNE|BPF_X, BPF_REG_5, BPF_REG_0, 0, L_PASS);
+        emit(a, BPF_LDX|BPF_DW|BPF_MEM, BPF_REG_5, BPF_REG_2, 14 + 32, 0);
+        emit_ld64(a, BPF_REG_0, 0, ipv6_raw64(src->ipv6.first.lo));
+        emit_jmp(a, BPF_JMP|BPF_JNE|BPF_X, BPF_REG_5, BPF_REG_0, 0, L_PASS);
+        emit_load_be(a, BPF_B, BPF_REG_2, 14 + 6);
+        emit_proto_dispatch(a, L_PORTS6);
+
+        asm_label(a, L_PORTS6);
+        emit_bounds(a, 14 + 40 + 4);
+        emit_load_be(a, BPF_H, BPF_REG_2, 14 + 40 + 2);
+        emit_range32(a, src->port.first, src->port.last);
+    } else {
+        asm_label(a, L_PORTS6);
+        emit_jmp(a, BPF_JMP|BPF_JA, 0, 0, 0, L_PASS);
+    }
+
+    /* return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS); */
+    asm_label(a, L_REDIRECT);
+    emit(a, BPF_LDX|BPF_W|BPF_MEM, BPF_REG_2, BPF_REG_1,
+            offsetof(struct xdp_md, rx_queue_index), 0);
+    emit_ld64(a, BPF_REG_1, BPF_PSEUDO_MAP_FD, (uint64_t)(unsigned)map_fd);
+    emit(a, BPF_ALU64|BPF_MOV|BPF_K, BPF_REG_3, 0, 0, XDP_PASS);
+    emit(a, BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+    emit(a, BPF_JMP|BPF_EXIT, 0, 0, 0, 0);
+
+    /* return XDP_PASS; */
+    asm_label(a, L_PASS);
+    emit(a, BPF_ALU64|BPF_MOV|BPF_K, BPF_REG_0, 0, 0, XDP_PASS);
+    emit(a, BPF_JMP|BPF_EXIT, 0, 0, 0, 0);
+
+    return asm_finish(a);
+}
+
+/***************************************************************************
+ * Creates the XSKMAP, loads the program, and attaches it to the
+ * interface using a BPF link, so that it's automatically detached if
+ * we crash.
+ ***************************************************************************/
+static int
+xdp_program_attach(struct XdpSocket *xsk, const struct stack_src_t *src,
+                   unsigned mode)
+{
+    union bpf_attr attr;
+    struct XdpAsm *a;
+    char log_buf[4096];
+    uint32_t key;
+    uint32_t value;
+    int err;
+
+    /* map: queue-id -> socket */
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(uint32_t);
+    attr.max_entries = xsk->queue_id + 1;
+    xsk->map_fd = sys_bpf(BPF_MAP_CREATE, &attr, sizeof(attr));
+    if (xsk->map_fd < 0) {
+        LOG(0, "[-] xdp: map create: %s\n", strerror(errno));
+        return -1;
+    }
+
+    key = xsk->queue_id;
+    value = (uint32_t)xsk->fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = (uint32_t)xsk->map_fd;
+    attr.key = (uint64_t)(uintptr_t)&key;
+    attr.value = (uint64_t)(uintptr_t)&value;
+    err = sys_bpf(BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
+    if (err) {
+        LOG(0, "[-] xdp: map update: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* program */
+    a = MALLOC(sizeof(*a));
+    err = xdp_program_generate(a, src, xsk->map_fd);
+    if (err) {
+        LOG(0, "[-] xdp: program too big\n");
+        free(a);
+        return -1;
+    }
+    log_buf[0] = '\0';
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uint64_t)(uintptr_t)a->insns;
+    attr.insn_cnt = a->count;
+    attr.license = (uint64_t)(uintptr_t)"GPL";
+    attr.log_buf = (uint64_t)(uintptr_t)log_buf;
+    attr.log_size = sizeof(log_buf);
+    attr.log_level = 1;
+    xsk->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr, sizeof(attr));
+    free(a);
+    if (xsk->prog_fd < 0) {
+        LOG(0, "[-] xdp: program load: %s\n", strerror(errno));
+        LOG(1, "%s\n", log_buf);
+        return -1;
+    }
+
+    /* attach */
+    for (;;) {
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = (uint32_t)xsk->prog_fd;
+        attr.link_create.target_ifindex = xsk->ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        if (mode == Xdp_Generic)
+            attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+        else
+            attr.link_create.flags = XDP_FLAGS_DRV_MODE;
+        xsk->link_fd = sys_bpf(BPF_LINK_CREATE, &attr, sizeof(attr));
+        if (xsk->link_fd >= 0)
+            break;
+        if (mode == Xdp_Auto) {
+            LOG(1, "[-] xdp: native attach: %s, trying generic\n", strerror(errno));
+            mode = Xdp_Generic;
+            continue;
+        }
+        LOG(0, "[-] xdp: attach: %s\n", strerror(errno));
+        return -1;
+    }
+    LOG(1, "[+] xdp: program attached (%s mode)\n",
+        (mode == Xdp_Generic) ? "generic" : "native");
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static int
+ring_map(struct XdpSocket *xsk, struct XdpRing *ring,
+         const struct xdp_ring_offset *off, size_t desc_size,
+         uint32_t count, off_t pgoff)
+{
+    unsigned char *map;
+
+    ring->map_length = off->desc + count * desc_size;
+    map = mmap(NULL, ring->map_length, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, xsk->fd, pgoff);
+    if (map == MAP_FAILED) {
+        LOG(0, "[-] xdp: ring mmap: %s\n", strerror(errno));
+        ring->map = NULL;
+        return -1;
+    }
+    ring->map = map;
+    ring->producer = (uint32_t *)(map + off->producer);
+    ring->consumer = (uint32_t *)(map + off->consumer);
+    ring->flags = (uint32_t *)(map + off->flags);
+    ring->descs = map + off->desc;
+    ring->size = count;
+    ring->mask = count - 1;
+    ring->cached_prod = *ring->producer;
+    ring->cached_cons = *ring->consumer;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct XdpSocket *
+xdpsock_create(const char *ifname, const struct stack_src_t *src,
+               unsigned mode, unsigned queue_id)
+{
+    struct XdpSocket *xsk;
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen;
+    unsigned count;
+    unsigned i;
+    int err;
+
+    xsk = CALLOC(1, sizeof(*xsk));
+    xsk->fd = -1;
+    xsk->map_fd = -1;
+    xsk->prog_fd = -1;
+    xsk->link_fd = -1;
+    xsk->queue_id = queue_id;
+    xsk->ifindex = if_nametoindex(ifname);
+    if (xsk->ifindex == 0) {
+        LOG(0, "[-] xdp: %s: unknown interface\n", ifname);
+        goto fail;
+    }
+
+    xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk->fd < 0) {
+        LOG(0, "[-] xdp: socket(AF_XDP): %s\n", strerror(errno));
+        if (errno == EPERM)
+            LOG(0, "    [hint] need to sudo or run as root or something\n");
+        goto fail;
+    }
+
+    /* Register the UMEM */
+    xsk->umem_length = (size_t)XDP_FRAME_COUNT * XDP_FRAME_SIZE;
+    xsk->umem = mmap(NULL, xsk->umem_length, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (xsk->umem == MAP_FAILED) {
+        xsk->umem = NULL;
+        LOG(0, "[-] xdp: umem: %s\n", strerror(errno));
+        goto fail;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uint64_t)(uintptr_t)xsk->umem;
+    reg.len = xsk->umem_length;
+    reg.chunk_size = XDP_FRAME_SIZE;
+    reg.headroom = 0;
+    err = setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg));
+    if (err) {
+        LOG(0, "[-] xdp: XDP_UMEM_REG: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    /* Size the rings */
+    count = XDP_RX_FRAMES;
+    err = setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &count, sizeof(count));
+    err |= setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &count, sizeof(count));
+    count = XDP_TX_FRAMES;
+    err |= setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &count, sizeof(count));
+    err |= setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &count, sizeof(count));
+    if (err) {
+        LOG(0, "[-] xdp: ring setup: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    /* Map the rings */
+    optlen = sizeof(off);
+    err = getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen);
+    if (err) {
+        LOG(0, "[-] xdp: XDP_MMAP_OFFSETS: %s\n", strerror(errno));
+        goto fail;
+    }
+    if (ring_map(xsk, &xsk->fill, &off.fr, sizeof(uint64_t),
+                 XDP_RX_FRAMES, XDP_UMEM_PGOFF_FILL_RING)
+        || ring_map(xsk, &xsk->comp, &off.cr, sizeof(uint64_t),
+                 XDP_TX_FRAMES, XDP_UMEM_PGOFF_COMPLETION_RING)
+        || ring_map(xsk, &xsk->rx, &off.rx, sizeof(struct xdp_desc),
+                 XDP_RX_FRAMES, XDP_PGOFF_RX_RING)
+        || ring_map(xsk, &xsk->tx, &off.tx, sizeof(struct xdp_desc),
+                 XDP_TX_FRAMES, XDP_PGOFF_TX_RING))
+        goto fail;
+
+    /* Our side of the producer/consumer rings starts with everything
+     * empty. The fill ring is the exception: we hand all the receive
+     * frames to the kernel up front. */
+    for (i=0; i<XDP_RX_FRAMES; i++) {
+        uint64_t *addrs = xsk->fill.descs;
+        addrs[(xsk->fill.cached_prod + i) & xsk->fill.mask] =
+                                            (uint64_t)i * XDP_FRAME_SIZE;
+    }
+    xsk->fill.cached_prod += XDP_RX_FRAMES;
+    ring_store_release(xsk->fill.producer, xsk->fill.cached_prod);
+
+    for (i=0; i<XDP_TX_FRAMES; i++)
+        xsk->tx_free[i] = (uint64_t)(XDP_RX_FRAMES + i) * XDP_FRAME_SIZE;
+    xsk->tx_free_count = XDP_TX_FRAMES;
+
+    /* Bind to the interface queue */
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = xsk->ifindex;
+    sxdp.sxdp_queue_id = queue_id;
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    if (mode == Xdp_Generic)
+        sxdp.sxdp_flags |= XDP_COPY;
+    err = bind(xsk->fd, (struct sockaddr *)&sxdp, sizeof(sxdp));
+    if (err) {
+        LOG(0, "[-] xdp: bind(%s, queue=%u): %s\n",
+            ifname, queue_id, strerror(errno));
+        goto fail;
+    }
+
+    /* Now start redirecting packets to the socket */
+    if (xdp_program_attach(xsk, src, mode) != 0)
+        goto fail;
+
+    LOG(1, "[+] if(%s): AF_XDP socket on queue %u\n", ifname, queue_id);
+    return xsk;
+
+fail:
+    xdpsock_destroy(xsk);
+    return NULL;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+xdpsock_destroy(struct XdpSocket *xsk)
+{
+    if (xsk == NULL)
+        return;
+
+    /* closing the link detaches the program from the interface */
+    if (xsk->link_fd >= 0)
+        close(xsk->link_fd);
+    if (xsk->prog_fd >= 0)
+        close(xsk->prog_fd);
+    if (xsk->map_fd >= 0)
+        close(xsk->map_fd);
+
+    if (xsk->fill.map)
+        munmap(xsk->fill.map, xsk->fill.map_length);
+    if (xsk->comp.map)
+        munmap(xsk->comp.map, xsk->comp.map_length);
+    if (xsk->rx.map)
+        munmap(xsk->rx.map, xsk->rx.map_length);
+    if (xsk->tx.map)
+        munmap(xsk->tx.map, xsk->tx.map_length);
+    if (xsk->fd >= 0)
+        close(xsk->fd);
+    if (xsk->umem)
+        munmap(xsk->umem, xsk->umem_length);
+    free(xsk);
+}
+
+/***************************************************************************
+ * Take back transmit frames the kernel has finished with.
+ ***************************************************************************/
+static void
+xdpsock_reclaim(struct XdpSocket *xsk)
+{
+    const uint64_t *addrs = xsk->comp.descs;
+    uint32_t prod = ring_load_acquire(xsk->comp.producer);
+    uint32_t cons = xsk->comp.cached_cons;
+
+    while (cons != prod) {
+        xsk->tx_free[xsk->tx_free_count++] = addrs[cons & xsk->comp.mask];
+        cons++;
+    }
+    if (cons != xsk->comp.cached_cons) {
+        xsk->comp.cached_cons = cons;
+        ring_store_release(xsk->comp.consumer, cons);
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+xdpsock_flush(struct XdpSocket *xsk)
+{
+    if (xsk->tx_pending) {
+        ring_store_release(xsk->tx.producer, xsk->tx.cached_prod);
+        xsk->tx_pending = 0;
+    }
+
+    /* In copy mode, and with some drivers, the kernel only transmits
+     * when we tell it to. */
+    if (ring_load_acquire(xsk->tx.flags) & XDP_RING_NEED_WAKEUP)
+        sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+
+    xdpsock_reclaim(xsk);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+xdpsock_send(struct XdpSocket *xsk,
+             const unsigned char *packet, unsigned length,
+             unsigned flush)
+{
+    struct xdp_desc *desc;
+    uint64_t addr;
+
+    if (length > XDP_FRAME_SIZE)
+        return -1;
+
+    /* Wait for a free frame. Since there are exactly as many TX ring
+     * entries as TX frames, having a frame means there's a ring slot */
+    if (xsk->tx_free_count == 0)
+        xdpsock_reclaim(xsk);
+    while (xsk->tx_free_count == 0) {
+        xdpsock_flush(xsk);
+        if (xsk->tx_free_count == 0) {
+            if (is_tx_done > 1)
+                return -1;
+            sched_yield();
+        }
+    }
+    addr = xsk->tx_free[--xsk->tx_free_count];
+
+    memcpy(xsk->umem + addr, packet, length);
+    desc = (struct xdp_desc *)xsk->tx.descs + (xsk->tx.cached_prod & xsk->tx.mask);
+    desc->addr = addr;
+    desc->len = length;
+    desc->options = 0;
+    xsk->tx.cached_prod++;
+    xsk->tx_pending++;
+
+    /* Post the batch to the kernel */
+    if (flush || xsk->tx_pending >= XDP_TX_BATCH)
+        xdpsock_flush(xsk);
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+xdpsock_set_busy_poll(struct XdpSocket *xsk)
+{
+    xsk->is_busy_poll = 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+xdpsock_recv(struct XdpSocket *xsk,
+             unsigned *length, unsigned *secs, unsigned *usecs,
+             const unsigned char **packet)
+{
+    const struct xdp_desc *desc;
+    struct timespec ts;
+
+    /* Give the previous frame back to the kernel. The fill ring has
+     * room for every receive frame, so this can't overflow. */
+    if (xsk->is_rx_held) {
+        uint64_t *addrs = xsk->fill.descs;
+        addrs[xsk->fill.cached_prod & xsk->fill.mask] = xsk->rx_held;
+        xsk->fill.cached_prod++;
+        ring_store_release(xsk->fill.producer, xsk->fill.cached_prod);
+        xsk->is_rx_held = 0;
+    }
+
+    /* Wait for a packet */
+    if (xsk->rx.cached_cons == xsk->rx.cached_prod) {
+        xsk->rx.cached_prod = ring_load_acquire(xsk->rx.producer);
+        if (xsk->rx.cached_cons == xsk->rx.cached_prod && xsk->is_busy_poll) {
+            /* The kernel only refills from the fill ring when asked */
+            if (ring_load_acquire(xsk->fill.flags) & XDP_RING_NEED_WAKEUP)
+                recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+            return 1;
+        }
+        if (xsk->rx.cached_cons == xsk->rx.cached_prod) {
+            struct pollfd pfd;
+            pfd.fd = xsk->fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            poll(&pfd, 1, 100);
+            xsk->rx.cached_prod = ring_load_acquire(xsk->rx.producer);
+            if (xsk->rx.cached_cons == xsk->rx.cached_prod)
+                return 1;
+        }
+    }
+
+    desc = (const struct xdp_desc *)xsk->rx.descs
+                    + (xsk->rx.cached_cons & xsk->rx.mask);
+    xsk->rx_held = desc->addr;
+    xsk->is_rx_held = 1;
+    *packet = xsk->umem + desc->addr;
+    *length = desc->len;
+    xsk->rx.cached_cons++;
+    ring_store_release(xsk->rx.consumer, xsk->rx.cached_cons);
+
+    /* AF_XDP has no timestamps, so use the clock */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    *secs = (unsigned)ts.tv_sec;
+    *usecs = (unsigned)(ts.tv_nsec / 1000);
+    return 0;
+}
+
+
+/***************************************************************************
+ * To test the generated program without needing privileges, we run it
+ * through a minimal eBPF interpreter that understands just the
+ * instructions we emit. It also acts like the verifier in one respect:
+ * any packet access past the end is an error, since it means our
+ * bounds checks are wrong.
+ ***************************************************************************/
+#define TEST_CTX    0xC0000000ULL
+#define TEST_MAP    0xD0000000ULL
+
+static int
+xdp_interpret(const struct XdpAsm *a, const unsigned char *px, unsigned length,
+              unsigned queue_id, unsigned map_queue)
+{
+    uint64_t r[11] = {0};
+    unsigned pc = 0;
+    unsigned steps;
+    static const unsigned one = 1;
+    unsigned is_little_endian = *(const unsigned char *)&one;
+
+    r[1] = TEST_CTX;
+    for (steps=0; steps<1000 && pc < a->count; steps++) {
+        const struct bpf_insn *insn = &a->insns[pc++];
+        uint64_t *dst = &r[insn->dst_reg];
+        uint64_t src = (BPF_SRC(insn->code) == BPF_X)
+                            ? r[insn->src_reg]
+                            : (uint64_t)(int64_t)insn->imm;
+        unsigned cls = BPF_CLASS(insn->code);
+
+        if (cls == BPF_LDX) {
+            uint64_t addr = r[insn->src_reg] + insn->off;
+            unsigned size;
+            switch (BPF_SIZE(insn->code)) {
+            case BPF_B: size = 1; break;
+            case BPF_H: size = 2; break;
+            case BPF_W: size = 4; break;
+            default: size = 8; break;
+            }
+            if (r[insn->src_reg] == TEST_CTX) {
+                switch (insn->off) {
+                case offsetof(struct xdp_md, data): *dst = 0; break;
+                case offsetof(struct xdp_md, data_end): *dst = length; break;
+                case offsetof(struct xdp_md, rx_queue_index): *dst = queue_id; break;
+                default: return -1;
+                }
+            } else if (addr + size > length) {
+                return -2; /* out-of-bounds packet access */
+            } else {
+                uint64_t value = 0;
+                if (is_little_endian)
+                    memcpy(&value, px + addr, size);
+                else
+                    memcpy((unsigned char *)&value + 8 - size, px + addr, size);
+                *dst = value;
+            }
+        } else if (cls == BPF_ALU64) {
+            switch (BPF_OP(insn->code)) {
+            case BPF_MOV: *dst = src; break;
+            case BPF_ADD: *dst += src; break;
+            case BPF_AND: *dst &= src; break;
+            case BPF_LSH: *dst <<= src; break;
+            default: return -1;
+            }
+        } else if (cls == BPF_ALU && BPF_OP(insn->code) == BPF_END) {
+            uint64_t x = *dst;
+            if (is_little_endian) {
+                if (insn->imm == 16)
+                    x = ((x >> 8) & 0xFF) | ((x & 0xFF) << 8);
+                else if (insn->imm == 32)
+                    x = ((x >> 24) & 0xFF) | ((x >> 8) & 0xFF00)
+                        | ((x & 0xFF00) << 8) | ((x & 0xFF) << 24);
+                else
+                    return -1;
+            }
+            *dst = x & ((insn->imm == 16) ? 0xFFFF : 0xFFFFFFFF);
+        } else if (cls == BPF_LD && insn->code == (BPF_LD|BPF_DW|BPF_IMM)) {
+            if (insn->src_reg == BPF_PSEUDO_MAP_FD)
+                *dst = TEST_MAP;
+            else
+                *dst = (uint32_t)insn[0].imm | ((uint64_t)(uint32_t)insn[1].imm << 32);
+            pc++;
+        } else if (cls == BPF_JMP || cls == BPF_JMP32) {
+            uint64_t x = *dst;
+            uint64_t y = src;
+            unsigned is_taken;
+            if (cls == BPF_JMP32) {
+                x = (uint32_t)x;
+                y = (uint32_t)y;
+            }
+            switch (BPF_OP(insn->code)) {
+            case BPF_JA: is_taken = 1; break;
+            case BPF_JEQ: is_taken = (x == y); break;
+            case BPF_JNE: is_taken = (x != y); break;
+            case BPF_JGT: is_taken = (x > y); break;
+            case BPF_JLT: is_taken = (x < y); break;
+            case BPF_CALL:
+                if (insn->imm != BPF_FUNC_redirect_map || r[1] != TEST_MAP)
+                    return -1;
+                r[0] = (r[2] == map_queue) ? XDP_REDIRECT : (r[3] & 3);
+                continue;
+            case BPF_EXIT:
+                return (int)r[0];
+            default:
+                return -1;
+            }
+            if (is_taken)
+                pc += insn->off;
+        } else
+            return -1;
+    }
+    return -1;
+}
+
+/* Builds a test frame: Ethernet + IPv4 + transport header */
+static unsigned
+test_ipv4(unsigned char *px, unsigned ip_dst, unsigned proto, unsigned port_dst)
+{
+    memset(px, 0, 64);
+    px[12] = 0x08; px[13] = 0x00;
+    px[14] = 0x45;
+    px[14+9] = (unsigned char)proto;
+    px[14+16] = (unsigned char)(ip_dst >> 24);
+    px[14+17] = (unsigned char)(ip_dst >> 16);
+    px[14+18] = (unsigned char)(ip_dst >> 8);
+    px[14+19] = (unsigned char)(ip_dst >> 0);
+    px[34+2] = (unsigned char)(port_dst >> 8);
+    px[34+3] = (unsigned char)(port_dst >> 0);
+    return 54;
+}
+
+int
+xdpsock_selftest(void)
+{
+    struct XdpAsm *a;
+    struct stack_src_t src;
+    unsigned char px[128];
+    unsigned length;
+    int line = 0;
+
+    memset(&src, 0, sizeof(src));
+    src.ipv4.first = 0xC0A80110; /* 192.168.1.16 */
+    src.ipv4.last = 0xC0A80117;
+    src.ipv4.range = 8;
+    src.port.first = 40000;
+    src.port.last = 40015;
+    src.port.range = 16;
+    src.ipv6.first.hi = 0x20010db800000000ULL;
+    src.ipv6.first.lo = 0x0000000000000042ULL;
+    src.ipv6.last = src.ipv6.first;
+    src.ipv6.range = 1;
+
+    a = MALLOC(sizeof(*a));
+    if (xdp_program_generate(a, &src, 3) != 0) {
+        line = __LINE__;
+        goto fail;
+    }
+
+    /* TCP to us */
+    length = test_ipv4(px, 0xC0A80112, 6, 40007);
+    if (xdp_interpret(a, px, length, 0, 0) != XDP_REDIRECT) {line = __LINE__; goto fail;}
+
+    /* ... but on a queue without a socket, goes to the kernel */
+    if (xdp_interpret(a, px, length, 1, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    /* TCP to our IP address but another port, such as SSH */
+    length = test_ipv4(px, 0xC0A80112, 6, 22);
+    if (xdp_interpret(a, px, length, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    /* UDP just past the port range */
+    length = test_ipv4(px, 0xC0A80112, 17, 40016);
+    if (xdp_interpret(a, px, length, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    /* ICMP to us */
+    length = test_ipv4(px, 0xC0A80117, 1, 0);
+    if (xdp_interpret(a, px, length, 0, 0) != XDP_REDIRECT) {line = __LINE__; goto fail;}
+
+    /* somebody else */
+    length = test_ipv4(px, 0xC0A80118, 6, 40007);
+    if (xdp_interpret(a, px, length, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    /* truncated: header claims a port we can't read */
+    length = test_ipv4(px, 0xC0A80112, 6, 40007);
+    if (xdp_interpret(a, px, 36, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+    if (xdp_interpret(a, px, 10, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    /* IP options move the transport header */
+    length = test_ipv4(px, 0xC0A80112, 6, 0);
+    px[14] = 0x46;
+    px[38+2] = 40001 >> 8;
+    px[38+3] = 40001 & 0xFF;
+    if (xdp_interpret(a, px, length + 4, 0, 0) != XDP_REDIRECT) {line = __LINE__; goto fail;}
+
+    /* ARP request for us, and an ARP reply (for the kernel) */
+    memset(px, 0, 64);
+    px[12] = 0x08; px[13] = 0x06;
+    px[14+7] = 1;
+    px[14+24] = 192; px[14+25] = 168; px[14+26] = 1; px[14+27] = 0x10;
+    if (xdp_interpret(a, px, 60, 0, 0) != XDP_REDIRECT) {line = __LINE__; goto fail;}
+    px[14+7] = 2;
+    if (xdp_interpret(a, px, 60, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    /* IPv6 TCP to us, then to another address */
+    memset(px, 0, sizeof(px));
+    px[12] = 0x86; px[13] = 0xdd;
+    px[14] = 0x60;
+    px[14+6] = 6;
+    px[14+24] = 0x20; px[14+25] = 0x01; px[14+26] = 0x0d; px[14+27] = 0xb8;
+    px[14+39] = 0x42;
+    px[54+2] = 40000 >> 8;
+    px[54+3] = 40000 & 0xFF;
+    if (xdp_interpret(a, px, 74, 0, 0) != XDP_REDIRECT) {line = __LINE__; goto fail;}
+    px[14+39] = 0x43;
+    if (xdp_interpret(a, px, 74, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    /* Addresses with the high bit set need unsigned compares */
+    src.ipv4.first = 0xC8000001;
+    src.ipv4.last = 0xC8000001;
+    src.ipv6.range = 0;
+    if (xdp_program_generate(a, &src, 3) != 0) {line = __LINE__; goto fail;}
+    length = test_ipv4(px, 0xC8000001, 6, 40000);
+    if (xdp_interpret(a, px, length, 0, 0) != XDP_REDIRECT) {line = __LINE__; goto fail;}
+    length = test_ipv4(px, 0x48000001, 6, 40000);
+    if (xdp_interpret(a, px, length, 0, 0) != XDP_PASS) {line = __LINE__; goto fail;}
+
+    free(a);
+    return 0;
+fail:
+    fprintf(stderr, "[-] xdp: selftest failed, line=%d\n", line);
+    free(a);
+    return 1;
+}
+
+#else /* !HAVE_AF_XDP */
+
+struct XdpSocket *
+xdpsock_create(const char *ifname, const struct stack_src_t *src,
+               unsigned mode, unsigned queue_id)
+{
+    UNUSEDPARM(src);
+    UNUSEDPARM(mode);
+    UNUSEDPARM(queue_id);
+    LOG(0, "[-] if(%s): AF_XDP not supported on this platform\n", ifname);
+    return NULL;
+}
+void
+xdpsock_destroy(struct XdpSocket *xsk)
+{
+    UNUSEDPARM(xsk);
+}
+int
+xdpsock_send(struct XdpSocket *xsk,
+             const unsigned char *packet, unsigned length,
+             unsigned flush)
+{
+    UNUSEDPARM(xsk);
+    UNUSEDPARM(packet);
+    UNUSEDPARM(length);
+    UNUSEDPARM(flush);
+    return -1;
+}
+void
+xdpsock_flush(struct XdpSocket *xsk)
+{
+    UNUSEDPARM(xsk);
+}
+void
+xdpsock_set_busy_poll(struct XdpSocket *xsk)
+{
+    UNUSEDPARM(xsk);
+}
+int
+xdpsock_recv(struct XdpSocket *xsk,
+             unsigned *length, unsigned *secs, unsigned *usecs,
+             const unsigned char **packet)
+{
+    UNUSEDPARM(xsk);
+    UNUSEDPARM(length);
+    UNUSEDPARM(secs);
+    UNUSEDPARM(usecs);
+    UNUSEDPARM(packet);
+    return 1;
+}
+int
+xdpsock_selftest(void)
+{
+    return 0;
+}
+
+#endif
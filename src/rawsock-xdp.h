@@ -0,0 +1,82 @@
+/*
+    AF_XDP adapter backend
+
+    On Linux, this lets us bypass the kernel's network stack without
+    needing PF_RING licenses: a small XDP program attached to the
+    interface redirects only the packets addressed to our source
+    IP/port range to an AF_XDP socket, and passes everything else on
+    to the kernel as normal. The socket's packet memory (the "UMEM") is
+    shared between transmit and receive.
+
+    The transmit thread owns the TX and completion rings, the receive
+    thread owns the RX and fill rings, so no locking is needed.
+*/
+#ifndef RAWSOCK_XDP_H
+#define RAWSOCK_XDP_H
+struct stack_src_t;
+struct XdpSocket;
+
+/**
+ * How the XDP program is attached to the interface (--adapter-xdp).
+ * Generic mode works with any driver, including veth, but is slower.
+ */
+enum XdpMode {
+    Xdp_None = 0,
+    Xdp_Auto,       /* try native first, fall back to generic */
+    Xdp_Generic,    /* XDP_FLAGS_SKB_MODE */
+    Xdp_Native,     /* XDP_FLAGS_DRV_MODE */
+};
+
+/**
+ * Parses the value of --adapter-xdp, such as "generic" or "native".
+ * @return one of the XdpMode values, or -1 on error
+ */
+int xdpsock_parse_mode(const char *value);
+
+/**
+ * Creates an AF_XDP socket bound to the given interface queue, and
+ * attaches the redirect program. Packets not matching 'src' continue
+ * to the kernel.
+ * @return NULL on failure, such as when the kernel doesn't support
+ *      AF_XDP or we don't have the privileges.
+ */
+struct XdpSocket *
+xdpsock_create(const char *ifname, const struct stack_src_t *src,
+                unsigned mode, unsigned queue_id);
+
+/**
+ * Detaches the XDP program and frees everything.
+ */
+void xdpsock_destroy(struct XdpSocket *xsk);
+
+/**
+ * Queues a packet for transmit. Descriptors are only posted to the
+ * kernel when 'flush' is set or a batch fills up.
+ */
+int xdpsock_send(struct XdpSocket *xsk,
+                 const unsigned char *packet, unsigned length,
+                 unsigned flush);
+
+/**
+ * Posts any queued transmit descriptors and kicks the kernel.
+ */
+void xdpsock_flush(struct XdpSocket *xsk);
+
+/**
+ * Gets the next received packet. The packet points into the UMEM and
+ * remains valid until the next call.
+ * @return 0 if a packet was received, 1 on timeout
+ */
+int xdpsock_recv(struct XdpSocket *xsk,
+                 unsigned *length, unsigned *secs, unsigned *usecs,
+                 const unsigned char **packet);
+
+/**
+ * Makes xdpsock_recv() return immediately when the ring is empty,
+ * instead of sleeping in poll(), for --busy-poll.
+ */
+void xdpsock_set_busy_poll(struct XdpSocket *xsk);
+
+int xdpsock_selftest(void);
+
+#endif
@@ -11,6 +11,9 @@
 #include "util-safefunc.h"
 #include "stub-pcap.h"
 #include "stub-pfring.h"
+#include "rawsock-xdp.h"
+#include "rawsock-vnet.h"
+#include "stack-src.h"
 #include "pixie-timer.h"
 #include "main-globals.h"
 #include "proto-preprocess.h"
@@ -40,6 +43,9 @@ static int is_pcap_file = 0;
 #include <netinet/in.h>
 #include <net/if.h>
 #include <arpa/inet.h>
+#if defined(__linux__)
+#include <linux/if_packet.h>
+#endif
 
 #else
 #endif
@@ -260,6 +266,10 @@ adapter_from_index(unsigned index)
 void
 rawsock_flush(struct Adapter *adapter)
 {
+    if (adapter->xdp) {
+        xdpsock_flush(adapter->xdp);
+        return;
+    }
     if (adapter->sendq) {
         PCAP.sendqueue_transmit(adapter->pcap, adapter->sendq, 0);
 
@@ -297,6 +307,10 @@ rawsock_send_packet(
         packet_trace(stdout, adapter->pt_start, packet, length, 1);
     }
 
+    /* AF_XDP */
+    if (adapter->xdp)
+        return xdpsock_send(adapter->xdp, packet, length, flush);
+
     /* PF_RING */
     if (adapter->ring) {
         int err = PF_RING_ERROR_NO_TX_SLOT_AVAILABLE;
@@ -329,6 +343,10 @@ rawsock_send_packet(
         return 0;
     }
 
+    /* AF_PACKET with checksum offload */
+    if (adapter->vnet)
+        return vnetsock_send(adapter->vnet, packet, length);
+
     /* LIBPCAP */
     if (adapter->pcap)
         return PCAP.sendpacket(adapter->pcap, packet, length);
@@ -347,7 +365,9 @@ int rawsock_recv_packet(
     const unsigned char **packet)
 {
     
-    if (adapter->ring) {
+    if (adapter->xdp) {
+        return xdpsock_recv(adapter->xdp, length, secs, usecs, packet);
+    } else if (adapter->ring) {
         /* This is for doing libpfring instead of libpcap */
         struct pfring_pkthdr hdr;
         int err;
@@ -525,10 +545,191 @@ rawsock_ignore_transmits(struct Adapter *adapter, const char *ifname)
 }
 
 /***************************************************************************
+ * Linux-only: join the adapter's AF_PACKET socket to a PACKET_FANOUT
+ * group. All sockets in the same group on the same interface share the
+ * incoming traffic between them rather than each receiving a copy. We
+ * use the "hash" mode, so that all the packets of a given flow (such as
+ * the SYN-ACK, the banner, and the FIN) land on the same receive
+ * thread, which is required because each receive thread has its own
+ * TCP connection table and dedup table.
+ *
+ * PORTABILITY: libpcap on Linux is a wrapper around AF_PACKET, so we can
+ * simply apply the socket option to the underlying file descriptor.
+ * Other platforms have no equivalent, so this fails and the caller
+ * falls back to a single receive thread.
+ ***************************************************************************/
+int
+rawsock_set_fanout(struct Adapter *adapter, unsigned group_id)
+{
+#if defined(__linux__) && defined(PACKET_FANOUT)
+    int fd;
+    int err;
+    unsigned fanout_arg;
+
+    if (adapter == NULL || adapter->pcap == NULL || adapter->ring)
+        return -1;
+
+    fd = PCAP.fileno(adapter->pcap);
+    if (fd < 0)
+        return -1;
+
+    fanout_arg = (group_id & 0xFFFF)
+                | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+    err = setsockopt(fd, SOL_PACKET, PACKET_FANOUT,
+                        &fanout_arg, sizeof(fanout_arg));
+    if (err) {
+        LOG(0, "[-] if(%s): PACKET_FANOUT: %s\n",
+                adapter->ifname, strerror(errno));
+        return -1;
+    }
+    LOG(1, "[+] if(%s): joined fanout group %u\n",
+            adapter->ifname, group_id & 0xFFFF);
+    return 0;
+#else
+    UNUSEDPARM(adapter);
+    UNUSEDPARM(group_id);
+    return -1;
+#endif
+}
+
+/***************************************************************************
+ * Restricts what the adapter captures to packets matching a libpcap
+ * filter expression, like "arp". Only for libpcap handles.
+ ***************************************************************************/
+int
+rawsock_set_filter(struct Adapter *adapter, const char *filter)
+{
+    struct bpf_program bpf;
+    int err;
+
+    if (adapter == NULL || adapter->pcap == NULL || adapter->ring || adapter->xdp)
+        return -1;
+
+    memset(&bpf, 0, sizeof(bpf));
+    err = PCAP.compile(adapter->pcap, &bpf, filter, 1, 0xFFFFFFFF);
+    if (err) {
+        LOG(1, "[-] if(%s): pcap_compile(\"%s\") failed\n",
+                adapter->ifname, filter);
+        return -1;
+    }
+    err = PCAP.setfilter(adapter->pcap, &bpf);
+    PCAP.freecode(&bpf);
+    if (err) {
+        LOG(1, "[-] if(%s): pcap_setfilter: %s\n",
+                adapter->ifname, PCAP.geterr(adapter->pcap));
+        return -1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * For --busy-poll: instead of sleeping in the kernel until a packet
+ * arrives, the receive thread spins checking for packets. This burns
+ * a whole CPU, so it only makes sense when the thread has been pinned
+ * to a core of its own, but it takes the wakeup latency out of the
+ * receive path.
  ***************************************************************************/
-static void
+int
+rawsock_set_busy_poll(struct Adapter *adapter)
+{
+    if (adapter == NULL)
+        return -1;
+
+    if (adapter->xdp) {
+        xdpsock_set_busy_poll(adapter->xdp);
+        return 0;
+    } else if (adapter->ring) {
+        /* PF_RING already polls without blocking */
+        return 0;
+    } else if (adapter->pcap && !is_pcap_file) {
+        char errbuf[PCAP_ERRBUF_SIZE] = "";
+
+        if (PCAP.setnonblock(adapter->pcap, 1, errbuf) != 0) {
+            LOG(0, "[-] if(%s): pcap_setnonblock: %s\n",
+                    adapter->ifname, errbuf);
+            return -1;
+        }
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+        {
+            /* Also have the driver poll the NIC's queue directly */
+            int fd = PCAP.fileno(adapter->pcap);
+            int usecs = 50;
+            if (fd >= 0)
+                setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+        }
+#endif
+        return 0;
+    }
+    return -1;
+}
+
+/***************************************************************************
+ * Switch an open adapter over to AF_XDP (--adapter-xdp). This has to
+ * happen after we know our source IP addresses and ports, since the
+ * XDP program needs them in order to know which packets are ours. Once
+ * the socket is up, we close the libpcap handle, because the packets
+ * we want no longer reach it anyway.
+ ***************************************************************************/
+int
+rawsock_init_xdp(struct Adapter *adapter, const struct stack_src_t *src,
+                 unsigned mode, unsigned queue_id)
+{
+    if (adapter->ring) {
+        LOG(0, "[-] if(%s): can't use both PF_RING and AF_XDP\n", adapter->ifname);
+        return -1;
+    }
+    if (adapter->is_vlan) {
+        LOG(0, "[-] if(%s): AF_XDP doesn't support --adapter-vlan\n", adapter->ifname);
+        return -1;
+    }
+    if (adapter->link_type != 1) {
+        LOG(0, "[-] if(%s): AF_XDP needs an Ethernet interface\n", adapter->ifname);
+        return -1;
+    }
+
+    adapter->xdp = xdpsock_create(adapter->ifname, src, mode, queue_id);
+    if (adapter->xdp == NULL)
+        return -1;
+
+    if (adapter->pcap) {
+        PCAP.close(adapter->pcap);
+        adapter->pcap = NULL;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Send through a packet socket that lets the NIC fill in TCP/UDP
+ * checksums (--adapter-offload). Receive stays with libpcap. This only
+ * makes sense for the plain libpcap transmit path: PF_RING and AF_XDP
+ * bypass the kernel, and the Windows send queue isn't a packet socket.
+ ***************************************************************************/
+int
+rawsock_init_vnet(struct Adapter *adapter)
+{
+    if (adapter->ring || adapter->xdp || adapter->sendq
+        || adapter->pcap == NULL || adapter->link_type != 1)
+        return -1;
+    if (memcmp(adapter->ifname, "file:", 5) == 0)
+        return -1;
+
+    adapter->vnet = vnetsock_create(adapter->ifname);
+    if (adapter->vnet == NULL)
+        return -1;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
 rawsock_close_adapter(struct Adapter *adapter)
 {
+    if (adapter->xdp) {
+        xdpsock_destroy(adapter->xdp);
+    }
+    if (adapter->vnet) {
+        vnetsock_destroy(adapter->vnet);
+    }
     if (adapter->ring) {
         PFRING.close(adapter->ring);
     }
@@ -612,6 +813,7 @@ rawsock_init_adapter(const char *adapter_name,
 
     adapter->is_vlan = is_vlan;
     adapter->vlan_id = vlan_id;
+    safe_strcpy(adapter->ifname, sizeof(adapter->ifname), adapter_name);
     
     if (is_offline)
         return adapter;
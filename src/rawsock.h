@@ -7,6 +7,7 @@
 #include <stdio.h>
 struct Adapter;
 struct TemplateSet;
+struct stack_src_t;
 #include "stack-queue.h"
 
 
@@ -52,6 +53,67 @@ rawsock_init_adapter(const char *adapter_name,
                      unsigned vlan_id);
 
 
+/**
+ * Closes an adapter opened with rawsock_init_adapter() and frees it.
+ */
+void rawsock_close_adapter(struct Adapter *adapter);
+
+/**
+ * Joins the adapter's receive socket to a PACKET_FANOUT group (Linux),
+ * so that several adapters opened on the same interface split the
+ * incoming flows between them instead of each seeing every packet.
+ * @param group_id
+ *      A 16-bit number identifying the group. All the adapters that
+ *      share traffic must use the same number.
+ * @return
+ *      0 on success, or -1 if unsupported by this platform/driver
+ */
+int rawsock_set_fanout(struct Adapter *adapter, unsigned group_id);
+
+/**
+ * Only capture packets matching the libpcap filter expression.
+ * @return
+ *      0 on success, or -1 if the filter couldn't be set, such as
+ *      when not using libpcap
+ */
+int rawsock_set_filter(struct Adapter *adapter, const char *filter);
+
+/**
+ * Makes rawsock_recv_packet() return immediately when no packet is
+ * waiting, so that the receive thread spins rather than sleeping in
+ * the kernel (--busy-poll).
+ * @return
+ *      0 on success, or -1 if unsupported
+ */
+int rawsock_set_busy_poll(struct Adapter *adapter);
+
+/**
+ * Switches an adapter to use an AF_XDP socket for transmit and receive
+ * instead of libpcap (Linux only). An XDP program is attached to the
+ * interface that redirects to us only those packets addressed to
+ * 'src', so the rest of the system keeps working normally.
+ * @param mode
+ *      One of the XdpMode values from rawsock-xdp.h
+ * @param queue_id
+ *      The NIC receive queue to bind to. Packets arriving on other queues
+ *      go to the kernel, so the NIC should be set to a single queue
+ *      with something like "ethtool -L eth0 combined 1".
+ * @return
+ *      0 on success, or -1 if AF_XDP couldn't be set up
+ */
+int rawsock_init_xdp(struct Adapter *adapter, const struct stack_src_t *src,
+                     unsigned mode, unsigned queue_id);
+
+/**
+ * Sends through a Linux packet socket with PACKET_VNET_HDR, so that the
+ * NIC fills in TCP and UDP checksums (--adapter-offload). Once this
+ * succeeds, every TCP/UDP packet sent must carry just the pseudo-header
+ * sum in its checksum field, see template_set_checksum_offload().
+ * @return
+ *      0 on success, or -1 if unsupported, in which case nothing changes
+ */
+int rawsock_init_vnet(struct Adapter *adapter);
+
 /**
  * Print to the command-line the list of available adapters. It's called
  * when the "--iflist" option is specified on the command-line.
@@ -29,6 +29,10 @@ static int mass_setconfig(struct lua_State *L)
     name = luaL_checkstring(L, 2);
     value = luaL_checkstring(L, 3);
     
+    /* Already done, in a per-thread VM */
+    if (masscan == NULL)
+        return 0;
+
     masscan_set_parameter(masscan, name, value);
     
     return 0;
@@ -59,10 +63,9 @@ static int mass_gc(struct lua_State *L)
  * with this object in order to setup the scan that it wants to
  * do.
  ***************************************************************************/
-void scripting_masscan_init(struct Masscan *masscan)
+void scripting_masscan_init(struct Masscan *masscan, struct lua_State *L)
 {
     struct MasscanWrapper *wrapper;
-    struct lua_State *L = masscan->scripting.L;
 
     static const luaL_Reg my_methods[] = {
         {"setconfig",   mass_setconfig},
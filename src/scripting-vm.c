@@ -0,0 +1,230 @@
+/*
+    Per-thread Lua VMs for scripting
+
+    A lua_State can only be used by one thread at a time, so rather than
+    sharing the one created by scripting_init(), each receive thread gets
+    its own. They're all created from the same bytecode, which was
+    compiled once at startup, so the script's file isn't read (or its
+    syntax checked) again.
+
+    Each connection that runs the script needs a coroutine. Creating one
+    per connection means lots of garbage when scanning quickly, so when
+    a connection is done with it, its coroutine goes back into a pool
+    for the next connection. That's only possible if the script ran to
+    the end, since Lua 5.3 can't reset a coroutine that's in the middle
+    of something or that died with an error. Those are let go.
+*/
+#include "masscan.h"
+#include "scripting.h"
+#include "stub-lua.h"
+#include "pixie-timer.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include "unusedparm.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct ScriptingThread {
+    struct lua_State *L;
+    struct ScriptingVM *vm;
+    struct ScriptingThread *next;
+
+    /* A reference from the registry to the coroutine, so that it isn't
+     * garbage collected while we hold onto it */
+    int ref;
+};
+
+struct ScriptingVM {
+    struct lua_State *L;
+    struct ScriptingThread *freed_list;
+    struct ScriptingStats *stats;
+};
+
+/***************************************************************************
+ * Called by lua_dump() with each chunk of bytecode.
+ ***************************************************************************/
+static int
+bytecode_writer(struct lua_State *L, const void *p, size_t sz, void *ud)
+{
+    struct Masscan *masscan = (struct Masscan *)ud;
+
+    UNUSEDPARM(L);
+
+    masscan->scripting.bytecode = REALLOC(masscan->scripting.bytecode,
+                                    masscan->scripting.bytecode_length + sz);
+    memcpy(masscan->scripting.bytecode + masscan->scripting.bytecode_length,
+           p, sz);
+    masscan->scripting.bytecode_length += sz;
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scripting_compile(struct Masscan *masscan, struct lua_State *L)
+{
+    free(masscan->scripting.bytecode);
+    masscan->scripting.bytecode = NULL;
+    masscan->scripting.bytecode_length = 0;
+
+    /* The compiled function is on the top of the stack */
+    return lua_dump(L, bytecode_writer, masscan, 0);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct ScriptingVM *
+scripting_vm_create(const struct Masscan *masscan, struct ScriptingStats *stats)
+{
+    struct ScriptingVM *vm;
+    struct lua_State *L;
+    const char *filename = masscan->scripting.name;
+    int x;
+
+    if (masscan->scripting.bytecode == NULL)
+        return NULL;
+
+    L = luaL_newstate();
+    luaL_openlibs(L);
+
+    /* Scripts configure the scan from their main body, but that has
+     * already been done by the first VM, so here that does nothing */
+    scripting_masscan_init(NULL, L);
+
+    x = luaL_loadbufferx(L, masscan->scripting.bytecode,
+                         masscan->scripting.bytecode_length, filename, "b");
+    if (x == LUA_OK)
+        x = lua_pcall(L, 0, 0, 0);
+    if (x != LUA_OK) {
+        LOG(0, "%s error running: %s: %s\n", "SCRIPTING:", filename, lua_tostring(L, -1));
+        lua_close(L);
+        exit(1);
+    }
+
+    vm = CALLOC(1, sizeof(*vm));
+    vm->L = L;
+    vm->stats = stats;
+    return vm;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scripting_vm_destroy(struct ScriptingVM *vm)
+{
+    if (vm == NULL)
+        return;
+
+    /* Closing the state frees the coroutines themselves */
+    while (vm->freed_list) {
+        struct ScriptingThread *thread = vm->freed_list;
+        vm->freed_list = thread->next;
+        free(thread);
+    }
+    lua_close(vm->L);
+    free(vm);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct lua_State *
+scripting_vm_state(const struct ScriptingVM *vm)
+{
+    if (vm == NULL)
+        return NULL;
+    return vm->L;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct ScriptingThread *
+scripting_thread_acquire(struct ScriptingVM *vm)
+{
+    struct ScriptingThread *thread;
+
+    if (vm->freed_list) {
+        thread = vm->freed_list;
+        vm->freed_list = thread->next;
+        thread->next = NULL;
+        return thread;
+    }
+
+    thread = CALLOC(1, sizeof(*thread));
+    thread->vm = vm;
+    thread->L = lua_newthread(vm->L);
+    thread->ref = luaL_ref(vm->L, LUA_REGISTRYINDEX);
+    if (vm->stats)
+        vm->stats->coroutines++;
+    return thread;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+scripting_thread_release(struct ScriptingThread *thread)
+{
+    struct ScriptingVM *vm;
+
+    if (thread == NULL)
+        return;
+    vm = thread->vm;
+
+    /* Only a coroutine that ran to the end can be used again. One that's
+     * still suspended, or died with an error, is left to the GC */
+    if (lua_status(thread->L) != LUA_OK) {
+        luaL_unref(vm->L, LUA_REGISTRYINDEX, thread->ref);
+        free(thread);
+        return;
+    }
+
+    lua_settop(thread->L, 0);
+    thread->next = vm->freed_list;
+    vm->freed_list = thread;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+struct lua_State *
+scripting_thread_state(const struct ScriptingThread *thread)
+{
+    return thread->L;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scripting_thread_resume(struct ScriptingThread *thread, int nargs)
+{
+    struct ScriptingStats *stats = thread->vm->stats;
+    uint64_t start;
+    int x;
+
+    start = pixie_thread_cputime();
+    x = lua_resume(thread->L, NULL, nargs);
+    if (stats) {
+        stats->cpu_nanoseconds += pixie_thread_cputime() - start;
+        stats->calls++;
+    }
+
+    if (x != LUA_OK && x != LUA_YIELD) {
+        LOG(1, "%s error: %s\n", "SCRIPTING:", lua_tostring(thread->L, -1));
+        if (stats)
+            stats->errors++;
+    }
+    return x;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+scripting_thread_call(struct ScriptingThread *thread, const char *function)
+{
+    struct lua_State *L = thread->L;
+
+    lua_getglobal(L, function);
+    if (!lua_isfunction(L, -1)) {
+        lua_settop(L, 0);
+        return LUA_OK;
+    }
+    return scripting_thread_resume(thread, 0);
+}
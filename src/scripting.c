@@ -48,7 +48,7 @@ scripting_init(struct Masscan *masscan)
     /*
      * Create the Masscan object
      */
-    scripting_masscan_init(masscan);
+    scripting_masscan_init(masscan, L);
     
     /*
      * Load the script. This will verify the syntax.
@@ -59,6 +59,17 @@ scripting_init(struct Masscan *masscan)
         lua_close(L);
         exit(1);
     }
+
+    /*
+     * Keep the compiled script, so that each receive thread can create
+     * its own VM without going back to the file.
+     */
+    x = scripting_compile(masscan, L);
+    if (x != 0) {
+        LOG(0, "%s error compiling: %s\n", "SCRIPTING:", filename);
+        lua_close(L);
+        exit(1);
+    }
     
     /*
      * Lua: Start running the script. At this stage, the "onConnection()" function doesn't
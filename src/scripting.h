@@ -4,10 +4,25 @@
 #ifndef SCRIPTING_H
 #define SCRIPTING_H
 #include "proto-banner1.h"
+#include <stdint.h>
 struct Masscan;
+struct lua_State;
+struct ScriptingVM;
+struct ScriptingThread;
 
 extern const struct ProtocolParserStream banner_scripting;
 
+/**
+ * What the script has been doing, kept by each receive thread for the
+ * status line.
+ */
+struct ScriptingStats {
+    uint64_t cpu_nanoseconds;   /* CPU time spent running the script */
+    uint64_t calls;             /* times a coroutine was resumed */
+    uint64_t errors;            /* of which ended with an error */
+    uint64_t coroutines;        /* created, the rest were reused */
+};
+
 /**
  * Load the Lua scripting library and run the initialization
  * stage of all the specified scripts
@@ -15,9 +30,58 @@ extern const struct ProtocolParserStream banner_scripting;
 void scripting_init(struct Masscan *masscan);
 
 /**
- * Create the "Masscan" object within the scripting subsystem
+ * Create the "Masscan" object within the scripting subsystem. With a
+ * NULL 'masscan', its "setconfig" method is ignored, for the VMs
+ * created after the scan has been configured.
+ */
+void scripting_masscan_init(struct Masscan *masscan, struct lua_State *L);
+
+/**
+ * Saves the compiled script on the top of the stack of 'L' as bytecode
+ * in masscan->scripting, for scripting_vm_create().
+ * @return 0 on success
+ */
+int scripting_compile(struct Masscan *masscan, struct lua_State *L);
+
+/**
+ * Creates a Lua VM for use by a single thread, running the bytecode
+ * saved by scripting_init().
+ * @param stats
+ *      Where to count the time spent in the script, or NULL.
+ * @return NULL when not scripting
+ */
+struct ScriptingVM *
+scripting_vm_create(const struct Masscan *masscan, struct ScriptingStats *stats);
+
+void scripting_vm_destroy(struct ScriptingVM *vm);
+
+struct lua_State *scripting_vm_state(const struct ScriptingVM *vm);
+
+/**
+ * Gets a coroutine for running the script on a connection, from the
+ * VM's pool if there's one there.
+ */
+struct ScriptingThread *scripting_thread_acquire(struct ScriptingVM *vm);
+
+/**
+ * Gives a coroutine back to the pool when the connection is done.
+ */
+void scripting_thread_release(struct ScriptingThread *thread);
+
+struct lua_State *scripting_thread_state(const struct ScriptingThread *thread);
+
+/**
+ * Resumes the coroutine with 'nargs' arguments on its stack, counting the
+ * CPU time it takes.
+ * @return LUA_OK when finished, LUA_YIELD if suspended, or an error
+ */
+int scripting_thread_resume(struct ScriptingThread *thread, int nargs);
+
+/**
+ * Starts the named global function (like "onConnection") in the
+ * coroutine, if the script has defined one.
  */
-void scripting_masscan_init(struct Masscan *masscan);
+int scripting_thread_call(struct ScriptingThread *thread, const char *function);
 
 #endif
 
@@ -289,20 +289,6 @@ stack_arp_incoming_request( struct stack_t *stack,
     memset(&request, 0, sizeof(request));
 
 
-    /* Get a buffer for sending the response packet. This thread doesn't
-     * send the packet itself. Instead, it formats a packet, then hands
-     * that packet off to a transmit thread for later transmission. */
-    response = stack_get_packetbuffer(stack);
-    if (response == NULL)
-        return -1;
-
-    /* ARP packets are too short, so increase the packet size to
-     * the Ethernet minimum */
-    response->length = 60;
-
-    /* Fill the padded area with zeroes to avoid leaking data */
-    memset(response->px, 0, response->length);
-
     /*
      * Parse the response as an ARP packet
      */
@@ -326,6 +312,21 @@ stack_arp_incoming_request( struct stack_t *stack,
         return -1;
     }
 
+    /* Get a buffer for sending the response packet. This thread doesn't
+     * send the packet itself. Instead, it formats a packet, then hands
+     * that packet off to the transmit thread's priority lane, so that
+     * it goes out ahead of everything else. */
+    response = stack_get_priority_packetbuffer(stack);
+    if (response == NULL)
+        return -1;
+
+    /* ARP packets are too short, so increase the packet size to
+     * the Ethernet minimum */
+    response->length = 60;
+
+    /* Fill the padded area with zeroes to avoid leaking data */
+    memset(response->px, 0, response->length);
+
     /*
      * Create the response packet
      */
@@ -356,7 +357,7 @@ stack_arp_incoming_request( struct stack_t *stack,
     /*
      * Now queue the packet up for transmission
      */
-    stack_transmit_packetbuffer(stack, response);
+    stack_transmit_priority(stack, response);
 
     return 0;
 }
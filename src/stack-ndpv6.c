@@ -135,8 +135,8 @@ stack_ndpv6_incoming_request(struct stack_t *stack, struct PreprocessedInfo *par
     
     /* Get a buffer for sending the response packet. This thread doesn't
      * send the packet itself. Instead, it formats a packet, then hands
-     * that packet off to a transmit thread for later transmission. */
-    response = stack_get_packetbuffer(stack);
+     * that packet off to the transmit thread's priority lane. */
+    response = stack_get_priority_packetbuffer(stack);
     if (response == NULL)
         return -1; 
 
@@ -177,7 +177,7 @@ stack_ndpv6_incoming_request(struct stack_t *stack, struct PreprocessedInfo *par
 
     /* Transmit the packet-buffer */
     response->length = offset;
-    stack_transmit_packetbuffer(stack, response);
+    stack_transmit_priority(stack, response);
     return 0;
 }
 
@@ -34,6 +34,70 @@ stack_transmit_packetbuffer(struct stack_t *stack, struct PacketBuffer *response
     }
 }
 
+struct PacketBuffer *
+stack_get_priority_packetbuffer(struct stack_t *stack)
+{
+    struct PacketBuffer *response = NULL;
+    int err;
+
+    err = rte_ring_sc_dequeue(stack->priority_buffers, (void**)&response);
+    if (err != 0) {
+        /* Dropping a neighbor reply is harmless, since the router will
+         * ask again, but stalling the receive thread isn't */
+        stack->neighbor.dropped++;
+        return NULL;
+    }
+    return response;
+}
+
+void
+stack_transmit_priority(struct stack_t *stack, struct PacketBuffer *response)
+{
+    int err;
+
+    response->timestamp = pixie_gettime();
+
+    /* The priority queue has a slot for every priority buffer */
+    for (err=1; err; ) {
+        err = rte_ring_sp_enqueue(stack->priority_queue, response);
+        if (err) {
+            fprintf(stderr, "[-] priority queue full (should be impossible)\n");
+            pixie_usleep(1000);
+        }
+    }
+}
+
+/***************************************************************************
+ * Send everything in the priority lane, and recycle the buffers.
+ ***************************************************************************/
+static void
+stack_flush_priority(
+    struct stack_t *stack,
+    struct Adapter *adapter,
+    uint64_t *packets_sent)
+{
+    for (;;) {
+        struct PacketBuffer *p;
+        uint64_t latency;
+        int err;
+
+        err = rte_ring_sc_dequeue(stack->priority_queue, (void**)&p);
+        if (err)
+            break;
+
+        rawsock_send_packet(adapter, p->px, (unsigned)p->length, 1);
+
+        latency = pixie_gettime() - p->timestamp;
+        stack->neighbor.replies++;
+        stack->neighbor.latency_total += latency;
+        if (stack->neighbor.latency_max < latency)
+            stack->neighbor.latency_max = latency;
+
+        rte_ring_sp_enqueue(stack->priority_buffers, p);
+        (*packets_sent)++;
+    }
+}
+
 /***************************************************************************
  * The receive thread doesn't transmit packets. Instead, it queues them
  * up on the transmit thread. Every so often, the transmit thread needs
@@ -50,6 +114,12 @@ stack_flush_packets(
     uint64_t *packets_sent,
     uint64_t *batchsize)
 {
+    /*
+     * ARP and NDP replies go first, regardless of the throttler, since
+     * if the router's neighbor entry for us expires we lose everything
+     */
+    stack_flush_priority(stack, adapter, packets_sent);
+
     /*
      * Send a batch of queued packets
      */
@@ -111,11 +181,12 @@ stack_create(macaddress_t source_mac, struct stack_src_t *src)
 #define BUFFER_COUNT 16384
     stack->packet_buffers = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
     stack->transmit_queue = rte_ring_create(BUFFER_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    stack->buffers = HUGE_CALLOC(BUFFER_COUNT-1, sizeof(stack->buffers[0]));
     for (i=0; i<BUFFER_COUNT-1; i++) {
         struct PacketBuffer *p;
         int err;
 
-        p = MALLOC(sizeof(*p));
+        p = &stack->buffers[i];
         err = rte_ring_sp_enqueue(stack->packet_buffers, p);
         if (err) {
             /* I dunno why but I can't queue all 256 packets, just 255 */
@@ -123,8 +194,32 @@ stack_create(macaddress_t source_mac, struct stack_src_t *src)
         }
     }
 
+    /*
+     * Allocate the priority lane
+     */
+#define PRIORITY_COUNT 256
+    stack->priority_buffers = rte_ring_create(PRIORITY_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    stack->priority_queue = rte_ring_create(PRIORITY_COUNT, RING_F_SP_ENQ|RING_F_SC_DEQ);
+    stack->priority_backing = CALLOC(PRIORITY_COUNT-1, sizeof(stack->priority_backing[0]));
+    for (i=0; i<PRIORITY_COUNT-1; i++)
+        rte_ring_sp_enqueue(stack->priority_buffers, &stack->priority_backing[i]);
+
     return stack;
 }
 
+void
+stack_destroy(struct stack_t *stack)
+{
+    if (stack == NULL)
+        return;
+    free(stack->packet_buffers);
+    free(stack->transmit_queue);
+    HUGE_FREE(stack->buffers);
+    free(stack->priority_buffers);
+    free(stack->priority_queue);
+    free(stack->priority_backing);
+    free(stack);
+}
+
 
 
@@ -10,12 +10,34 @@ typedef struct rte_ring PACKET_QUEUE;
 
 struct PacketBuffer {
     size_t length;
+    uint64_t timestamp; /* when queued, for priority packets */
     unsigned char px[2040];
 };
 
+/**
+ * Counters for the ARP/NDP replies sent through the priority lane.
+ * The receive thread writes 'dropped', the transmit thread the rest.
+ */
+struct NeighborStats {
+    uint64_t replies;
+    uint64_t dropped;
+    uint64_t latency_total; /* microseconds from queued to sent */
+    uint64_t latency_max;
+};
+
 struct stack_t {
     PACKET_QUEUE *packet_buffers;
     PACKET_QUEUE *transmit_queue;
+    struct PacketBuffer *buffers; /* backing memory for packet_buffers */
+
+    /* A small separate lane for ARP and NDP replies, so that they
+     * never wait behind thousands of queued RSTs and banner packets,
+     * nor starve for free buffers */
+    PACKET_QUEUE *priority_buffers;
+    PACKET_QUEUE *priority_queue;
+    struct PacketBuffer *priority_backing;
+    struct NeighborStats neighbor;
+
     macaddress_t source_mac;
     struct stack_src_t *src;
 };
@@ -35,6 +57,26 @@ stack_get_packetbuffer(struct stack_t *stack);
 void
 stack_transmit_packetbuffer(struct stack_t *stack, struct PacketBuffer *response);
 
+/**
+ * Get a buffer from the priority lane, for ARP/NDP replies. Unlike
+ * stack_get_packetbuffer(), this never waits.
+ * @return NULL if all priority buffers are in flight
+ */
+struct PacketBuffer *
+stack_get_priority_packetbuffer(struct stack_t *stack);
+
+/**
+ * Queue up a priority packet. These are sent before anything else
+ * the next time the transmit thread flushes, whatever the throttler
+ * says.
+ */
+void
+stack_transmit_priority(struct stack_t *stack, struct PacketBuffer *response);
+
+/**
+ * Sends queued packets, the priority lane first. Priority packets are
+ * always all sent, normal packets only up to 'batchsize'.
+ */
 void
 stack_flush_packets(
     struct stack_t *stack,
@@ -45,4 +87,11 @@ stack_flush_packets(
 struct stack_t *
 stack_create(macaddress_t source_mac, struct stack_src_t *src);
 
+/**
+ * Frees a stack that no thread is using, such as one for a receive
+ * thread that ended up not being started.
+ */
+void
+stack_destroy(struct stack_t *stack);
+
 #endif
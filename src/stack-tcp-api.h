@@ -35,6 +35,26 @@ tcpapi_set_timeout(struct stack_handle_t *socket,
                    unsigned usecs
                    );
 
+/**
+ * How long to wait for the server to speak first, before sending our
+ * hello, based on what servers on the same port have done. This also
+ * starts the clock for tcpapi_hello_result().
+ * @param is_hello
+ *      Whether we have a hello to send. If not, there's nothing to do but
+ *      wait the full time.
+ * @return
+ *      microseconds to wait, possibly 0
+ */
+unsigned
+tcpapi_hello_wait(struct stack_handle_t *socket, bool is_hello);
+
+/**
+ * Tells the stack whether the server spoke first, so that it learns for
+ * the next connections to this port.
+ */
+void
+tcpapi_hello_result(struct stack_handle_t *socket, bool is_spoke_first);
+
 /**
  * Change from the "send" state to the "receive" state.
  * Has no effect if in any state other than "send".
@@ -66,14 +66,23 @@ again:
                      * By default, wait for the "hello timeout" period
                      * receiving any packets they send us. If nothing is
                      * received in this period, then timeout will cause us
-                     * to switch to sending
+                     * to switch to sending. How long that is depends on
+                     * what other servers on this port have done, and
+                     * may be no wait at all.
                      */
                     if (stream != NULL && (stream->flags & SF__nowait_hello) != 0) {
                         tcpapi_change_app_state(socket, App_SendFirst);
                         state = App_SendFirst;
                         goto again;
                     } else {
-                        tcpapi_set_timeout(socket, 2 /*tcpcon->timeout_hello*/, 0);
+                        unsigned wait = tcpapi_hello_wait(socket, stream != NULL);
+
+                        if (wait == 0) {
+                            tcpapi_change_app_state(socket, App_SendFirst);
+                            state = App_SendFirst;
+                            goto again;
+                        }
+                        tcpapi_set_timeout(socket, wait / 1000000, wait % 1000000);
                         tcpapi_recv(socket);
                         tcpapi_change_app_state(socket, App_ReceiveHello);
                     }
@@ -91,6 +100,7 @@ again:
                     /* We've got no response from the initial connection,
                      * so switch from them being responsible for communications
                      * to us being responsible, and start sending */
+                    tcpapi_hello_result(socket, false);
                     if (stream) {
                         tcpapi_change_app_state(socket, App_SendFirst);
                         state = App_SendFirst;
@@ -100,6 +110,7 @@ again:
                 case APP_RECV_PAYLOAD:
                     /* We've receive some data from them, so wait for some more.
                      * This means we won't be transmitting anything to them. */
+                    tcpapi_hello_result(socket, true);
                     tcpapi_change_app_state(socket, App_ReceiveNext);
                     state = App_ReceiveNext;
                     goto again;
@@ -81,6 +81,7 @@
 #include "util-malloc.h"
 #include "util-errormsg.h"
 #include "scripting.h"
+#include "stack-tcp-learn.h"
 
 
 #ifdef _MSC_VER
@@ -89,6 +90,21 @@
 #pragma warning(disable:4996)
 #endif
 
+/**
+ * Banners bigger than this are written out in pieces of this size while
+ * the connection is still open. Output formats escape non-printable bytes
+ * into as many as 4 characters within a MAX_BANNER_LENGTH buffer, so
+ * this makes sure no piece gets cut short there. The connection's total
+ * is still capped by --banner-limit, beyond which the banner is truncated.
+ */
+#define BANNER_CHUNK (MAX_BANNER_LENGTH/4)
+
+/**
+ * The most banner bytes we keep from one connection, unless changed
+ * with --banner-limit.
+ */
+#define BANNER_LIMIT_DEFAULT (64*1024)
+
 struct TCP_Segment {
     unsigned seqno;
     unsigned char *buf;
@@ -133,6 +149,14 @@ struct TCP_Control_Block
     unsigned is_small_window:1; /* send with smaller window */
     unsigned is_their_fin:1;
 
+    /** Set while the ACK of their SYN-ACK hasn't been sent yet, because
+     * it may go out with the first segment of our hello instead */
+    unsigned is_ack_deferred:1;
+
+    /** Set while waiting the full hello timeout for their greeting, the
+     * outcome of which goes into the --hello-learn statistics */
+    unsigned is_hello_sampled:1;
+
     /** Set to true when the TCB is in-use/allocated, set to zero
      * when it's about to be deleted soon */
     unsigned is_active:1;
@@ -152,6 +176,10 @@ struct TCP_Control_Block
     */
     time_t when_created;
 
+    /** When we started waiting for their greeting */
+    unsigned hello_secs;
+    unsigned hello_usecs;
+
     /*
      * If Running a script, the thread object
      */
@@ -186,6 +214,20 @@ struct TCP_ConnectionTable {
     
     struct ScriptingVM *scripting_vm;
 
+    /** Where TCBs get memory for banners, and how much each may hold
+     * (--banner-limit) */
+    struct BannerPool *banner_pool;
+    unsigned banner_limit;
+
+    /** Where we count handshakes, may be NULL */
+    struct TcpHandshakeStats *handshake_stats;
+
+    /** Whether servers speak first on each port, as seen by this thread,
+     * and as loaded from a file, either may be NULL */
+    struct HelloLearn *hello_learn;
+    const struct HelloLearn *hello_prior;
+    unsigned hello_explore;
+
     /** This is for creating follow-up connections based on the first
      * connection. Given an existing IP/port, it returns a different
      * one for the new conenction. */
@@ -487,6 +529,12 @@ tcpcon_set_parameter(struct TCP_ConnectionTable *tcpcon,
         LOG(1, "TCP connection-timeout = %u\n", tcpcon->timeout_connection);
         return;
     }
+    if (name_equals(name, "banner-limit")) {
+        uint64_t n = parseInt(value, value_length);
+        tcpcon->banner_limit = (unsigned)n;
+        LOG(1, "TCP banner-limit = %u\n", tcpcon->banner_limit);
+        return;
+    }
     if (name_equals(name, "hello-timeout")) {
         uint64_t n = parseInt(value, value_length);
         tcpcon->timeout_hello = (unsigned)n;
@@ -637,9 +685,35 @@ tcpcon_set_banner_flags(struct TCP_ConnectionTable *tcpcon,
 
 /***************************************************************************
  ***************************************************************************/
-void scripting_init_tcp(struct TCP_ConnectionTable *tcpcon, struct lua_State *L)
+void tcpcon_set_banner_pool(struct TCP_ConnectionTable *tcpcon, struct BannerPool *pool)
+{
+    tcpcon->banner_pool = pool;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void tcpcon_set_handshake_stats(struct TCP_ConnectionTable *tcpcon,
+                                struct TcpHandshakeStats *stats)
+{
+    tcpcon->handshake_stats = stats;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void tcpcon_set_hello_learn(struct TCP_ConnectionTable *tcpcon,
+                            struct HelloLearn *learn,
+                            const struct HelloLearn *prior)
 {
-    tcpcon->banner1->L = L;
+    tcpcon->hello_learn = learn;
+    tcpcon->hello_prior = prior;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void scripting_init_tcp(struct TCP_ConnectionTable *tcpcon, struct ScriptingVM *vm)
+{
+    tcpcon->scripting_vm = vm;
+    tcpcon->banner1->L = scripting_vm_state(vm);
     
     banner_scripting.init(tcpcon->banner1);
 }
@@ -667,6 +741,7 @@ tcpcon_create_table(    size_t entry_count,
         tcpcon->timeout_connection = 30; /* half a minute before destroying tcb */
     tcpcon->timeout_hello = 2;
     tcpcon->entropy = entropy;
+    tcpcon->banner_limit = BANNER_LIMIT_DEFAULT;
 
     /* Find nearest power of 2 to the tcb count, but don't go
      * over the number 16-million */
@@ -690,12 +765,11 @@ tcpcon_create_table(    size_t entry_count,
     /* Create the table. If we can't allocate enough memory, then shrink
      * the desired size of the table */
     while (tcpcon->entries == 0) {
-        tcpcon->entries = malloc(entry_count * sizeof(*tcpcon->entries));
+        tcpcon->entries = huge_calloc_try(entry_count, sizeof(*tcpcon->entries));
         if (tcpcon->entries == NULL) {
             entry_count >>= 1;
         }
     }
-    memset(tcpcon->entries, 0, entry_count * sizeof(*tcpcon->entries));
 
 
     /* fill in the table structure */
@@ -791,6 +865,50 @@ enum DestroyReason {
 
 };
 
+/***************************************************************************
+ * Writes out banners while the connection is still going, rather than
+ * holding everything until it closes: those the parser has said are
+ * finished, like each certificate in a chain, and any that have grown
+ * to BANNER_CHUNK, like a big web page, which are written in pieces.
+ * Whatever comes after the connection's --banner-limit is dropped.
+ ***************************************************************************/
+static void
+banner_stream(struct TCP_ConnectionTable *tcpcon, struct TCP_Control_Block *tcb)
+{
+    struct BannerOutput *banout;
+    struct BannerOutput *next;
+
+    for (banout = &tcb->banout; banout != NULL; banout = next) {
+        unsigned proto = banout->protocol & 0x0FFFFFFF;
+        unsigned is_finished = (banout->protocol & 0x80000000) != 0;
+
+        next = banout->next;
+        if (banout->length == 0 || proto == 0)
+            continue;
+
+        /* The heuristic banner gets parsed again once the protocol
+         * is known, so it has to stay whole */
+        if (!is_finished && (banout->length < BANNER_CHUNK || proto == PROTO_HEUR))
+            continue;
+
+        tcpcon->report_banner(
+                              tcpcon->out,
+                              global_now,
+                              tcb->ip_them,
+                              6, /*TCP protocol*/
+                              tcb->port_them,
+                              proto,
+                              tcb->ttl,
+                              banout->banner,
+                              banout->length);
+
+        if (is_finished)
+            banout_discard(&tcb->banout, banout);
+        else
+            banout->length = 0;
+    }
+}
+
 /***************************************************************************
  * Flush all the banners associated with this TCP connection. This always
  * called when TCB is destroyed. This may also be called earlier, such
@@ -893,7 +1011,7 @@ tcpcon_destroy_tcb(
     }
     
     if (tcb->scripting_thread)
-        ; //scripting_thread_close(tcb->scripting_thread);
+        scripting_thread_release(tcb->scripting_thread);
     tcb->scripting_thread = 0;
     
     /* KLUDGE: this needs to be made elegant */
@@ -937,6 +1055,12 @@ tcpcon_destroy_table(struct TCP_ConnectionTable *tcpcon)
     if (tcpcon == NULL)
         return;
 
+    if (tcpcon->handshake_stats) {
+        LOG(1, "[+] tcp: %llu handshakes, %llu ACKs sent with data\n",
+            (unsigned long long)tcpcon->handshake_stats->handshakes,
+            (unsigned long long)tcpcon->handshake_stats->acks_merged);
+    }
+
     /*
      * Do a graceful destruction of all the entires. If they have banners,
      * they will be sent to the output
@@ -956,7 +1080,7 @@ tcpcon_destroy_table(struct TCP_ConnectionTable *tcpcon)
     }
 
     banner1_destroy(tcpcon->banner1);
-    free(tcpcon->entries);
+    HUGE_FREE(tcpcon->entries);
     free(tcpcon);
 }
 
@@ -1046,7 +1170,13 @@ tcpcon_create_tcb(
         stream = banner1->payloads.tcp[port_them];
     }
     tcb->stream = stream;
-    banout_init(&tcb->banout);
+    banout_init_pool(&tcb->banout, tcpcon->banner_pool, tcpcon->banner_limit);
+
+    /* Run the script on this connection */
+    if (stream == &banner_scripting && tcpcon->scripting_vm) {
+        tcb->scripting_thread = scripting_thread_acquire(tcpcon->scripting_vm);
+        scripting_thread_call(tcb->scripting_thread, "onConnection");
+    }
 
     /* The TCB is now allocated/in-use */
     assert(tcb->ip_me.version != 0 && tcb->ip_them.version != 0);
@@ -1118,6 +1248,13 @@ tcpcon_send_packet(
     /* If sending an ACK, print a message */
     if ((tcp_flags & 0x10) == 0x10) {
         LOGtcb(tcb, 0, "xmit ACK ackingthem=%u\n", tcb->seqno_them-tcb->seqno_them_first);
+
+        /* This acknowledges their SYN-ACK too, so no bare ACK is needed */
+        if (tcb->is_ack_deferred) {
+            tcb->is_ack_deferred = 0;
+            if (tcpcon->handshake_stats)
+                tcpcon->handshake_stats->acks_merged++;
+        }
     }
 
     /* Get a buffer for sending the response packet. This thread doesn't
@@ -1161,7 +1298,8 @@ tcpcon_send_packet(
      * KLUDGE:
      */
     if (tcb->is_small_window)
-        tcp_set_window(response->px, response->length, 600);
+        tcp_set_window(tcpcon->pkt_template,
+                       response->px, response->length, 600);
     
     /* Put this buffer on the transmit queue. Remember: transmits happen
      * from a transmit-thread only, and this function is being called
@@ -1172,13 +1310,14 @@ tcpcon_send_packet(
 
 /***************************************************************************
  ***************************************************************************/
-void
-tcp_send_RST(
+static void
+_tcp_send_flags(
     struct TemplatePacket *templ,
     struct stack_t *stack,
     ipaddress ip_them, ipaddress ip_me,
     unsigned port_them, unsigned port_me,
-    unsigned seqno_them, unsigned seqno_me
+    unsigned seqno_them, unsigned seqno_me,
+    unsigned flags
 )
 {
     struct PacketBuffer *response = 0;
@@ -1205,7 +1344,7 @@ tcp_send_RST(
         ip_them, port_them,
         ip_me, port_me,
         seqno_me, seqno_them,
-        0x04, /*RST*/
+        flags,
         0, 0,
         response->px, sizeof(response->px)
         );
@@ -1218,6 +1357,36 @@ tcp_send_RST(
     stack_transmit_packetbuffer(stack, response);
 }
 
+/***************************************************************************
+ ***************************************************************************/
+void
+tcp_send_RST(
+    struct TemplatePacket *templ,
+    struct stack_t *stack,
+    ipaddress ip_them, ipaddress ip_me,
+    unsigned port_them, unsigned port_me,
+    unsigned seqno_them, unsigned seqno_me
+)
+{
+    _tcp_send_flags(templ, stack, ip_them, ip_me, port_them, port_me,
+                    seqno_them, seqno_me, 0x04 /*RST*/);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+tcp_send_ACK(
+    struct TemplatePacket *templ,
+    struct stack_t *stack,
+    ipaddress ip_them, ipaddress ip_me,
+    unsigned port_them, unsigned port_me,
+    unsigned seqno_them, unsigned seqno_me
+)
+{
+    _tcp_send_flags(templ, stack, ip_them, ip_me, port_them, port_me,
+                    seqno_them, seqno_me, 0x10 /*ACK*/);
+}
+
 
 /***************************************************************************
  * DEBUG: when printing debug messages (-d option), this prints a string
@@ -1591,6 +1760,7 @@ banner_parse(
                                     payload_length,
                                     &tcb->banout,
                                     socket);
+    banner_stream(tcpcon, tcb);
     return payload_length;
 }
 
@@ -1714,11 +1884,13 @@ tcpapi_set_timeout(struct stack_handle_t *socket,
                         unsigned secs,
                         unsigned usecs
                         ) {
-    struct TCP_ConnectionTable *tcpcon = socket->tcpcon;
-    struct TCP_Control_Block *tcb = socket->tcb;
+    struct TCP_ConnectionTable *tcpcon;
+    struct TCP_Control_Block *tcb;
 
-    if (socket == NULL)
+    if (socket == NULL || socket->tcb == NULL)
         return SOCKERR_EBADF;
+    tcpcon = socket->tcpcon;
+    tcb = socket->tcb;
 
     timeouts_add(tcpcon->timeouts,
              tcb->timeout,
@@ -1729,6 +1901,65 @@ tcpapi_set_timeout(struct stack_handle_t *socket,
 }
 
 
+/***************************************************************************
+ * One connection in this many waits the full time even on ports we've
+ * learned about, to keep on learning.
+ ***************************************************************************/
+#define HELLO_EXPLORE 16
+
+unsigned
+tcpapi_hello_wait(struct stack_handle_t *socket, bool is_hello) {
+    struct TCP_ConnectionTable *tcpcon;
+    struct TCP_Control_Block *tcb;
+    unsigned default_ms;
+    unsigned wait_ms;
+
+    if (socket == NULL || socket->tcb == NULL)
+        return 0;
+    tcpcon = socket->tcpcon;
+    tcb = socket->tcb;
+    default_ms = tcpcon->timeout_hello * 1000;
+
+    if (is_hello)
+        wait_ms = hellolearn_wait(tcpcon->hello_learn, tcpcon->hello_prior,
+                                  tcb->port_them, default_ms);
+    else
+        wait_ms = default_ms;
+    if (wait_ms != default_ms && (++tcpcon->hello_explore % HELLO_EXPLORE) == 0)
+        wait_ms = default_ms;
+
+    /* Only waiting the full time tells us whether they speak first */
+    tcb->is_hello_sampled = (wait_ms == default_ms && tcpcon->hello_learn);
+    tcb->hello_secs = socket->secs;
+    tcb->hello_usecs = socket->usecs;
+
+    return wait_ms * 1000;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+tcpapi_hello_result(struct stack_handle_t *socket, bool is_spoke_first) {
+    struct TCP_ConnectionTable *tcpcon;
+    struct TCP_Control_Block *tcb;
+    int64_t elapsed;
+
+    if (socket == NULL || socket->tcb == NULL)
+        return;
+    tcpcon = socket->tcpcon;
+    tcb = socket->tcb;
+    if (!tcb->is_hello_sampled)
+        return;
+    tcb->is_hello_sampled = 0;
+
+    elapsed = ((int64_t)socket->secs - tcb->hello_secs) * 1000000
+                + ((int64_t)socket->usecs - tcb->hello_usecs);
+    if (elapsed < 0)
+        elapsed = 0;
+    hellolearn_record(tcpcon->hello_learn, tcb->port_them,
+                      is_spoke_first, (unsigned)(elapsed / 1000));
+}
+
 /***************************************************************************
  ***************************************************************************/
 int
@@ -2019,10 +2250,22 @@ stack_incoming_tcp(struct TCP_ConnectionTable *tcpcon,
                     LOGtcb(tcb, 1, "%s connection established\n",
                            what_to_string(what));
 
-                    /* Send "ACK" to acknowlege their "SYN-ACK" */
-                    _tcb_send_ack(tcpcon, tcb);
+                    if (tcpcon->handshake_stats)
+                        tcpcon->handshake_stats->handshakes++;
+
+                    /* Acknowledge their "SYN-ACK". When the application
+                     * sends its hello right away (SF__nowait_hello), the
+                     * first segment of that does this for us, so we
+                     * only send a bare ACK if it didn't. The TCB may
+                     * have been destroyed by then, or even reused,
+                     * but in either case the flag is cleared */
+                    tcb->is_ack_deferred = 1;
                     _tcb_change_state_to(tcb, STATE_ESTABLISHED_RECV);
                     application_notify(tcpcon, tcb, APP_CONNECTED, 0, 0, secs, usecs);
+                    if (tcb->is_active && tcb->is_ack_deferred) {
+                        tcb->is_ack_deferred = 0;
+                        _tcb_send_ack(tcpcon, tcb);
+                    }
                     break;
                 default:
                     ERRMSGip(tcb->ip_them, tcb->port_them, "%s:%s **** UNHANDLED EVENT ****\n", 
@@ -2312,3 +2555,52 @@ stack_incoming_tcp(struct TCP_ConnectionTable *tcpcon,
     return TCB__okay;
 }
 
+
+/***************************************************************************
+ * Checks that the timeouts the apps ask for, such as the hello wait,
+ * end up at the right tick in the timeout ring.
+ ***************************************************************************/
+int
+tcpcon_selftest(void)
+{
+    struct TCP_ConnectionTable tcpcon;
+    struct TCP_Control_Block tcb;
+    struct stack_handle_t socket;
+    uint64_t start;
+    void *p;
+    int is_fail = 0;
+
+    memset(&tcpcon, 0, sizeof(tcpcon));
+    memset(&tcb, 0, sizeof(tcb));
+    socket.tcpcon = &tcpcon;
+    socket.tcb = &tcb;
+    socket.secs = 1000;
+    socket.usecs = 900000;
+    start = TICKS_FROM_TV(socket.secs, socket.usecs);
+    tcpcon.timeouts = timeouts_create(start);
+
+    /* A 250 millisecond wait is a quarter of a second worth of ticks,
+     * even when it carries over into the next second */
+    tcpapi_set_timeout(&socket, 0, 250000);
+    if (tcb.timeout->timestamp - start != TICKS_PER_SECOND / 4)
+        is_fail = 1;
+
+    /* Nothing fires after only 100 milliseconds, but it has by 250 */
+    p = timeouts_remove(tcpcon.timeouts, start + TICKS_FROM_USECS(100000));
+    if (p != NULL)
+        is_fail = 1;
+    p = timeouts_remove(tcpcon.timeouts, start + TICKS_FROM_USECS(250000));
+    if (p != &tcb)
+        is_fail = 1;
+
+    tcpapi_set_timeout(&socket, 2, 500000);
+    if (tcb.timeout->timestamp - start != TICKS_PER_SECOND * 5 / 2)
+        is_fail = 1;
+
+    HUGE_FREE(tcpcon.timeouts);
+    if (is_fail) {
+        fprintf(stderr, "[-] tcpcon: selftest failed: timeouts\n");
+        return 1;
+    }
+    return 0;
+}
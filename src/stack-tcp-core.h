@@ -10,6 +10,9 @@ struct TCP_Control_Block;
 struct TemplatePacket;
 struct TCP_ConnectionTable;
 struct lua_State;
+struct ScriptingVM;
+struct BannerPool;
+struct HelloLearn;
 struct ProtocolParserStream;
 
 #define TCP_SEQNO(px,i) (px[i+4]<<24|px[i+5]<<16|px[i+6]<<8|px[i+7])
@@ -47,7 +50,37 @@ tcpcon_set_http_header(struct TCP_ConnectionTable *tcpcon,
                         const void *value,
                         enum http_field_t what);
 
-void scripting_init_tcp(struct TCP_ConnectionTable *tcpcon, struct lua_State *L);
+void scripting_init_tcp(struct TCP_ConnectionTable *tcpcon, struct ScriptingVM *vm);
+
+/**
+ * Banners for new connections get their memory from this pool, which
+ * belongs to the same thread as the table.
+ */
+void tcpcon_set_banner_pool(struct TCP_ConnectionTable *tcpcon, struct BannerPool *pool);
+
+/**
+ * Counts of completed handshakes, and of those whose ACK went out in the
+ * same segment as the first data we sent rather than on its own.
+ */
+struct TcpHandshakeStats {
+    uint64_t handshakes;
+    uint64_t acks_merged;
+};
+
+/**
+ * Where the table counts handshakes, which belongs to the same thread.
+ */
+void tcpcon_set_handshake_stats(struct TCP_ConnectionTable *tcpcon,
+                                struct TcpHandshakeStats *stats);
+
+/**
+ * Where the table records, and looks up, whether servers on a port speak
+ * first (--hello-learn). The first belongs to the same thread, the
+ * second is shared, read-only. Either may be NULL.
+ */
+void tcpcon_set_hello_learn(struct TCP_ConnectionTable *tcpcon,
+                            struct HelloLearn *learn,
+                            const struct HelloLearn *prior);
 
 /**
  * Create a TCP connection table (to store TCP control blocks) with
@@ -164,4 +197,20 @@ tcp_send_RST(
     unsigned seqno_them, unsigned seqno_me
 );
 
+/**
+ * Send a bare ACK, also without a TCP connection table. This is how
+ * --stateless-banners completes the handshake.
+ */
+void
+tcp_send_ACK(
+    struct TemplatePacket *templ,
+    struct stack_t *stack,
+    ipaddress ip_them, ipaddress ip_me,
+    unsigned port_them, unsigned port_me,
+    unsigned seqno_them, unsigned seqno_me
+);
+
+int
+tcpcon_selftest(void);
+
 #endif
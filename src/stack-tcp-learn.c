@@ -0,0 +1,341 @@
+/*
+    Learning which ports have servers that speak first
+
+    See stack-tcp-learn.h. The delay before a greeting is kept as a small
+    histogram per port, so that we can pick a wait that catches nearly
+    all of them without remembering every sample. The file is text,
+    one line per port:
+
+        port connections spoke-first <100ms <250ms <500ms <1s <2s more
+
+    where the last columns split up the 'spoke-first' count by delay.
+
+    Loading a file halves its counts, so that what was learned in
+    earlier scans counts for less and less, and servers that changed
+    what they do don't stay stuck with what they used to do.
+*/
+#include "stack-tcp-learn.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HELLOLEARN_BUCKETS 6
+
+/** Upper bound of each bucket of delays, in milliseconds */
+static const unsigned bucket_ms[HELLOLEARN_BUCKETS] = {
+    100, 250, 500, 1000, 2000, ~0U
+};
+
+/** Below this many samples, a port gets the default wait */
+#define HELLOLEARN_MIN_SAMPLES 16
+
+/** A port whose servers spoke first on fewer than 1 in this many
+ * connections is one where we don't wait at all */
+#define HELLOLEARN_RARE 32
+
+/** Waits long enough for this percent of those that spoke first */
+#define HELLOLEARN_COVER 95
+
+/** Each time the counts are loaded from a file, they are divided by
+ * this, so a scan counts twice as much as the one before it */
+#define HELLOLEARN_DECAY 2
+
+struct HelloLearnPort {
+    unsigned connections;
+    unsigned spoke_first;
+    unsigned delays[HELLOLEARN_BUCKETS];
+};
+
+struct HelloLearn {
+    struct HelloLearnPort ports[65536];
+};
+
+/***************************************************************************
+ ***************************************************************************/
+struct HelloLearn *
+hellolearn_create(void)
+{
+    return CALLOC(1, sizeof(struct HelloLearn));
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+hellolearn_destroy(struct HelloLearn *learn)
+{
+    free(learn);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+hellolearn_record(struct HelloLearn *learn, unsigned port,
+                  unsigned is_spoke_first, unsigned delay_ms)
+{
+    struct HelloLearnPort *p;
+    unsigned i;
+
+    if (learn == NULL)
+        return;
+    p = &learn->ports[port & 0xFFFF];
+
+    p->connections++;
+    if (!is_spoke_first)
+        return;
+    p->spoke_first++;
+    for (i=0; i<HELLOLEARN_BUCKETS-1 && delay_ms >= bucket_ms[i]; i++)
+        ;
+    p->delays[i]++;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+hellolearn_wait(const struct HelloLearn *learn, const struct HelloLearn *prior,
+                unsigned port, unsigned default_ms)
+{
+    struct HelloLearnPort sum = {0};
+    uint64_t covered = 0;
+    unsigned i;
+
+    port &= 0xFFFF;
+    if (learn) {
+        sum = learn->ports[port];
+    }
+    if (prior) {
+        const struct HelloLearnPort *p = &prior->ports[port];
+        sum.connections += p->connections;
+        sum.spoke_first += p->spoke_first;
+        for (i=0; i<HELLOLEARN_BUCKETS; i++)
+            sum.delays[i] += p->delays[i];
+    }
+
+    if (sum.connections < HELLOLEARN_MIN_SAMPLES)
+        return default_ms;
+
+    /* Servers here don't send greetings */
+    if ((uint64_t)sum.spoke_first * HELLOLEARN_RARE < sum.connections)
+        return 0;
+
+    /* Find the shortest wait that would've caught nearly all of them */
+    for (i=0; i<HELLOLEARN_BUCKETS; i++) {
+        covered += sum.delays[i];
+        if (covered * 100 >= (uint64_t)sum.spoke_first * HELLOLEARN_COVER)
+            break;
+    }
+    if (i >= HELLOLEARN_BUCKETS || bucket_ms[i] >= default_ms)
+        return default_ms;
+    return bucket_ms[i];
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static unsigned
+hellolearn_read(struct HelloLearn *learn, FILE *fp)
+{
+    char line[256];
+    unsigned count = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned port;
+        unsigned n[2 + HELLOLEARN_BUCKETS];
+        struct HelloLearnPort *p;
+        unsigned i;
+        int x;
+
+        if (line[0] == '#')
+            continue;
+        x = sscanf(line, "%u %u %u %u %u %u %u %u %u",
+                   &port, &n[0], &n[1],
+                   &n[2], &n[3], &n[4], &n[5], &n[6], &n[7]);
+        if (x != 3 + HELLOLEARN_BUCKETS || port > 65535)
+            continue;
+
+        p = &learn->ports[port];
+        p->connections += n[0];
+        p->spoke_first += n[1];
+        for (i=0; i<HELLOLEARN_BUCKETS; i++)
+            p->delays[i] += n[2+i];
+        count++;
+    }
+    return count;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+hellolearn_write(FILE *fp, struct HelloLearn * const *tables, size_t count)
+{
+    unsigned port;
+
+    fprintf(fp, "# masscan --hello-learn\n");
+    fprintf(fp, "# port connections spoke-first <100ms <250ms <500ms <1s <2s more\n");
+
+    for (port=0; port<65536; port++) {
+        struct HelloLearnPort sum = {0};
+        size_t j;
+        unsigned i;
+
+        for (j=0; j<count; j++) {
+            const struct HelloLearnPort *p;
+            if (tables[j] == NULL)
+                continue;
+            p = &tables[j]->ports[port];
+            sum.connections += p->connections;
+            sum.spoke_first += p->spoke_first;
+            for (i=0; i<HELLOLEARN_BUCKETS; i++)
+                sum.delays[i] += p->delays[i];
+        }
+        if (sum.connections == 0)
+            continue;
+
+        fprintf(fp, "%u %u %u", port, sum.connections, sum.spoke_first);
+        for (i=0; i<HELLOLEARN_BUCKETS; i++)
+            fprintf(fp, " %u", sum.delays[i]);
+        fprintf(fp, "\n");
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+static void
+hellolearn_decay(struct HelloLearn *learn)
+{
+    unsigned port;
+    unsigned i;
+
+    for (port=0; port<65536; port++) {
+        struct HelloLearnPort *p = &learn->ports[port];
+        p->connections /= HELLOLEARN_DECAY;
+        p->spoke_first = 0;
+        for (i=0; i<HELLOLEARN_BUCKETS; i++) {
+            p->delays[i] /= HELLOLEARN_DECAY;
+            p->spoke_first += p->delays[i];
+        }
+        if (p->spoke_first > p->connections)
+            p->connections = p->spoke_first;
+    }
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+hellolearn_load(struct HelloLearn *learn, const char *filename)
+{
+    FILE *fp;
+    unsigned count;
+
+    fp = fopen(filename, "rt");
+    if (fp == NULL)
+        return -1;
+    count = hellolearn_read(learn, fp);
+    fclose(fp);
+    hellolearn_decay(learn);
+
+    LOG(1, "[+] hello-learn: %u ports from %s\n", count, filename);
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+hellolearn_save(const char *filename, struct HelloLearn * const *tables,
+                size_t count)
+{
+    FILE *fp;
+
+    fp = fopen(filename, "wt");
+    if (fp == NULL) {
+        LOG(0, "[-] FAIL: could not write %s\n", filename);
+        return -1;
+    }
+    hellolearn_write(fp, tables, count);
+    fclose(fp);
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+hellolearn_selftest(void)
+{
+    struct HelloLearn *tables[2];
+    struct HelloLearn *loaded;
+    FILE *fp;
+    unsigned i;
+
+    tables[0] = hellolearn_create();
+    tables[1] = hellolearn_create();
+
+    /* Not enough samples yet */
+    for (i=0; i<HELLOLEARN_MIN_SAMPLES - 1; i++)
+        hellolearn_record(tables[0], 80, 0, 0);
+    if (hellolearn_wait(tables[0], NULL, 80, 2000) != 2000)
+        goto fail;
+
+    /* Nobody on port 80 speaks first, not even with the other table */
+    hellolearn_record(tables[1], 80, 0, 0);
+    if (hellolearn_wait(tables[0], tables[1], 80, 2000) != 0)
+        goto fail;
+
+    /* FTP servers do, mostly quickly, with one slow one */
+    for (i=0; i<40; i++)
+        hellolearn_record(tables[1], 21, 1, 30 + i);
+    hellolearn_record(tables[1], 21, 1, 600);
+    if (hellolearn_wait(tables[1], NULL, 21, 2000) != 100)
+        goto fail;
+
+    /* Lots of slow ones push it back to the default */
+    for (i=0; i<10; i++)
+        hellolearn_record(tables[1], 21, 1, 5000);
+    if (hellolearn_wait(tables[1], NULL, 21, 2000) != 2000)
+        goto fail;
+
+    /* Round trip through the file format */
+    fp = tmpfile();
+    if (fp == NULL) {
+        /* can't test this part here */
+        hellolearn_destroy(tables[0]);
+        hellolearn_destroy(tables[1]);
+        return 0;
+    }
+    hellolearn_write(fp, tables, 2);
+    rewind(fp);
+    loaded = hellolearn_create();
+    i = hellolearn_read(loaded, fp);
+    fclose(fp);
+    if (i != 2
+        || memcmp(&loaded->ports[21], &tables[1]->ports[21], sizeof(loaded->ports[21])) != 0
+        || loaded->ports[80].connections != HELLOLEARN_MIN_SAMPLES
+        || hellolearn_wait(NULL, loaded, 80, 2000) != 0) {
+        hellolearn_destroy(loaded);
+        goto fail;
+    }
+
+    /* Old counts fade, until a port is forgotten */
+    hellolearn_decay(loaded);
+    if (loaded->ports[21].connections != 25 || loaded->ports[21].spoke_first != 25
+        || loaded->ports[80].connections != HELLOLEARN_MIN_SAMPLES/2
+        || hellolearn_wait(NULL, loaded, 80, 2000) != 2000) {
+        hellolearn_destroy(loaded);
+        goto fail;
+    }
+    for (i=0; i<8; i++)
+        hellolearn_decay(loaded);
+    if (loaded->ports[21].connections != 0) {
+        hellolearn_destroy(loaded);
+        goto fail;
+    }
+    hellolearn_destroy(loaded);
+
+    hellolearn_destroy(tables[0]);
+    hellolearn_destroy(tables[1]);
+    return 0;
+fail:
+    fprintf(stderr, "[-] hello-learn: selftest failed\n");
+    hellolearn_destroy(tables[0]);
+    hellolearn_destroy(tables[1]);
+    return 1;
+}
@@ -0,0 +1,84 @@
+/*
+    Learning which ports have servers that speak first
+
+    Without a registered hello that's sent right away, a new connection
+    waits for the server's greeting (--hello-timeout) before sending its
+    own hello. On ports where servers never speak first, like most web
+    ports, that's a wasted wait for every connection, keeping the TCB
+    around for nothing.
+
+    So we count, per port, how many servers sent something before we did,
+    and how long they took. Once a port has enough samples, connections to
+    it wait only long enough to catch most greetings, or not at all if
+    servers there don't send greetings. One connection in every few still
+    waits the full time, so that the numbers keep up with what we find.
+
+    The counts can be saved to a file at the end of a scan and loaded at
+    the start of the next one (--hello-learn), so that a scan doesn't
+    have to learn it all over again.
+*/
+#ifndef STACK_TCP_LEARN_H
+#define STACK_TCP_LEARN_H
+#include <stdio.h>
+
+struct HelloLearn;
+
+/**
+ * Create an empty table. Each receive thread has its own, and a shared
+ * one holds what was loaded from a file.
+ */
+struct HelloLearn *
+hellolearn_create(void);
+
+void
+hellolearn_destroy(struct HelloLearn *learn);
+
+/**
+ * Records what happened on a connection that waited the full hello
+ * timeout.
+ * @param is_spoke_first
+ *      Whether the server sent something before the timeout.
+ * @param delay_ms
+ *      If it did, how many milliseconds after the connection was
+ *      established.
+ */
+void
+hellolearn_record(struct HelloLearn *learn, unsigned port,
+                  unsigned is_spoke_first, unsigned delay_ms);
+
+/**
+ * How long to wait for the server to speak first, based on both tables.
+ * @param prior
+ *      What was loaded from a file, or NULL.
+ * @param default_ms
+ *      What to wait when there aren't enough samples for this port.
+ * @return
+ *      milliseconds to wait, possibly 0, or 'default_ms'
+ */
+unsigned
+hellolearn_wait(const struct HelloLearn *learn, const struct HelloLearn *prior,
+                unsigned port, unsigned default_ms);
+
+/**
+ * Reads a file written by hellolearn_save(), adding its counts to the
+ * table. The counts are halved, so that older scans matter less.
+ * @return
+ *      0 on success, or -1 if the file couldn't be opened
+ */
+int
+hellolearn_load(struct HelloLearn *learn, const char *filename);
+
+/**
+ * Writes the sum of the tables to a file, as text, one line per port.
+ * Any of the tables may be NULL.
+ * @return
+ *      0 on success, or -1 if the file couldn't be written
+ */
+int
+hellolearn_save(const char *filename, struct HelloLearn * const *tables,
+                size_t count);
+
+int
+hellolearn_selftest(void);
+
+#endif
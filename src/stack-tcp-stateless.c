@@ -0,0 +1,202 @@
+/*
+    Stateless banner grabbing (--stateless-banners)
+
+    See stack-tcp-stateless.h for the idea. The exchange looks like:
+
+        us      SYN     seq=cookie
+        them    SYN-ACK seq=X           ack=cookie+1
+        us      ACK     seq=cookie+1    ack=X+1
+        them    data    seq=X+1         ack=cookie+1
+        us      RST     seq=cookie+1    ack=X+1+length
+
+    Only the SYN-ACK and the data matter to us, and both are checked
+    against the cookie the same way. We don't check the server's own
+    sequence number, since we didn't choose it.
+
+    The banner parsers are the same ones used with --banners, given a
+    socket without a TCB. Anything they try to send, like a telnet
+    option reply or STARTTLS, fails harmlessly.
+*/
+#include "stack-tcp-stateless.h"
+#include "stack-tcp-core.h"
+#include "stack-tcp-api.h"
+#include "proto-banner1.h"
+#include "proto-banout.h"
+#include "main-dedup.h"
+#include "output.h"
+#include "util-logger.h"
+#include "util-malloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Added to our port in the dedup table, to tell the greeting apart from
+ * the SYN-ACK of the same connection.
+ */
+#define STATELESS_DEDUP_DATA 0x100000
+
+struct StatelessGrab {
+    struct Banner1 *banner1;
+    struct TemplatePacket *tmpl;
+    struct stack_t *stack;
+    struct Output *out;
+    uint64_t count_acks;
+    uint64_t count_banners;
+};
+
+/***************************************************************************
+ ***************************************************************************/
+struct StatelessGrab *
+stateless_create(struct TemplatePacket *tmpl, struct stack_t *stack,
+                 struct Output *out)
+{
+    struct StatelessGrab *grab;
+
+    grab = CALLOC(1, sizeof(*grab));
+    grab->banner1 = banner1_create();
+    grab->tmpl = tmpl;
+    grab->stack = stack;
+    grab->out = out;
+    return grab;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+stateless_destroy(struct StatelessGrab *grab)
+{
+    if (grab == NULL)
+        return;
+    LOG(1, "[+] stateless: %llu handshakes, %llu banners\n",
+        (unsigned long long)grab->count_acks,
+        (unsigned long long)grab->count_banners);
+    banner1_destroy(grab->banner1);
+    free(grab);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+stateless_synack(struct StatelessGrab *grab,
+                 ipaddress ip_them, unsigned port_them,
+                 ipaddress ip_me, unsigned port_me,
+                 unsigned seqno_them, unsigned seqno_me)
+{
+    tcp_send_ACK(grab->tmpl, grab->stack,
+                 ip_them, ip_me,
+                 port_them, port_me,
+                 seqno_them + 1, seqno_me);
+    grab->count_acks++;
+}
+
+/***************************************************************************
+ * Runs the greeting through the banner parsers, as if it were the
+ * first data on a new connection.
+ ***************************************************************************/
+static void
+stateless_parse(const struct Banner1 *banner1, unsigned port_them,
+                const unsigned char *px, size_t length,
+                struct BannerOutput *banout, unsigned secs)
+{
+    struct StreamState state;
+    struct stack_handle_t socket = {0};
+
+    memset(&state, 0, sizeof(state));
+    state.port = (unsigned short)port_them;
+    socket.secs = secs;
+
+    banner1_parse(banner1, &state, px, length, banout, &socket);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+stateless_data(struct StatelessGrab *grab, struct DedupTable *dedup,
+               time_t timestamp,
+               ipaddress ip_them, unsigned port_them,
+               ipaddress ip_me, unsigned port_me,
+               unsigned seqno_them, unsigned seqno_me,
+               unsigned cookie, unsigned ttl,
+               const unsigned char *px, size_t length)
+{
+    struct BannerOutput banout[1];
+    struct BannerOutput *p;
+
+    /* They must be acknowledging our SYN and nothing else */
+    if (seqno_me - 1 != cookie) {
+        ipaddress_formatted_t fmt = ipaddress_fmt(ip_them);
+        LOG(2, "%s - bad cookie: ackno=0x%08x expected=0x%08x\n",
+            fmt.string, seqno_me-1, cookie);
+        return 0;
+    }
+
+    /* Close it whatever happens next. The server may have sent more
+     * than one segment before this reaches it, which are answered the
+     * same way */
+    tcp_send_RST(grab->tmpl, grab->stack,
+                 ip_them, ip_me,
+                 port_them, port_me,
+                 seqno_them + (unsigned)length, seqno_me);
+
+    /* Only the first segment is the start of the greeting */
+    if (dedup_is_duplicate(dedup, ip_them, port_them,
+                           ip_me, port_me | STATELESS_DEDUP_DATA))
+        return 0;
+
+    banout_init(banout);
+    stateless_parse(grab->banner1, port_them, px, length, banout,
+                    (unsigned)timestamp);
+
+    for (p = banout; p != NULL; p = p->next) {
+        if (p->length && p->protocol) {
+            output_report_banner(grab->out, timestamp,
+                                 ip_them, 6, port_them,
+                                 p->protocol & 0x0FFFFFFF,
+                                 ttl,
+                                 p->banner, p->length);
+        }
+    }
+    banout_release(banout);
+
+    grab->count_banners++;
+    return 1;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+stateless_selftest(void)
+{
+    static const struct {
+        unsigned port;
+        const char *greeting;
+        unsigned proto;
+        const char *banner;
+    } tests[] = {
+        {22, "SSH-2.0-OpenSSH_8.9p1 Ubuntu-3\r\n", PROTO_SSH2, "SSH-2.0-OpenSSH_8.9p1 Ubuntu-3"},
+        {21, "220 (vsFTPd 3.0.5)\r\n", PROTO_FTP, "220 (vsFTPd 3.0.5)"},
+        {0, 0, 0, 0}
+    };
+    struct Banner1 *banner1;
+    unsigned i;
+    int result = 0;
+
+    banner1 = banner1_create();
+
+    for (i=0; tests[i].greeting; i++) {
+        struct BannerOutput banout[1];
+
+        banout_init(banout);
+        stateless_parse(banner1, tests[i].port,
+                        (const unsigned char *)tests[i].greeting,
+                        strlen(tests[i].greeting), banout, 0);
+        if (!banout_is_contains(banout, tests[i].proto, tests[i].banner)) {
+            fprintf(stderr, "[-] stateless: selftest failed, test #%u\n", i);
+            result = 1;
+        }
+        banout_release(banout);
+    }
+
+    banner1_destroy(banner1);
+    return result;
+}
@@ -0,0 +1,77 @@
+/*
+    Stateless banner grabbing (--stateless-banners)
+
+    For protocols where the server speaks first, like SSH, FTP, SMTP,
+    POP3, IMAP, and telnet, the banner is the first segment of data the
+    server sends after the handshake. We don't need a TCP connection for
+    that: the SYN-ACK is answered with an ACK whose numbers come from the
+    SYN-cookie, the server's greeting carries that same cookie back in
+    its acknowledgement number, and once we've parsed it we send a RST.
+
+    Nothing is remembered between those packets, so this runs at the
+    speed of a SYN scan, using a constant amount of memory, instead of
+    needing a TCB for every open port.
+
+    The catch is that we only ever see the first segment, and never
+    send anything, so it's no good for protocols like HTTP where the
+    client has to speak first.
+*/
+#ifndef STACK_TCP_STATELESS_H
+#define STACK_TCP_STATELESS_H
+#include "massip-addr.h"
+#include <time.h>
+struct Output;
+struct DedupTable;
+struct TemplatePacket;
+struct stack_t;
+
+struct StatelessGrab;
+
+/**
+ * Create one for each receive thread.
+ * @param tmpl
+ *      The TCP template, used to build the ACK and RST packets.
+ * @param stack
+ *      Where those packets get queued to be sent.
+ */
+struct StatelessGrab *
+stateless_create(struct TemplatePacket *tmpl, struct stack_t *stack,
+                 struct Output *out);
+
+void
+stateless_destroy(struct StatelessGrab *grab);
+
+/**
+ * Completes the handshake after a SYN-ACK, whose cookie the caller has
+ * already checked. This is called for retransmitted SYN-ACKs too, since
+ * they mean our ACK got lost.
+ */
+void
+stateless_synack(struct StatelessGrab *grab,
+                 ipaddress ip_them, unsigned port_them,
+                 ipaddress ip_me, unsigned port_me,
+                 unsigned seqno_them, unsigned seqno_me);
+
+/**
+ * Handles a segment of data from the server.
+ * @param cookie
+ *      The SYN-cookie for this connection. The data must acknowledge
+ *      our SYN, and nothing more, so its acknowledgement number must be
+ *      one more than this.
+ * @return
+ *      1 if this was the server's greeting, which has been reported,
+ *      0 if it was ignored.
+ */
+unsigned
+stateless_data(struct StatelessGrab *grab, struct DedupTable *dedup,
+               time_t timestamp,
+               ipaddress ip_them, unsigned port_them,
+               ipaddress ip_me, unsigned port_me,
+               unsigned seqno_them, unsigned seqno_me,
+               unsigned cookie, unsigned ttl,
+               const unsigned char *px, size_t length);
+
+int
+stateless_selftest(void);
+
+#endif
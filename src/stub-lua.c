@@ -80,6 +80,7 @@ int stublua_init(void)
     
     
     DOLINK(lua_close)
+    DOLINK(lua_dump)
     DOLINK(lua_getfield)
     DOLINK(lua_getglobal)
     DOLINK(lua_geti)
@@ -103,6 +104,7 @@ int stublua_init(void)
     DOLINK(lua_setglobal)
     DOLINK(lua_seti)
     DOLINK(lua_settop)
+    DOLINK(lua_status)
     DOLINK(lua_toboolean)
     DOLINK(lua_tointegerx)
     DOLINK(lua_tolstring)
@@ -24,6 +24,7 @@ typedef unsigned long long lua_Unsigned;
 typedef ptrdiff_t lua_KContext;
 typedef int (*lua_KFunction) (lua_State *L, int status, lua_KContext ctx);
 typedef int (*lua_CFunction) (lua_State *L);
+typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef struct luaL_Reg {
     const char *name;
     lua_CFunction func;
@@ -86,6 +87,7 @@ typedef struct luaL_Reg {
 #endif
 
 LUAAPI void        (*lua_close)(lua_State *L);
+LUAAPI int         (*lua_dump)(lua_State *L, lua_Writer writer, void *data, int strip);
 LUAAPI int         (*lua_getfield)(lua_State *L, int idx, const char *k);
 LUAAPI int         (*lua_getglobal)(lua_State *L, const char *name);
 LUAAPI int         (*lua_geti)(lua_State *L, int idx, lua_Integer n);
@@ -109,6 +111,7 @@ LUAAPI void        (*lua_setfield)(lua_State *L, int idx, const char *k);
 LUAAPI void        (*lua_setglobal)(lua_State *L, const char *name);
 LUAAPI void        (*lua_seti)(lua_State *L, int idx, lua_Integer n);
 LUAAPI void        (*lua_settop)(lua_State *L, int idx);
+LUAAPI int         (*lua_status)(lua_State *L);
 LUAAPI int         (*lua_toboolean)(lua_State *L, int idx);
 LUAAPI lua_Integer (*lua_tointegerx)(lua_State *L, int idx, int *pisnum);
 LUAAPI const char *(*lua_tolstring)(lua_State *L, int idx, size_t *len);
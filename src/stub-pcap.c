@@ -267,6 +267,46 @@ static const char*null_PCAP_GETERR(pcap_t *p)
 	UNUSEDPARM(p);
 	return "(unknown)";
 }
+static int null_PCAP_FILENO(pcap_t *p)
+{
+#ifdef STATICPCAP
+    return pcap_fileno(p);
+#endif
+    my_null(1, p);
+	return -1;
+}
+static int null_PCAP_SETNONBLOCK(pcap_t *p, int nonblock, char *errbuf)
+{
+#ifdef STATICPCAP
+    return pcap_setnonblock(p, nonblock, errbuf);
+#endif
+    my_null(3, p, nonblock, errbuf);
+	return -1;
+}
+static int null_PCAP_COMPILE(pcap_t *p, struct bpf_program *fp, const char *str, int optimize, unsigned netmask)
+{
+#ifdef STATICPCAP
+    return pcap_compile(p, fp, str, optimize, netmask);
+#endif
+    my_null(5, p, fp, str, optimize, netmask);
+	return -1;
+}
+static int null_PCAP_SETFILTER(pcap_t *p, struct bpf_program *fp)
+{
+#ifdef STATICPCAP
+    return pcap_setfilter(p, fp);
+#endif
+    my_null(2, p, fp);
+	return -1;
+}
+static void null_PCAP_FREECODE(struct bpf_program *fp)
+{
+#ifdef STATICPCAP
+    pcap_freecode(fp);
+    return;
+#endif
+    my_null(1, fp);
+}
 static const char *null_PCAP_DEV_NAME(const pcap_if_t *dev)
 {
     return dev->name;
@@ -422,6 +462,11 @@ pl->func_err=0, pl->datalink = null_##PCAP_DATALINK;
     DOLINK(PCAP_DATALINK_VAL_TO_NAME , datalink_val_to_name);
     DOLINK(PCAP_PERROR          , perror);
     DOLINK(PCAP_GETERR          , geterr);
+    DOLINK(PCAP_FILENO          , fileno);
+    DOLINK(PCAP_SETNONBLOCK     , setnonblock);
+    DOLINK(PCAP_COMPILE         , compile);
+    DOLINK(PCAP_SETFILTER       , setfilter);
+    DOLINK(PCAP_FREECODE        , freecode);
 
 
     /* pseudo functions that don't exist in the libpcap interface */
@@ -74,6 +74,12 @@ enum {
     PCAP_WARNING_TSTAMP_TYPE_NOTSUP     =   3,
 };
 
+/* A compiled BPF filter, from pcap_compile(). We never look inside */
+struct bpf_program {
+    unsigned bf_len;
+    void *bf_insns;
+};
+
 /* The packet header for capturing packets. Apple macOS inexplicably adds
  * an extra comment-field onto the end of this, so the definition needs
  * to be careful to match the real definition */
@@ -109,6 +115,11 @@ typedef int         (*PCAP_SETDIRECTION)(pcap_t *, pcap_direction_t);
 typedef const char *(*PCAP_DATALINK_VAL_TO_NAME)(int dlt);
 typedef void        (*PCAP_PERROR)(pcap_t *p, char *prefix);
 typedef const char *(*PCAP_GETERR)(pcap_t *p);
+typedef int         (*PCAP_FILENO)(pcap_t *p);
+typedef int         (*PCAP_SETNONBLOCK)(pcap_t *p, int nonblock, char *errbuf);
+typedef int         (*PCAP_COMPILE)(pcap_t *p, struct bpf_program *fp, const char *str, int optimize, unsigned netmask);
+typedef int         (*PCAP_SETFILTER)(pcap_t *p, struct bpf_program *fp);
+typedef void        (*PCAP_FREECODE)(struct bpf_program *fp);
 typedef const char *(*PCAP_DEV_NAME)(const pcap_if_t *dev);
 typedef const char *(*PCAP_DEV_DESCRIPTION)(const pcap_if_t *dev);
 typedef const pcap_if_t *(*PCAP_DEV_NEXT)(const pcap_if_t *dev);
@@ -176,6 +187,11 @@ struct PcapFunctions {
     PCAP_DATALINK_VAL_TO_NAME datalink_val_to_name;
     PCAP_PERROR             perror;
     PCAP_GETERR             geterr;
+    PCAP_FILENO             fileno;
+    PCAP_SETNONBLOCK        setnonblock;
+    PCAP_COMPILE            compile;
+    PCAP_SETFILTER          setfilter;
+    PCAP_FREECODE           freecode;
     
     /* Accessor functions for opaque data structure, don't really
      * exist in libpcap */
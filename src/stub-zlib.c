@@ -0,0 +1,85 @@
+/*
+    Loads zlib at runtime
+
+    As with libpcap and Lua, we don't link to zlib when building, so that
+    the program still runs where it isn't installed, in which case gzip
+    compression of output files isn't available.
+*/
+#include "stub-zlib.h"
+#include "util-logger.h"
+
+#if defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+struct ZlibFunctions ZLIB;
+
+int stubzlib_init(void)
+{
+    static const char *possible_names[] = {
+#if defined(__APPLE__)
+        "libz.1.dylib",
+        "libz.dylib",
+#elif defined(WIN32)
+        "zlib1.dll",
+        "zlib.dll",
+#else
+        "libz.so.1",
+        "libz.so",
+#endif
+        0
+    };
+    struct ZlibFunctions *zl = &ZLIB;
+    void *lib = NULL;
+    unsigned is_err = 0;
+    unsigned i;
+
+    if (zl->is_available)
+        return 0;
+
+    for (i=0; possible_names[i]; i++) {
+#if defined(WIN32)
+        lib = (void*)LoadLibraryA(possible_names[i]);
+#else
+        lib = dlopen(possible_names[i], RTLD_LAZY);
+#endif
+        if (lib) {
+            LOG(2, "[+] zlib: found library: %s\n", possible_names[i]);
+            break;
+        }
+    }
+    if (lib == NULL) {
+        LOG(2, "[-] zlib: library not found\n");
+        return -1;
+    }
+
+#if defined(WIN32)
+#define DOLINK(TYPE, name) \
+    zl->name = (TYPE)GetProcAddress((HMODULE)lib, #name); \
+    if (zl->name == NULL) is_err = 1;
+#else
+#define DOLINK(TYPE, name) \
+    zl->name = (TYPE)dlsym(lib, #name); \
+    if (zl->name == NULL) is_err = 1;
+#endif
+
+    DOLINK(ZLIB_DEFLATEINIT2_,  deflateInit2_);
+    DOLINK(ZLIB_DEFLATE,        deflate);
+    DOLINK(ZLIB_DEFLATEEND,     deflateEnd);
+    DOLINK(ZLIB_INFLATEINIT2_,  inflateInit2_);
+    DOLINK(ZLIB_INFLATE,        inflate);
+    DOLINK(ZLIB_INFLATERESET,   inflateReset);
+    DOLINK(ZLIB_INFLATEEND,     inflateEnd);
+    DOLINK(ZLIB_ZLIBVERSION,    zlibVersion);
+#undef DOLINK
+
+    if (is_err) {
+        LOG(0, "[-] zlib: library is missing functions\n");
+        return -1;
+    }
+    zl->is_available = 1;
+    return 0;
+}
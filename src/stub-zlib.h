@@ -0,0 +1,95 @@
+/*
+    Stub declarations, for loading zlib dynamically at runtime using
+    dlopen() or LoadLibrary().
+
+    This is only the part of the zlib API that we use, for streaming
+    gzip. The structure layout and constants are those of <zlib.h>,
+    which are stable across zlib 1.x.
+ */
+#ifndef STUB_ZLIB_H
+#define STUB_ZLIB_H
+#include <stddef.h>
+
+typedef struct z_stream_s {
+    const unsigned char *next_in;
+    unsigned avail_in;
+    unsigned long total_in;
+
+    unsigned char *next_out;
+    unsigned avail_out;
+    unsigned long total_out;
+
+    const char *msg;
+    struct internal_state *state;
+
+    void *(*zalloc)(void *opaque, unsigned items, unsigned size);
+    void (*zfree)(void *opaque, void *address);
+    void *opaque;
+
+    int data_type;
+    unsigned long adler;
+    unsigned long reserved;
+} z_stream;
+
+#define Z_NO_FLUSH      0
+#define Z_SYNC_FLUSH    2
+#define Z_FINISH        4
+
+#define Z_OK            0
+#define Z_STREAM_END    1
+#define Z_BUF_ERROR     (-5)
+
+#define Z_DEFLATED      8
+#define Z_DEFAULT_STRATEGY 0
+
+/* Only the major version is checked by the library */
+#define STUB_ZLIB_VERSION "1.2.11"
+
+typedef int (*ZLIB_DEFLATEINIT2_)(z_stream *strm, int level, int method,
+                                  int window_bits, int mem_level, int strategy,
+                                  const char *version, int stream_size);
+typedef int (*ZLIB_DEFLATE)(z_stream *strm, int flush);
+typedef int (*ZLIB_DEFLATEEND)(z_stream *strm);
+typedef int (*ZLIB_INFLATEINIT2_)(z_stream *strm, int window_bits,
+                                  const char *version, int stream_size);
+typedef int (*ZLIB_INFLATE)(z_stream *strm, int flush);
+typedef int (*ZLIB_INFLATERESET)(z_stream *strm);
+typedef int (*ZLIB_INFLATEEND)(z_stream *strm);
+typedef const char *(*ZLIB_ZLIBVERSION)(void);
+
+struct ZlibFunctions {
+    unsigned is_available:1;
+
+    ZLIB_DEFLATEINIT2_      deflateInit2_;
+    ZLIB_DEFLATE            deflate;
+    ZLIB_DEFLATEEND         deflateEnd;
+    ZLIB_INFLATEINIT2_      inflateInit2_;
+    ZLIB_INFLATE            inflate;
+    ZLIB_INFLATERESET       inflateReset;
+    ZLIB_INFLATEEND         inflateEnd;
+    ZLIB_ZLIBVERSION        zlibVersion;
+};
+
+/**
+ * The zlib function pointers, used in the form "ZLIB.deflate()".
+ * Check ZLIB.is_available first.
+ */
+extern struct ZlibFunctions ZLIB;
+
+/* The same as the macros in <zlib.h> */
+#define ZLIB_deflateInit2(strm, level, method, bits, mem, strategy) \
+    ZLIB.deflateInit2_((strm), (level), (method), (bits), (mem), (strategy), \
+                       STUB_ZLIB_VERSION, (int)sizeof(z_stream))
+#define ZLIB_inflateInit2(strm, bits) \
+    ZLIB.inflateInit2_((strm), (bits), STUB_ZLIB_VERSION, (int)sizeof(z_stream))
+
+/**
+ * Loads the shared library (libz.so, libz.dylib, or zlib1.dll), if it's
+ * there. Not thread safe, so call from the startup thread.
+ * @return
+ *  0 on success or
+ *  -1 if the library isn't installed
+ */
+int stubzlib_init(void);
+
+#endif
@@ -0,0 +1,86 @@
+/*
+    Loads libzstd at runtime
+
+    Like zlib, see stub-zlib.c, this is optional: without it, only zstd
+    compression isn't available.
+*/
+#include "stub-zstd.h"
+#include "util-logger.h"
+
+#if defined(WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+struct ZstdFunctions ZSTD;
+
+int stubzstd_init(void)
+{
+    static const char *possible_names[] = {
+#if defined(__APPLE__)
+        "libzstd.1.dylib",
+        "libzstd.dylib",
+#elif defined(WIN32)
+        "libzstd.dll",
+        "zstd.dll",
+#else
+        "libzstd.so.1",
+        "libzstd.so",
+#endif
+        0
+    };
+    struct ZstdFunctions *zs = &ZSTD;
+    void *lib = NULL;
+    unsigned is_err = 0;
+    unsigned i;
+
+    if (zs->is_available)
+        return 0;
+
+    for (i=0; possible_names[i]; i++) {
+#if defined(WIN32)
+        lib = (void*)LoadLibraryA(possible_names[i]);
+#else
+        lib = dlopen(possible_names[i], RTLD_LAZY);
+#endif
+        if (lib) {
+            LOG(2, "[+] zstd: found library: %s\n", possible_names[i]);
+            break;
+        }
+    }
+    if (lib == NULL) {
+        LOG(2, "[-] zstd: library not found\n");
+        return -1;
+    }
+
+#if defined(WIN32)
+#define DOLINK(TYPE, name) \
+    zs->name = (TYPE)GetProcAddress((HMODULE)lib, "ZSTD_"#name); \
+    if (zs->name == NULL) is_err = 1;
+#else
+#define DOLINK(TYPE, name) \
+    zs->name = (TYPE)dlsym(lib, "ZSTD_"#name); \
+    if (zs->name == NULL) is_err = 1;
+#endif
+
+    DOLINK(ZSTD_CREATECCTX,         createCCtx);
+    DOLINK(ZSTD_FREECCTX,           freeCCtx);
+    DOLINK(ZSTD_CCTX_SETPARAMETER,  CCtx_setParameter);
+    DOLINK(ZSTD_COMPRESSSTREAM2,    compressStream2);
+    DOLINK(ZSTD_CREATEDCTX,         createDCtx);
+    DOLINK(ZSTD_FREEDCTX,           freeDCtx);
+    DOLINK(ZSTD_DECOMPRESSSTREAM,   decompressStream);
+    DOLINK(ZSTD_ISERROR,            isError);
+    DOLINK(ZSTD_GETERRORNAME,       getErrorName);
+#undef DOLINK
+
+    if (is_err) {
+        /* Too old, from before the streaming API was stable */
+        LOG(0, "[-] zstd: library is missing functions, needs 1.4 or later\n");
+        return -1;
+    }
+    zs->is_available = 1;
+    return 0;
+}
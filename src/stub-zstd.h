@@ -0,0 +1,76 @@
+/*
+    Stub declarations, for loading Zstandard (libzstd) dynamically at
+    runtime using dlopen() or LoadLibrary().
+
+    This is only the streaming part of the API that we use, which has
+    been stable since zstd 1.4.0.
+ */
+#ifndef STUB_ZSTD_H
+#define STUB_ZSTD_H
+#include <stddef.h>
+
+typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+
+typedef struct ZSTD_inBuffer_s {
+    const void *src;
+    size_t size;
+    size_t pos;
+} ZSTD_inBuffer;
+
+typedef struct ZSTD_outBuffer_s {
+    void *dst;
+    size_t size;
+    size_t pos;
+} ZSTD_outBuffer;
+
+/* ZSTD_EndDirective */
+#define ZSTD_e_continue 0
+#define ZSTD_e_flush    1
+#define ZSTD_e_end      2
+
+/* ZSTD_cParameter */
+#define ZSTD_c_compressionLevel 100
+
+typedef ZSTD_CCtx *(*ZSTD_CREATECCTX)(void);
+typedef size_t (*ZSTD_FREECCTX)(ZSTD_CCtx *cctx);
+typedef size_t (*ZSTD_CCTX_SETPARAMETER)(ZSTD_CCtx *cctx, int param, int value);
+typedef size_t (*ZSTD_COMPRESSSTREAM2)(ZSTD_CCtx *cctx, ZSTD_outBuffer *output,
+                                       ZSTD_inBuffer *input, int end_op);
+typedef ZSTD_DCtx *(*ZSTD_CREATEDCTX)(void);
+typedef size_t (*ZSTD_FREEDCTX)(ZSTD_DCtx *dctx);
+typedef size_t (*ZSTD_DECOMPRESSSTREAM)(ZSTD_DCtx *dctx, ZSTD_outBuffer *output,
+                                        ZSTD_inBuffer *input);
+typedef unsigned (*ZSTD_ISERROR)(size_t code);
+typedef const char *(*ZSTD_GETERRORNAME)(size_t code);
+
+struct ZstdFunctions {
+    unsigned is_available:1;
+
+    ZSTD_CREATECCTX         createCCtx;
+    ZSTD_FREECCTX           freeCCtx;
+    ZSTD_CCTX_SETPARAMETER  CCtx_setParameter;
+    ZSTD_COMPRESSSTREAM2    compressStream2;
+    ZSTD_CREATEDCTX         createDCtx;
+    ZSTD_FREEDCTX           freeDCtx;
+    ZSTD_DECOMPRESSSTREAM   decompressStream;
+    ZSTD_ISERROR            isError;
+    ZSTD_GETERRORNAME       getErrorName;
+};
+
+/**
+ * The libzstd function pointers, used in the form "ZSTD.compressStream2()"
+ * for "ZSTD_compressStream2()". Check ZSTD.is_available first.
+ */
+extern struct ZstdFunctions ZSTD;
+
+/**
+ * Loads the shared library (libzstd.so, libzstd.dylib, or libzstd.dll),
+ * if it's there. Not thread safe, so call from the startup thread.
+ * @return
+ *  0 on success or
+ *  -1 if the library isn't installed
+ */
+int stubzstd_init(void);
+
+#endif
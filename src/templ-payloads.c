@@ -22,6 +22,7 @@
 #include "proto-dns.h"
 #include "proto-isakmp.h"
 #include "util-malloc.h"
+#include "util-checksum.h"
 #include "massip.h"
 #include "templ-nmap-payloads.h"
 
@@ -472,29 +473,6 @@ struct PayloadUDP_Default hard_coded_udp_payloads[] = {
 };
 
 
-/***************************************************************************
- * Calculate the partial checksum of the payload. This allows us to simply
- * add this to the checksum when transmitting instead of recalculating
- * everything.
- ***************************************************************************/
-static unsigned
-partial_checksum(const unsigned char *px, size_t icmp_length)
-{
-    uint64_t xsum = 0;
-    unsigned i;
-
-    for (i=0; i<icmp_length; i += 2) {
-        xsum += px[i]<<8 | px[i + 1];
-    }
-
-    xsum -= (icmp_length & 1) * px[i - 1]; /* yea I know going off end of packet is bad so sue me */
-    xsum = (xsum & 0xFFFF) + (xsum >> 16);
-    xsum = (xsum & 0xFFFF) + (xsum >> 16);
-    xsum = (xsum & 0xFFFF) + (xsum >> 16);
-
-    return (unsigned)xsum;
-}
-
 /***************************************************************************
  * If we have the port, return the best payload for that port.
  ***************************************************************************/
@@ -642,7 +620,9 @@ payloads_datagram_add(struct PayloadsUDP *payloads,
         p->source_port = source_port;
         p->length = (unsigned)length;
         memcpy(p->buf, buf, length);
-        p->xsum = partial_checksum(buf, length);
+        /* Added to the checksum when transmitting, instead of
+         * recalculating everything */
+        p->xsum = checksum_partial(buf, length);
         p->set_cookie = set_cookie;
 
         /* insert in sorted order */
@@ -22,6 +22,7 @@
 #include "vulncheck.h"
 #include "util-checksum.h"
 #include "util-malloc.h"
+#include "rawsock-vnet.h"
 #include "stub-pcap-dlt.h" /* data link types, like NULL, RAW, or ETHERNET */
 #include <assert.h>
 #include <string.h>
@@ -185,17 +186,13 @@ ip_header_checksum(const unsigned char *px, unsigned offset, unsigned max_offset
 {
     unsigned header_length = (px[offset]&0xF) * 4;
     unsigned xsum = 0;
-    unsigned i;
 
     /* restrict check only over packet */
     if (max_offset > offset + header_length)
         max_offset = offset + header_length;
 
     /* add all the two-byte words together */
-    xsum = 0;
-    for (i = offset; i < max_offset; i += 2) {
-        xsum += px[i]<<8 | px[i+1];
-    }
+    xsum = checksum_partial(px + offset, max_offset - offset);
 
     /* if more than 16 bits in result, reduce to 16 bits */
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
@@ -212,7 +209,6 @@ tcp_checksum2(const unsigned char *px, unsigned offset_ip,
               unsigned offset_tcp, size_t tcp_length)
 {
     uint64_t xsum = 0;
-    unsigned i;
 
     /* pseudo checksum */
     xsum = 6;
@@ -223,11 +219,7 @@ tcp_checksum2(const unsigned char *px, unsigned offset_ip,
     xsum += px[offset_ip + 18] << 8 | px[offset_ip + 19];
 
     /* TCP checksum */
-    for (i=0; i<tcp_length; i += 2) {
-        xsum += px[offset_tcp + i]<<8 | px[offset_tcp + i + 1];
-    }
-
-    xsum -= (tcp_length & 1) * px[offset_tcp + i - 1]; /* yea I know going off end of packet is bad so sue me */
+    xsum += checksum_partial(px + offset_tcp, tcp_length);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
@@ -247,7 +239,6 @@ tcp_ipv4_checksum(struct TemplatePacket *tmpl)
     unsigned offset_app = tmpl->ipv4.offset_app;
     unsigned offset_tcp = tmpl->ipv4.offset_tcp;
     unsigned xsum = 0;
-    unsigned i;
 
 
 
@@ -260,9 +251,7 @@ tcp_ipv4_checksum(struct TemplatePacket *tmpl)
     xsum += px[offset_ip + 18] << 8 | px[offset_ip + 19];
 
     /* TCP checksum */
-    for (i=offset_tcp; i<offset_app; i += 2) {
-        xsum += px[i]<<8 | px[i+1];
-    }
+    xsum += checksum_partial(px + offset_tcp, offset_app - offset_tcp);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
@@ -279,7 +268,6 @@ udp_checksum2(const unsigned char *px, unsigned offset_ip,
               unsigned offset_tcp, size_t tcp_length)
 {
     uint64_t xsum = 0;
-    unsigned i;
 
     /* pseudo checksum */
     xsum = 17;
@@ -290,11 +278,7 @@ udp_checksum2(const unsigned char *px, unsigned offset_ip,
     xsum += px[offset_ip + 18] << 8 | px[offset_ip + 19];
 
     /* TCP checksum */
-    for (i=0; i<tcp_length; i += 2) {
-        xsum += px[offset_tcp + i]<<8 | px[offset_tcp + i + 1];
-    }
-
-    xsum -= (tcp_length & 1) * px[offset_tcp + i - 1]; /* yea I know going off end of packet is bad so sue me */
+    xsum += checksum_partial(px + offset_tcp, tcp_length);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
@@ -321,13 +305,8 @@ icmp_checksum2(const unsigned char *px,
               unsigned offset_icmp, size_t icmp_length)
 {
     uint64_t xsum = 0;
-    unsigned i;
 
-    for (i=0; i<icmp_length; i += 2) {
-        xsum += px[offset_icmp + i]<<8 | px[offset_icmp + i + 1];
-    }
-
-    xsum -= (icmp_length & 1) * px[offset_icmp + i - 1]; /* yea I know going off end of packet is bad so sue me */
+    xsum = checksum_partial(px + offset_icmp, icmp_length);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
     xsum = (xsum & 0xFFFF) + (xsum >> 16);
@@ -347,6 +326,46 @@ icmp_ipv4_checksum(struct TemplatePacket *tmpl)
 }
 
 
+/***************************************************************************
+ * With --adapter-offload, the NIC calculates the TCP/UDP checksum, but it
+ * needs us to start it off with the sum of the pseudo-header (addresses,
+ * protocol, and length). Unlike a finished checksum, this isn't inverted.
+ ***************************************************************************/
+static unsigned
+pseudo_checksum_ipv4(const unsigned char *px, unsigned offset_ip,
+                     unsigned ip_proto, size_t length)
+{
+    uint64_t xsum;
+
+    xsum = ip_proto;
+    xsum += length;
+    xsum += px[offset_ip + 12] << 8 | px[offset_ip + 13];
+    xsum += px[offset_ip + 14] << 8 | px[offset_ip + 15];
+    xsum += px[offset_ip + 16] << 8 | px[offset_ip + 17];
+    xsum += px[offset_ip + 18] << 8 | px[offset_ip + 19];
+
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    return (unsigned)xsum;
+}
+
+static unsigned
+pseudo_checksum_ipv6(const unsigned char *px, unsigned offset_ip,
+                     unsigned ip_proto, size_t length)
+{
+    uint64_t xsum;
+
+    xsum = ip_proto;
+    xsum += length;
+    xsum += checksum_partial(px + offset_ip + 8, 32);
+
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    return (unsigned)xsum;
+}
+
 /***************************************************************************
  ***************************************************************************/
 struct TemplateSet templ_copy(const struct TemplateSet *templset)
@@ -371,7 +390,8 @@ struct TemplateSet templ_copy(const struct TemplateSet *templset)
 /***************************************************************************
  ***************************************************************************/
 void
-tcp_set_window(unsigned char *px, size_t px_length, unsigned window)
+tcp_set_window(const struct TemplatePacket *tmpl,
+               unsigned char *px, size_t px_length, unsigned window)
 {
     struct PreprocessedInfo parsed;
     unsigned x;
@@ -403,6 +423,11 @@ tcp_set_window(unsigned char *px, size_t px_length, unsigned window)
 
     px[offset + 14] = (unsigned char)(window>>8);
     px[offset + 15] = (unsigned char)(window>>0);
+
+    /* The pseudo-header sum the NIC starts from doesn't cover this */
+    if (tmpl && tmpl->is_checksum_offload)
+        return;
+
     px[offset + 16] = (unsigned char)(0);
     px[offset + 17] = (unsigned char)(0);
 
@@ -500,9 +525,13 @@ tcp_create_packet(
         px[offset_tcp+16] = (unsigned char)(0 >>  8);
         px[offset_tcp+17] = (unsigned char)(0 >>  0);
 
-        xsum = tcp_checksum2(px, tmpl->ipv4.offset_ip, tmpl->ipv4.offset_tcp,
-                             new_length - tmpl->ipv4.offset_tcp);
-        xsum = ~xsum;
+        if (tmpl->is_checksum_offload)
+            xsum = pseudo_checksum_ipv4(px, offset_ip, 6, new_length - offset_tcp);
+        else {
+            xsum = tcp_checksum2(px, tmpl->ipv4.offset_ip, tmpl->ipv4.offset_tcp,
+                                 new_length - tmpl->ipv4.offset_tcp);
+            xsum = ~xsum;
+        }
 
         px[offset_tcp+16] = (unsigned char)(xsum >>  8);
         px[offset_tcp+17] = (unsigned char)(xsum >>  0);
@@ -601,7 +630,10 @@ tcp_create_packet(
         px[offset_tcp+16] = (unsigned char)(0 >>  8);
         px[offset_tcp+17] = (unsigned char)(0 >>  0);
 
-        xsum = checksum_ipv6(px + offset_ip + 8, px + offset_ip + 24, 6, (offset_app - offset_tcp) + payload_length, px + offset_tcp);
+        if (tmpl->is_checksum_offload)
+            xsum = pseudo_checksum_ipv6(px, offset_ip, 6, (offset_app - offset_tcp) + payload_length);
+        else
+            xsum = checksum_ipv6(px + offset_ip + 8, px + offset_ip + 24, 6, (offset_app - offset_tcp) + payload_length, px + offset_tcp);
         px[offset_tcp+16] = (unsigned char)(xsum >>  8);
         px[offset_tcp+17] = (unsigned char)(xsum >>  0);
 
@@ -797,7 +829,10 @@ template_set_target_ipv6(
         px[offset_tcp+ 6] = (unsigned char)(seqno >>  8);
         px[offset_tcp+ 7] = (unsigned char)(seqno >>  0);
 
-        xsum = checksum_ipv6(px + offset_ip + 8, px + offset_ip + 24, 6,  tmpl->ipv6.length - offset_tcp, px + offset_tcp);
+        if (tmpl->is_checksum_offload)
+            xsum = pseudo_checksum_ipv6(px, offset_ip, 6, tmpl->ipv6.length - offset_tcp);
+        else
+            xsum = checksum_ipv6(px + offset_ip + 8, px + offset_ip + 24, 6,  tmpl->ipv6.length - offset_tcp, px + offset_tcp);
         px[offset_tcp+16] = (unsigned char)(xsum >>  8);
         px[offset_tcp+17] = (unsigned char)(xsum >>  0);
         break;
@@ -812,7 +847,10 @@ template_set_target_ipv6(
 
         px[offset_tcp+6] = (unsigned char)(0);
         px[offset_tcp+7] = (unsigned char)(0);
-        xsum = checksum_ipv6(px + offset_ip + 8, px + offset_ip + 24, 17,  tmpl->ipv6.length - offset_tcp, px + offset_tcp);
+        if (tmpl->is_checksum_offload)
+            xsum = pseudo_checksum_ipv6(px, offset_ip, 17, tmpl->ipv6.length - offset_tcp);
+        else
+            xsum = checksum_ipv6(px + offset_ip + 8, px + offset_ip + 24, 17,  tmpl->ipv6.length - offset_tcp, px + offset_tcp);
         px[offset_tcp+6] = (unsigned char)(xsum >>  8);
         px[offset_tcp+7] = (unsigned char)(xsum >>  0);
         break;
@@ -1006,6 +1044,12 @@ template_set_target_ipv4(
         px[offset_tcp+ 6] = (unsigned char)(seqno >>  8);
         px[offset_tcp+ 7] = (unsigned char)(seqno >>  0);
 
+        if (tmpl->is_checksum_offload) {
+            xsum = pseudo_checksum_ipv4(px, offset_ip, 6, tmpl->ipv4.length - offset_tcp);
+            px[offset_tcp+16] = (unsigned char)(xsum >>  8);
+            px[offset_tcp+17] = (unsigned char)(xsum >>  0);
+            break;
+        }
         xsum += (uint64_t)tmpl->ipv4.checksum_tcp
                 + (uint64_t)ip_me
                 + (uint64_t)ip_them
@@ -1030,6 +1074,12 @@ template_set_target_ipv4(
 
         px[offset_tcp+6] = (unsigned char)(0);
         px[offset_tcp+7] = (unsigned char)(0);
+        if (tmpl->is_checksum_offload) {
+            xsum = pseudo_checksum_ipv4(px, offset_ip, 17, tmpl->ipv4.length - offset_tcp);
+            px[offset_tcp+6] = (unsigned char)(xsum >>  8);
+            px[offset_tcp+7] = (unsigned char)(xsum >>  0);
+            break;
+        }
         xsum = udp_checksum2(px, offset_ip, offset_tcp, tmpl->ipv4.length - offset_tcp);
         /*xsum += (uint64_t)tmpl->checksum_tcp
                 + (uint64_t)ip_me
@@ -1487,6 +1537,17 @@ template_set_ttl(struct TemplateSet *tmplset, unsigned ttl)
     }
 }
 
+/***************************************************************************
+ ***************************************************************************/
+void
+template_set_checksum_offload(struct TemplateSet *tmplset)
+{
+    unsigned i;
+
+    for (i=0; i<Proto_Count; i++)
+        tmplset->pkts[i].is_checksum_offload = 1;
+}
+
 void
 template_set_vlan(struct TemplateSet *tmplset, unsigned vlan)
 {
@@ -1519,6 +1580,111 @@ template_set_vlan(struct TemplateSet *tmplset, unsigned vlan)
 
 
 
+/***************************************************************************
+ * Finishes a frame built for --adapter-offload the way the kernel or NIC
+ * would: sum from the start of the TCP/UDP header to the end of the frame,
+ * including the pseudo-header sum already in the checksum field.
+ ***************************************************************************/
+static void
+_offload_finish(unsigned char *px, size_t length)
+{
+    struct VnetHeader hdr;
+    uint64_t xsum = 0;
+    size_t i;
+
+    if (!vnet_header_fill(&hdr, px, (unsigned)length))
+        return;
+    for (i=hdr.csum_start; i+1<length; i += 2)
+        xsum += px[i] << 8 | px[i+1];
+    if (i < length)
+        xsum += px[i] << 8;
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = (xsum & 0xFFFF) + (xsum >> 16);
+    xsum = ~xsum;
+    px[hdr.csum_start + hdr.csum_offset + 0] = (unsigned char)(xsum >> 8);
+    px[hdr.csum_start + hdr.csum_offset + 1] = (unsigned char)(xsum >> 0);
+}
+
+/***************************************************************************
+ * Packets built for checksum offload must come out identical to the
+ * normal ones once the checksum has been filled in.
+ ***************************************************************************/
+static int
+_offload_selftest(struct TemplateSet *tmplset)
+{
+    static const char payload[] = "GET / HTTP/1.0\r\nHost: a\r\n\r\n";
+    struct TemplatePacket tmpl[2];
+    unsigned char px[2][2048];
+    size_t len[2];
+    ipaddress ip_them;
+    ipaddress ip_me;
+    int i;
+
+    tmpl[0] = tmplset->pkts[Proto_TCP];
+    tmpl[1] = tmplset->pkts[Proto_TCP];
+    tmpl[0].is_checksum_offload = 0;
+    tmpl[1].is_checksum_offload = 1;
+
+    /* IPv4 data segment, odd length */
+    memset(&ip_them, 0, sizeof(ip_them));
+    memset(&ip_me, 0, sizeof(ip_me));
+    ip_them.version = 4;
+    ip_them.ipv4 = 0x0a010203;
+    ip_me.version = 4;
+    ip_me.ipv4 = 0xc0a80164;
+    for (i=0; i<2; i++)
+        len[i] = tcp_create_packet(&tmpl[i], ip_them, 80, ip_me, 40000,
+                                   0x12345678, 0x9abcdef0, 0x18,
+                                   (const unsigned char *)payload, sizeof(payload)-1,
+                                   px[i], sizeof(px[i]));
+    /* ...including after changing the window, as the stack does */
+    tcp_set_window(&tmpl[0], px[0], len[0], 600);
+    tcp_set_window(&tmpl[1], px[1], len[1], 600);
+    _offload_finish(px[1], len[1]);
+    if (len[0] != len[1] || memcmp(px[0], px[1], len[0]) != 0)
+        return 1;
+
+    /* IPv6 data segment */
+    ip_them.version = 6;
+    ip_them.ipv6.hi = 0x20010db800000000ULL;
+    ip_them.ipv6.lo = 0x1;
+    ip_me.version = 6;
+    ip_me.ipv6.hi = 0x20010db800000000ULL;
+    ip_me.ipv6.lo = 0x2;
+    for (i=0; i<2; i++)
+        len[i] = tcp_create_packet(&tmpl[i], ip_them, 443, ip_me, 40000,
+                                   0x12345678, 0x9abcdef0, 0x18,
+                                   (const unsigned char *)payload, sizeof(payload)-2,
+                                   px[i], sizeof(px[i]));
+    _offload_finish(px[1], len[1]);
+    if (len[0] != len[1] || memcmp(px[0], px[1], len[0]) != 0)
+        return 1;
+
+    /* SYN probes */
+    for (i=0; i<2; i++) {
+        struct TemplateSet tmp = *tmplset;
+        tmp.pkts[Proto_TCP].is_checksum_offload = (i == 1);
+        template_set_target_ipv4(&tmp, 0x0a010203, 80, 0xc0a80164, 40000,
+                                 0x12345678, px[i], sizeof(px[i]), &len[i]);
+    }
+    _offload_finish(px[1], len[1]);
+    if (len[0] != len[1] || memcmp(px[0], px[1], len[0]) != 0)
+        return 1;
+
+    for (i=0; i<2; i++) {
+        struct TemplateSet tmp = *tmplset;
+        tmp.pkts[Proto_TCP].is_checksum_offload = (i == 1);
+        template_set_target_ipv6(&tmp, ip_them.ipv6, 80, ip_me.ipv6, 40000,
+                                 0x12345678, px[i], sizeof(px[i]), &len[i]);
+    }
+    _offload_finish(px[1], len[1]);
+    if (len[0] != len[1] || memcmp(px[0], px[1], len[0]) != 0)
+        return 1;
+
+    return 0;
+}
+
 /***************************************************************************
  ***************************************************************************/
 int
@@ -1554,6 +1720,11 @@ template_selftest(void)
     //failures += tmplset->pkts[Proto_ICMP_timestamp].proto != Proto_ICMP_timestamp;
     //failures += tmplset->pkts[Proto_ARP].proto  != Proto_ARP;
 
+    if (_offload_selftest(tmplset)) {
+        fprintf(stderr, "[-] template: checksum offload selftest failed\n");
+        failures++;
+    }
+
     if (failures)
         fprintf(stderr, "template: failed\n");
     return failures;
@@ -67,6 +67,10 @@ struct TemplatePacket {
     } ipv6;
     enum TemplateProtocol proto;
     struct PayloadsUDP *payloads;
+
+    /** TCP/UDP checksums are left for the NIC to finish, so the field
+     * only gets the sum of the pseudo-header (--adapter-offload) */
+    unsigned is_checksum_offload:1;
 };
 
 /**
@@ -187,10 +191,18 @@ tcp_create_packet(
  * out going packets
  */
 void
-tcp_set_window(unsigned char *px, size_t px_length, unsigned window);
+tcp_set_window(const struct TemplatePacket *tmpl,
+               unsigned char *px, size_t px_length, unsigned window);
 
 
 void template_set_ttl(struct TemplateSet *tmplset, unsigned ttl);
 void template_set_vlan(struct TemplateSet *tmplset, unsigned vlan);
 
+/**
+ * Leave the TCP/UDP checksums of everything built from these templates
+ * for the NIC to finish, after rawsock_init_vnet() succeeds. The field
+ * gets just the pseudo-header sum, which is what the NIC expects.
+ */
+void template_set_checksum_offload(struct TemplateSet *tmplset);
+
 #endif
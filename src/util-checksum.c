@@ -7,6 +7,21 @@
     Dependencies: none
 */
 #include "util-checksum.h"
+#include "pixie-timer.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#define TARGET(x) __attribute__((target(x)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define CHECKSUM_X86 1
+#define TARGET(x)
+#endif
 
 /**
  * Calculates the checksum over a buffer.
@@ -49,6 +64,248 @@ _checksum_calculate(const void *vbuf, size_t length)
     return sum;
 }
 
+/**
+ * Folds a sum down to 16-bits, without reversing the bits.
+ */
+static unsigned
+_checksum_fold(uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (unsigned)sum;
+}
+
+/**
+ * The portable version, one 16-bit word at a time.
+ */
+static unsigned
+_checksum_scalar(const unsigned char *buf, size_t length)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i=0; i+1<length; i += 2)
+        sum += buf[i]<<8 | buf[i+1];
+    if (length & 1)
+        sum += buf[length-1]<<8;
+    return _checksum_fold(sum);
+}
+
+#if defined(CHECKSUM_X86)
+/*
+ * The vector versions rely on a property of the Internet checksum that
+ * RFC 1071 points out: it doesn't matter what byte-order we add words
+ * in, as long as we swap the result at the end, and it doesn't matter
+ * whether we add 16-bit or 32-bit words, as long as we fold the carries
+ * back in. So we add 32-bit little-endian words into 64-bit lanes,
+ * which can't overflow for any packet we'll ever see, and sort it all
+ * out at the end.
+ */
+
+/**
+ * Adds what's left over after the vector loop, then folds and swaps.
+ */
+static unsigned
+_checksum_tail(uint64_t sum, const unsigned char *buf, size_t length)
+{
+    uint32_t w32;
+    uint16_t w16;
+    unsigned result;
+
+    while (length >= 4) {
+        memcpy(&w32, buf, 4);
+        sum += w32;
+        buf += 4;
+        length -= 4;
+    }
+    if (length >= 2) {
+        memcpy(&w16, buf, 2);
+        sum += w16;
+        buf += 2;
+        length -= 2;
+    }
+    if (length)
+        sum += buf[0]; /* the high byte, when read big-endian */
+
+    result = _checksum_fold(sum);
+    return ((result & 0xFF) << 8) | (result >> 8);
+}
+
+TARGET("sse2")
+static unsigned
+_checksum_sse2(const unsigned char *buf, size_t length)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+    uint64_t lanes[2];
+
+    while (length >= 32) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)buf);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+        buf += 32;
+        length -= 32;
+    }
+    if (length >= 16) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)buf);
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+        buf += 16;
+        length -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(acc0, acc1));
+    return _checksum_tail(lanes[0] + lanes[1], buf, length);
+}
+
+TARGET("avx2")
+static unsigned
+_checksum_avx2(const unsigned char *buf, size_t length)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    uint64_t lanes[4];
+
+    while (length >= 64) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(buf + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+        buf += 64;
+        length -= 64;
+    }
+    if (length >= 32) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)buf);
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+        buf += 32;
+        length -= 32;
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, _mm256_add_epi64(acc0, acc1));
+    return _checksum_tail(lanes[0] + lanes[1] + lanes[2] + lanes[3], buf, length);
+}
+
+static int
+_cpu_has_sse2(void)
+{
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    return (regs[3] >> 26) & 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static int
+_cpu_has_avx2(void)
+{
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return 0;
+    /* The OS must also be saving the AVX registers (OSXSAVE, XCR0) */
+    __cpuid(regs, 1);
+    if (((regs[2] >> 27) & 1) == 0 || ((regs[2] >> 28) & 1) == 0)
+        return 0;
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] >> 5) & 1;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static int
+_cpu_has_nothing(void)
+{
+    return 1;
+}
+
+/**
+ * The versions we have, from slowest to fastest. We use the last one
+ * that the CPU supports.
+ */
+static const struct ChecksumKernel {
+    const char *name;
+    unsigned (*sum)(const unsigned char *buf, size_t length);
+    int (*is_supported)(void);
+} kernels[] = {
+    {"scalar", _checksum_scalar, _cpu_has_nothing},
+#if defined(CHECKSUM_X86)
+    {"sse2", _checksum_sse2, _cpu_has_sse2},
+    {"avx2", _checksum_avx2, _cpu_has_avx2},
+#endif
+};
+
+static unsigned _checksum_dispatch(const unsigned char *buf, size_t length);
+static const char *kernel_name = "scalar";
+static unsigned (*kernel_sum)(const unsigned char *, size_t) = _checksum_dispatch;
+
+/**
+ * The first call picks the fastest version, then replaces itself with
+ * it. If threads race on this, they all pick the same thing.
+ */
+static unsigned
+_checksum_dispatch(const unsigned char *buf, size_t length)
+{
+    size_t i;
+
+    for (i=0; i<sizeof(kernels)/sizeof(kernels[0]); i++) {
+        if (kernels[i].is_supported()) {
+            kernel_name = kernels[i].name;
+            kernel_sum = kernels[i].sum;
+        }
+    }
+    return kernel_sum(buf, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+unsigned
+checksum_partial(const void *buf, size_t length)
+{
+    return kernel_sum((const unsigned char *)buf, length);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+const char *
+checksum_kernel_name(void)
+{
+    if (kernel_sum == _checksum_dispatch)
+        checksum_partial("", 0);
+    return kernel_name;
+}
+
+/**
+ * Sums the payload, except for the existing checksum field at 'offset',
+ * as though it were zero. The field always starts on an even offset, so
+ * the bytes after it are still paired up the same way.
+ */
+static unsigned
+_checksum_without_field(const unsigned char *buf, size_t length, size_t offset)
+{
+    if (length < offset + 2)
+        return checksum_partial(buf, length);
+    return checksum_partial(buf, offset)
+            + checksum_partial(buf + offset + 2, length - offset - 2);
+}
 
 /**
  * After we sum up all the numbers involved, we must "fold" the upper
@@ -85,26 +342,23 @@ checksum_ipv4(unsigned ip_src, unsigned ip_dst, unsigned ip_proto, size_t payloa
     sum += (ip_dst>> 0) & 0xFFFF;
     sum += ip_proto;
     sum += (unsigned)payload_length;
-    sum += _checksum_calculate(buf, payload_length);
 
-    /* Remove the existing checksum field from the calculation. */
+    /* Add the payload, skipping the existing checksum field */
     switch (ip_proto) {
     case 0: /* IP header -- has no pseudo header */
-        sum = _checksum_calculate(buf, payload_length);
-        sum -= buf[10]<<8 | buf[11]; /* pretend the existing checksum field is zero */
+        sum = _checksum_without_field(buf, payload_length, 10);
         break;
     case 1:
-        sum -= buf[2]<<8 | buf[3];
+        sum += _checksum_without_field(buf, payload_length, 2);
         break;
     case 2: /* IGMP - group message - has no pseudo header */
-        sum = _checksum_calculate(payload, payload_length);
-        sum -= buf[2]<<8 | buf[3];
+        sum = _checksum_without_field(buf, payload_length, 2);
         break;
     case 6:
-        sum -= buf[16]<<8 | buf[17];
+        sum += _checksum_without_field(buf, payload_length, 16);
         break;
     case 17:
-        sum -= buf[6]<<8 | buf[7];
+        sum += _checksum_without_field(buf, payload_length, 6);
         break;
     default:
         return 0xFFFFFFFF;
@@ -121,27 +375,24 @@ checksum_ipv6(const unsigned char *ip_src, const unsigned char *ip_dst, unsigned
     unsigned sum;
 
     /* Calculate the pseudo-header */
-    sum = _checksum_calculate(ip_src, 16);
-    sum += _checksum_calculate(ip_dst, 16);
+    sum = checksum_partial(ip_src, 16);
+    sum += checksum_partial(ip_dst, 16);
     sum += (unsigned)payload_length;
     sum += ip_proto;
 
-    /* Calculate the remainder of the checksum */
-    sum += _checksum_calculate(payload, payload_length);
-
-    /* Remove the existing checksum field. */
+    /* Add the payload, skipping the existing checksum field */
     switch (ip_proto) {
     case 0:
         return 0;
     case 1:
     case 58:
-        sum -= buf[2]<<8 | buf[3];
+        sum += _checksum_without_field(buf, payload_length, 2);
         break;
     case 6:
-        sum -= buf[16]<<8 | buf[17];
+        sum += _checksum_without_field(buf, payload_length, 16);
         break;
     case 17:
-        sum -= buf[6]<<8 | buf[7];
+        sum += _checksum_without_field(buf, payload_length, 6);
         break;
     default:
         return 0xFFFFFFFF;
@@ -225,12 +476,116 @@ static struct {
 };
 
 
+/*
+ * Compares every version we can run on this CPU against the simple
+ * byte-at-a-time loop, for every length up to a few hundred bytes at
+ * every alignment, so that all the odd leftovers are covered.
+ */
+static int
+_kernels_selftest(void)
+{
+    static unsigned char buf[4096 + 64];
+    uint64_t seed = 1;
+    size_t i;
+    size_t k;
+
+    for (i=0; i<sizeof(buf); i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (unsigned char)(seed >> 56);
+    }
+
+    for (k=0; k<sizeof(kernels)/sizeof(kernels[0]); k++) {
+        size_t align;
+        size_t length;
+
+        if (!kernels[k].is_supported())
+            continue;
+
+        /* RFC 1071 section 3 example */
+        if (kernels[k].sum((const unsigned char *)"\x00\x01\xf2\x03\xf4\xf5\xf6\xf7", 8) != 0xddf2)
+            goto fail;
+
+        for (align=0; align<64; align++) {
+            for (length=0; length<=320; length++) {
+                if (kernels[k].sum(buf + align, length)
+                    != _checksum_fold(_checksum_calculate(buf + align, length)))
+                    goto fail;
+            }
+            length = sizeof(buf) - 64 - align;
+            if (kernels[k].sum(buf + align, length)
+                != _checksum_fold(_checksum_calculate(buf + align, length)))
+                goto fail;
+        }
+
+        /* All ones has the most carries, all zeroes must stay zero */
+        {
+            static unsigned char ones[4096 + 1];
+            static const unsigned char zeroes[256];
+            memset(ones, 0xFF, sizeof(ones));
+            for (align=0; align<2; align++) {
+                for (length=0; length+align<=sizeof(ones); length += 67) {
+                    if (kernels[k].sum(ones + align, length)
+                        != _checksum_fold(_checksum_calculate(ones + align, length)))
+                        goto fail;
+                }
+            }
+            if (kernels[k].sum(zeroes, sizeof(zeroes)) != 0)
+                goto fail;
+        }
+        continue;
+    fail:
+        fprintf(stderr, "[-] checksum: %s: selftest failed\n", kernels[k].name);
+        return 1;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ ***************************************************************************/
+void
+checksum_benchmark(void)
+{
+    static unsigned char buf[1500];
+    size_t iterations = 1000000;
+    size_t k;
+
+    memset(buf, 0xA5, sizeof(buf));
+
+    printf("-- checksum --\n");
+    for (k=0; k<sizeof(kernels)/sizeof(kernels[0]); k++) {
+        uint64_t start;
+        uint64_t stop;
+        unsigned x = 0;
+        size_t i;
+
+        if (!kernels[k].is_supported())
+            continue;
+
+        start = pixie_nanotime();
+        for (i=0; i<iterations; i++) {
+            buf[i & 0xFF] = (unsigned char)i;
+            x += kernels[k].sum(buf, sizeof(buf));
+        }
+        stop = pixie_nanotime();
+
+        /* use the result so the loop isn't optimized away */
+        if (x == 0xFFFFFFFF)
+            printf("%u\n", x);
+
+        printf("%12s: %6.1f nanoseconds/packet (%u bytes)\n", kernels[k].name,
+               (double)(stop - start) / (double)iterations, (unsigned)sizeof(buf));
+    }
+    printf("%12s: %s\n", "using", checksum_kernel_name());
+}
 
 int checksum_selftest(void)
 {
     unsigned sum;
     size_t i;
 
+    if (_kernels_selftest())
+        return 1; /* fail */
+
     /* Run through some IPv6 examples of TCP, UDP, and ICMP */
     for (i=0; ipv6packets[i].buf; i++) {
         sum = checksum_ipv6(
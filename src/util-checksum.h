@@ -38,6 +38,29 @@ checksum_ipv4(unsigned ip_src, unsigned ip_dst, unsigned ip_proto, size_t payloa
 unsigned 
 checksum_ipv6(const unsigned char *ip_src, const unsigned char *ip_dst, unsigned ip_proto, size_t payload_length, const void *payload);
 
+/**
+ * Adds up a buffer as big-endian 16-bit words, the core of the Internet
+ * checksum, as if an odd last byte were followed by a zero. This uses
+ * SSE2 or AVX2 if the CPU has them.
+ * @return
+ *      the sum folded to 16-bits, but NOT inverted, so that it can be
+ *      added to other sums (like the pseudo-header) before finishing
+ */
+unsigned
+checksum_partial(const void *buf, size_t length);
+
+/**
+ * The name of the version of checksum_partial() we are using, like
+ * "avx2" or "scalar".
+ */
+const char *
+checksum_kernel_name(void);
+
+/**
+ * Times each version of checksum_partial(), for --benchmark.
+ */
+void checksum_benchmark(void);
+
 
 /**
  * Simple unit tests.
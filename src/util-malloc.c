@@ -116,3 +116,326 @@ STRDUP(const char *str)
 }
 
 
+
+/***************************************************************************
+ * HUGEPAGES
+ *
+ * Our big tables are accessed at random, one entry per packet, so at
+ * high packet rates nearly every lookup is a TLB miss as well as a cache
+ * miss. Putting them on 2-megabyte pages means a 32-megabyte table needs
+ * only 16 TLB entries instead of 8192.
+ *
+ * Each allocation is preceded by a small header so that HUGE_FREE()
+ * knows whether it came from mmap() or the heap.
+ ***************************************************************************/
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#include "util-logger.h"
+#include "pixie-timer.h"
+
+#define HUGE_2MB        ((size_t)2 * 1024 * 1024)
+#define HUGE_1GB        ((size_t)1024 * 1024 * 1024)
+#define HUGE_HEADER     64 /* keep mmap()ed tables cache-line aligned */
+
+enum {HugeKind_Heap, HugeKind_Mmap};
+
+struct HugeHeader {
+    size_t length;  /* length of the whole mapping, including header */
+    void *base;     /* start of the mapping */
+    unsigned kind;
+};
+
+static unsigned huge_policy = Huge_Off;
+
+void
+huge_set_policy(unsigned policy)
+{
+    huge_policy = policy;
+}
+
+int
+huge_parse_policy(const char *value)
+{
+    if (value == NULL || value[0] == '\0')
+        return Huge_Auto;
+    if (strcmp(value, "off") == 0 || strcmp(value, "0") == 0
+        || strcmp(value, "false") == 0 || strcmp(value, "no") == 0)
+        return Huge_Off;
+    if (strcmp(value, "auto") == 0 || strcmp(value, "thp") == 0
+        || strcmp(value, "1") == 0 || strcmp(value, "true") == 0
+        || strcmp(value, "yes") == 0)
+        return Huge_Auto;
+    if (strcmp(value, "2m") == 0 || strcmp(value, "2M") == 0
+        || strcmp(value, "2mb") == 0 || strcmp(value, "2MB") == 0)
+        return Huge_2MB;
+    if (strcmp(value, "1g") == 0 || strcmp(value, "1G") == 0
+        || strcmp(value, "1gb") == 0 || strcmp(value, "1GB") == 0)
+        return Huge_1GB;
+    return -1;
+}
+
+#if defined(__linux__)
+/***************************************************************************
+ * Maps anonymous memory aligned to a 2-megabyte boundary, and asks
+ * the kernel to back it with transparent hugepages.
+ ***************************************************************************/
+static void *
+huge_mmap_thp(size_t length, size_t *r_length, void **r_base)
+{
+    size_t extra = length + HUGE_2MB;
+    unsigned char *p;
+    unsigned char *aligned;
+    size_t head;
+    size_t tail;
+
+    p = mmap(NULL, extra, PROT_READ|PROT_WRITE,
+             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    /* trim the unaligned parts off the front and back */
+    aligned = (unsigned char *)(((uintptr_t)p + HUGE_2MB - 1) & ~(uintptr_t)(HUGE_2MB - 1));
+    head = aligned - p;
+    tail = extra - head - length;
+    if (head)
+        munmap(p, head);
+    if (tail)
+        munmap(aligned + length, tail);
+
+#if defined(MADV_HUGEPAGE)
+    madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+    *r_length = length;
+    *r_base = aligned;
+    return aligned;
+}
+
+/***************************************************************************
+ * Maps explicitly reserved hugepages (/proc/sys/vm/nr_hugepages). This
+ * fails if not enough have been reserved.
+ ***************************************************************************/
+static void *
+huge_mmap_hugetlb(size_t length, size_t page_size,
+                  size_t *r_length, void **r_base)
+{
+#if defined(MAP_HUGETLB)
+    int flags = MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB;
+    void *p;
+
+    length = (length + page_size - 1) & ~(page_size - 1);
+#if defined(MAP_HUGE_SHIFT)
+    if (page_size == HUGE_1GB)
+        flags |= (30 << MAP_HUGE_SHIFT);
+    else
+        flags |= (21 << MAP_HUGE_SHIFT);
+#endif
+    p = mmap(NULL, length, PROT_READ|PROT_WRITE, flags, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    *r_length = length;
+    *r_base = p;
+    return p;
+#else
+    (void)length; (void)page_size; (void)r_length; (void)r_base;
+    return NULL;
+#endif
+}
+#endif
+
+/***************************************************************************
+ ***************************************************************************/
+static void *
+huge_alloc(size_t count, size_t size, unsigned policy)
+{
+    struct HugeHeader *hdr = NULL;
+    size_t length;
+    size_t map_length = 0;
+    void *base = NULL;
+    static unsigned is_warned = 0;
+
+    if (size != 0 && count >= (SIZE_MAX - HUGE_HEADER)/size) {
+        fprintf(stderr, "[-] alloc too large, aborting\n");
+        abort();
+    }
+    length = count * size + HUGE_HEADER;
+
+#if defined(__linux__)
+    /* Only worth it for tables spanning several pages. Explicit 1-gig
+     * pages are only used for tables big enough to not waste most of
+     * the page, with smaller tables getting 2-meg pages. */
+    if (policy != Huge_Off && length >= HUGE_2MB) {
+        if (policy == Huge_1GB && length >= HUGE_1GB/4)
+            hdr = huge_mmap_hugetlb(length, HUGE_1GB, &map_length, &base);
+        if (hdr == NULL && (policy == Huge_1GB || policy == Huge_2MB))
+            hdr = huge_mmap_hugetlb(length, HUGE_2MB, &map_length, &base);
+        if (hdr == NULL && policy != Huge_Auto && !is_warned) {
+            is_warned = 1;
+            LOG(0, "[-] hugepages: none reserved, using transparent hugepages\n");
+            LOG(0, "    [hint] echo 1024 > /proc/sys/vm/nr_hugepages\n");
+        }
+        if (hdr == NULL)
+            hdr = huge_mmap_thp(length, &map_length, &base);
+        if (hdr) {
+            /* mmap() gives us zeroed memory */
+            hdr->length = map_length;
+            hdr->base = base;
+            hdr->kind = HugeKind_Mmap;
+            return (unsigned char *)hdr + HUGE_HEADER;
+        }
+    }
+#else
+    (void)policy;
+    (void)is_warned;
+    (void)map_length;
+    (void)base;
+#endif
+
+    hdr = calloc(1, length);
+    if (hdr == NULL)
+        return NULL;
+    hdr->length = length;
+    hdr->base = hdr;
+    hdr->kind = HugeKind_Heap;
+    return (unsigned char *)hdr + HUGE_HEADER;
+}
+
+void *
+huge_calloc_try(size_t count, size_t size)
+{
+    return huge_alloc(count, size, huge_policy);
+}
+
+void *
+HUGE_CALLOC(size_t count, size_t size)
+{
+    void *p = huge_alloc(count, size, huge_policy);
+    if (p == NULL) {
+        fprintf(stderr, "[-] out of memory, aborting\n");
+        abort();
+    }
+    return p;
+}
+
+void
+HUGE_FREE(void *p)
+{
+    struct HugeHeader *hdr;
+
+    if (p == NULL)
+        return;
+    hdr = (struct HugeHeader *)((unsigned char *)p - HUGE_HEADER);
+#if defined(__linux__)
+    if (hdr->kind == HugeKind_Mmap) {
+        munmap(hdr->base, hdr->length);
+        return;
+    }
+#endif
+    free(hdr->base);
+}
+
+/***************************************************************************
+ ***************************************************************************/
+int
+huge_selftest(void)
+{
+    static const unsigned policies[] = {Huge_Off, Huge_Auto};
+    static const size_t sizes[] = {1, 4096, 3*1024*1024 + 7};
+    size_t i, j;
+
+    for (i=0; i<sizeof(policies)/sizeof(policies[0]); i++) {
+        for (j=0; j<sizeof(sizes)/sizeof(sizes[0]); j++) {
+            unsigned char *p;
+            size_t k;
+
+            p = huge_alloc(1, sizes[j], policies[i]);
+            if (p == NULL)
+                goto fail;
+            if (((uintptr_t)p & 15) != 0)
+                goto fail;
+            for (k=0; k<sizes[j]; k += 4093) {
+                if (p[k] != 0)
+                    goto fail;
+                p[k] = 0xA5;
+            }
+            p[sizes[j] - 1] = 0xA5;
+            HUGE_FREE(p);
+        }
+    }
+
+    if (huge_parse_policy("2m") != Huge_2MB || huge_parse_policy("bad") != -1)
+        goto fail;
+    return 0;
+fail:
+    fprintf(stderr, "[-] huge: selftest failed\n");
+    return 1;
+}
+
+/***************************************************************************
+ * Measures random access into a large table, the way we access the
+ * dedup and TCB tables, with and without hugepages. This is a pointer
+ * chase, so each access must wait for the previous one, exposing the
+ * full cost of the TLB miss.
+ ***************************************************************************/
+static double
+huge_benchmark_one(unsigned policy, size_t count, size_t iterations)
+{
+    uint32_t *table;
+    uint64_t start;
+    uint64_t stop;
+    size_t i;
+    uint32_t x;
+    uint64_t seed = 1;
+
+    table = huge_alloc(count, sizeof(table[0]), policy);
+    if (table == NULL)
+        return 0.0;
+
+    /* Sattolo's algorithm: a random permutation that is one big cycle */
+    for (i=0; i<count; i++)
+        table[i] = (uint32_t)i;
+    for (i=count-1; i>0; i--) {
+        size_t j;
+        uint32_t tmp;
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        j = (size_t)((seed >> 33) % i);
+        tmp = table[i];
+        table[i] = table[j];
+        table[j] = tmp;
+    }
+
+    x = 0;
+    start = pixie_nanotime();
+    for (i=0; i<iterations; i++)
+        x = table[x];
+    stop = pixie_nanotime();
+
+    /* use the result so the loop isn't optimized away */
+    if (x == 0xFFFFFFFF)
+        printf("%u\n", x);
+
+    HUGE_FREE(table);
+    return (double)(stop - start) / (double)iterations;
+}
+
+void
+huge_benchmark(void)
+{
+    static const struct {
+        unsigned policy;
+        const char *name;
+    } tests[] = {
+        {Huge_Off, "4k pages"},
+        {Huge_Auto, "THP"},
+        {Huge_2MB, "2M hugetlb"},
+    };
+    size_t count = 64 * 1024 * 1024; /* 256 megabytes */
+    size_t iterations = 10 * 1000 * 1000;
+    size_t i;
+
+    printf("-- hugepages -- \n");
+    for (i=0; i<sizeof(tests)/sizeof(tests[0]); i++) {
+        double ns = huge_benchmark_one(tests[i].policy, count, iterations);
+        printf("%12s: %6.1f nanoseconds/lookup\n", tests[i].name, ns);
+    }
+}
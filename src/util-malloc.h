@@ -4,6 +4,10 @@
  
     Also, defines a REALLOCARRAY() function that checks for integer
     overflow before trying to allocate memory.
+
+    Also, defines HUGE_CALLOC() for the big randomly-accessed tables
+    (dedup, TCBs, timeouts, packet buffers), which can be placed on
+    hugepages to reduce TLB misses (--hugepages).
 */
 #ifndef UTIL_MALLOC_H
 #define UTIL_MALLOC_H
@@ -25,6 +29,49 @@ REALLOC(void *p, size_t size);
 char *
 STRDUP(const char *str);
 
+/**
+ * Where HUGE_CALLOC() gets its memory from (--hugepages)
+ */
+enum HugePolicy {
+    Huge_Off,   /* normal heap */
+    Huge_Auto,  /* transparent hugepages, via madvise() */
+    Huge_2MB,   /* explicit MAP_HUGETLB 2-megabyte pages */
+    Huge_1GB,   /* explicit MAP_HUGETLB 1-gigabyte pages */
+};
+
+/**
+ * Sets the policy for all future HUGE_CALLOC() calls. Call once at
+ * startup, before any threads are created.
+ */
+void huge_set_policy(unsigned policy);
+
+/**
+ * Parses "off", "auto", "2m", or "1g".
+ * @return an enum HugePolicy, or -1 on error
+ */
+int huge_parse_policy(const char *value);
+
+/**
+ * Like CALLOC(), but for large tables, which will be put on hugepages
+ * if so configured, falling back to normal pages if hugepages aren't
+ * available. The memory must be freed with HUGE_FREE(), not free().
+ */
+void *
+HUGE_CALLOC(size_t count, size_t size);
+
+/**
+ * Same as HUGE_CALLOC(), but returns NULL instead of aborting if out
+ * of memory, for callers that shrink their request and try again.
+ */
+void *
+huge_calloc_try(size_t count, size_t size);
+
+void
+HUGE_FREE(void *p);
+
+int huge_selftest(void);
+void huge_benchmark(void);
+
 
 
 #endif